@@ -8,11 +8,18 @@
 #include "vr_sandesh.h"
 #include "vr_bridge.h"
 #include "vr_htable.h"
+#include "vr_btable.h"
 #include "vr_nexthop.h"
 #include "vr_datapath.h"
 #include "vr_defs.h"
 #include "vr_hash.h"
 
+#if defined(__AVX2__) && !defined(__KERNEL__)
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(__KERNEL__)
+#include <emmintrin.h>
+#endif
+
 #if defined(__linux__) && defined(__KERNEL__)
 extern short vr_bridge_table_major;
 #endif
@@ -20,7 +27,12 @@ unsigned char *vr_bridge_table_path;
 
 unsigned int vr_bridge_entries = VR_DEF_BRIDGE_ENTRIES;
 unsigned int vr_bridge_oentries = 0;
+unsigned int vr_bridge_learn_rate = 0;
 static vr_htable_t vn_rtable;
+static struct vr_bridge_learn *vr_bridge_learner;
+/* lookup index, a line a bucket of the table */
+static struct vr_btable *vr_bridge_index;
+static unsigned int vr_bridge_index_entries;
 char vr_bcast_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
 int bridge_table_init(struct vr_rtable *, struct rtable_fspec *);
@@ -31,6 +43,9 @@ extern struct vr_vrf_stats *(*vr_inet_vrf_stats)(unsigned short, unsigned int);
 extern l4_pkt_type_t vr_ip_well_known_packet(struct vr_packet *);
 extern l4_pkt_type_t vr_ip6_well_known_packet(struct vr_packet *);
 extern int vr_bridge_get_mac_type(char *mac);
+extern unsigned int vr_interfaces;
+static int vr_bridge_learn_init(void);
+static void vr_bridge_learn_exit(bool);
 
 void *vr_bridge_table = NULL;
 void *vr_obridge_table = NULL;
@@ -87,12 +102,254 @@ vr_unknown_uc_flood(struct vr_interface *ingress_vif,
     return false;
 }
 
+static inline uint64_t
+bridge_index_key(struct vr_bridge_entry_key *key)
+{
+    uint64_t ikey;
+
+    memcpy(&ikey, key, sizeof(ikey));
+    return ikey;
+}
+
+static inline struct vr_bridge_index_line *
+bridge_index_line(unsigned int bucket)
+{
+    return (struct vr_bridge_index_line *)vr_btable_get(vr_bridge_index,
+            bucket);
+}
+
+/* bit 'i' of the returned mask is set if key 'i' of the line is 'ikey' */
+static inline unsigned int
+bridge_index_match(struct vr_bridge_index_line *bil, uint64_t ikey)
+{
+#if defined(__AVX2__) && !defined(__KERNEL__)
+    __m256i keys = _mm256_loadu_si256((__m256i *)bil->bil_key);
+
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(keys,
+                    _mm256_set1_epi64x((long long)ikey))));
+#elif defined(__SSE2__) && !defined(__KERNEL__)
+    unsigned int i, mask = 0;
+    __m128i eq, key = _mm_set1_epi64x((long long)ikey);
+
+    /* two keys a vector, each equal if both of its halves are */
+    for (i = 0; i < VR_HENTRIES_PER_BUCKET; i += 2) {
+        eq = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)&bil->bil_key[i]),
+                key);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        mask |= _mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+    }
+
+    return mask;
+#else
+    unsigned int i, mask = 0;
+
+    for (i = 0; i < VR_HENTRIES_PER_BUCKET; i++) {
+        if (bil->bil_key[i] == ikey)
+            mask |= (1 << i);
+    }
+
+    return mask;
+#endif
+}
+
+/*
+ * Looks the key up in the index. A match of the key is only a hint, which
+ * the entry itself confirms: the index is updated after the entries are,
+ * and without a lock. The key of vrf 0 and the zero mac is also that of
+ * the slots of no entry, so only a valid entry is taken.
+ */
+static struct vr_bridge_entry *
+bridge_index_find(struct vr_bridge_entry_key *key)
+{
+    unsigned int bucket, slot, mask;
+    uint64_t ikey = bridge_index_key(key);
+    struct vr_bridge_entry *be;
+
+    bucket = vr_htable_bucket_by_hash(vn_rtable,
+            vr_hash(key, sizeof(*key), 0));
+    mask = bridge_index_match(bridge_index_line(bucket), ikey);
+    while (mask) {
+        slot = vr_ffs_32(mask) - 1;
+        mask &= (mask - 1);
+
+        be = (struct vr_bridge_entry *)vr_htable_get_hentry_by_index(vn_rtable,
+                (bucket * VR_HENTRIES_PER_BUCKET) + slot);
+        if (be && vr_htable_hentry_match(vn_rtable, &be->be_hentry, key,
+                    sizeof(*key)))
+            return be;
+    }
+
+    return NULL;
+}
+
+/* called whenever the key or the nexthop of an entry of a bucket changes */
+static void
+bridge_index_set(struct vr_bridge_entry *be)
+{
+    unsigned int index = be->be_hentry.hentry_index;
+    struct vr_bridge_index_line *bil;
+
+    if (!vr_bridge_index || (index >= vr_bridge_index_entries))
+        return;
+
+    bil = bridge_index_line(index / VR_HENTRIES_PER_BUCKET);
+    index %= VR_HENTRIES_PER_BUCKET;
+
+    /*
+     * the nexthop is cleared before the key changes, and a lookup reads
+     * the key again after the nexthop, so that it never pairs a key with
+     * the nexthop of another
+     */
+    if (bil->bil_key[index] != bridge_index_key(&be->be_key)) {
+        bil->bil_nh[index] = NULL;
+        vr_sync_synchronize();
+        bil->bil_key[index] = bridge_index_key(&be->be_key);
+        vr_sync_synchronize();
+    }
+    bil->bil_nh[index] = be->be_nh;
+
+    return;
+}
+
+static void
+bridge_index_clear(struct vr_bridge_entry *be)
+{
+    unsigned int index = be->be_hentry.hentry_index;
+    struct vr_bridge_index_line *bil;
+
+    if (!vr_bridge_index || (index >= vr_bridge_index_entries))
+        return;
+
+    bil = bridge_index_line(index / VR_HENTRIES_PER_BUCKET);
+    index %= VR_HENTRIES_PER_BUCKET;
+
+    bil->bil_nh[index] = NULL;
+    vr_sync_synchronize();
+    bil->bil_key[index] = 0;
+
+    return;
+}
+
+/*
+ * Nexthop of (vrf, mac), for the callers that need nothing else of the
+ * entry: a hit in the index reads just its line
+ */
+struct vr_nexthop *
+vr_bridge_lookup_fast(unsigned int vrf, uint8_t *mac)
+{
+    unsigned int bucket, slot, mask;
+    uint64_t ikey;
+    struct vr_bridge_entry *be;
+    struct vr_bridge_entry_key key;
+    struct vr_bridge_index_line *bil;
+    struct vr_nexthop *nh;
+
+    if (!vn_rtable || !mac)
+        return NULL;
+
+    VR_MAC_COPY(key.be_mac, mac);
+    key.be_vrf_id = vrf;
+
+    if (vr_bridge_index) {
+        ikey = bridge_index_key(&key);
+        bucket = vr_htable_bucket_by_hash(vn_rtable,
+                vr_hash(&key, sizeof(key), 0));
+        bil = bridge_index_line(bucket);
+        mask = bridge_index_match(bil, ikey);
+        while (mask) {
+            slot = vr_ffs_32(mask) - 1;
+            mask &= (mask - 1);
+
+            nh = bil->bil_nh[slot];
+            vr_compiler_barrier();
+            if (nh && (bil->bil_key[slot] == ikey))
+                return nh;
+        }
+    }
+
+    be = (struct vr_bridge_entry *)vr_htable_find_hentry(vn_rtable, &key, 0);
+    if (!be)
+        return NULL;
+
+    return be->be_nh;
+}
+
+static void
+bridge_index_entry_add(vr_htable_t table, vr_hentry_t *hentry,
+        unsigned int index, void *data)
+{
+    struct vr_bridge_entry *be = (struct vr_bridge_entry *)hentry;
+
+    if (be && (be->be_flags & VR_BE_VALID_FLAG))
+        bridge_index_set(be);
+
+    return;
+}
+
+static void
+bridge_index_reset(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < vr_bridge_index_entries / VR_HENTRIES_PER_BUCKET; i++)
+        memset(bridge_index_line(i), 0, sizeof(struct vr_bridge_index_line));
+
+    return;
+}
+
+static void
+bridge_index_exit(void)
+{
+    if (!vr_bridge_index)
+        return;
+
+    vr_btable_free(vr_bridge_index);
+    vr_bridge_index = NULL;
+    vr_bridge_index_entries = 0;
+
+    return;
+}
+
+/* not fatal, the lookups just walk the buckets of the table */
+static void
+bridge_index_init(void)
+{
+    unsigned int buckets;
+
+    if (vr_bridge_index)
+        return;
+
+    buckets = vr_htable_buckets(vn_rtable);
+    vr_bridge_index = vr_btable_alloc(buckets,
+            sizeof(struct vr_bridge_index_line));
+    if (!vr_bridge_index) {
+        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, buckets);
+        return;
+    }
+
+    vr_bridge_index_entries = buckets * VR_HENTRIES_PER_BUCKET;
+    bridge_index_reset();
+
+    /* a restored table comes with its entries */
+    vr_htable_trav(vn_rtable, 0, bridge_index_entry_add, NULL);
+
+    return;
+}
+
 struct vr_bridge_entry *
 vr_find_bridge_entry(struct vr_bridge_entry_key *key)
 {
+    struct vr_bridge_entry *be;
+
     if (!vn_rtable || !key)
         return NULL;
 
+    if (vr_bridge_index) {
+        be = bridge_index_find(key);
+        if (be)
+            return be;
+    }
+
     return (struct vr_bridge_entry *)vr_htable_find_hentry(vn_rtable, key, 0);
 }
 
@@ -135,8 +392,11 @@ bridge_add(unsigned int router_id, unsigned int vrf,
         be->be_nh_id = -1;
     }
 
-    /* Un ref the old nexthop */
-    if (be->be_nh_id != nh_id) {
+    /*
+     * Un ref the old nexthop. An entry restored on a warm restart has the
+     * id of its nexthop, but not the nexthop itself
+     */
+    if ((be->be_nh_id != nh_id) || !be->be_nh) {
         old_nh = be->be_nh;
         be->be_nh = vrouter_get_nexthop(router_id, nh_id);
         if (be->be_nh) {
@@ -153,6 +413,8 @@ bridge_add(unsigned int router_id, unsigned int vrf,
             vrouter_put_nexthop(old_nh);
     }
 
+    bridge_index_set(be);
+
     return be;
 }
 
@@ -230,6 +492,7 @@ bridge_table_entry_free(vr_htable_t table, vr_hentry_t *hentry,
 
     /* Mark this entry as invalid */
     be->be_flags &= ~VR_BE_VALID_FLAG;
+    bridge_index_clear(be);
 
     if (be->be_nh) {
         nh = be->be_nh;
@@ -355,21 +618,14 @@ bridge_lookup(uint8_t *mac, struct vr_forwarding_md *fmd)
 struct vr_nexthop *
 __vrouter_bridge_lookup(unsigned int vrf_id, unsigned char *mac)
 {
-    struct vr_route_req rt;
-
     if (!mac)
         return NULL;
 
-    rt.rtr_req.rtr_label_flags = 0;
-    rt.rtr_req.rtr_index = VR_BE_INVALID_INDEX;
-    rt.rtr_req.rtr_mac_size = VR_ETHER_ALEN;
-    rt.rtr_req.rtr_mac = mac;
     /* If multicast L2 packet, use broadcast composite nexthop */
-    if (IS_MAC_BMCAST(rt.rtr_req.rtr_mac))
-        rt.rtr_req.rtr_mac = (int8_t *)vr_bcast_mac;
-   rt.rtr_req.rtr_vrf_id = vrf_id;
+    if (IS_MAC_BMCAST(mac))
+        mac = (unsigned char *)vr_bcast_mac;
 
-    return vr_bridge_lookup(vrf_id,  &rt);
+    return vr_bridge_lookup_fast(vrf_id, mac);
 }
 
 
@@ -471,6 +727,37 @@ bridge_entry_req_destroy(struct vr_route_req *resp)
         vr_free(resp->rtr_req.rtr_mac, VR_ROUTE_REQ_MAC_OBJECT);
 }
 
+/*
+ * The marker of a dump is the mac of the last entry that was dumped, and
+ * rtr_index is where that entry is in the table (the index that the entry
+ * was dumped with, which vr_send_route_dump() sends back). If the entry is
+ * still there, the walk picks up right after it rather than looking for
+ * the marker from the start of the table in every chunk. Clients that do
+ * not send the index get the walk from the start.
+ */
+static unsigned int
+bridge_table_dump_start(struct vr_message_dumper *dumper)
+{
+    struct vr_route_req *req = (struct vr_route_req *)(dumper->dump_req);
+    unsigned int index = (unsigned int)req->rtr_req.rtr_index;
+    struct vr_bridge_entry *be;
+
+    if (dumper->dump_been_to_marker ||
+            (index >= (vr_bridge_entries + vr_bridge_oentries)))
+        return 0;
+
+    be = (struct vr_bridge_entry *)vr_htable_get_hentry_by_index(vn_rtable,
+            index);
+    if (!be || !(be->be_flags & VR_BE_VALID_FLAG) ||
+            (be->be_key.be_vrf_id != req->rtr_req.rtr_vrf_id) ||
+            !VR_MAC_CMP(be->be_key.be_mac, req->rtr_req.rtr_mac))
+        return 0;
+
+    dumper->dump_been_to_marker = 1;
+
+    return index + 1;
+}
+
 static int
 __bridge_table_dump(struct vr_message_dumper *dumper)
 {
@@ -480,7 +767,8 @@ __bridge_table_dump(struct vr_message_dumper *dumper)
     unsigned int i;
     struct vr_bridge_entry *be;
 
-    for(i = 0; i < (vr_bridge_entries + vr_bridge_oentries); i++) {
+    for (i = bridge_table_dump_start(dumper);
+            i < (vr_bridge_entries + vr_bridge_oentries); i++) {
         be = (struct vr_bridge_entry *)
                 vr_htable_get_hentry_by_index(vn_rtable, i);
         if (!be)
@@ -643,6 +931,76 @@ generate_response:
     return;
 }
 
+/*
+ * Warm restart. The entries a previous instance left in the table keep
+ * the id of their nexthop, but the nexthop pointer is of no use anymore.
+ */
+static void
+vr_bridge_table_restore_prepare(void)
+{
+    unsigned int i;
+    struct vr_bridge_entry *be;
+
+    for (i = 0; i < vr_bridge_entries + vr_bridge_oentries; i++) {
+        if (i < vr_bridge_entries)
+            be = (struct vr_bridge_entry *)vr_bridge_table + i;
+        else
+            be = (struct vr_bridge_entry *)vr_obridge_table +
+                (i - vr_bridge_entries);
+
+        if (be->be_flags & VR_BE_VALID_FLAG) {
+            be->be_nh = NULL;
+            continue;
+        }
+
+        memset(be, 0, sizeof(*be));
+    }
+
+    return;
+}
+
+static void
+bridge_table_entry_revalidate(vr_htable_t table, vr_hentry_t *hentry,
+        unsigned int index, void *data)
+{
+    struct vr_nexthop *nh;
+    struct vr_bridge_entry *be = (struct vr_bridge_entry *)hentry;
+
+    if (!be || !(be->be_flags & VR_BE_VALID_FLAG) || be->be_nh)
+        return;
+
+    nh = vrouter_get_nexthop(0, be->be_nh_id);
+    if (!nh) {
+        bridge_table_entry_free(table, hentry, index, data);
+        return;
+    }
+
+    /* the agent might have just programmed the entry again */
+    if (!vr_sync_bool_compare_and_swap_p(&be->be_nh, NULL, nh))
+        vrouter_put_nexthop(nh);
+    else
+        bridge_index_set(be);
+
+    return;
+}
+
+/*
+ * End of the warm restart window. The restored entries that the agent did
+ * not program again get their nexthop back by its id, if the agent brought
+ * it back, and are removed otherwise.
+ */
+void
+vr_bridge_table_revalidate(struct vrouter *router)
+{
+    if (!vr_bridge_table_restored || !vn_rtable)
+        return;
+
+    vr_bridge_table_restored = 0;
+    vr_htable_trav(vn_rtable, 0, bridge_table_entry_revalidate, NULL);
+
+    return;
+}
+
 int
 bridge_table_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
 {
@@ -660,10 +1018,19 @@ bridge_table_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
             vr_obridge_table = (unsigned char *)vr_bridge_table + VR_BRIDGE_TABLE_SIZE;
     }
 
-    rtable->algo_data = vr_htable_attach(vrouter_get(0), vr_bridge_entries,
-                vr_bridge_table, vr_bridge_oentries, vr_obridge_table,
-                sizeof(struct vr_bridge_entry),
+    if (vr_bridge_table_restored && vr_bridge_table) {
+        vr_bridge_table_restore_prepare();
+        rtable->algo_data = vr_htable_restore(vrouter_get(0),
+                vr_bridge_entries, vr_bridge_table, vr_bridge_oentries,
+                vr_obridge_table, sizeof(struct vr_bridge_entry),
+                sizeof(struct vr_bridge_entry_key), 0, bridge_entry_key);
+    } else {
+        vr_bridge_table_restored = 0;
+        rtable->algo_data = vr_htable_attach(vrouter_get(0),
+                vr_bridge_entries, vr_bridge_table, vr_bridge_oentries,
+                vr_obridge_table, sizeof(struct vr_bridge_entry),
                 sizeof(struct vr_bridge_entry_key), 0, bridge_entry_key);
+    }
 
     if (!rtable->algo_data)
         return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
@@ -680,8 +1047,9 @@ bridge_table_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
     rtable->algo_dump = bridge_table_dump;
 
     vn_rtable = rtable->algo_data;
+    bridge_index_init();
 
-    return 0;
+    return vr_bridge_learn_init();
 }
 
 void
@@ -691,9 +1059,14 @@ bridge_table_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs,
     if (!vn_rtable)
         return;
 
-    vr_htable_reset(vn_rtable, bridge_table_entry_free, NULL);
+    vr_bridge_learn_exit(soft_reset);
+
+    /* a table kept for a warm restart is left as it is for the next one */
+    if (soft_reset || !vr_warm_restart)
+        vr_htable_reset(vn_rtable, bridge_table_entry_free, NULL);
 
     if (!soft_reset) {
+        bridge_index_exit();
         vr_htable_delete(vn_rtable);
         rtable->algo_data = NULL;
         vn_rtable = NULL;
@@ -747,6 +1120,77 @@ bridge_table_lock(struct vr_interface *vif, uint8_t *mac)
     return hash;
 }
 
+static mac_learn_t
+__vr_bridge_learn_post(struct vr_bridge_learn *bl, unsigned int cpu,
+        struct vr_packet *pkt, struct vr_eth *eth,
+        struct vr_forwarding_md *fmd)
+{
+    unsigned int head;
+    uint32_t hash, tick;
+    struct vr_packet *pkt_c;
+    struct vr_bridge_learn_ring *blr;
+    struct vr_bridge_learn_filter *blf;
+    struct vr_bridge_learn_event *ble;
+
+    if (cpu >= bl->bl_cpus)
+        return MAC_LEARN_FAILURE;
+
+    blr = bl->bl_rings[cpu];
+    hash = vr_hash(eth->eth_smac, VR_ETHER_ALEN, fmd->fmd_dvrf);
+    blf = &blr->blr_filter[hash & (VR_BRIDGE_LEARN_FILTER_SIZE - 1)];
+    tick = bl->bl_ticks;
+    if ((blf->blf_hash == hash) &&
+            ((tick - blf->blf_tick) < VR_BRIDGE_LEARN_HOLD_TICKS)) {
+        blr->blr_held++;
+        return MAC_LEARN_FAILURE;
+    }
+
+    head = blr->blr_head;
+    if ((head - blr->blr_tail) >= VR_BRIDGE_LEARN_RING_SIZE) {
+        blr->blr_full++;
+        return MAC_LEARN_FAILURE;
+    }
+
+    pkt_c = pkt_cow(pkt, 0);
+    if (!pkt_c)
+        return MAC_LEARN_FAILURE;
+
+    ble = &blr->blr_events[head & (VR_BRIDGE_LEARN_RING_SIZE - 1)];
+    ble->ble_pkt = pkt_c;
+    ble->ble_vrf = fmd->fmd_dvrf;
+    ble->ble_vif = pkt->vp_if->vif_idx;
+    VR_MAC_COPY(ble->ble_mac, eth->eth_smac);
+
+    /* the timer is not to see the slot before it is filled */
+    vr_sync_synchronize();
+    blr->blr_head = head + 1;
+    blr->blr_posted++;
+
+    blf->blf_hash = hash;
+    blf->blf_tick = tick;
+
+    return MAC_LEARNT;
+}
+
+/*
+ * post the learn of the source MAC of pkt on the ring of this cpu, for the
+ * learn timer to apply. The ring has a single producer, which on Linux
+ * the softirq datapath must not preempt from process context.
+ */
+static mac_learn_t
+vr_bridge_learn_post(struct vr_bridge_learn *bl, struct vr_packet *pkt,
+        struct vr_eth *eth, struct vr_forwarding_md *fmd)
+{
+    unsigned int cpu;
+    mac_learn_t ml_res;
+
+    cpu = vr_get_cpu_local();
+    ml_res = __vr_bridge_learn_post(bl, cpu, pkt, eth, fmd);
+    vr_put_cpu_local();
+
+    return ml_res;
+}
+
 mac_learn_t
 vr_bridge_learn(struct vrouter *router, struct vr_packet *pkt,
         struct vr_eth *eth, struct vr_forwarding_md *fmd)
@@ -786,6 +1230,9 @@ vr_bridge_learn(struct vrouter *router, struct vr_packet *pkt,
         if (!nh)
             return MAC_LEARN_FAILURE;
 
+        if (vr_bridge_learner)
+            return vr_bridge_learn_post(vr_bridge_learner, pkt, eth, fmd);
+
         lock = bridge_table_lock(pkt->vp_if, eth->eth_smac);
         if (lock < 0)
             return MAC_LEARN_FAILURE;
@@ -832,6 +1279,252 @@ vr_bridge_learn(struct vrouter *router, struct vr_packet *pkt,
     return ml_res;
 }
 
+static struct vr_bridge_entry *
+bridge_learn_lookup(unsigned int vrf, uint8_t *mac)
+{
+    struct vr_route_req rt;
+
+    rt.rtr_req.rtr_label_flags = 0;
+    rt.rtr_req.rtr_index = VR_BE_INVALID_INDEX;
+    rt.rtr_req.rtr_mac_size = VR_ETHER_ALEN;
+    rt.rtr_req.rtr_mac = mac;
+    rt.rtr_req.rtr_vrf_id = vrf;
+
+    return __bridge_lookup(vrf, &rt);
+}
+
+static void
+vr_bridge_learn_apply(struct vr_bridge_learn *bl,
+        struct vr_bridge_learn_event *ble)
+{
+    int lock;
+    struct vr_packet *pkt = ble->ble_pkt;
+    struct vr_interface *vif;
+    struct vr_bridge_entry *be;
+    struct vr_nexthop *nh = NULL;
+
+    ble->ble_pkt = NULL;
+    vif = __vrouter_get_interface(bl->bl_router, ble->ble_vif);
+    if (!vif || (pkt->vp_if != vif) || (ble->ble_vif >= bl->bl_vifs)) {
+        bl->bl_failed++;
+        pkt->vp_if = NULL;
+        PKT_LOG(VP_DROP_INVALID_IF, pkt, 0, VR_BRIDGE_C, __LINE__);
+        vr_pfree(pkt, VP_DROP_INVALID_IF);
+        return;
+    }
+
+    /* posted by another cpu too, or added by the agent in the meantime */
+    be = bridge_learn_lookup(ble->ble_vrf, ble->ble_mac);
+    if (be && be->be_nh) {
+        bl->bl_known++;
+        vr_pfree(pkt, VP_DROP_CLONED_ORIGINAL);
+        return;
+    }
+
+    if (bl->bl_vif_learns[ble->ble_vif] >= vr_bridge_learn_rate) {
+        bl->bl_rate_limited++;
+        vr_pfree(pkt, VP_DROP_CLONED_ORIGINAL);
+        return;
+    }
+
+    be = bridge_learn_lookup(ble->ble_vrf, (uint8_t *)vr_bcast_mac);
+    if (be)
+        nh = be->be_nh;
+    if (!nh)
+        goto fail;
+
+    lock = bridge_table_lock(vif, ble->ble_mac);
+    if (lock < 0)
+        goto fail;
+
+    be = bridge_add(0, ble->ble_vrf, ble->ble_mac, nh->nh_id);
+    if (be)
+        be->be_flags |= VR_BE_MAC_NEW_FLAG;
+    bridge_table_unlock(vif, ble->ble_mac, lock);
+    if (!be)
+        goto fail;
+
+    bl->bl_vif_learns[ble->ble_vif]++;
+    bl->bl_learnt++;
+    vr_sync_fetch_and_add_64u(&be->be_packets, 1);
+
+    vr_trap(pkt, ble->ble_vrf, AGENT_TRAP_MAC_LEARN,
+            (void *)&be->be_hentry.hentry_index);
+    return;
+
+fail:
+    bl->bl_failed++;
+    vr_pfree(pkt, VP_DROP_CLONED_ORIGINAL);
+    return;
+}
+
+static void
+vr_bridge_learn_tick(void *arg)
+{
+    unsigned int i, cpu, head, tail, budget = VR_BRIDGE_LEARN_BATCH;
+    struct vr_bridge_learn *bl = (struct vr_bridge_learn *)arg;
+    struct vr_bridge_learn_ring *blr;
+
+    if (!bl || !vn_rtable)
+        return;
+
+    bl->bl_ticks++;
+    if (!(bl->bl_ticks % (1000 / VR_BRIDGE_LEARN_TICK_MSECS)))
+        memset(bl->bl_vif_learns, 0,
+                bl->bl_vifs * sizeof(*bl->bl_vif_learns));
+
+    /* start from another cpu every tick, for a busy one not to starve */
+    for (i = 0; (i < bl->bl_cpus) && budget; i++) {
+        cpu = (bl->bl_ticks + i) % bl->bl_cpus;
+        blr = bl->bl_rings[cpu];
+        tail = blr->blr_tail;
+        head = blr->blr_head;
+        vr_sync_synchronize();
+
+        while ((tail != head) && budget) {
+            vr_bridge_learn_apply(bl,
+                    &blr->blr_events[tail & (VR_BRIDGE_LEARN_RING_SIZE - 1)]);
+            tail++;
+            budget--;
+        }
+
+        /* and the cpu is not to reuse the slots before they are done */
+        vr_sync_synchronize();
+        blr->blr_tail = tail;
+    }
+
+    return;
+}
+
+void
+vr_bridge_learn_stats(struct vr_bridge_learn_stats *stats)
+{
+    unsigned int i;
+    struct vr_bridge_learn *bl = vr_bridge_learner;
+    struct vr_bridge_learn_ring *blr;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!bl)
+        return;
+
+    for (i = 0; i < bl->bl_cpus; i++) {
+        blr = bl->bl_rings[i];
+        stats->bls_posted += blr->blr_posted;
+        stats->bls_held += blr->blr_held;
+        stats->bls_full += blr->blr_full;
+    }
+
+    stats->bls_learnt = bl->bl_learnt;
+    stats->bls_known = bl->bl_known;
+    stats->bls_rate_limited = bl->bl_rate_limited;
+    stats->bls_failed = bl->bl_failed;
+
+    return;
+}
+
+static void
+vr_bridge_learn_exit(bool soft_reset)
+{
+    unsigned int i, tail;
+    struct vr_bridge_learn *bl = vr_bridge_learner;
+    struct vr_bridge_learn_ring *blr;
+    struct vr_packet *pkt;
+
+    if (!bl)
+        return;
+
+    /*
+     * the timer keeps running across a reset. The learns still queued are
+     * of interfaces that the agent adds again, or else are let go by the
+     * timer
+     */
+    if (soft_reset) {
+        bl->bl_learnt = bl->bl_known = 0;
+        bl->bl_rate_limited = bl->bl_failed = 0;
+        for (i = 0; i < bl->bl_cpus; i++) {
+            blr = bl->bl_rings[i];
+            blr->blr_posted = blr->blr_held = blr->blr_full = 0;
+        }
+        return;
+    }
+
+    vr_bridge_learner = NULL;
+    if (bl->bl_timer) {
+        vr_delete_timer(bl->bl_timer);
+        vr_free(bl->bl_timer, VR_TIMER_OBJECT);
+    }
+
+    for (i = 0; i < bl->bl_cpus; i++) {
+        blr = bl->bl_rings[i];
+        for (tail = blr->blr_tail; tail != blr->blr_head; tail++) {
+            pkt = blr->blr_events[tail &
+                (VR_BRIDGE_LEARN_RING_SIZE - 1)].ble_pkt;
+            /* the interfaces may be gone already */
+            pkt->vp_if = NULL;
+            vr_pfree(pkt, VP_DROP_CLONED_ORIGINAL);
+        }
+        vr_free(blr, VR_BRIDGE_LEARN_OBJECT);
+    }
+
+    if (bl->bl_vif_learns)
+        vr_free(bl->bl_vif_learns, VR_BRIDGE_LEARN_OBJECT);
+    vr_free(bl, VR_BRIDGE_LEARN_OBJECT);
+
+    return;
+}
+
+static int
+vr_bridge_learn_init(void)
+{
+    unsigned int i;
+    struct vr_bridge_learn *bl;
+    struct vr_timer *vtimer;
+
+    if (!vr_bridge_learn_rate || vr_bridge_learner)
+        return 0;
+
+    bl = vr_zalloc(sizeof(*bl) + (vr_num_cpus * sizeof(bl->bl_rings[0])),
+            VR_BRIDGE_LEARN_OBJECT);
+    if (!bl)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, vr_num_cpus);
+    vr_bridge_learner = bl;
+
+    bl->bl_router = vrouter_get(0);
+    bl->bl_vifs = vr_interfaces;
+    bl->bl_vif_learns = vr_zalloc(bl->bl_vifs * sizeof(*bl->bl_vif_learns),
+            VR_BRIDGE_LEARN_OBJECT);
+    if (!bl->bl_vif_learns)
+        goto fail;
+
+    /* one allocation a cpu, so that cpus do not share lines */
+    for (i = 0; i < vr_num_cpus; i++) {
+        bl->bl_rings[i] = vr_zalloc(sizeof(struct vr_bridge_learn_ring),
+                VR_BRIDGE_LEARN_OBJECT);
+        if (!bl->bl_rings[i])
+            goto fail;
+        bl->bl_cpus++;
+    }
+
+    vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
+    if (!vtimer)
+        goto fail;
+
+    vtimer->vt_timer = vr_bridge_learn_tick;
+    vtimer->vt_vr_arg = bl;
+    vtimer->vt_msecs = VR_BRIDGE_LEARN_TICK_MSECS;
+    if (vr_create_timer(vtimer)) {
+        vr_free(vtimer, VR_TIMER_OBJECT);
+        goto fail;
+    }
+    bl->bl_timer = vtimer;
+
+    return 0;
+
+fail:
+    vr_bridge_learn_exit(false);
+    return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, vr_num_cpus);
+}
+
 unsigned int
 vr_bridge_input(struct vrouter *router, struct vr_packet *pkt,
                 struct vr_forwarding_md *fmd)
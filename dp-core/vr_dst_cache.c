@@ -0,0 +1,243 @@
+/*
+ * vr_dst_cache.c -- per cpu cache of the route lookups of forwarded packets
+ */
+#include <vr_os.h>
+#include <vr_types.h>
+#include <vrouter.h>
+#include "vr_route.h"
+#include "vr_nexthop.h"
+#include "vr_bridge.h"
+#include "vr_hash.h"
+#include "vr_dst_cache.h"
+
+unsigned int vr_dst_cache_entries = VR_DEF_DST_CACHE_ENTRIES;
+volatile uint32_t vr_dst_cache_gen = 1;
+
+static struct vr_dst_cache **vr_dst_caches;
+static unsigned int vr_dst_cache_cpus;
+static unsigned int vr_dst_cache_mask;
+
+static struct vr_dst_cache_entry *
+vr_dst_cache_entry_get(struct vr_dst_cache *dc, unsigned int vrf,
+        uint8_t *dst, unsigned int len)
+{
+    return &dc->dc_entries[vr_hash(dst, len, vrf) & vr_dst_cache_mask];
+}
+
+/* 'gen' is the generation read before the route was looked up */
+static void
+vr_dst_cache_entry_set(struct vr_dst_cache_entry *dce, unsigned int vrf,
+        struct vr_route_req *rt, uint32_t gen)
+{
+    dce->dce_gen = 0;
+    vr_compiler_barrier();
+    dce->dce_vrf = vrf;
+    dce->dce_family = rt->rtr_req.rtr_family;
+    dce->dce_prefix_len = rt->rtr_req.rtr_prefix_len;
+    memcpy(dce->dce_dst, rt->rtr_req.rtr_prefix,
+            RT_IP_ADDR_SIZE(rt->rtr_req.rtr_family));
+    dce->dce_nh = rt->rtr_nh;
+    dce->dce_label = rt->rtr_req.rtr_label;
+    dce->dce_index = rt->rtr_req.rtr_index;
+    dce->dce_label_flags = rt->rtr_req.rtr_label_flags;
+    vr_compiler_barrier();
+    dce->dce_gen = gen;
+
+    return;
+}
+
+static struct vr_nexthop *
+__vr_dst_cache_lookup(unsigned int cpu, unsigned int vrf,
+        struct vr_route_req *rt)
+{
+    unsigned int len;
+    uint32_t gen;
+    struct vr_dst_cache *dc;
+    struct vr_dst_cache_entry *dce;
+    struct vr_nexthop *nh;
+
+    if (!vr_dst_caches || (cpu >= vr_dst_cache_cpus) ||
+            (vrf >= VR_MAX_VRFS))
+        return vr_inet_route_lookup(vrf, rt);
+
+    len = RT_IP_ADDR_SIZE(rt->rtr_req.rtr_family);
+    dc = vr_dst_caches[cpu];
+    dce = vr_dst_cache_entry_get(dc, vrf, rt->rtr_req.rtr_prefix, len);
+
+    gen = vr_dst_cache_gen;
+    if ((dce->dce_gen == gen) && (dce->dce_vrf == vrf) &&
+            (dce->dce_family == rt->rtr_req.rtr_family) &&
+            !memcmp(dce->dce_dst, rt->rtr_req.rtr_prefix, len)) {
+        dc->dc_hits++;
+        rt->rtr_req.rtr_label_flags = dce->dce_label_flags;
+        rt->rtr_req.rtr_label = dce->dce_label;
+        rt->rtr_req.rtr_prefix_len = dce->dce_prefix_len;
+        rt->rtr_req.rtr_index = dce->dce_index;
+        rt->rtr_nh = dce->dce_nh;
+        return dce->dce_nh;
+    }
+
+    dc->dc_misses++;
+    /*
+     * the generation is read before the lookup, so that a route that
+     * changes in between leaves the entry stale
+     */
+    vr_sync_synchronize();
+
+    /* the default of a vrf without a table comes with no label */
+    rt->rtr_req.rtr_label_flags = 0;
+    rt->rtr_req.rtr_label = 0;
+    rt->rtr_req.rtr_index = VR_BE_INVALID_INDEX;
+    nh = vr_inet_route_lookup(vrf, rt);
+    if (!nh)
+        return NULL;
+
+    rt->rtr_nh = nh;
+    vr_dst_cache_entry_set(dce, vrf, rt, gen);
+
+    return nh;
+}
+
+/*
+ * vr_inet_route_lookup through the cache of the cpu. The caches are not
+ * locked, so the cpu is held, and the datapath kept off it, meanwhile.
+ */
+struct vr_nexthop *
+vr_dst_cache_lookup(unsigned int vrf, struct vr_route_req *rt)
+{
+    unsigned int cpu;
+    struct vr_nexthop *nh;
+
+    cpu = vr_get_cpu_local();
+    nh = __vr_dst_cache_lookup(cpu, vrf, rt);
+    vr_put_cpu_local();
+
+    return nh;
+}
+
+/*
+ * Fills the cache of the cpu with the routes that a burst lookup of IPv4
+ * destinations of 'vrf' found, for vr_dst_cache_lookup to hit on as the
+ * packets get forwarded. 'gen' is the generation read before the burst
+ * was looked up.
+ */
+void
+vr_dst_cache_fill(unsigned int vrf, uint32_t gen, uint32_t *dsts,
+        struct vr_route_result *res, unsigned int num)
+{
+    unsigned int i, cpu;
+    struct vr_dst_cache *dc;
+    struct vr_dst_cache_entry *dce;
+    struct vr_route_req rt;
+
+    if (!vr_dst_caches || (vrf >= VR_MAX_VRFS) || !gen)
+        return;
+
+    cpu = vr_get_cpu_local();
+    if (cpu >= vr_dst_cache_cpus) {
+        vr_put_cpu_local();
+        return;
+    }
+
+    dc = vr_dst_caches[cpu];
+    rt.rtr_req.rtr_family = AF_INET;
+    for (i = 0; i < num; i++) {
+        if (!res[i].rr_nh)
+            continue;
+
+        rt.rtr_req.rtr_prefix = (uint8_t *)&dsts[i];
+        rt.rtr_req.rtr_prefix_len = res[i].rr_prefix_len;
+        rt.rtr_req.rtr_label = res[i].rr_label;
+        rt.rtr_req.rtr_index = res[i].rr_index;
+        rt.rtr_req.rtr_label_flags = res[i].rr_label_flags;
+        rt.rtr_nh = res[i].rr_nh;
+
+        dce = vr_dst_cache_entry_get(dc, vrf, rt.rtr_req.rtr_prefix,
+                sizeof(dsts[i]));
+        vr_dst_cache_entry_set(dce, vrf, &rt, gen);
+    }
+    vr_put_cpu_local();
+
+    return;
+}
+
+void
+vr_dst_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+    unsigned int i;
+
+    *hits = *misses = 0;
+    if (!vr_dst_caches)
+        return;
+
+    for (i = 0; i < vr_dst_cache_cpus; i++) {
+        *hits += vr_dst_caches[i]->dc_hits;
+        *misses += vr_dst_caches[i]->dc_misses;
+    }
+
+    return;
+}
+
+void
+vr_dst_cache_exit(struct vrouter *router, bool soft_reset)
+{
+    unsigned int i;
+
+    vr_dst_cache_invalidate();
+    if (!vr_dst_caches)
+        return;
+
+    for (i = 0; i < vr_dst_cache_cpus; i++) {
+        if (soft_reset) {
+            vr_dst_caches[i]->dc_hits = 0;
+            vr_dst_caches[i]->dc_misses = 0;
+        } else if (vr_dst_caches[i]) {
+            vr_free(vr_dst_caches[i], VR_DST_CACHE_OBJECT);
+        }
+    }
+
+    if (!soft_reset) {
+        vr_free(vr_dst_caches, VR_DST_CACHE_OBJECT);
+        vr_dst_caches = NULL;
+        vr_dst_cache_cpus = 0;
+    }
+
+    return;
+}
+
+int
+vr_dst_cache_init(struct vrouter *router)
+{
+    unsigned int i, entries, size;
+
+    /* If the caches already exist, or are not wanted, dont create */
+    if (vr_dst_caches || !vr_dst_cache_entries)
+        return 0;
+
+    /* direct mapped, on the low bits of the hash */
+    for (entries = 1; (entries << 1) <= vr_dst_cache_entries; entries <<= 1)
+        ;
+
+    vr_dst_caches = vr_zalloc(vr_num_cpus * sizeof(struct vr_dst_cache *),
+            VR_DST_CACHE_OBJECT);
+    if (!vr_dst_caches)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, vr_num_cpus);
+
+    /* one allocation a cpu, so that cpus do not share lines */
+    size = sizeof(struct vr_dst_cache) +
+        (entries * sizeof(struct vr_dst_cache_entry));
+    for (i = 0; i < vr_num_cpus; i++) {
+        vr_dst_caches[i] = vr_zalloc(size, VR_DST_CACHE_OBJECT);
+        if (!vr_dst_caches[i]) {
+            vr_dst_cache_cpus = i;
+            vr_dst_cache_exit(router, false);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+        }
+    }
+
+    vr_dst_cache_entries = entries;
+    vr_dst_cache_mask = entries - 1;
+    vr_dst_cache_cpus = vr_num_cpus;
+
+    return 0;
+}
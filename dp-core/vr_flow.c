@@ -10,6 +10,7 @@
 #include <vr_htable.h>
 #include <vr_flow.h>
 #include <vr_mirror.h>
+#include <vr_flow_log.h>
 #include "vr_interface.h"
 #include "vr_sandesh.h"
 #include "vr_message.h"
@@ -32,6 +33,22 @@
 
 unsigned int vr_flow_entries = VR_DEF_FLOW_ENTRIES;
 unsigned int vr_oflow_entries = 0;
+/*
+ * Upper bound the overflow table may grow to while in use. 0 keeps the
+ * overflow table at its initial size
+ */
+unsigned int vr_oflow_entries_max = 0;
+/* the overflow table size the flow table was created with */
+static unsigned int vr_oflow_entries_base;
+/* look the flows up through a cuckoo index instead of the overflow chains */
+unsigned int vr_flow_cuckoo = 0;
+/* seconds a flow has to be idle for the datapath to age it. 0 disables */
+unsigned int vr_flow_aging_timeout = 0;
+/* remember the results of source validation, by flow index */
+unsigned int vr_flow_rpf_cache = 0;
+volatile uint32_t vr_flow_rpf_gen = 1;
+/* keep the last seen times of flows, for the flowlets of ECMP composites */
+unsigned int vr_flow_flowlet = 0;
 /*
  * Knob to unconditionally close flow on TCP RST;
  * If this knob is set, the flow would be closed
@@ -52,43 +69,37 @@ unsigned int vr_uncond_close_flow_on_tcp_rst = 0;
  */
 void *vr_flow_table = NULL;
 void *vr_oflow_table = NULL;
+/*
+ * Memory reserved by the host right after the overflow table, for the
+ * overflow table to grow into. If not set, the growth is allocated
+ */
+void *vr_oflow_ext_table = NULL;
 /*
  * The flow table memory can also be a file that could be mapped. The path
  * is set by somebody and passed to agent for it to map
  */
 unsigned char *vr_flow_path;
 unsigned int vr_flow_hold_limit = VR_DEF_MAX_FLOW_TABLE_HOLD_COUNT;
+/* packets a flow in hold can hold, and the per cpu pool they come from */
+unsigned int vr_flow_hold_queue_len = VR_DEF_FLOW_QUEUE_ENTRIES;
+unsigned int vr_flow_hold_pool_nodes = VR_DEF_FLOW_HOLD_POOL_NODES;
+unsigned int vr_flow_hold_pool_queues = VR_DEF_FLOW_HOLD_POOL_QUEUES;
 
 #if defined(__linux__) && defined(__KERNEL__)
 extern short vr_flow_major;
 #endif
 
+extern unsigned int datapath_offloads;
+
 void vr_flow_defer_cb(struct vrouter *router, void *arg);
 
 uint32_t vr_hashrnd = 0;
 int hashrnd_inited = 0;
 
-static struct vr_flow_entry *vr_flow_bucket_first_entry(struct vrouter *router, struct vr_flow *key) {
-    return (struct vr_flow_entry*)
-        vr_htable_get_bucket(router->vr_flow_table, key, key->flow_key_len);
-}
-
-/*
- * The vr_flow_bucket_lock and vr_flow_bucket_unlock callbacks may not be
- * implemented for all instances of host_os. Those callback are needed only for
- * implementations that require strict race condition controll for
- * hardware offloading (like DPDK).
- * Those helper functions call the locks only when they are available.
- */
-static void vr_flow_bucket_may_lock(struct vr_flow_entry *fe) {
-    if (vr_flow_bucket_lock && vr_flow_bucket_unlock)
-        vr_flow_bucket_lock(fe);
-}
-
-static void vr_flow_bucket_may_unlock(struct vr_flow_entry *fe) {
-    if (vr_flow_bucket_lock && vr_flow_bucket_unlock)
-        vr_flow_bucket_unlock(fe);
-}
+/* fails to compile if the per packet fields spill out of the hot lines */
+typedef char vr_flow_entry_hot_size_check[
+    (__builtin_offsetof(struct vr_flow_entry, fe_mme) <=
+        VR_FLOW_ENTRY_HOT_SIZE) ? 1 : -1];
 
 static void vr_flush_entry(struct vrouter *, struct vr_flow_entry *,
         struct vr_flow_md *, struct vr_forwarding_md *);
@@ -101,6 +112,9 @@ __vr_flow_schedule_transition(struct vrouter *, struct vr_flow_entry *,
         unsigned int, unsigned short);
 static bool vr_flow_is_fat_flow(struct vrouter *, struct vr_packet *,
         struct vr_flow_entry *);
+static void vr_flow_age_arm(struct vrouter *, unsigned int);
+static struct vr_flow_rpf_stats *vr_flow_get_rpf_stats(struct vrouter *,
+        unsigned int);
 
 struct vr_flow_entry *vr_find_flow(struct vrouter *, struct vr_flow *,
         uint8_t, unsigned int *);
@@ -274,6 +288,7 @@ vr_flow_reset_entry(struct vrouter *router, struct vr_flow_entry *fe)
     memset(&fe->fe_stats, 0, sizeof(fe->fe_stats));
     fe->fe_type = VP_TYPE_NULL;
     fe->fe_flags = 0;
+    fe->fe_insert_state = VR_FLOW_INSERT_NONE;
 
     vr_htable_release_hentry(router->vr_flow_table, &fe->fe_hentry);
     return;
@@ -404,6 +419,224 @@ vr_flow_start_modify(struct vrouter *router, struct vr_flow_entry *fe)
     return false;
 }
 
+static struct vr_flow_hold_pool *
+vr_flow_hold_pool_get(struct vrouter *router, unsigned int cpu)
+{
+    if (!router->vr_flow_hold_pool || (cpu >= vr_num_cpus))
+        return NULL;
+
+    return &router->vr_flow_hold_pool[cpu];
+}
+
+static void
+vr_flow_hold_drop(struct vrouter *router, unsigned int reason)
+{
+    struct vr_flow_hold_pool *vfhp;
+
+    vfhp = vr_flow_hold_pool_get(router, vr_get_cpu());
+    if (vfhp)
+        vfhp->vfhp_drops[reason]++;
+
+    return;
+}
+
+/* gives a chain of nodes, all of the same cpu, back to their pool */
+static void
+vr_flow_hold_nodes_free(struct vrouter *router,
+        struct vr_flow_hold_node *head, struct vr_flow_hold_node *tail,
+        unsigned int count)
+{
+    struct vr_flow_hold_node *node;
+    struct vr_flow_hold_pool *vfhp;
+
+    vfhp = vr_flow_hold_pool_get(router, head->vfhn_cpu);
+    if (!vfhp) {
+        while (head) {
+            node = head;
+            head = head->vfhn_next;
+            vr_free(node, VR_FLOW_QUEUE_OBJECT);
+        }
+        return;
+    }
+
+    do {
+        tail->vfhn_next = vfhp->vfhp_returned_nodes;
+    } while (!vr_sync_bool_compare_and_swap_p(&vfhp->vfhp_returned_nodes,
+                tail->vfhn_next, head));
+    (void)vr_sync_add_and_fetch_32u(&vfhp->vfhp_nodes_returned, count);
+
+    return;
+}
+
+/*
+ * Takes a node for the 'slot'th packet of a flow. Past the reserved
+ * entries, the flow gets a node only while the pool is not under pressure.
+ */
+static struct vr_flow_hold_node *
+__vr_flow_hold_node_alloc(struct vrouter *router, unsigned int cpu,
+        unsigned int slot, unsigned short *drop_reason)
+{
+    struct vr_flow_hold_node *node;
+    struct vr_flow_hold_pool *vfhp;
+
+    vfhp = vr_flow_hold_pool_get(router, cpu);
+    if (!vfhp) {
+        /* a cpu that has no pool allocates as it always did */
+        node = vr_zalloc(sizeof(*node), VR_FLOW_QUEUE_OBJECT);
+        if (!node) {
+            *drop_reason = VP_DROP_FLOW_NO_MEMORY;
+            return NULL;
+        }
+
+        node->vfhn_cpu = VR_FLOW_HOLD_NO_CPU;
+        return node;
+    }
+
+    if ((slot >= VR_FLOW_QUEUE_RESERVED_ENTRIES) &&
+            ((vfhp->vfhp_nodes_taken - vfhp->vfhp_nodes_returned) >=
+             (vfhp->vfhp_node_count - (vfhp->vfhp_node_count / 4)))) {
+        vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_SHARE]++;
+        *drop_reason = VP_DROP_FLOW_QUEUE_LIMIT_EXCEEDED;
+        return NULL;
+    }
+
+    if (!vfhp->vfhp_nodes)
+        vfhp->vfhp_nodes =
+            vr_sync_lock_test_and_set_p(&vfhp->vfhp_returned_nodes, NULL);
+
+    node = vfhp->vfhp_nodes;
+    if (!node) {
+        vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_POOL]++;
+        *drop_reason = VP_DROP_FLOW_NO_MEMORY;
+        return NULL;
+    }
+
+    vfhp->vfhp_nodes = node->vfhn_next;
+    node->vfhn_next = NULL;
+    vfhp->vfhp_nodes_taken++;
+
+    return node;
+}
+
+static struct vr_flow_hold_node *
+vr_flow_hold_node_alloc(struct vrouter *router, unsigned int slot,
+        unsigned short *drop_reason)
+{
+    unsigned int cpu;
+    struct vr_flow_hold_node *node;
+
+    cpu = vr_get_cpu_local();
+    node = __vr_flow_hold_node_alloc(router, cpu, slot, drop_reason);
+    vr_put_cpu_local();
+
+    return node;
+}
+
+/*
+ * A queue for the flow at 'index'. The datapath takes it from the pool of
+ * its cpu. The agent, which might run on any cpu in any context, allocates,
+ * and so does the datapath once the pool has run out. Running out is
+ * counted, but does not cost the flow.
+ */
+static struct vr_flow_queue *
+vr_flow_queue_alloc(struct vrouter *router, unsigned int index,
+        bool datapath)
+{
+    unsigned int cpu = VR_FLOW_HOLD_NO_CPU;
+    struct vr_flow_queue *vfq = NULL;
+    struct vr_flow_hold_pool *vfhp;
+
+    if (datapath) {
+        cpu = vr_get_cpu_local();
+        vfhp = vr_flow_hold_pool_get(router, cpu);
+        if (vfhp) {
+            if (!vfhp->vfhp_queues)
+                vfhp->vfhp_queues = vr_sync_lock_test_and_set_p(
+                        &vfhp->vfhp_returned_queues, NULL);
+
+            vfq = vfhp->vfhp_queues;
+            if (vfq)
+                vfhp->vfhp_queues = vfq->vfq_next;
+            else
+                vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_QUEUE]++;
+        }
+        vr_put_cpu_local();
+    }
+
+    if (!vfq) {
+        cpu = VR_FLOW_HOLD_NO_CPU;
+        vfq = vr_malloc(sizeof(*vfq), VR_FLOW_QUEUE_OBJECT);
+        if (!vfq)
+            return NULL;
+    }
+
+    memset(vfq, 0, sizeof(*vfq));
+    vfq->vfq_cpu = cpu;
+    vfq->vfq_index = index;
+    vfq->vfq_limit = vr_flow_hold_queue_len;
+    if (vfq->vfq_limit > VR_MAX_FLOW_QUEUE_ENTRIES)
+        vfq->vfq_limit = VR_MAX_FLOW_QUEUE_ENTRIES;
+    else if (!vfq->vfq_limit)
+        vfq->vfq_limit = 1;
+
+    return vfq;
+}
+
+static void
+vr_flow_queue_free(struct vrouter *router, struct vr_flow_queue *vfq)
+{
+    unsigned int i;
+    struct vr_flow_hold_node *node;
+    struct vr_flow_hold_pool *vfhp;
+
+    if (!vfq)
+        return;
+
+    /* flushed queues have nothing left, but one that never got used may */
+    for (i = 0; i < vfq->vfq_limit; i++) {
+        node = vfq->vfq_nodes[i];
+        if (!node)
+            continue;
+
+        vfq->vfq_nodes[i] = NULL;
+        if (node->vfhn_pnode.pl_packet) {
+            vr_pfree(node->vfhn_pnode.pl_packet, VP_DROP_FLOW_UNUSABLE);
+            node->vfhn_pnode.pl_packet = NULL;
+        }
+        vr_flow_hold_nodes_free(router, node, node, 1);
+    }
+
+    vfhp = vr_flow_hold_pool_get(router, vfq->vfq_cpu);
+    if (!vfhp) {
+        vr_free(vfq, VR_FLOW_QUEUE_OBJECT);
+        return;
+    }
+
+    do {
+        vfq->vfq_next = vfhp->vfhp_returned_queues;
+    } while (!vr_sync_bool_compare_and_swap_p(&vfhp->vfhp_returned_queues,
+                vfq->vfq_next, vfq));
+
+    return;
+}
+
+bool
+vr_flow_queue_has_packets(struct vr_flow_queue *vfq)
+{
+    unsigned int i;
+    struct vr_flow_hold_node *node;
+
+    if (!vfq)
+        return false;
+
+    for (i = 0; i < vfq->vfq_limit; i++) {
+        node = vfq->vfq_nodes[i];
+        if (node && node->vfhn_pnode.pl_packet)
+            return true;
+    }
+
+    return false;
+}
 
 /* Non-static due to RCU callback pointer comparison in vRouter/DPDK */
 static void
@@ -464,7 +697,7 @@ vr_flow_defer_cb(struct vrouter *router, void *arg)
     vfq = (struct vr_flow_queue *)vfdd->vfdd_flow_queue;
     if (vfq) {
         vr_flow_flush_hold_queue(router, fe, vfq);
-        vr_free(vfq, VR_FLOW_QUEUE_OBJECT);
+        vr_flow_queue_free(router, vfq);
         vfdd->vfdd_flow_queue = NULL;
     }
 
@@ -533,6 +766,108 @@ vr_flow_defer(struct vr_flow_md *flmd, struct vr_flow_entry *fe)
     return;
 }
 
+/*
+ * Grows the overflow table by its initial size, up to vr_oflow_entries_max.
+ * Runs from a work item, and the flow indices handed out so far stay as
+ * they are, so nothing needs to be migrated. The users that map the table
+ * learn about the new size from vr_flow_table_data and map it again.
+ */
+static void
+vr_flow_table_grow(void *arg)
+{
+    int ret = 0;
+    unsigned int oentries;
+    void *mem = NULL;
+    struct vrouter *router = (struct vrouter *)arg;
+    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+
+    oentries = vr_oflow_entries_base;
+    if (vr_oflow_entries + oentries > vr_oflow_entries_max)
+        oentries = vr_oflow_entries_max - vr_oflow_entries;
+    if (!oentries)
+        goto exit_grow;
+
+    /*
+     * The host maps the address space to grow into without backing it,
+     * hence the pages are allocated first, and the growth given up if
+     * there are none to be had
+     */
+    if (vr_oflow_ext_table) {
+        mem = (char *)vr_oflow_ext_table +
+            ((vr_oflow_entries - vr_oflow_entries_base) *
+             sizeof(struct vr_flow_entry));
+        if (!vr_table_mem_reserve)
+            ret = -EOPNOTSUPP;
+        else
+            ret = vr_table_mem_reserve(mem,
+                    (unsigned long)oentries * sizeof(struct vr_flow_entry));
+    }
+
+    if (!ret)
+        ret = vr_htable_grow_oentries(router->vr_flow_table, oentries, mem);
+    if (ret) {
+        vr_printf("vrouter: Failed to grow the flow table by %u entries (%d)\n",
+                oentries, ret);
+        /* do not retry for every new flow */
+        vr_oflow_entries_max = vr_oflow_entries;
+        goto exit_grow;
+    }
+
+    vr_oflow_entries += oentries;
+    (void)vr_sync_add_and_fetch_32u(&infop->vfti_resizes, 1);
+    vr_printf("vrouter: Flow table grown to %u overflow entries\n",
+            vr_oflow_entries);
+
+exit_grow:
+    (void)vr_sync_bool_compare_and_swap_32u(&infop->vfti_grow_scheduled, 1, 0);
+    return;
+}
+
+/*
+ * Schedules the growth of the overflow table once three quarters of it are
+ * in use. The offload tables are sized for the initial flow table, hence
+ * the table does not grow with offloads enabled.
+ */
+static void
+vr_flow_table_may_grow(struct vrouter *router)
+{
+    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+
+    if (vr_likely(vr_oflow_entries >= vr_oflow_entries_max))
+        return;
+
+    if (datapath_offloads || !infop)
+        return;
+
+    if (vr_flow_table_used_oflow_entries(router) < (vr_oflow_entries / 4) * 3)
+        return;
+
+    if (!vr_sync_bool_compare_and_swap_32u(&infop->vfti_grow_scheduled, 0, 1))
+        return;
+
+    if (vr_schedule_work(vr_get_cpu(), vr_flow_table_grow, (void *)router))
+        (void)vr_sync_bool_compare_and_swap_32u(&infop->vfti_grow_scheduled,
+                1, 0);
+
+    return;
+}
+
+/* a new flow at 'index' has not been seen, whatever was there before */
+static void
+vr_flow_last_seen_reset(struct vrouter *router, unsigned int index)
+{
+    uint32_t *last_seen;
+
+    if (!router->vr_flow_last_seen)
+        return;
+
+    last_seen = (uint32_t *)vr_btable_get(router->vr_flow_last_seen, index);
+    if (last_seen)
+        *last_seen = 0;
+
+    return;
+}
+
 static struct vr_flow_entry *
 vr_flow_table_get_free_entry(struct vrouter *router, struct vr_flow *key,
         unsigned int *free_index)
@@ -543,7 +878,16 @@ vr_flow_table_get_free_entry(struct vrouter *router, struct vr_flow *key,
     fe = (struct vr_flow_entry *)
          vr_htable_find_free_hentry(router->vr_flow_table, key,
                  key->flow_key_len);
+    if (!fe || (fe->fe_hentry.hentry_index >= vr_flow_entries))
+        vr_flow_table_may_grow(router);
+
     if (fe) {
+        /*
+         * keep the entry hidden from lookups until the insertion is
+         * published by vr_flow_insert_publish
+         */
+        vr_htable_hentry_hide(&fe->fe_hentry);
+        fe->fe_insert_state = VR_FLOW_INSERT_PENDING;
         flags = fe->fe_flags;
         if (!(flags & VR_FLOW_FLAG_ACTIVE)) {
             if (vr_flow_set_active(fe)) {
@@ -559,6 +903,7 @@ vr_flow_table_get_free_entry(struct vrouter *router, struct vr_flow *key,
         fe->fe_gen_id = (fe->fe_gen_id + 1) %
             (1 << (8 * sizeof(fe->fe_gen_id)));
         *free_index = fe->fe_hentry.hentry_index;
+        vr_flow_last_seen_reset(router, *free_index);
     }
 
     return fe;
@@ -567,22 +912,26 @@ vr_flow_table_get_free_entry(struct vrouter *router, struct vr_flow *key,
 
 static struct vr_flow_entry *
 vr_flow_get_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
-        bool need_hold, unsigned int *fe_index)
+        bool need_hold, bool datapath, unsigned int *fe_index,
+        unsigned short *drop_reason)
 {
     struct vr_flow_entry *fe = NULL;
 
+    if (drop_reason)
+        *drop_reason = VP_DROP_FLOW_TABLE_FULL;
+
     fe = vr_flow_table_get_free_entry(router, key, fe_index);
     if (fe) {
         if (need_hold) {
-            fe->fe_hold_list = vr_zalloc(sizeof(struct vr_flow_queue),
-                    VR_FLOW_QUEUE_OBJECT);
+            fe->fe_hold_list = vr_flow_queue_alloc(router, *fe_index,
+                    datapath);
             if (!fe->fe_hold_list) {
                 vr_flow_reset_entry(router, fe);
                 fe = NULL;
                 vr_printf("%s:%d flow reset\n", __func__, __LINE__);
+                if (drop_reason)
+                    *drop_reason = VP_DROP_FLOW_NO_MEMORY;
                 return fe;
-            } else {
-                fe->fe_hold_list->vfq_index = *fe_index;
             }
         }
 
@@ -612,220 +961,1018 @@ vr_find_flow(struct vrouter *router, struct vr_flow *key,
 }
 
 
-void
-vr_flow_fill_pnode(struct vr_packet_node *pnode, struct vr_packet *pkt,
-        struct vr_forwarding_md *fmd)
+/*
+ * Lock-free insertion.
+ *
+ * A new entry is claimed through the hash table (a compare and swap on the
+ * hentry flags), hidden in the hash table, marked VR_FLOW_INSERT_PENDING
+ * and has its key written. A hidden entry is skipped by the lookups before
+ * its key is compared, so that they need not look at the insertion state,
+ * which lives past the hot cache lines. The inserter then scans the bucket
+ * for other entries holding the same key:
+ *
+ *   - a published entry means somebody else won, and ours is released
+ *   - a pending entry with a lower index wins over ours
+ *   - a pending entry with a higher index is aborted by us, with a compare
+ *     and swap of its state from PENDING to ABORTED
+ *
+ * and finally publishes its own entry with a compare and swap from PENDING
+ * to NONE, which fails if a lower indexed inserter aborted it meanwhile.
+ * Since the state is written and the bucket scanned on either side of a
+ * full barrier, of any two concurrent inserters of a key at least one sees
+ * the other, and at most one of them can be published.
+ */
+struct vr_flow_insert_scan {
+    struct vr_flow_entry *fis_fe;
+    struct vr_flow_entry *fis_winner;
+    int fis_result;
+};
+
+static bool
+vr_flow_insert_key_match(struct vr_flow_entry *fe, struct vr_flow_entry *new)
 {
-    struct vr_ip *ip = (struct vr_ip *)pkt_inner_network_header(pkt);
+    if (fe->fe_key.flow_key_len != new->fe_key.flow_key_len)
+        return false;
 
-    /*
-     * we cannot cache nexthop here. to cache, we need to hold reference
-     * to the nexthop. to hold a reference, we will have to hold a lock,
-     * which we cannot. the only known case of misbehavior if we do not
-     * cache is ECMP. when the packet comes from the fabric, the nexthop
-     * actually points to a local composite, whereas a route lookup actually
-     * returns a different nexthop, in which case the ecmp index will return
-     * a bad nexthop. to avoid that, we will cache the label, and reuse it
-     */
-    pkt->vp_nh = NULL;
+    return !memcmp(&fe->fe_key, &new->fe_key, new->fe_key.flow_key_len);
+}
 
-    pnode->pl_flags = 0;
-    pnode->pl_vif_idx = pkt->vp_if->vif_idx;
+static void
+vr_flow_insert_scan_cb(vr_htable_t htable, vr_hentry_t *ent,
+        unsigned int index, void *data)
+{
+    uint8_t state;
+    unsigned short flags;
+    struct vr_flow_entry *fe;
+    struct vr_flow_insert_scan *scan = (struct vr_flow_insert_scan *)data;
 
-    if (fmd) {
-        pnode->pl_outer_src_ip = fmd->fmd_outer_src_ip;
-        pnode->pl_label = fmd->fmd_label;
-        if (vr_fmd_label_is_vxlan_id(fmd))
-            pnode->pl_flags |= PN_FLAG_LABEL_IS_VXLAN_ID;
-        if (fmd->fmd_to_me)
-            pnode->pl_flags |= PN_FLAG_TO_ME;
-    }
+    if (scan->fis_result)
+        return;
 
-    if (ip) {
-        if (vr_ip_is_ip4(ip)) {
-            /*
-             * Source IP & Dest IP can change while the packet is in the queue
-             * (NAT). For e.g.: when the cloned head of a fragment is enqueued
-             * to the assembler and subsequently dequeued by the assembler, the
-             * original packet might have undergone a NAT, resulting in wrong
-             * hash and thus a wrong search for other fragments of the packet.
-             * Hence, store them here for others interested in the original IPs
-             */
-            pnode->pl_inner_src_ip = ip->ip_saddr;
-            pnode->pl_inner_dst_ip = ip->ip_daddr;
-            if (vr_ip_fragment_head(ip))
-                pnode->pl_flags |= PN_FLAG_FRAGMENT_HEAD;
-        } else if (vr_ip_is_ip6(ip)) {
-            if (vr_ip6_fragment_head((struct vr_ip6 *)ip))
-                pnode->pl_flags |= PN_FLAG_FRAGMENT_HEAD;
+    fe = CONTAINER_OF(fe_hentry, struct vr_flow_entry, ent);
+    if (fe == scan->fis_fe)
+        return;
+
+    if (!vr_flow_insert_key_match(fe, scan->fis_fe))
+        return;
+
+    /* the key has to be read before the state it is guarded by */
+    vr_sync_synchronize();
+
+    state = fe->fe_insert_state;
+    if (state == VR_FLOW_INSERT_PENDING) {
+        if (index < scan->fis_fe->fe_hentry.hentry_index) {
+            scan->fis_winner = fe;
+            scan->fis_result = -EAGAIN;
+            return;
         }
+
+        if (vr_sync_bool_compare_and_swap_8u(&fe->fe_insert_state,
+                    VR_FLOW_INSERT_PENDING, VR_FLOW_INSERT_ABORTED))
+            return;
+
+        /* it got published (or aborted) before we could abort it */
+        state = fe->fe_insert_state;
     }
 
-    pnode->pl_dscp = fmd->fmd_dscp;
-    pnode->pl_dotonep = fmd->fmd_dotonep;
-    pnode->pl_vrf = fmd->fmd_dvrf;
-    pnode->pl_vlan = fmd->fmd_vlan;
-    pnode->pl_mirror_vlan = fmd->fmd_mirror_data;
+    if (state != VR_FLOW_INSERT_NONE)
+        return;
+
+    flags = fe->fe_flags;
+    if ((flags & VR_FLOW_FLAG_ACTIVE) &&
+            !(flags & VR_FLOW_FLAG_DELETE_MARKED) &&
+            vr_flow_insert_key_match(fe, scan->fis_fe)) {
+        scan->fis_winner = fe;
+        scan->fis_result = -EEXIST;
+    }
+
+    return;
+}
+
+static void
+vr_flow_insert_abort(struct vrouter *router, struct vr_flow_entry *fe)
+{
+    /* never published, hence nothing could have been queued */
+    if (fe->fe_hold_list) {
+        vr_flow_queue_free(router, fe->fe_hold_list);
+        fe->fe_hold_list = NULL;
+    }
 
+    /* hide the key before the state is cleared in vr_flow_reset_entry */
+    fe->fe_key.flow_key_len = 0;
+    fe->fe_flags = 0;
     vr_sync_synchronize();
-    pnode->pl_packet = pkt;
+
+    vr_flow_reset_entry(router, fe);
+    return;
+}
+
+/*
+ * Returns 0 if 'fe' got published, -EEXIST if the key is already present
+ * in the table (returned in 'winner') and -EAGAIN if another inserter of
+ * the same key won, in which case the caller should look the key up again.
+ * 'fe' is released on failure.
+ */
+static int
+vr_flow_insert_publish(struct vrouter *router, struct vr_flow_entry *fe,
+        struct vr_flow_entry **winner)
+{
+    unsigned int spins = 0;
+    struct vr_flow_insert_scan scan = {
+        .fis_fe = fe,
+        .fis_winner = NULL,
+        .fis_result = 0,
+    };
+
+    /* make the pending state and key visible before looking at others */
+    vr_sync_synchronize();
+
+    vr_htable_trav_bucket(router->vr_flow_table, &fe->fe_key,
+            fe->fe_key.flow_key_len, vr_flow_insert_scan_cb, &scan);
+
+    if (!scan.fis_result &&
+            vr_sync_bool_compare_and_swap_8u(&fe->fe_insert_state,
+                VR_FLOW_INSERT_PENDING, VR_FLOW_INSERT_NONE)) {
+        vr_htable_hentry_unhide(&fe->fe_hentry);
+        vr_flow_age_arm(router, fe->fe_hentry.hentry_index);
+        return 0;
+    }
+
+    vr_flow_insert_abort(router, fe);
+
+    if (scan.fis_result == -EEXIST) {
+        *winner = scan.fis_winner;
+        return -EEXIST;
+    }
+
+    /* give the winner a chance to publish before looking up again */
+    if (scan.fis_winner) {
+        while ((scan.fis_winner->fe_insert_state == VR_FLOW_INSERT_PENDING) &&
+                (spins++ < VR_FLOW_INSERT_SPINS))
+            vr_pause();
+    }
+
+    return -EAGAIN;
+}
+
+
+/*
+ * Resolves a burst of keys. All the keys are hashed and their buckets
+ * prefetched first, so that the bucket cache misses of the whole burst
+ * overlap instead of being taken one after the other, and only then the
+ * keys are looked up, once each. Entries that are not found are returned
+ * as NULL, with VR_INVALID_HENTRY_INDEX for their index. Returns the
+ * number of keys that hit an entry.
+ */
+unsigned int
+vr_flow_lookup_burst(struct vrouter *router, struct vr_flow **keys,
+        struct vr_flow_entry **entries, unsigned int *fe_indices,
+        unsigned int num)
+{
+    unsigned int i, j, count, found = 0;
+    unsigned int hash[VR_FLOW_LOOKUP_BURST_MAX];
+    struct vr_flow_entry *fe;
+
+    if (!router || !router->vr_flow_table)
+        return 0;
+
+    for (i = 0; i < num; i += count) {
+        count = num - i;
+        if (count > VR_FLOW_LOOKUP_BURST_MAX)
+            count = VR_FLOW_LOOKUP_BURST_MAX;
+
+        for (j = 0; j < count; j++) {
+            hash[j] = vr_htable_hash(router->vr_flow_table, keys[i + j],
+                    keys[i + j]->flow_key_len);
+            vr_htable_prefetch_by_hash(router->vr_flow_table, hash[j]);
+        }
+
+        for (j = 0; j < count; j++) {
+            fe = (struct vr_flow_entry *)
+                vr_htable_find_hentry_by_hash(router->vr_flow_table,
+                        keys[i + j], keys[i + j]->flow_key_len, hash[j]);
+            if (fe) {
+                /*
+                 * the key compare has pulled in the first line; the
+                 * action and the stats live in the second hot line
+                 */
+                vr_prefetch(&fe->fe_stats);
+                found++;
+            }
+
+            if (fe_indices)
+                fe_indices[i + j] = fe ? fe->fe_hentry.hentry_index :
+                    VR_INVALID_HENTRY_INDEX;
+            if (entries)
+                entries[i + j] = fe;
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Takes up the flow that vr_flow_prefetch_burst resolved for pkt, if the
+ * entry still holds key. Packets reach here in the order of the burst,
+ * less the ones that were dropped or took another path on the way, and
+ * hence the cursor only moves forward.
+ */
+static struct vr_flow_entry *
+vr_flow_burst_take(struct vrouter *router, struct vr_flow *key,
+        struct vr_packet *pkt, unsigned int *fe_index)
+{
+    unsigned int i, cpu;
+    struct vr_flow_entry *fe;
+    struct vr_flow_burst *vfb;
+    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+
+    cpu = vr_get_cpu();
+    if (!infop || !infop->vfti_burst || (cpu >= vr_num_cpus))
+        return NULL;
+
+    vfb = &infop->vfti_burst[cpu];
+    for (i = vfb->vfb_next; i < vfb->vfb_count; i++) {
+        if (vfb->vfb_pkt[i] == pkt)
+            break;
+    }
+
+    if (i >= vfb->vfb_count)
+        return NULL;
+
+    vfb->vfb_next = i + 1;
+    if (vfb->vfb_index[i] == VR_INVALID_HENTRY_INDEX)
+        return NULL;
+
+    fe = vr_flow_get_entry(router, vfb->vfb_index[i]);
+    if (!fe || !vr_htable_hentry_match(router->vr_flow_table,
+                &fe->fe_hentry, key, key->flow_key_len))
+        return NULL;
+
+    *fe_index = vfb->vfb_index[i];
+    return fe;
+}
+
+/*
+ * Forms the flow keys of a burst of packets received on a VM interface
+ * and resolves them through vr_flow_lookup_burst, so that the flow bucket
+ * misses of the burst overlap. What was found is kept in the burst
+ * context of the cpu, for vr_flow_lookup to take up when each packet gets
+ * there. Only the common case is handled here (untagged, unfragmented
+ * IPv4 TCP/UDP with no fat flow config), where the key can be formed
+ * without any route or fragment table lookup. Everything else is left to
+ * the regular per packet path. Returns the number of packets that hit a
+ * flow.
+ */
+unsigned int
+vr_flow_prefetch_burst(struct vrouter *router, struct vr_interface *vif,
+        struct vr_packet **pkts, unsigned int num)
+{
+    unsigned int i, cpu, found, nkeys = 0;
+    unsigned short *t_hdr;
+    struct vr_eth *eth;
+    struct vr_ip *ip;
+    struct vr_flow_burst *vfb = NULL;
+    struct vr_flow flows[VR_FLOW_LOOKUP_BURST_MAX];
+    struct vr_flow *keys[VR_FLOW_LOOKUP_BURST_MAX];
+
+    cpu = vr_get_cpu();
+    if (router && router->vr_flow_table_info &&
+            router->vr_flow_table_info->vfti_burst && (cpu < vr_num_cpus)) {
+        vfb = &router->vr_flow_table_info->vfti_burst[cpu];
+        vfb->vfb_count = vfb->vfb_next = 0;
+    }
+
+    if (!vfb || !vif || !vif_is_virtual(vif) || vif_is_service(vif) ||
+            !(vif->vif_flags & VIF_FLAG_POLICY_ENABLED) ||
+            vif->fat_flow_cfg_size)
+        return 0;
+
+    if (num > VR_FLOW_LOOKUP_BURST_MAX)
+        num = VR_FLOW_LOOKUP_BURST_MAX;
+
+    for (i = 0; i < num; i++) {
+        if (!pkts[i] || (pkt_head_len(pkts[i]) <
+                    (VR_ETHER_HLEN + sizeof(struct vr_ip) + 4)))
+            continue;
+
+        eth = (struct vr_eth *)pkt_data(pkts[i]);
+        if (ntohs(eth->eth_proto) != VR_ETH_PROTO_IP)
+            continue;
+
+        ip = (struct vr_ip *)(eth + 1);
+        if (!vr_ip_is_ip4(ip) || (ip->ip_hl != 5) || vr_ip_fragment(ip))
+            continue;
+
+        if ((ip->ip_proto != VR_IP_PROTO_TCP) &&
+                (ip->ip_proto != VR_IP_PROTO_UDP))
+            continue;
+
+        if (IS_BMCAST_IP(ip->ip_daddr))
+            continue;
+
+        t_hdr = (unsigned short *)(ip + 1);
+        vr_inet_fill_flow(&flows[nkeys], vif->vif_nh_id, ip->ip_saddr,
+                ip->ip_daddr, ip->ip_proto, *t_hdr, *(t_hdr + 1),
+                VR_FLOW_KEY_ALL);
+        keys[nkeys] = &flows[nkeys];
+        vfb->vfb_pkt[nkeys] = pkts[i];
+        nkeys++;
+    }
+
+    if (!nkeys)
+        return 0;
+
+    found = vr_flow_lookup_burst(router, keys, NULL, vfb->vfb_index, nkeys);
+    vfb->vfb_count = nkeys;
+
+    return found;
+}
+
+
+void
+vr_flow_fill_pnode(struct vr_packet_node *pnode, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd)
+{
+    struct vr_ip *ip = (struct vr_ip *)pkt_inner_network_header(pkt);
+
+    /*
+     * we cannot cache nexthop here. to cache, we need to hold reference
+     * to the nexthop. to hold a reference, we will have to hold a lock,
+     * which we cannot. the only known case of misbehavior if we do not
+     * cache is ECMP. when the packet comes from the fabric, the nexthop
+     * actually points to a local composite, whereas a route lookup actually
+     * returns a different nexthop, in which case the ecmp index will return
+     * a bad nexthop. to avoid that, we will cache the label, and reuse it
+     */
+    pkt->vp_nh = NULL;
+
+    pnode->pl_flags = 0;
+    pnode->pl_vif_idx = pkt->vp_if->vif_idx;
+
+    if (fmd) {
+        pnode->pl_outer_src_ip = fmd->fmd_outer_src_ip;
+        pnode->pl_label = fmd->fmd_label;
+        if (vr_fmd_label_is_vxlan_id(fmd))
+            pnode->pl_flags |= PN_FLAG_LABEL_IS_VXLAN_ID;
+        if (fmd->fmd_to_me)
+            pnode->pl_flags |= PN_FLAG_TO_ME;
+    }
+
+    if (ip) {
+        if (vr_ip_is_ip4(ip)) {
+            /*
+             * Source IP & Dest IP can change while the packet is in the queue
+             * (NAT). For e.g.: when the cloned head of a fragment is enqueued
+             * to the assembler and subsequently dequeued by the assembler, the
+             * original packet might have undergone a NAT, resulting in wrong
+             * hash and thus a wrong search for other fragments of the packet.
+             * Hence, store them here for others interested in the original IPs
+             */
+            pnode->pl_inner_src_ip = ip->ip_saddr;
+            pnode->pl_inner_dst_ip = ip->ip_daddr;
+            if (vr_ip_fragment_head(ip))
+                pnode->pl_flags |= PN_FLAG_FRAGMENT_HEAD;
+        } else if (vr_ip_is_ip6(ip)) {
+            if (vr_ip6_fragment_head((struct vr_ip6 *)ip))
+                pnode->pl_flags |= PN_FLAG_FRAGMENT_HEAD;
+        }
+    }
+
+    pnode->pl_dscp = fmd->fmd_dscp;
+    pnode->pl_dotonep = fmd->fmd_dotonep;
+    pnode->pl_vrf = fmd->fmd_dvrf;
+    pnode->pl_vlan = fmd->fmd_vlan;
+    pnode->pl_mirror_vlan = fmd->fmd_mirror_data;
+
+    vr_sync_synchronize();
+    pnode->pl_packet = pkt;
+
+    return;
+}
+
+static int
+vr_enqueue_flow(struct vrouter *router, struct vr_flow_entry *fe,
+        struct vr_packet *pkt, unsigned int index,
+        struct vr_flow_stats *stats, struct vr_forwarding_md *fmd)
+{
+    int ret = 0;
+    unsigned int i;
+    unsigned short drop_reason = 0;
+    struct vr_flow_queue *vfq = fe->fe_hold_list;
+    struct vr_flow_hold_node *node;
+    struct vr_packet_node *pnode;
+
+    if (!vfq) {
+        drop_reason = VP_DROP_FLOW_UNUSABLE;
+        PKT_LOG(drop_reason, pkt, 0, VR_FLOW_C, __LINE__);
+        goto drop;
+    }
+
+    i = vr_sync_fetch_and_add_32u(&vfq->vfq_entries, 1);
+    if (i >= vfq->vfq_limit) {
+        vr_flow_hold_drop(router, VR_FLOW_HOLD_DROP_LIMIT);
+        drop_reason = VP_DROP_FLOW_QUEUE_LIMIT_EXCEEDED;
+        PKT_LOG(drop_reason, pkt, 0, VR_FLOW_C, __LINE__);
+        goto drop;
+    }
+
+    node = vr_flow_hold_node_alloc(router, i, &drop_reason);
+    if (!node) {
+        PKT_LOG(drop_reason, pkt, 0, VR_FLOW_C, __LINE__);
+        goto drop;
+    }
+
+    pnode = &node->vfhn_pnode;
+    vr_flow_fill_pnode(pnode, pkt, fmd);
+    if (!i)
+        ret = vr_trap_flow(router, fe, pkt, index, stats, pnode);
+
+    /* the packet itself went to the agent if it could not be cloned */
+    if (pnode->pl_packet) {
+        vfq->vfq_nodes[i] = node;
+    } else {
+        vr_flow_hold_nodes_free(router, node, node, 1);
+    }
+
+    return ret;
+drop:
+    vr_pfree(pkt, drop_reason);
+    return 0;
+}
+
+static flow_result_t
+vr_flow_nat(struct vr_flow_entry *fe,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    if (pkt->vp_type == VP_TYPE_IP)
+        return vr_inet_flow_nat(fe, pkt, fmd);
+
+    if (pkt->vp_type == VP_TYPE_IP6)
+        return vr_inet6_flow_nat(fe, pkt, fmd);
+
+    PKT_LOG(VP_DROP_FLOW_ACTION_INVALID, pkt, 0, VR_FLOW_C, __LINE__);
+    vr_pfree(pkt, VP_DROP_FLOW_ACTION_INVALID);
+    return FLOW_CONSUMED;
+}
+
+static void
+vr_flow_set_forwarding_md(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, struct vr_forwarding_md *md)
+{
+    struct vr_flow_entry *rfe;
+
+    md->fmd_flow_index = index;
+    md->fmd_ecmp_nh_index = fe->fe_ecmp_nh_index;
+    md->fmd_underlay_ecmp_index = fe->fe_underlay_ecmp_index;
+    md->fmd_udp_src_port = fe->fe_udp_src_port;
+    if (fe->fe_flags & VR_RFLOW_VALID) {
+        rfe = vr_flow_get_entry(router, fe->fe_rflow);
+        if (rfe)
+            md->fmd_ecmp_src_nh_index = rfe->fe_ecmp_nh_index;
+    }
+
+    return;
+}
+
+static bool
+__vr_flow_mark_evict(struct vrouter *router, struct vr_flow_entry *fe)
+{
+    unsigned short flags;
+
+    flags = fe->fe_flags;
+    if (flags & VR_FLOW_FLAG_ACTIVE) {
+        flags = vr_sync_fetch_and_or_16u(&fe->fe_flags,
+                VR_FLOW_FLAG_EVICT_CANDIDATE);
+        if (!(flags & VR_FLOW_FLAG_EVICT_CANDIDATE)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+vr_flow_mark_evict(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index)
+{
+    bool evict_forward_flow = true;
+
+    struct vr_flow_entry *rfe = NULL;
+
+    /* start modifying the entry */
+    if (!vr_flow_start_modify(router, fe)) {
+        return;
+    }
+
+    if (fe->fe_rflow >= 0) {
+        rfe = vr_flow_get_entry(router, fe->fe_rflow);
+        if (rfe) {
+            evict_forward_flow = false;
+            if (rfe->fe_tcp_flags & VR_FLOW_TCP_DEAD) {
+                if (!vr_flow_start_modify(router, rfe)) {
+                    /* no modification. hence...*/
+                    rfe = NULL;
+                } else {
+                    /* we do not want hold flows to be evicted, just yet */
+                    if (((rfe->fe_rflow == index) || (rfe->fe_rflow < 0)) &&
+                            (rfe->fe_action != VR_FLOW_ACTION_HOLD)) {
+                        evict_forward_flow = __vr_flow_mark_evict(router, rfe);
+                    }
+                }
+            } else {
+                /* no modification. hence...*/
+                rfe = NULL;
+            }
+        }
+    }
+
+    /*
+     * presence of rfe means that we might need to reset the evict bit
+     * or at the minimum reset the modified bit under failure conditions
+     *
+     * CEM-18166: In case rfe has already been deleted, under special
+     * circumstances, fe might still have fe_rflow pointing to it.
+     * In this case (and other cases where rfe is not active anymore),
+     * evict_forward_flow will remain true, which makes sense because we still
+     * want to evict this flow, because of TCP FIN or RST.
+     */
+    if (evict_forward_flow) {
+        if (__vr_flow_mark_evict(router, fe)) {
+            if (!__vr_flow_schedule_transition(router, fe,
+                        index, fe->fe_flags)) {
+                return;
+            } else {
+                goto reset_evict;
+            }
+        }
+    }
+
+    /* stop modifying the forward and the reverse */
+    if (rfe)
+        vr_flow_stop_modify(router, rfe);
+    vr_flow_stop_modify(router, fe);
+
+    return;
+
+reset_evict:
+    if (rfe)
+        vr_flow_reset_evict(router, rfe);
+    vr_flow_reset_evict(router, fe);
+
+    return;
+}
+
+/*
+ * Evicts an idle flow, and its reverse flow if one is given, through the
+ * same transition as the one vr_flow_mark_evict schedules for closed tcp
+ * flows. Returns true if the transition got scheduled.
+ */
+static bool
+vr_flow_age_evict(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, struct vr_flow_entry *rfe)
+{
+    if (!vr_flow_start_modify(router, fe))
+        return false;
+
+    if (rfe) {
+        if (!vr_flow_start_modify(router, rfe)) {
+            vr_flow_stop_modify(router, fe);
+            return false;
+        }
+        (void)__vr_flow_mark_evict(router, rfe);
+    }
+
+    if (__vr_flow_mark_evict(router, fe)) {
+        if (!__vr_flow_schedule_transition(router, fe, index, fe->fe_flags))
+            return true;
+
+        if (rfe)
+            vr_flow_reset_evict(router, rfe);
+        vr_flow_reset_evict(router, fe);
+        return false;
+    }
+
+    if (rfe)
+        vr_flow_reset_evict(router, rfe);
+    vr_flow_stop_modify(router, fe);
+
+    return false;
+}
+
+static struct vr_flow_age_entry *
+vr_flow_age_get_entry(struct vr_flow_aging *vfag, unsigned int index)
+{
+    return (struct vr_flow_age_entry *)vr_btable_get(vfag->vfag_entries,
+            index);
+}
+
+/*
+ * Hands a freshly inserted flow to the aging timer. Called on any cpu,
+ * hence the index is only pushed on the incoming list here.
+ */
+static void
+vr_flow_age_arm(struct vrouter *router, unsigned int index)
+{
+    uint32_t head;
+    struct vr_flow_aging *vfag = router->vr_flow_aging;
+    struct vr_flow_age_entry *vfae;
+
+    if (!vfag)
+        return;
+
+    vfae = vr_flow_age_get_entry(vfag, index);
+    if (!vfae)
+        return;
+
+    /* already on the wheel, or on its way there */
+    if (!vr_sync_bool_compare_and_swap_8u(&vfae->vfae_state,
+                VR_FLOW_AGE_IDLE, VR_FLOW_AGE_QUEUED))
+        return;
+
+    do {
+        head = vfag->vfag_incoming;
+        vfae->vfae_next = head;
+    } while (!vr_sync_bool_compare_and_swap_32u(&vfag->vfag_incoming,
+                head, index));
+
+    return;
+}
+
+static void
+vr_flow_age_insert(struct vr_flow_aging *vfag, unsigned int index,
+        struct vr_flow_age_entry *vfae, uint32_t expires)
+{
+    uint32_t ticks, *slot;
+
+    ticks = expires - vfag->vfag_now;
+    if ((int32_t)ticks < 0) {
+        ticks = 0;
+    } else if (ticks > VR_FLOW_AGING_MAX_TICKS) {
+        ticks = VR_FLOW_AGING_MAX_TICKS;
+    }
+    expires = vfag->vfag_now + ticks;
+    vfae->vfae_expires = expires;
+
+    if (ticks < VR_FLOW_AGING_WHEEL_SLOTS) {
+        slot = &vfag->vfag_wheel[0][expires & VR_FLOW_AGING_WHEEL_MASK];
+    } else {
+        slot = &vfag->vfag_wheel[1][(expires >> VR_FLOW_AGING_WHEEL_BITS) &
+            VR_FLOW_AGING_WHEEL_MASK];
+    }
+
+    vfae->vfae_next = *slot;
+    *slot = index;
+
+    return;
+}
+
+static void
+vr_flow_age_snapshot(struct vr_flow_aging *vfag,
+        struct vr_flow_age_entry *vfae, struct vr_flow_entry *fe)
+{
+    vfae->vfae_gen_id = fe->fe_gen_id;
+    vfae->vfae_packets = fe->fe_stats.flow_packets;
+    vfae->vfae_seen = vfag->vfag_now;
+
+    return;
+}
+
+static bool
+vr_flow_age_is_idle(struct vr_flow_aging *vfag, struct vr_flow_entry *fe,
+        struct vr_flow_age_entry *vfae)
+{
+    if ((vfae->vfae_state != VR_FLOW_AGE_ARMED) ||
+            (vfae->vfae_gen_id != fe->fe_gen_id) ||
+            (vfae->vfae_packets != fe->fe_stats.flow_packets))
+        return false;
+
+    return (vfag->vfag_now - vfae->vfae_seen) >= vfag->vfag_timeout;
+}
+
+static void
+vr_flow_age_expire(struct vr_flow_aging *vfag, unsigned int index,
+        struct vr_flow_age_entry *vfae)
+{
+    unsigned short flags;
+    struct vrouter *router = vfag->vfag_router;
+    struct vr_flow_entry *fe, *rfe = NULL;
+    struct vr_flow_age_entry *rvfae;
+
+    fe = vr_flow_get_entry(router, index);
+    if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+            (fe->fe_flags & VR_FLOW_FLAG_EVICTED)) {
+        vfae->vfae_state = VR_FLOW_AGE_IDLE;
+        vr_sync_synchronize();
+        /*
+         * a flow inserted at this index before the state got cleared
+         * found it armed and did not push itself, so take it back here
+         */
+        fe = vr_flow_get_entry(router, index);
+        if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+                (fe->fe_flags & VR_FLOW_FLAG_EVICTED) ||
+                !vr_sync_bool_compare_and_swap_8u(&vfae->vfae_state,
+                    VR_FLOW_AGE_IDLE, VR_FLOW_AGE_ARMED))
+            return;
+
+        vr_flow_age_snapshot(vfag, vfae, fe);
+        vr_flow_age_insert(vfag, index, vfae,
+                vfag->vfag_now + vfag->vfag_timeout);
+        return;
+    }
+
+    /* the index got reused, or the flow has seen packets since */
+    if ((vfae->vfae_gen_id != fe->fe_gen_id) ||
+            (vfae->vfae_packets != fe->fe_stats.flow_packets)) {
+        vr_flow_log_append(router, VR_FLOW_LOG_RING_TIMER, fe, index,
+                VR_FLOW_LOG_REASON_PERIODIC);
+        vr_flow_age_snapshot(vfag, vfae, fe);
+        vr_flow_age_insert(vfag, index, vfae,
+                vfag->vfag_now + vfag->vfag_timeout);
+        return;
+    }
+
+    if ((vfag->vfag_now - vfae->vfae_seen) < vfag->vfag_timeout) {
+        vr_flow_age_insert(vfag, index, vfae,
+                vfae->vfae_seen + vfag->vfag_timeout);
+        return;
+    }
+
+    flags = fe->fe_flags;
+    if ((fe->fe_action == VR_FLOW_ACTION_HOLD) || fe->fe_hold_list ||
+            (flags & (VR_FLOW_FLAG_EVICT_CANDIDATE |
+                      VR_FLOW_FLAG_DELETE_MARKED))) {
+        vr_flow_age_insert(vfag, index, vfae,
+                vfag->vfag_now + vfag->vfag_timeout);
+        return;
+    }
+
+    if ((flags & VR_RFLOW_VALID) && (fe->fe_rflow >= 0)) {
+        rfe = vr_flow_get_entry(router, fe->fe_rflow);
+        if (rfe && !(rfe->fe_flags & VR_FLOW_FLAG_ACTIVE))
+            rfe = NULL;
+
+        /* the reverse flow has to be idle too */
+        if (rfe) {
+            rvfae = vr_flow_age_get_entry(vfag, fe->fe_rflow);
+            if (!rvfae || !vr_flow_age_is_idle(vfag, rfe, rvfae)) {
+                vr_flow_age_insert(vfag, index, vfae,
+                        vfag->vfag_now + vfag->vfag_timeout);
+                return;
+            }
+        }
+    }
+
+    if (!vr_flow_age_evict(router, fe, index, rfe)) {
+        vr_flow_age_insert(vfag, index, vfae,
+                vfag->vfag_now + vfag->vfag_timeout);
+        return;
+    }
+
+    vfae->vfae_state = VR_FLOW_AGE_IDLE;
+    if (router->vr_flow_table_info)
+        router->vr_flow_table_info->vfti_aged++;
+
+    vr_flow_log_append(router, VR_FLOW_LOG_RING_TIMER, fe, index,
+            VR_FLOW_LOG_REASON_AGED);
+
+    return;
+}
+
+static void
+vr_flow_age_drain(struct vr_flow_aging *vfag)
+{
+    uint32_t index, next;
+    struct vr_flow_entry *fe;
+    struct vr_flow_age_entry *vfae;
+
+    do {
+        index = vfag->vfag_incoming;
+    } while (!vr_sync_bool_compare_and_swap_32u(&vfag->vfag_incoming,
+                index, VR_INVALID_HENTRY_INDEX));
+
+    for (; index != VR_INVALID_HENTRY_INDEX; index = next) {
+        vfae = vr_flow_age_get_entry(vfag, index);
+        next = vfae->vfae_next;
+
+        vfae->vfae_state = VR_FLOW_AGE_ARMED;
+        fe = (struct vr_flow_entry *)
+            __vr_htable_get_hentry_by_index(vfag->vfag_router->vr_flow_table,
+                    index);
+        if (fe)
+            vr_flow_age_snapshot(vfag, vfae, fe);
+        vr_flow_age_insert(vfag, index, vfae,
+                vfag->vfag_now + vfag->vfag_timeout);
+    }
+
+    return;
+}
+
+/* moves the flows of the next level one slot down to level zero */
+static void
+vr_flow_age_cascade(struct vr_flow_aging *vfag)
+{
+    uint32_t index, next, *slot;
+    struct vr_flow_age_entry *vfae;
+
+    slot = &vfag->vfag_wheel[1][(vfag->vfag_now >> VR_FLOW_AGING_WHEEL_BITS) &
+        VR_FLOW_AGING_WHEEL_MASK];
+    index = *slot;
+    *slot = VR_INVALID_HENTRY_INDEX;
+
+    for (; index != VR_INVALID_HENTRY_INDEX; index = next) {
+        vfae = vr_flow_age_get_entry(vfag, index);
+        next = vfae->vfae_next;
+        vr_flow_age_insert(vfag, index, vfae, vfae->vfae_expires);
+    }
+
+    return;
+}
+
+static uint32_t
+vr_flow_age_clock(struct vr_flow_aging *vfag)
+{
+    uint64_t secs, nsecs, msecs;
+
+    vr_get_mono_time(&secs, &nsecs);
+    msecs = (secs * 1000) + (nsecs / 1000000);
+
+    return (uint32_t)((msecs - vfag->vfag_start_msecs) /
+            VR_FLOW_AGING_TICK_MSECS);
+}
+
+static void
+vr_flow_age_tick(void *arg)
+{
+    unsigned int ticks = 0, budget;
+    uint32_t index, clock, *slot;
+    struct vr_flow_aging *vfag = (struct vr_flow_aging *)arg;
+    struct vr_flow_age_entry *vfae;
+
+    if (!vfag || !vfag->vfag_router->vr_flow_table)
+        return;
+
+    vr_flow_age_drain(vfag);
+
+    budget = vfag->vfag_budget;
+    clock = vr_flow_age_clock(vfag);
+    do {
+        slot = &vfag->vfag_wheel[0][vfag->vfag_now & VR_FLOW_AGING_WHEEL_MASK];
+        while ((*slot != VR_INVALID_HENTRY_INDEX) && budget) {
+            index = *slot;
+            vfae = vr_flow_age_get_entry(vfag, index);
+            *slot = vfae->vfae_next;
+            vr_flow_age_expire(vfag, index, vfae);
+            budget--;
+        }
+
+        /* what is left of the slot is looked at in the next tick */
+        while (*slot != VR_INVALID_HENTRY_INDEX) {
+            index = *slot;
+            vfae = vr_flow_age_get_entry(vfag, index);
+            *slot = vfae->vfae_next;
+            vr_flow_age_insert(vfag, index, vfae, vfag->vfag_now + 1);
+        }
+
+        vfag->vfag_now++;
+        if (!(vfag->vfag_now & VR_FLOW_AGING_WHEEL_MASK))
+            vr_flow_age_cascade(vfag);
+    } while (((int32_t)(clock - vfag->vfag_now) > 0) &&
+            (++ticks < VR_FLOW_AGING_CATCHUP_TICKS));
 
     return;
 }
 
-static int
-vr_enqueue_flow(struct vrouter *router, struct vr_flow_entry *fe,
-        struct vr_packet *pkt, unsigned int index,
-        struct vr_flow_stats *stats, struct vr_forwarding_md *fmd)
+/*
+ * Warm restart. The flows a previous instance left in the table are kept
+ * if they were established, i.e not held, half inserted, evicted or
+ * deleted, with the pointers they carried cleared. The others are wiped,
+ * keeping only their gen id, so that stale references to the index miss.
+ */
+static void
+vr_flow_restore_entry(struct vr_flow_entry *fe)
 {
-    int ret = 0;
-    unsigned int i;
-    unsigned short drop_reason = 0;
-    struct vr_flow_queue *vfq = fe->fe_hold_list;
-    struct vr_packet_node *pnode;
+    uint8_t gen_id;
 
-    if (!vfq) {
-        drop_reason = VP_DROP_FLOW_UNUSABLE;
-        PKT_LOG(drop_reason, pkt, 0, VR_FLOW_C, __LINE__);
-        goto drop;
-    }
+    fe->fe_hold_list = NULL;
+    fe->fe_mme = NULL;
 
-    i = vr_sync_fetch_and_add_32u(&vfq->vfq_entries, 1);
-    if (i >= VR_MAX_FLOW_QUEUE_ENTRIES) {
-        drop_reason = VP_DROP_FLOW_QUEUE_LIMIT_EXCEEDED;
-        PKT_LOG(drop_reason, pkt, 0, VR_FLOW_C, __LINE__);
-        goto drop;
+    if ((fe->fe_flags & VR_FLOW_FLAG_ACTIVE) &&
+            !(fe->fe_flags & (VR_FLOW_FLAG_EVICT_CANDIDATE |
+                    VR_FLOW_FLAG_EVICTED | VR_FLOW_FLAG_DELETE_MARKED)) &&
+            (fe->fe_insert_state == VR_FLOW_INSERT_NONE) &&
+            (fe->fe_action != VR_FLOW_ACTION_HOLD) &&
+            ((fe->fe_type == VP_TYPE_IP) || (fe->fe_type == VP_TYPE_IP6))) {
+        /* whatever work was deferred on the flow went with the instance */
+        fe->fe_flags &= ~VR_FLOW_FLAG_MODIFIED;
+        return;
     }
 
-    pnode = &vfq->vfq_pnodes[i];
-    vr_flow_fill_pnode(pnode, pkt, fmd);
-    if (!i)
-        ret = vr_trap_flow(router, fe, pkt, index, stats, pnode);
+    gen_id = fe->fe_gen_id;
+    memset(fe, 0, sizeof(*fe));
+    fe->fe_gen_id = gen_id;
 
-    return ret;
-drop:
-    vr_pfree(pkt, drop_reason);
-    return 0;
+    return;
 }
 
-static flow_result_t
-vr_flow_nat(struct vr_flow_entry *fe,
-        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+/* goes over the raw memory, before the table is attached to it */
+static void
+vr_flow_restore_prepare(void)
 {
-    if (pkt->vp_type == VP_TYPE_IP)
-        return vr_inet_flow_nat(fe, pkt, fmd);
+    unsigned int i;
 
-    if (pkt->vp_type == VP_TYPE_IP6)
-        return vr_inet6_flow_nat(fe, pkt, fmd);
+    for (i = 0; i < vr_flow_entries; i++)
+        vr_flow_restore_entry((struct vr_flow_entry *)vr_flow_table + i);
 
-    PKT_LOG(VP_DROP_FLOW_ACTION_INVALID, pkt, 0, VR_FLOW_C, __LINE__);
-    vr_pfree(pkt, VP_DROP_FLOW_ACTION_INVALID);
-    return FLOW_CONSUMED;
+    for (i = 0; i < vr_oflow_entries; i++)
+        vr_flow_restore_entry((struct vr_flow_entry *)vr_oflow_table + i);
+
+    return;
 }
 
-static void
-vr_flow_set_forwarding_md(struct vrouter *router, struct vr_flow_entry *fe,
-        unsigned int index, struct vr_forwarding_md *md)
+static bool
+vr_flow_restore_pending(struct vrouter *router, unsigned int index)
 {
-    struct vr_flow_entry *rfe;
+    struct vr_flow_restore *vfr = router->vr_flow_restore;
 
-    md->fmd_flow_index = index;
-    md->fmd_ecmp_nh_index = fe->fe_ecmp_nh_index;
-    md->fmd_underlay_ecmp_index = fe->fe_underlay_ecmp_index;
-    md->fmd_udp_src_port = fe->fe_udp_src_port;
-    if (fe->fe_flags & VR_RFLOW_VALID) {
-        rfe = vr_flow_get_entry(router, fe->fe_rflow);
-        if (rfe)
-            md->fmd_ecmp_src_nh_index = rfe->fe_ecmp_nh_index;
-    }
+    if (!vfr || vfr->vfr_done || (index >= vfr->vfr_entries))
+        return false;
 
-    return;
+    return !!(vfr->vfr_pending[index / 32] & (1U << (index % 32)));
 }
 
-static bool
-__vr_flow_mark_evict(struct vrouter *router, struct vr_flow_entry *fe)
+/*
+ * the agent programmed a restored flow again, with the gen id it knows
+ * the flow by
+ */
+static void
+vr_flow_restore_confirm(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, uint8_t gen_id)
 {
-    unsigned short flags;
+    struct vr_flow_restore *vfr = router->vr_flow_restore;
 
-    flags = fe->fe_flags;
-    if (flags & VR_FLOW_FLAG_ACTIVE) {
-        flags = vr_sync_fetch_and_or_16u(&fe->fe_flags,
-                VR_FLOW_FLAG_EVICT_CANDIDATE);
-        if (!(flags & VR_FLOW_FLAG_EVICT_CANDIDATE)) {
-            return true;
-        }
-    }
+    if (!vr_flow_restore_pending(router, index))
+        return;
 
-    return false;
+    fe->fe_gen_id = gen_id;
+    (void)vr_sync_and_and_fetch_32u(&vfr->vfr_pending[index / 32],
+            ~(1U << (index % 32)));
+
+    return;
 }
 
+/*
+ * End of the restart window. Evicts the restored flows that the agent did
+ * not program again: their gen id was never confirmed, and the agent does
+ * not know them by any other. Runs once, the timer is stopped after.
+ */
 static void
-vr_flow_mark_evict(struct vrouter *router, struct vr_flow_entry *fe,
-        unsigned int index)
+vr_flow_restore_revalidate(void *arg)
 {
-    bool evict_forward_flow = true;
-
-    struct vr_flow_entry *rfe = NULL;
+    unsigned int i;
+    uint32_t pending = 0;
+    struct vr_flow_restore *vfr = (struct vr_flow_restore *)arg;
+    struct vrouter *router;
+    struct vr_flow_entry *fe, *rfe;
 
-    /* start modifying the entry */
-    if (!vr_flow_start_modify(router, fe)) {
+    if (!vfr || vfr->vfr_done)
         return;
-    }
 
-    if (fe->fe_rflow >= 0) {
-        rfe = vr_flow_get_entry(router, fe->fe_rflow);
-        if (rfe) {
-            evict_forward_flow = false;
-            if (rfe->fe_tcp_flags & VR_FLOW_TCP_DEAD) {
-                if (!vr_flow_start_modify(router, rfe)) {
-                    /* no modification. hence...*/
-                    rfe = NULL;
-                } else {
-                    /* we do not want hold flows to be evicted, just yet */
-                    if (((rfe->fe_rflow == index) || (rfe->fe_rflow < 0)) &&
-                            (rfe->fe_action != VR_FLOW_ACTION_HOLD)) {
-                        evict_forward_flow = __vr_flow_mark_evict(router, rfe);
-                    }
-                }
-            } else {
-                /* no modification. hence...*/
-                rfe = NULL;
+    router = vfr->vfr_router;
+    for (i = 0; i < vfr->vfr_entries; i++) {
+        if (!(i % 32)) {
+            pending = vfr->vfr_pending[i / 32];
+            if (!pending) {
+                i += 31;
+                continue;
             }
         }
-    }
 
-    /*
-     * presence of rfe means that we might need to reset the evict bit
-     * or at the minimum reset the modified bit under failure conditions
-     *
-     * CEM-18166: In case rfe has already been deleted, under special
-     * circumstances, fe might still have fe_rflow pointing to it.
-     * In this case (and other cases where rfe is not active anymore),
-     * evict_forward_flow will remain true, which makes sense because we still
-     * want to evict this flow, because of TCP FIN or RST.
-     */
-    if (evict_forward_flow) {
-        if (__vr_flow_mark_evict(router, fe)) {
-            if (!__vr_flow_schedule_transition(router, fe,
-                        index, fe->fe_flags)) {
-                return;
-            } else {
-                goto reset_evict;
-            }
+        if (!(pending & (1U << (i % 32))))
+            continue;
+
+        fe = vr_flow_get_entry(router, i);
+        if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+                (fe->fe_flags & VR_FLOW_FLAG_EVICTED))
+            continue;
+
+        rfe = NULL;
+        if ((fe->fe_flags & VR_RFLOW_VALID) && (fe->fe_rflow >= 0)) {
+            rfe = vr_flow_get_entry(router, fe->fe_rflow);
+            if (rfe && !(rfe->fe_flags & VR_FLOW_FLAG_ACTIVE))
+                rfe = NULL;
         }
-    }
 
-    /* stop modifying the forward and the reverse */
-    if (rfe)
-        vr_flow_stop_modify(router, rfe);
-    vr_flow_stop_modify(router, fe);
+        if (vr_flow_age_evict(router, fe, i, rfe))
+            vfr->vfr_evicted++;
+    }
 
-    return;
+    vfr->vfr_done = true;
+    if (vfr->vfr_timer)
+        vfr->vfr_timer->vt_stop_timer = 1;
+    vr_bridge_table_revalidate(router);
 
-reset_evict:
-    if (rfe)
-        vr_flow_reset_evict(router, rfe);
-    vr_flow_reset_evict(router, fe);
+    vr_printf("vrouter: warm restart window over, %u of %u restored "
+            "flows evicted\n", vfr->vfr_evicted, vfr->vfr_restored);
 
     return;
 }
@@ -889,6 +2036,39 @@ vr_flow_update_ecmp_index(struct vrouter *router, struct vr_flow_entry *fe,
     return 0;
 }
 
+/*
+ * Microseconds the flow at index has been idle for, before the packet at
+ * hand, which becomes its last seen one. 0 for a flow not seen before, and
+ * when the last seen times are not kept. The times wrap in a bit over an
+ * hour, by when the flow is taken as having been idle for less.
+ */
+uint32_t
+vr_flow_idle_usecs(struct vrouter *router, int index)
+{
+    uint32_t now, last, *last_seen;
+    uint64_t secs, nsecs;
+
+    if (!router->vr_flow_last_seen || (index < 0))
+        return 0;
+
+    last_seen = (uint32_t *)vr_btable_get(router->vr_flow_last_seen, index);
+    if (!last_seen)
+        return 0;
+
+    vr_get_mono_time(&secs, &nsecs);
+    now = (uint32_t)((secs * 1000000) + (nsecs / 1000));
+    /* 0 is that of the flows not seen */
+    if (!now)
+        now = 1;
+
+    last = *last_seen;
+    *last_seen = now;
+    if (!last)
+        return 0;
+
+    return now - last;
+}
+
 static flow_result_t
 vr_flow_action_default(struct vrouter *router, struct vr_flow_entry *fe,
         unsigned int index, struct vr_packet *pkt,
@@ -1122,6 +2302,75 @@ drop_pkt:
     return FLOW_HELD;
 }
 
+/*
+ * nh_validate_src of the source nexthop of the flow, through the rpf cache
+ * for ECMP sources. Sources of other kinds are a compare in a line that
+ * the nexthop lookup has already brought in, and are not worth the extra
+ * line of the cache. PBB sources check the source mac of the packet,
+ * which the cache does not key on, and are not cached either.
+ */
+static int
+vr_flow_validate_src(struct vrouter *router, unsigned int index,
+        struct vr_nexthop *src_nh, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd, int *modified_index)
+{
+    int valid_src;
+    uint8_t flags_in;
+    uint32_t gen = 0;
+    struct vr_flow_rpf_entry *vfre = NULL;
+    struct vr_flow_rpf_stats *vfrs;
+
+    vfrs = vr_flow_get_rpf_stats(router, pkt->vp_cpu);
+    flags_in = fmd->fmd_flags & FMD_FLAG_ETREE_ROOT;
+
+    if (router->vr_flow_rpf && (src_nh->nh_type == NH_COMPOSITE) &&
+            (src_nh->nh_flags & NH_FLAG_COMPOSITE_ECMP) &&
+            IS_MAC_ZERO(fmd->fmd_smac))
+        vfre = (struct vr_flow_rpf_entry *)vr_btable_get(router->vr_flow_rpf,
+                index);
+
+    if (vfre) {
+        gen = vr_flow_rpf_gen;
+        if ((vfre->vfre_gen == gen) &&
+                (vfre->vfre_nh_id == src_nh->nh_id) &&
+                (vfre->vfre_vif == pkt->vp_if) &&
+                (vfre->vfre_src_ip == fmd->fmd_outer_src_ip) &&
+                (vfre->vfre_ecmp_index == fmd->fmd_ecmp_src_nh_index) &&
+                (vfre->vfre_flags_in == flags_in)) {
+            vr_compiler_barrier();
+            if (vfre->vfre_gen == gen) {
+                vr_fmd_update_etree_root(fmd, !!vfre->vfre_flags_out);
+                if (vfrs)
+                    vfrs->vfrs_cached++;
+                return NH_SOURCE_VALID;
+            }
+        }
+
+        /* a nexthop that changes from here on leaves the result stale */
+        vr_sync_synchronize();
+    }
+
+    if (vfrs)
+        vfrs->vfrs_validated++;
+
+    valid_src = src_nh->nh_validate_src(pkt, src_nh, fmd, modified_index);
+    if (!vfre || (valid_src != NH_SOURCE_VALID))
+        return valid_src;
+
+    vfre->vfre_gen = 0;
+    vr_compiler_barrier();
+    vfre->vfre_nh_id = src_nh->nh_id;
+    vfre->vfre_vif = pkt->vp_if;
+    vfre->vfre_src_ip = fmd->fmd_outer_src_ip;
+    vfre->vfre_ecmp_index = fmd->fmd_ecmp_src_nh_index;
+    vfre->vfre_flags_in = flags_in;
+    vfre->vfre_flags_out = fmd->fmd_flags & FMD_FLAG_ETREE_ROOT;
+    vr_compiler_barrier();
+    vfre->vfre_gen = gen;
+
+    return valid_src;
+}
+
 static flow_result_t
 vr_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
         unsigned int index, struct vr_packet *pkt,
@@ -1139,7 +2388,8 @@ vr_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
     }
 
     if (src_nh->nh_validate_src) {
-        valid_src = src_nh->nh_validate_src(pkt, src_nh, fmd, &modified_index);
+        valid_src = vr_flow_validate_src(router, index, src_nh, pkt, fmd,
+                &modified_index);
         if (valid_src == NH_SOURCE_INVALID) {
             PKT_LOG(VP_DROP_INVALID_SOURCE, pkt, 0, VR_FLOW_C, __LINE__);
             vr_pfree(pkt, VP_DROP_INVALID_SOURCE);
@@ -1223,6 +2473,47 @@ vr_trap_flow(struct vrouter *router, struct vr_flow_entry *fe,
     return vr_trap(npkt, fe->fe_vrf, trap_reason, &ta);
 }
 
+/*
+ * Appends to the ring of the cpu we run on. On Linux, the datapath also
+ * runs in process context, so keep the softirq one from entering the same
+ * ring half way through a record.
+ */
+static void
+vr_flow_log_append_local(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, uint8_t reason)
+{
+    unsigned int cpu;
+
+    cpu = vr_get_cpu_local();
+    vr_flow_log_append(router, cpu, fe, index, reason);
+    vr_put_cpu_local();
+
+    return;
+}
+
+/*
+ * Logs the first packet of a flow and every vr_flow_log_threshold packets
+ * after that, so that the readers of the log see the flow move
+ */
+static inline void
+vr_flow_log_packet(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, uint32_t packets)
+{
+    struct vr_flow_log *vfl = router->vr_flow_log;
+
+    if (!vfl)
+        return;
+
+    if (packets == 1) {
+        vr_flow_log_append_local(router, fe, index, VR_FLOW_LOG_REASON_NEW);
+    } else if (!(packets & vfl->vfl_threshold_mask)) {
+        vr_flow_log_append_local(router, fe, index,
+                VR_FLOW_LOG_REASON_THRESHOLD);
+    }
+
+    return;
+}
+
 static flow_result_t
 vr_do_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
         unsigned int index, struct vr_packet *pkt,
@@ -1245,6 +2536,8 @@ vr_do_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
     if (!new_stats)
         fe->fe_stats.flow_packets_oflow++;
 
+    vr_flow_log_packet(router, fe, index, new_stats);
+
     if (fe->fe_action == VR_FLOW_ACTION_HOLD) {
         vr_enqueue_flow(router, fe, pkt, index, stats_p, fmd);
         return FLOW_HELD;
@@ -1271,72 +2564,89 @@ vr_flow_table_hold_count(struct vrouter *router)
     return 0;
 }
 
-static void
-vr_flow_burst_timeout(void *arg)
+/*
+ * Per cpu share of a burst parameter, rounded up so that every cpu gets
+ * at least one token when the parameter is set
+ */
+static inline uint64_t
+vr_flow_burst_share(unsigned int value)
+{
+    return (value + vr_num_cpus - 1) / vr_num_cpus;
+}
+
+static inline uint64_t
+vr_flow_admission_msecs(void)
+{
+    uint64_t secs, nsecs;
+
+    vr_get_mono_time(&secs, &nsecs);
+
+    return (secs * 1000) + (nsecs / 1000000);
+}
+
+static struct vr_flow_admission *
+vr_flow_get_admission(struct vrouter *router, unsigned int cpu)
 {
-    int tokens;
-    struct vrouter *router = (struct vrouter *)arg;
     struct vr_flow_table_info *infop = router->vr_flow_table_info;
 
-    tokens = infop->vfti_burst_tokens - infop->vfti_burst_used;
-    if (tokens > 0) {
+    if (!infop->vfti_admission || (cpu >= vr_num_cpus))
+        return NULL;
 
-        tokens  = infop->vfti_burst_tokens_configured - tokens;
-        if (tokens <= 0) {
-            infop->vfti_timer->vt_stop_timer = 1;
-            return;
-        }
+    return &infop->vfti_admission[cpu];
+}
 
-        if (tokens > infop->vfti_burst_step_configured)
-            tokens = infop->vfti_burst_step_configured;
-    } else {
-        tokens = infop->vfti_burst_step_configured;
-    }
+static struct vr_flow_rpf_stats *
+vr_flow_get_rpf_stats(struct vrouter *router, unsigned int cpu)
+{
+    struct vr_flow_table_info *infop = router->vr_flow_table_info;
 
-    infop->vfti_burst_tokens += tokens;
+    if (!infop || !infop->vfti_rpf_stats || (cpu >= vr_num_cpus))
+        return NULL;
 
-    return;
+    return &infop->vfti_rpf_stats[cpu];
 }
 
+static unsigned int
+vr_flow_admission_hold_count(struct vrouter *router,
+        struct vr_flow_admission *vfa)
+{
+    if (!vfa)
+        return vr_flow_table_hold_count(router);
+
+    if (!(vfa->vfa_checks++ % VR_FLOW_HOLD_COUNT_REFRESH))
+        vfa->vfa_hold_count = vr_flow_table_hold_count(router);
+
+    return vfa->vfa_hold_count;
+}
+
+/*
+ * Adds the tokens earned since the last refill, one step share per
+ * elapsed burst interval, up to the cpu's share of the burst tokens
+ */
 static void
-vr_flow_start_burst_processing(struct vrouter *router)
+vr_flow_admission_refill(struct vrouter *router,
+        struct vr_flow_admission *vfa, uint64_t now)
 {
-    struct vr_timer *vtimer;
+    uint64_t intervals, tokens, max_tokens;
     struct vr_flow_table_info *infop = router->vr_flow_table_info;
 
-    if (!infop->vfti_burst_tokens_configured ||
-            !infop->vfti_burst_interval_configured ||
-            !infop->vfti_burst_step_configured) {
+    if (!infop->vfti_burst_interval_configured)
         return;
-    }
-
-    if (!infop->vfti_timer) {
-        vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
-        if (!vtimer) {
-            vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, sizeof(*vtimer));
-            return;
-        }
 
-        vtimer->vt_timer = vr_flow_burst_timeout;
-        vtimer->vt_vr_arg = router;
-        vtimer->vt_msecs = infop->vfti_burst_interval_configured;
+    if ((now - vfa->vfa_refill_msecs) < infop->vfti_burst_interval_configured)
+        return;
 
-        if (vr_create_timer(vtimer)) {
-            vr_free(vtimer, VR_TIMER_OBJECT);
-            return;
-        }
+    intervals = (now - vfa->vfa_refill_msecs) /
+        infop->vfti_burst_interval_configured;
+    vfa->vfa_refill_msecs = now;
 
-        infop->vfti_timer = vtimer;
-    } else {
-        if (!infop->vfti_timer->vt_stop_timer)
-            return;
+    max_tokens = vr_flow_burst_share(infop->vfti_burst_tokens_configured);
+    tokens = vfa->vfa_tokens +
+        (intervals * vr_flow_burst_share(infop->vfti_burst_step_configured));
+    if (tokens > max_tokens)
+        tokens = max_tokens;
 
-        if (vr_sync_bool_compare_and_swap_32u(
-                 &infop->vfti_timer->vt_stop_timer, 1, 0)) {
-            infop->vfti_timer->vt_msecs = infop->vfti_burst_interval_configured;
-            vr_restart_timer(infop->vfti_timer);
-        }
-    }
+    vfa->vfa_tokens = tokens;
 
     return;
 }
@@ -1347,6 +2657,7 @@ vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry
 {
     unsigned int cpu;
     uint64_t act_count;
+    struct vr_flow_admission *vfa;
     struct vr_flow_table_info *infop = router->vr_flow_table_info;
 
     cpu = vr_get_cpu();
@@ -1374,9 +2685,11 @@ vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry
 
     infop->vfti_hold_count[cpu]++;
 
-    if (burst == true) {
-        (void)vr_sync_add_and_fetch_64u(&infop->vfti_burst_used, 1);
-        vr_flow_start_burst_processing(router);
+    vfa = vr_flow_get_admission(router, cpu);
+    if (vfa) {
+        vfa->vfa_admitted++;
+        if (burst == true)
+            vfa->vfa_burst_admitted++;
     }
 
     return;
@@ -1655,9 +2968,42 @@ vr_flow_tcp_digest(struct vrouter *router, struct vr_flow_entry *flow_e,
     return;
 }
 
+/*
+ * While new flows are admitted against burst tokens, a vif with a flow
+ * quota can take at most that many of them per burst interval on a cpu,
+ * so that a single flooding vif can not drain the tokens of the others
+ */
+static inline bool
+vr_flow_vif_quota_allow(struct vrouter *router, struct vr_interface *vif,
+        unsigned int cpu, uint64_t now)
+{
+    struct vr_interface_stats *stats;
+    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+
+    if (!vif->vif_flow_quota || !vif->vif_stats)
+        return true;
+
+    stats = vif_get_stats(vif, cpu);
+    if ((now - stats->vis_flow_quota_msecs) >=
+            infop->vfti_burst_interval_configured) {
+        stats->vis_flow_quota_msecs = now;
+        stats->vis_flow_quota_used = 0;
+    }
+
+    if (stats->vis_flow_quota_used >= vif->vif_flow_quota) {
+        stats->vis_flow_quota_drops++;
+        return false;
+    }
+
+    stats->vis_flow_quota_used++;
+
+    return true;
+}
+
 static inline bool
 vr_flow_vif_allow_new_flow(struct vrouter *router, struct vr_packet *pkt,
-                           unsigned short *drop_reason)
+                           unsigned short *drop_reason, bool burst,
+                           uint64_t now)
 {
     struct vr_interface *vif_l = NULL;
     struct vr_nexthop *nh = NULL;
@@ -1671,7 +3017,14 @@ vr_flow_vif_allow_new_flow(struct vrouter *router, struct vr_packet *pkt,
         }
     }
 
-    if (vif_l && vif_drop_new_flows(vif_l)) {
+    if (vif_l && vif_drop_new_flows(vif_l)) {
+        PKT_LOG(VP_DROP_NEW_FLOWS, pkt, 0, VR_FLOW_C, __LINE__);
+        *drop_reason = VP_DROP_NEW_FLOWS;
+        return false;
+    }
+
+    if (burst && vif_l &&
+            !vr_flow_vif_quota_allow(router, vif_l, vr_get_cpu(), now)) {
         PKT_LOG(VP_DROP_NEW_FLOWS, pkt, 0, VR_FLOW_C, __LINE__);
         *drop_reason = VP_DROP_NEW_FLOWS;
         return false;
@@ -1705,6 +3058,7 @@ void
 vr_flow_set_burst_params(struct vrouter *router, int burst_tokens,
                                 int burst_interval, int burst_step)
 {
+    unsigned int i;
     struct vr_flow_table_info *infop;
 
     if (!router || !router->vr_flow_table_info)
@@ -1721,25 +3075,24 @@ vr_flow_set_burst_params(struct vrouter *router, int burst_tokens,
     if (burst_step != -1)
         infop->vfti_burst_step_configured = burst_step;
 
+    /* let every cpu start over with a full share of the new tokens */
+    if (infop->vfti_admission) {
+        for (i = 0; i < vr_num_cpus; i++) {
+            infop->vfti_admission[i].vfa_tokens = 0;
+            infop->vfti_admission[i].vfa_refill_msecs = 0;
+        }
+    }
 
-    vr_flow_start_burst_processing(router);
     return;
 }
 
-static inline unsigned int
-vr_flow_burst_count(struct vrouter *router)
-{
-    struct vr_flow_table_info *infop = router->vr_flow_table_info;
-
-    return infop->vfti_burst_tokens;
-}
-
 static inline bool
 vr_flow_allow_new_flow(struct vrouter *router, struct vr_packet *pkt,
                        unsigned short *drop_reason, bool *burst)
 {
-    unsigned int hold_count;
-    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+    bool over_limit = false;
+    uint64_t now = 0;
+    struct vr_flow_admission *vfa = NULL;
 
     *drop_reason = VP_DROP_FLOW_UNUSABLE;
     if (burst)
@@ -1754,58 +3107,89 @@ vr_flow_allow_new_flow(struct vrouter *router, struct vr_packet *pkt,
     }
 
     if (vr_flow_hold_limit) {
-        hold_count = vr_flow_table_hold_count(router);
-        if (hold_count > vr_flow_hold_limit) {
-            if (infop->vfti_burst_used >= vr_flow_burst_count(router)) {
+        vfa = vr_flow_get_admission(router, vr_get_cpu());
+        if (vr_flow_admission_hold_count(router, vfa) > vr_flow_hold_limit) {
+            over_limit = true;
+            if (vfa) {
+                now = vr_flow_admission_msecs();
+                vr_flow_admission_refill(router, vfa, now);
+            }
+
+            if (!vfa || !vfa->vfa_tokens) {
+                if (vfa)
+                    vfa->vfa_dropped++;
                 PKT_LOG(VP_DROP_FLOW_UNUSABLE, pkt, 0, VR_FLOW_C, __LINE__);
                 *drop_reason = VP_DROP_FLOW_UNUSABLE;
                 return false;
             }
-            if (burst) {
-                *burst = true;
-            }
         }
     }
 
-    return vr_flow_vif_allow_new_flow(router, pkt, drop_reason);
+    if (!vr_flow_vif_allow_new_flow(router, pkt, drop_reason,
+                over_limit, now))
+        return false;
+
+    if (over_limit) {
+        vfa->vfa_tokens--;
+        if (burst)
+            *burst = true;
+    }
+
+    return true;
 }
 
 static inline struct vr_flow_entry *
 vr_flow_new_hold_flow(struct vrouter *router, struct vr_flow *key,
                  struct vr_packet *pkt, unsigned int *fe_index,
                  struct vr_forwarding_md *fmd) {
-    struct vr_flow_entry *bucket_fe, *flow_e;
+    int ret;
+    unsigned int retries = VR_FLOW_INSERT_RETRIES;
+    struct vr_flow_entry *flow_e, *winner;
     unsigned short drop_reason = 0;
-    bool burst = false;
-    /* Slow path: lock, to make find+create atomic thus avoid races
-     * with another vr_flow_lookup or vr_add_flow). We also need need
-     * to retry the find, as previous one was done without locking */
-    bucket_fe = vr_flow_bucket_first_entry(router, key);
-    vr_flow_bucket_may_lock(bucket_fe);
-    flow_e = vr_find_flow(router, key, pkt->vp_type, fe_index);
-    if (!flow_e) {
-        if (!vr_flow_allow_new_flow(router, pkt, &drop_reason, &burst)) {
-            vr_flow_bucket_may_unlock(bucket_fe);
-            PKT_LOG(drop_reason, pkt, key , VR_FLOW_C, __LINE__);
-            vr_pfree(pkt, drop_reason);
+    bool burst = false, admitted = false;
+
+    do {
+        /* the entry might have been published since the lockless lookup */
+        flow_e = vr_find_flow(router, key, pkt->vp_type, fe_index);
+        if (flow_e)
             return flow_e;
+
+        if (!admitted) {
+            if (!vr_flow_allow_new_flow(router, pkt, &drop_reason, &burst)) {
+                PKT_LOG(drop_reason, pkt, key , VR_FLOW_C, __LINE__);
+                vr_pfree(pkt, drop_reason);
+                return NULL;
+            }
+            admitted = true;
         }
 
         flow_e = vr_flow_get_free_entry(router, key, pkt->vp_type,
-                true, fe_index);
+                true, true, fe_index, &drop_reason);
         if (!flow_e) {
-            vr_flow_bucket_may_unlock(bucket_fe);
-            PKT_LOG(VP_DROP_FLOW_TABLE_FULL, pkt, key, VR_FLOW_C, __LINE__);
-            vr_pfree(pkt, VP_DROP_FLOW_TABLE_FULL);
+            PKT_LOG(drop_reason, pkt, key, VR_FLOW_C, __LINE__);
+            vr_pfree(pkt, drop_reason);
             return flow_e;
         }
 
         flow_e->fe_vrf = fmd->fmd_dvrf;
-        /* mark as hold */
-        vr_flow_entry_set_hold(router, flow_e, burst);
-    }
-    vr_flow_bucket_may_unlock(bucket_fe);
-    return flow_e;
+        flow_e->fe_action = VR_FLOW_ACTION_HOLD;
+
+        ret = vr_flow_insert_publish(router, flow_e, &winner);
+        if (!ret) {
+            /* mark as hold */
+            vr_flow_entry_set_hold(router, flow_e, burst);
+            return flow_e;
+        }
+
+        if (ret == -EEXIST) {
+            *fe_index = winner->fe_hentry.hentry_index;
+            return winner;
+        }
+    } while (--retries);
+
+    PKT_LOG(VP_DROP_FLOW_UNUSABLE, pkt, key, VR_FLOW_C, __LINE__);
+    vr_pfree(pkt, VP_DROP_FLOW_UNUSABLE);
+    return NULL;
 }
 
 flow_result_t
@@ -1813,12 +3197,15 @@ vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
                struct vr_packet *pkt, struct vr_forwarding_md *fmd)
 {
     unsigned int fe_index;
+    uint16_t tcp_flags;
     struct vr_flow_entry *flow_e;
     pkt->vp_flags |= VP_FLAG_FLOW_SET;
 
     if (!fmd->fmd_fe) {
         /* Happy path: without locking */
-        flow_e = vr_find_flow(router, key, pkt->vp_type,  &fe_index);
+        flow_e = vr_flow_burst_take(router, key, pkt, &fe_index);
+        if (!flow_e)
+            flow_e = vr_find_flow(router, key, pkt->vp_type,  &fe_index);
         if (!flow_e) {
             if (pkt->vp_nh &&
                 (pkt->vp_nh->nh_flags &
@@ -1847,7 +3234,11 @@ vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
         flow_e->fe_src_info = pkt->vp_if->vif_idx;
 
     vr_flow_set_forwarding_md(router, flow_e, fe_index, fmd);
+    tcp_flags = flow_e->fe_tcp_flags;
     vr_flow_tcp_digest(router, flow_e, pkt, fmd);
+    if (router->vr_flow_log && (flow_e->fe_tcp_flags != tcp_flags))
+        vr_flow_log_append_local(router, flow_e, fe_index,
+                VR_FLOW_LOG_REASON_TCP);
 
     return vr_do_flow_action(router, flow_e, fe_index, pkt, fmd);
 }
@@ -2198,14 +3589,40 @@ static void
 __vr_flow_flush_hold_queue(struct vrouter *router, struct vr_flow_entry *fe,
         struct vr_forwarding_md *fmd, struct vr_flow_queue *vfq)
 {
-    unsigned int i;
-    struct vr_packet_node *pnode;
+    unsigned int i, entries, count = 0;
+    struct vr_flow_hold_node *node, *head = NULL, *tail = NULL;
+
+    entries = vfq->vfq_entries;
+    if (entries > vfq->vfq_limit)
+        entries = vfq->vfq_limit;
+
+    /*
+     * the nodes of a flow mostly come from the one cpu that the flow is
+     * received on, hence they are given back to their pool in one go
+     */
+    for (i = 0; i < entries; i++) {
+        node = vr_sync_lock_test_and_set_p(&vfq->vfq_nodes[i], NULL);
+        if (!node)
+            continue;
 
-    for (i = 0; i < VR_MAX_FLOW_QUEUE_ENTRIES; i++) {
-        pnode = &vfq->vfq_pnodes[i];
-        vr_flow_flush_pnode(router, pnode, fe, fmd);
+        vr_flow_flush_pnode(router, &node->vfhn_pnode, fe, fmd);
+
+        if (head && (head->vfhn_cpu != node->vfhn_cpu)) {
+            vr_flow_hold_nodes_free(router, head, tail, count);
+            head = NULL;
+            count = 0;
+        }
+
+        node->vfhn_next = head;
+        if (!head)
+            tail = node;
+        head = node;
+        count++;
     }
 
+    if (head)
+        vr_flow_hold_nodes_free(router, head, tail, count);
+
     return;
 }
 
@@ -2238,8 +3655,7 @@ vr_flush_entry(struct vrouter *router, struct vr_flow_entry *fe,
     return;
 
 free_flush_queue:
-    if (vfq)
-        vr_free(vfq, VR_FLOW_QUEUE_OBJECT);
+    vr_flow_queue_free(router, vfq);
     return;
 }
 
@@ -2388,24 +3804,37 @@ vr_add_flow(unsigned int rid, struct vr_flow *key, uint8_t type,
         bool need_hold_queue, unsigned int *fe_index,
         uint8_t *fe_gen_id)
 {
-    struct vr_flow_entry *flow_e;
+    int ret;
+    unsigned int retries = VR_FLOW_INSERT_RETRIES;
+    struct vr_flow_entry *flow_e, *winner;
     struct vrouter *router = vrouter_get(rid);
 
-    struct vr_flow_entry *bucket_fe = vr_flow_bucket_first_entry(router, key);
-    vr_flow_bucket_may_lock(bucket_fe);
-    flow_e = vr_find_flow(router, key, type, fe_index);
-    if (flow_e) {
-        vr_flow_bucket_may_unlock(bucket_fe);
-        *fe_gen_id = flow_e->fe_gen_id;
-        /* a race between agent and dp. allow agent to handle this error */
-        return NULL;
-    } else {
+    do {
+        flow_e = vr_find_flow(router, key, type, fe_index);
+        if (flow_e) {
+            *fe_gen_id = flow_e->fe_gen_id;
+            /* a race between agent and dp. allow agent to handle this error */
+            return NULL;
+        }
+
         flow_e = vr_flow_get_free_entry(router, key, type,
-                need_hold_queue, fe_index);
-        vr_flow_bucket_may_unlock(bucket_fe);
-    }
+                need_hold_queue, false, fe_index, NULL);
+        if (!flow_e)
+            return NULL;
+
+        ret = vr_flow_insert_publish(router, flow_e, &winner);
+        if (!ret)
+            return flow_e;
 
-    return flow_e;
+        *fe_index = (unsigned int)-1;
+        if (ret == -EEXIST) {
+            *fe_index = winner->fe_hentry.hentry_index;
+            *fe_gen_id = winner->fe_gen_id;
+            return NULL;
+        }
+    } while (--retries);
+
+    return NULL;
 }
 
 static struct vr_flow_entry *
@@ -2466,7 +3895,9 @@ vr_flow_set_req_is_invalid(struct vrouter *router, vr_flow_req *req,
             return -EINVAL;
 
         if ((fe->fe_type == VP_TYPE_IP) || (fe->fe_type == VP_TYPE_IP6)) {
-            if ((uint8_t)req->fr_gen_id != fe->fe_gen_id) {
+            /* a restored flow takes the gen id of the agent that owns it */
+            if (((uint8_t)req->fr_gen_id != fe->fe_gen_id) &&
+                    !vr_flow_restore_pending(router, req->fr_index)) {
                 error = -EBADF;
                 goto invalid_req;
             }
@@ -2793,6 +4224,9 @@ vr_flow_set(struct vrouter *router, vr_flow_req *req,
     if ((ret = vr_flow_set_req_is_invalid(router, req, fe)))
         goto exit_set;
 
+    if (fe)
+        vr_flow_restore_confirm(router, fe, fe_index, (uint8_t)req->fr_gen_id);
+
     if (fe) {
         if ((fe->fe_action == VR_FLOW_ACTION_HOLD) &&
             ((req->fr_action != fe->fe_action) ||
@@ -2845,8 +4279,8 @@ vr_flow_set(struct vrouter *router, vr_flow_req *req,
         if ((req->fr_action == VR_FLOW_ACTION_HOLD) &&
                 (fe->fe_action != req->fr_action)) {
             if (!fe->fe_hold_list) {
-                fe->fe_hold_list = vr_zalloc(sizeof(struct vr_flow_queue),
-                        VR_FLOW_QUEUE_OBJECT);
+                fe->fe_hold_list = vr_flow_queue_alloc(router,
+                        fe->fe_hentry.hentry_index, false);
                 if (!fe->fe_hold_list) {
                     ret = -ENOMEM;
                     goto exit_set;
@@ -2963,12 +4397,36 @@ vr_flow_table_data_destroy(vr_flow_table_data *ftable)
         ftable->ftable_file_path = NULL;
     }
 
+    if (ftable->ftable_log_file_path) {
+        vr_free(ftable->ftable_log_file_path, VR_FLOW_REQ_PATH_OBJECT);
+        ftable->ftable_log_file_path = NULL;
+    }
+
     if (ftable->ftable_hold_stat && ftable->ftable_hold_stat_size) {
         vr_free(ftable->ftable_hold_stat, VR_FLOW_HOLD_STAT_OBJECT);
         ftable->ftable_hold_stat = NULL;
         ftable->ftable_hold_stat_size = 0;
     }
 
+    if (ftable->ftable_admitted && ftable->ftable_admitted_size) {
+        vr_free(ftable->ftable_admitted, VR_FLOW_HOLD_STAT_OBJECT);
+        ftable->ftable_admitted = NULL;
+        ftable->ftable_admitted_size = 0;
+    }
+
+    if (ftable->ftable_burst_admitted && ftable->ftable_burst_admitted_size) {
+        vr_free(ftable->ftable_burst_admitted, VR_FLOW_HOLD_STAT_OBJECT);
+        ftable->ftable_burst_admitted = NULL;
+        ftable->ftable_burst_admitted_size = 0;
+    }
+
+    if (ftable->ftable_admission_drops &&
+            ftable->ftable_admission_drops_size) {
+        vr_free(ftable->ftable_admission_drops, VR_FLOW_HOLD_STAT_OBJECT);
+        ftable->ftable_admission_drops = NULL;
+        ftable->ftable_admission_drops_size = 0;
+    }
+
     vr_free(ftable, VR_FLOW_TABLE_DATA_OBJECT);
 
     return;
@@ -2977,7 +4435,7 @@ vr_flow_table_data_destroy(vr_flow_table_data *ftable)
 static vr_flow_table_data *
 vr_flow_table_data_get(vr_flow_table_data *ref)
 {
-    unsigned int hold_stat_size;
+    unsigned int hold_stat_size, admission_stat_size;
     unsigned int num_cpus = vr_num_cpus;
     vr_flow_table_data *ftable = vr_zalloc(sizeof(*ref),
             VR_FLOW_TABLE_DATA_OBJECT);
@@ -2994,23 +4452,46 @@ vr_flow_table_data_get(vr_flow_table_data *ref)
         }
     }
 
+    if (vr_flow_log_path) {
+        ftable->ftable_log_file_path = vr_zalloc(VR_UNIX_PATH_MAX,
+                VR_FLOW_REQ_PATH_OBJECT);
+        if (!ftable->ftable_log_file_path)
+            goto fail;
+    }
+
     if (num_cpus > VR_FLOW_MAX_CPUS)
         num_cpus = VR_FLOW_MAX_CPUS;
 
     hold_stat_size = num_cpus * sizeof(uint32_t);
     ftable->ftable_hold_stat = vr_zalloc(hold_stat_size, VR_FLOW_HOLD_STAT_OBJECT);
-    if (!ftable->ftable_hold_stat) {
-        if (ftable->ftable_file_path) {
-            vr_free(ftable->ftable_file_path, VR_FLOW_REQ_PATH_OBJECT);
-            ftable->ftable_file_path = NULL;
-        }
-
-        vr_free(ftable, VR_FLOW_TABLE_DATA_OBJECT);
-        return NULL;
-    }
+    if (!ftable->ftable_hold_stat)
+        goto fail;
     ftable->ftable_hold_stat_size = num_cpus;
 
+    admission_stat_size = num_cpus * sizeof(uint64_t);
+    ftable->ftable_admitted = vr_zalloc(admission_stat_size,
+            VR_FLOW_HOLD_STAT_OBJECT);
+    if (!ftable->ftable_admitted)
+        goto fail;
+    ftable->ftable_admitted_size = num_cpus;
+
+    ftable->ftable_burst_admitted = vr_zalloc(admission_stat_size,
+            VR_FLOW_HOLD_STAT_OBJECT);
+    if (!ftable->ftable_burst_admitted)
+        goto fail;
+    ftable->ftable_burst_admitted_size = num_cpus;
+
+    ftable->ftable_admission_drops = vr_zalloc(admission_stat_size,
+            VR_FLOW_HOLD_STAT_OBJECT);
+    if (!ftable->ftable_admission_drops)
+        goto fail;
+    ftable->ftable_admission_drops_size = num_cpus;
+
     return ftable;
+
+fail:
+    vr_flow_table_data_destroy(ftable);
+    return NULL;
 }
 
 void
@@ -3032,9 +4513,12 @@ void
 vr_flow_table_data_process(void *s_req)
 {
     int i, ret = 0;
-    uint64_t hold_count = 0;
+    uint64_t hold_count = 0, burst_free_tokens = 0;
     struct vrouter *router;
     struct vr_flow_table_info *infop;
+    struct vr_flow_admission *vfa;
+    struct vr_flow_rpf_stats *vfrs;
+    struct vr_flow_hold_pool *vfhp;
     vr_flow_table_data *resp = NULL, *ftable = (vr_flow_table_data *)s_req;
 
     if (!ftable) {
@@ -3068,6 +4552,12 @@ vr_flow_table_data_process(void *s_req)
         strncpy(resp->ftable_file_path, vr_flow_path, VR_UNIX_PATH_MAX - 1);
     }
 
+    resp->ftable_log_size = vr_flow_log_size(router);
+    if (vr_flow_log_path && resp->ftable_log_size) {
+        strncpy(resp->ftable_log_file_path, (char *)vr_flow_log_path,
+                VR_UNIX_PATH_MAX - 1);
+    }
+
     if (!infop)
         goto send_response;
 
@@ -3086,8 +4576,44 @@ vr_flow_table_data_process(void *s_req)
 
     resp->ftable_created = hold_count;
     resp->ftable_oflow_entries = vr_flow_table_used_oflow_entries(router);
-    resp->ftable_burst_free_tokens = infop->vfti_burst_tokens - infop->vfti_burst_used;
+    for (i = 0; ((i < vr_num_cpus) && (i < VR_FLOW_MAX_CPUS)); i++) {
+        vfa = vr_flow_get_admission(router, i);
+        if (!vfa)
+            break;
+
+        resp->ftable_admitted[i] = vfa->vfa_admitted;
+        resp->ftable_burst_admitted[i] = vfa->vfa_burst_admitted;
+        resp->ftable_admission_drops[i] = vfa->vfa_dropped;
+        burst_free_tokens += vfa->vfa_tokens;
+    }
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        vfrs = vr_flow_get_rpf_stats(router, i);
+        if (!vfrs)
+            break;
+
+        resp->ftable_rpf_validated += vfrs->vfrs_validated;
+        resp->ftable_rpf_cached += vfrs->vfrs_cached;
+    }
+    resp->ftable_burst_free_tokens = burst_free_tokens;
     resp->ftable_hold_entries = vr_flow_table_hold_count(router);
+    resp->ftable_resizes = infop->vfti_resizes;
+    resp->ftable_aged = infop->vfti_aged;
+
+    for (i = 0; router->vr_flow_hold_pool && (i < vr_num_cpus); i++) {
+        vfhp = &router->vr_flow_hold_pool[i];
+        resp->ftable_hold_limit_drops +=
+            vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_LIMIT];
+        resp->ftable_hold_share_drops +=
+            vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_SHARE];
+        resp->ftable_hold_pool_drops +=
+            vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_POOL];
+        resp->ftable_hold_queue_drops +=
+            vfhp->vfhp_drops[VR_FLOW_HOLD_DROP_QUEUE];
+        resp->ftable_hold_pool_nodes += vfhp->vfhp_node_count;
+        resp->ftable_hold_pool_used +=
+            vfhp->vfhp_nodes_taken - vfhp->vfhp_nodes_returned;
+    }
 
 send_response:
     vr_message_response(VR_FLOW_TABLE_DATA_OBJECT_ID, resp, ret, false);
@@ -3139,6 +4665,26 @@ vr_flow_table_info_destroy(struct vrouter *router)
     if (!router->vr_flow_table_info)
         return;
 
+    if (router->vr_flow_table_info->vfti_admission_mem) {
+        vr_free(router->vr_flow_table_info->vfti_admission_mem,
+                VR_FLOW_TABLE_INFO_OBJECT);
+        router->vr_flow_table_info->vfti_admission_mem = NULL;
+        router->vr_flow_table_info->vfti_admission = NULL;
+    }
+
+    if (router->vr_flow_table_info->vfti_rpf_stats_mem) {
+        vr_free(router->vr_flow_table_info->vfti_rpf_stats_mem,
+                VR_FLOW_TABLE_INFO_OBJECT);
+        router->vr_flow_table_info->vfti_rpf_stats_mem = NULL;
+        router->vr_flow_table_info->vfti_rpf_stats = NULL;
+    }
+
+    if (router->vr_flow_table_info->vfti_burst) {
+        vr_free(router->vr_flow_table_info->vfti_burst,
+                VR_FLOW_TABLE_INFO_OBJECT);
+        router->vr_flow_table_info->vfti_burst = NULL;
+    }
+
     vr_free(router->vr_flow_table_info, VR_FLOW_TABLE_INFO_OBJECT);
     router->vr_flow_table_info = NULL;
     router->vr_flow_table_info_size = 0;
@@ -3149,20 +4695,55 @@ vr_flow_table_info_destroy(struct vrouter *router)
 static void
 vr_flow_table_info_reset(struct vrouter *router)
 {
+    void *vfa_mem, *vfrs_mem;
+    struct vr_flow_admission *vfa;
+    struct vr_flow_rpf_stats *vfrs;
+    struct vr_flow_burst *vfb;
+
     if (!router->vr_flow_table_info)
         return;
 
-    if (router->vr_flow_table_info->vfti_timer) {
-        vr_delete_timer(router->vr_flow_table_info->vfti_timer);
-        vr_free(router->vr_flow_table_info->vfti_timer, VR_TIMER_OBJECT);
-        router->vr_flow_table_info->vfti_timer = NULL;
-    }
+    vfa_mem = router->vr_flow_table_info->vfti_admission_mem;
+    vfa = router->vr_flow_table_info->vfti_admission;
+    if (vfa)
+        memset(vfa, 0, sizeof(*vfa) * vr_num_cpus);
+
+    vfrs_mem = router->vr_flow_table_info->vfti_rpf_stats_mem;
+    vfrs = router->vr_flow_table_info->vfti_rpf_stats;
+    if (vfrs)
+        memset(vfrs, 0, sizeof(*vfrs) * vr_num_cpus);
+
+    vfb = router->vr_flow_table_info->vfti_burst;
+    if (vfb)
+        memset(vfb, 0, sizeof(*vfb) * vr_num_cpus);
 
     memset(router->vr_flow_table_info, 0, router->vr_flow_table_info_size);
+    router->vr_flow_table_info->vfti_admission_mem = vfa_mem;
+    router->vr_flow_table_info->vfti_admission = vfa;
+    router->vr_flow_table_info->vfti_rpf_stats_mem = vfrs_mem;
+    router->vr_flow_table_info->vfti_rpf_stats = vfrs;
+    router->vr_flow_table_info->vfti_burst = vfb;
 
     return;
 }
 
+/*
+ * Blocks of 'size' bytes, one a cpu, starting on a cache line. The
+ * allocators do not promise more than word alignment, so '*mem' gets what
+ * was allocated, for vr_free.
+ */
+static void *
+vr_flow_table_info_alloc_lines(unsigned int size, void **mem)
+{
+    *mem = vr_zalloc((size * vr_num_cpus) + VR_CACHE_LINE_SIZE - 1,
+            VR_FLOW_TABLE_INFO_OBJECT);
+    if (!*mem)
+        return NULL;
+
+    return (void *)(((uintptr_t)*mem + VR_CACHE_LINE_SIZE - 1) &
+            ~((uintptr_t)VR_CACHE_LINE_SIZE - 1));
+}
+
 static int
 vr_flow_table_info_init(struct vrouter *router)
 {
@@ -3181,18 +4762,373 @@ vr_flow_table_info_init(struct vrouter *router)
     router->vr_flow_table_info = infop;
     router->vr_flow_table_info_size = size;
 
+    infop->vfti_admission = vr_flow_table_info_alloc_lines(
+            sizeof(struct vr_flow_admission), &infop->vfti_admission_mem);
+    if (!infop->vfti_admission)
+        goto fail;
+
+    infop->vfti_rpf_stats = vr_flow_table_info_alloc_lines(
+            sizeof(struct vr_flow_rpf_stats), &infop->vfti_rpf_stats_mem);
+    if (!infop->vfti_rpf_stats)
+        goto fail;
+
+    infop->vfti_burst = vr_zalloc(sizeof(struct vr_flow_burst) *
+            vr_num_cpus, VR_FLOW_TABLE_INFO_OBJECT);
+    if (!infop->vfti_burst)
+        goto fail;
+
+    return 0;
+
+fail:
+    vr_flow_table_info_destroy(router);
+    return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, vr_num_cpus);
+}
+
+static void
+vr_flow_hold_pool_exit(struct vrouter *router)
+{
+    unsigned int i;
+    struct vr_flow_hold_pool *vfhp = router->vr_flow_hold_pool;
+
+    if (!vfhp)
+        return;
+
+    router->vr_flow_hold_pool = NULL;
+    for (i = 0; i < vr_num_cpus; i++) {
+        if (vfhp[i].vfhp_queue_table)
+            vr_btable_free(vfhp[i].vfhp_queue_table);
+        if (vfhp[i].vfhp_node_table)
+            vr_btable_free(vfhp[i].vfhp_node_table);
+    }
+    vr_free(vfhp, VR_FLOW_QUEUE_OBJECT);
+
+    return;
+}
+
+static int
+vr_flow_hold_pool_init(struct vrouter *router)
+{
+    unsigned int i, j, nodes, queues;
+    struct vr_flow_hold_pool *vfhp;
+    struct vr_flow_hold_node *node;
+    struct vr_flow_queue *vfq;
+
+    if (router->vr_flow_hold_pool || !vr_flow_hold_pool_nodes ||
+            !vr_flow_hold_pool_queues)
+        return 0;
+
+    /* each pool is a single chunk of memory */
+    nodes = vr_flow_hold_pool_nodes;
+    if (nodes > VR_SINGLE_ALLOC_LIMIT / sizeof(*node))
+        nodes = VR_SINGLE_ALLOC_LIMIT / sizeof(*node);
+    queues = vr_flow_hold_pool_queues;
+    if (queues > VR_SINGLE_ALLOC_LIMIT / sizeof(*vfq))
+        queues = VR_SINGLE_ALLOC_LIMIT / sizeof(*vfq);
+
+    vfhp = vr_zalloc(sizeof(*vfhp) * vr_num_cpus, VR_FLOW_QUEUE_OBJECT);
+    if (!vfhp)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                sizeof(*vfhp) * vr_num_cpus);
+    router->vr_flow_hold_pool = vfhp;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        vfhp[i].vfhp_node_table = vr_btable_alloc(nodes, sizeof(*node));
+        vfhp[i].vfhp_queue_table = vr_btable_alloc(queues, sizeof(*vfq));
+        if (!vfhp[i].vfhp_node_table || !vfhp[i].vfhp_queue_table) {
+            vr_flow_hold_pool_exit(router);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, i);
+        }
+
+        for (j = nodes; j-- > 0; ) {
+            node = vr_btable_get(vfhp[i].vfhp_node_table, j);
+            node->vfhn_cpu = i;
+            node->vfhn_next = vfhp[i].vfhp_nodes;
+            vfhp[i].vfhp_nodes = node;
+        }
+
+        for (j = queues; j-- > 0; ) {
+            vfq = vr_btable_get(vfhp[i].vfhp_queue_table, j);
+            vfq->vfq_next = vfhp[i].vfhp_queues;
+            vfhp[i].vfhp_queues = vfq;
+        }
+        vfhp[i].vfhp_node_count = nodes;
+    }
+
+    return 0;
+}
+
+static void
+vr_flow_aging_exit(struct vrouter *router)
+{
+    struct vr_flow_aging *vfag = router->vr_flow_aging;
+
+    if (!vfag)
+        return;
+
+    router->vr_flow_aging = NULL;
+    if (vfag->vfag_timer) {
+        vr_delete_timer(vfag->vfag_timer);
+        vr_free(vfag->vfag_timer, VR_TIMER_OBJECT);
+    }
+
+    if (vfag->vfag_entries)
+        vr_btable_free(vfag->vfag_entries);
+    vr_free(vfag, VR_FLOW_TABLE_INFO_OBJECT);
+
+    return;
+}
+
+static int
+vr_flow_aging_init(struct vrouter *router)
+{
+    unsigned int i, j, entries;
+    uint64_t secs, nsecs;
+    struct vr_flow_aging *vfag;
+    struct vr_timer *vtimer;
+
+    if (!vr_flow_aging_timeout || router->vr_flow_aging)
+        return 0;
+
+    vfag = vr_zalloc(sizeof(*vfag), VR_FLOW_TABLE_INFO_OBJECT);
+    if (!vfag)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                sizeof(*vfag));
+
+    vfag->vfag_router = router;
+    vfag->vfag_incoming = VR_INVALID_HENTRY_INDEX;
+    vfag->vfag_timeout = (vr_flow_aging_timeout * 1000) /
+        VR_FLOW_AGING_TICK_MSECS;
+    if (!vfag->vfag_timeout)
+        vfag->vfag_timeout = 1;
+    else if (vfag->vfag_timeout > VR_FLOW_AGING_MAX_TICKS)
+        vfag->vfag_timeout = VR_FLOW_AGING_MAX_TICKS;
+    vr_get_mono_time(&secs, &nsecs);
+    vfag->vfag_start_msecs = (secs * 1000) + (nsecs / 1000000);
+
+    for (i = 0; i < VR_FLOW_AGING_WHEEL_LEVELS; i++)
+        for (j = 0; j < VR_FLOW_AGING_WHEEL_SLOTS; j++)
+            vfag->vfag_wheel[i][j] = VR_INVALID_HENTRY_INDEX;
+
+    /* room for the overflow entries the table may grow to */
+    entries = vr_flow_entries + vr_oflow_entries;
+    if (vr_oflow_entries_max > vr_oflow_entries)
+        entries = vr_flow_entries + vr_oflow_entries_max;
+
+    vfag->vfag_budget = (entries / vfag->vfag_timeout) * 2;
+    if (vfag->vfag_budget < VR_FLOW_AGING_BUDGET)
+        vfag->vfag_budget = VR_FLOW_AGING_BUDGET;
+
+    vfag->vfag_entries = vr_btable_alloc(entries,
+            sizeof(struct vr_flow_age_entry));
+    if (!vfag->vfag_entries) {
+        vr_free(vfag, VR_FLOW_TABLE_INFO_OBJECT);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, entries);
+    }
+
+    vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
+    if (!vtimer) {
+        vr_btable_free(vfag->vfag_entries);
+        vr_free(vfag, VR_FLOW_TABLE_INFO_OBJECT);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                sizeof(*vtimer));
+    }
+
+    vtimer->vt_timer = vr_flow_age_tick;
+    vtimer->vt_vr_arg = vfag;
+    vtimer->vt_msecs = VR_FLOW_AGING_TICK_MSECS;
+    vfag->vfag_timer = vtimer;
+    router->vr_flow_aging = vfag;
+
+    if (vr_create_timer(vtimer)) {
+        vfag->vfag_timer = NULL;
+        vr_free(vtimer, VR_TIMER_OBJECT);
+        vr_flow_aging_exit(router);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+
+    return 0;
+}
+
+static void
+vr_flow_rpf_exit(struct vrouter *router)
+{
+    if (!router->vr_flow_rpf)
+        return;
+
+    vr_btable_free(router->vr_flow_rpf);
+    router->vr_flow_rpf = NULL;
+
+    return;
+}
+
+static int
+vr_flow_rpf_init(struct vrouter *router)
+{
+    unsigned int entries;
+
+    if (!vr_flow_rpf_cache || router->vr_flow_rpf)
+        return 0;
+
+    /* room for the overflow entries the table may grow to */
+    entries = vr_flow_entries + vr_oflow_entries;
+    if (vr_oflow_entries_max > vr_oflow_entries)
+        entries = vr_flow_entries + vr_oflow_entries_max;
+
+    router->vr_flow_rpf = vr_btable_alloc(entries,
+            sizeof(struct vr_flow_rpf_entry));
+    if (!router->vr_flow_rpf)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, entries);
+
+    return 0;
+}
+
+static void
+vr_flow_last_seen_exit(struct vrouter *router)
+{
+    if (!router->vr_flow_last_seen)
+        return;
+
+    vr_btable_free(router->vr_flow_last_seen);
+    router->vr_flow_last_seen = NULL;
+
+    return;
+}
+
+static int
+vr_flow_last_seen_init(struct vrouter *router)
+{
+    unsigned int entries;
+
+    if (!vr_flow_flowlet || router->vr_flow_last_seen)
+        return 0;
+
+    entries = vr_flow_entries + vr_oflow_entries;
+    if (vr_oflow_entries_max > vr_oflow_entries)
+        entries = vr_flow_entries + vr_oflow_entries_max;
+
+    router->vr_flow_last_seen = vr_btable_alloc(entries, sizeof(uint32_t));
+    if (!router->vr_flow_last_seen)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, entries);
+
+    return 0;
+}
+
+static void
+vr_flow_restore_exit(struct vrouter *router)
+{
+    struct vr_flow_restore *vfr = router->vr_flow_restore;
+
+    if (!vfr)
+        return;
+
+    router->vr_flow_restore = NULL;
+    if (vfr->vfr_timer) {
+        vr_delete_timer(vfr->vfr_timer);
+        vr_free(vfr->vfr_timer, VR_TIMER_OBJECT);
+    }
+
+    if (vfr->vfr_pending)
+        vr_free(vfr->vfr_pending, VR_FLOW_TABLE_INFO_OBJECT);
+    vr_free(vfr, VR_FLOW_TABLE_INFO_OBJECT);
+
+    return;
+}
+
+/*
+ * Sets the restored flows pending, hands them to the aging timer, and
+ * starts the restart window
+ */
+static int
+vr_flow_restore_init(struct vrouter *router)
+{
+    unsigned int i, entries;
+    struct vr_flow_entry *fe;
+    struct vr_flow_restore *vfr;
+    struct vr_timer *vtimer;
+
+    /* the window also settles the bridge table, if it is the one restored */
+    if ((!vr_flow_table_restored && !vr_bridge_table_restored) ||
+            router->vr_flow_restore)
+        return 0;
+
+    /* only the first instance of the table is the restored one */
+    vr_flow_table_restored = 0;
+
+    vfr = vr_zalloc(sizeof(*vfr), VR_FLOW_TABLE_INFO_OBJECT);
+    if (!vfr)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                sizeof(*vfr));
+
+    entries = vr_flow_entries + vr_oflow_entries;
+    vfr->vfr_router = router;
+    vfr->vfr_entries = entries;
+    vfr->vfr_pending = vr_zalloc(((entries + 31) / 32) * sizeof(uint32_t),
+            VR_FLOW_TABLE_INFO_OBJECT);
+    if (!vfr->vfr_pending) {
+        vr_free(vfr, VR_FLOW_TABLE_INFO_OBJECT);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, entries);
+    }
+
+    for (i = 0; i < entries; i++) {
+        fe = vr_flow_get_entry(router, i);
+        if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE))
+            continue;
+
+        vfr->vfr_pending[i / 32] |= (1U << (i % 32));
+        vfr->vfr_restored++;
+        vr_flow_age_arm(router, i);
+    }
+
+    vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
+    if (!vtimer) {
+        vr_free(vfr->vfr_pending, VR_FLOW_TABLE_INFO_OBJECT);
+        vr_free(vfr, VR_FLOW_TABLE_INFO_OBJECT);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                sizeof(*vtimer));
+    }
+
+    /* the first expiry stops the timer */
+    vtimer->vt_timer = vr_flow_restore_revalidate;
+    vtimer->vt_vr_arg = vfr;
+    vtimer->vt_msecs = (vr_warm_restart_window ?
+            vr_warm_restart_window : 1) * 1000;
+    vfr->vfr_timer = vtimer;
+    router->vr_flow_restore = vfr;
+
+    vr_printf("vrouter: %u flows restored\n", vfr->vfr_restored);
+
+    if (vr_create_timer(vtimer)) {
+        vfr->vfr_timer = NULL;
+        vr_free(vtimer, VR_TIMER_OBJECT);
+        vr_flow_restore_exit(router);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+
     return 0;
 }
 
 static void
 vr_flow_table_destroy(struct vrouter *router)
 {
+    vr_flow_restore_exit(router);
+    vr_flow_rpf_exit(router);
+    vr_flow_last_seen_exit(router);
+    vr_flow_aging_exit(router);
+    vr_flow_log_exit(router);
+
     if (router->vr_flow_table) {
         vr_htable_delete(router->vr_flow_table);
         router->vr_flow_table = NULL;
+        /*
+         * the extensions went with the table. a table kept for a warm
+         * restart keeps its size, so that the host can tell it grew
+         */
+        if (vr_oflow_entries_base && !vr_warm_restart)
+            vr_oflow_entries = vr_oflow_entries_base;
     }
 
     vr_flow_table_info_destroy(router);
+    vr_flow_hold_pool_exit(router);
 
     return;
 }
@@ -3249,9 +5185,12 @@ vr_compute_size_oflow_table(void)
 static int
 vr_flow_table_init(struct vrouter *router)
 {
+    int ret;
+
     if (!router->vr_flow_table) {
 
         vr_compute_size_oflow_table();
+        vr_oflow_entries_base = vr_oflow_entries;
 
         if (!vr_flow_table && vr_huge_page_mem_get) {
 
@@ -3261,17 +5200,54 @@ vr_flow_table_init(struct vrouter *router)
                 vr_oflow_table = (char*)vr_flow_table + VR_FLOW_TABLE_SIZE;
         }
 
-        router->vr_flow_table = vr_htable_attach(router, vr_flow_entries,
-                vr_flow_table, vr_oflow_entries, vr_oflow_table,
-                sizeof(struct vr_flow_entry), 0, 0, vr_flow_get_key);
+        if (vr_flow_table_restored && vr_flow_table) {
+            vr_flow_restore_prepare();
+            router->vr_flow_table = vr_htable_restore(router,
+                    vr_flow_entries, vr_flow_table, vr_oflow_entries,
+                    vr_oflow_table, sizeof(struct vr_flow_entry), 0, 0,
+                    vr_flow_get_key);
+        } else {
+            vr_flow_table_restored = 0;
+            router->vr_flow_table = vr_htable_attach(router, vr_flow_entries,
+                    vr_flow_table, vr_oflow_entries, vr_oflow_table,
+                    sizeof(struct vr_flow_entry), 0, 0, vr_flow_get_key);
+        }
 
         if (!router->vr_flow_table) {
             return vr_module_error(-ENOMEM, __FUNCTION__,
                     __LINE__, vr_flow_entries + vr_oflow_entries);
         }
+
+        /* not fatal, the lookups just keep walking the overflow chains */
+        if (vr_flow_cuckoo)
+            (void)vr_htable_cuckoo_init(router->vr_flow_table);
     }
 
-    return vr_flow_table_info_init(router);
+    ret = vr_flow_table_info_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_hold_pool_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_aging_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_rpf_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_last_seen_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_log_init(router);
+    if (ret)
+        return ret;
+
+    return vr_flow_restore_init(router);
 }
 
 static void
@@ -3325,7 +5301,10 @@ vr_link_local_ports_init(struct vrouter *router)
 void
 vr_flow_exit(struct vrouter *router, bool soft_reset)
 {
-    vr_flow_table_reset(router);
+    vr_flow_restore_exit(router);
+    /* a table kept for a warm restart is left as it is for the next one */
+    if (soft_reset || !vr_warm_restart)
+        vr_flow_table_reset(router);
     vr_link_local_ports_reset(router);
     if (!soft_reset) {
         vr_flow_table_destroy(router);
@@ -0,0 +1,240 @@
+/*
+ * vr_flow_log.c -- flow statistics change log
+ */
+#include <vr_os.h>
+#include <vr_types.h>
+#include <vrouter.h>
+#include <vr_flow.h>
+#include <vr_flow_log.h>
+#include "vr_btable.h"
+
+/* records per ring, rounded up to a power of 2. 0 disables the log */
+unsigned int vr_flow_log_records = 0;
+/* packets between two records of a flow, rounded up to a power of 2 */
+unsigned int vr_flow_log_threshold = VR_FLOW_LOG_DEF_THRESHOLD;
+/*
+ * host can provide its own memory, of vr_flow_log_mem_size() bytes, and
+ * a path that the readers can map it through
+ */
+void *vr_flow_log_mem = NULL;
+unsigned char *vr_flow_log_path;
+
+#define VR_FLOW_LOG_PAGE_SIZE           4096
+/* the info and each of the rings take a cache line, i.e two units */
+#define VR_FLOW_LOG_INFO_UNITS          2
+#define VR_FLOW_LOG_RING_UNITS          2
+
+static unsigned int
+vr_flow_log_pow2(unsigned int value)
+{
+    unsigned int pow2 = 1;
+
+    while ((pow2 < value) && (pow2 < (1U << 31)))
+        pow2 <<= 1;
+
+    return pow2;
+}
+
+/*
+ * Size of the memory the log needs for 'rings' rings (the cpus and the
+ * aging timer), rounded up to a page. 0 if there is no log, or if the
+ * log would take more than VR_FLOW_LOG_MAX_SIZE.
+ */
+unsigned int
+vr_flow_log_mem_size(unsigned int rings)
+{
+    uint64_t units, size;
+
+    if (!vr_flow_log_records ||
+            (vr_flow_log_records > VR_FLOW_LOG_MAX_RECORDS))
+        return 0;
+
+    units = VR_FLOW_LOG_INFO_UNITS +
+        ((uint64_t)rings * VR_FLOW_LOG_RING_UNITS) +
+        ((uint64_t)rings * vr_flow_log_pow2(vr_flow_log_records));
+    size = units * VR_FLOW_LOG_UNIT;
+    size = (size + VR_FLOW_LOG_PAGE_SIZE - 1) & ~(VR_FLOW_LOG_PAGE_SIZE - 1);
+    if (size > VR_FLOW_LOG_MAX_SIZE)
+        return 0;
+
+    return (unsigned int)size;
+}
+
+static struct vr_flow_log_ring *
+vr_flow_log_get_ring(struct vr_flow_log *vfl, unsigned int ring)
+{
+    return (struct vr_flow_log_ring *)vr_btable_get(vfl->vfl_table,
+            vfl->vfl_ring_units + (ring * VR_FLOW_LOG_RING_UNITS));
+}
+
+static struct vr_flow_log_record *
+vr_flow_log_get_record(struct vr_flow_log *vfl, unsigned int ring,
+        uint64_t seq)
+{
+    return (struct vr_flow_log_record *)vr_btable_get(vfl->vfl_table,
+            vfl->vfl_record_units + (ring * vfl->vfl_records) +
+            (unsigned int)(seq & (vfl->vfl_records - 1)));
+}
+
+/*
+ * Appends a record of the current counters of 'fe' to 'ring', which is
+ * the cpu the caller runs on or VR_FLOW_LOG_RING_TIMER. Each ring has a
+ * single producer, hence no atomics beyond the barriers the readers need.
+ */
+void
+vr_flow_log_append(struct vrouter *router, int ring, struct vr_flow_entry *fe,
+        unsigned int index, uint8_t reason)
+{
+    uint64_t head;
+    struct vr_flow_log *vfl = router->vr_flow_log;
+    struct vr_flow_log_ring *vfrg;
+    struct vr_flow_log_record *vflr;
+
+    if (!vfl || !fe)
+        return;
+
+    if (ring == VR_FLOW_LOG_RING_TIMER) {
+        ring = vfl->vfl_rings - 1;
+    } else if ((ring < 0) || ((unsigned int)ring >= (vfl->vfl_rings - 1))) {
+        return;
+    }
+
+    vfrg = vr_flow_log_get_ring(vfl, ring);
+    if (!vfrg)
+        return;
+
+    head = vfrg->vfrg_head;
+    vflr = vr_flow_log_get_record(vfl, ring, head);
+    if (!vflr)
+        return;
+
+    vflr->vflr_seq = VR_FLOW_LOG_SEQ_INVALID;
+    vr_sync_synchronize();
+
+    vflr->vflr_index = index;
+    vflr->vflr_bytes = fe->fe_stats.flow_bytes;
+    vflr->vflr_packets = fe->fe_stats.flow_packets;
+    vflr->vflr_bytes_oflow = fe->fe_stats.flow_bytes_oflow;
+    vflr->vflr_packets_oflow = fe->fe_stats.flow_packets_oflow;
+    vflr->vflr_tcp_flags = fe->fe_tcp_flags;
+    vflr->vflr_gen_id = fe->fe_gen_id;
+    vflr->vflr_reason = reason;
+    vr_sync_synchronize();
+
+    vflr->vflr_seq = head;
+    vfrg->vfrg_head = head + 1;
+
+    return;
+}
+
+void *
+vr_flow_log_get_va(struct vrouter *router, uint64_t offset)
+{
+    struct vr_flow_log *vfl = router->vr_flow_log;
+
+    if (!vfl || (offset >= vfl->vfl_size))
+        return NULL;
+
+    return vr_btable_get_address(vfl->vfl_table, offset);
+}
+
+unsigned int
+vr_flow_log_size(struct vrouter *router)
+{
+    if (!router->vr_flow_log)
+        return 0;
+
+    return router->vr_flow_log->vfl_size;
+}
+
+void
+vr_flow_log_exit(struct vrouter *router)
+{
+    struct vr_flow_log *vfl = router->vr_flow_log;
+
+    if (!vfl)
+        return;
+
+    router->vr_flow_log = NULL;
+    if (vfl->vfl_table)
+        vr_btable_free(vfl->vfl_table);
+    vr_free(vfl, VR_FLOW_TABLE_INFO_OBJECT);
+
+    return;
+}
+
+int
+vr_flow_log_init(struct vrouter *router)
+{
+    unsigned int i, j, rings, size;
+    struct iovec iov;
+    struct vr_flow_log *vfl;
+    struct vr_flow_log_info *vfli;
+    struct vr_flow_log_ring *vfrg;
+    struct vr_flow_log_record *vflr;
+
+    if (!vr_flow_log_records || router->vr_flow_log)
+        return 0;
+
+    /* one ring per cpu, and one for the aging timer */
+    rings = vr_num_cpus + 1;
+    size = vr_flow_log_mem_size(rings);
+    if (!size)
+        return vr_module_error(-EINVAL, __FUNCTION__, __LINE__,
+                vr_flow_log_records);
+
+    vfl = vr_zalloc(sizeof(*vfl), VR_FLOW_TABLE_INFO_OBJECT);
+    if (!vfl)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, sizeof(*vfl));
+
+    vfl->vfl_rings = rings;
+    vfl->vfl_records = vr_flow_log_pow2(vr_flow_log_records);
+    vfl->vfl_ring_units = VR_FLOW_LOG_INFO_UNITS;
+    vfl->vfl_record_units = VR_FLOW_LOG_INFO_UNITS +
+        (rings * VR_FLOW_LOG_RING_UNITS);
+    vfl->vfl_threshold_mask = vr_flow_log_pow2(vr_flow_log_threshold) - 1;
+    vfl->vfl_size = size;
+
+    /* the host memory is sized for at least as many cpus as we have */
+    if (vr_flow_log_mem) {
+        iov.iov_base = vr_flow_log_mem;
+        iov.iov_len = size;
+        vfl->vfl_table = vr_btable_attach(&iov, 1, VR_FLOW_LOG_UNIT);
+    } else {
+        vfl->vfl_table = vr_btable_alloc(size / VR_FLOW_LOG_UNIT,
+                VR_FLOW_LOG_UNIT);
+    }
+
+    if (!vfl->vfl_table) {
+        vr_free(vfl, VR_FLOW_TABLE_INFO_OBJECT);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+    }
+
+    vfli = (struct vr_flow_log_info *)vr_btable_get(vfl->vfl_table, 0);
+    memset(vfli, 0, sizeof(*vfli));
+
+    for (i = 0; i < rings; i++) {
+        vfrg = vr_flow_log_get_ring(vfl, i);
+        memset(vfrg, 0, sizeof(*vfrg));
+        for (j = 0; j < vfl->vfl_records; j++) {
+            vflr = vr_flow_log_get_record(vfl, i, j);
+            memset(vflr, 0, sizeof(*vflr));
+            vflr->vflr_seq = VR_FLOW_LOG_SEQ_INVALID;
+        }
+    }
+
+    vfli->vfli_version = VR_FLOW_LOG_VERSION;
+    vfli->vfli_rings = rings;
+    vfli->vfli_records = vfl->vfl_records;
+    vfli->vfli_record_size = VR_FLOW_LOG_UNIT;
+    vfli->vfli_ring_offset = vfl->vfl_ring_units * VR_FLOW_LOG_UNIT;
+    vfli->vfli_record_offset = vfl->vfl_record_units * VR_FLOW_LOG_UNIT;
+    vfli->vfli_threshold = vfl->vfl_threshold_mask + 1;
+    /* readers go by the magic, so it goes last */
+    vr_sync_synchronize();
+    vfli->vfli_magic = VR_FLOW_LOG_MAGIC;
+
+    router->vr_flow_log = vfl;
+
+    return 0;
+}
@@ -838,7 +838,7 @@ fragment_table_scanner_init(struct vrouter *router)
     scanner->sp_router = router;
     scanner->sp_scan_marker = 0;
 
-    vtimer = vr_malloc(sizeof(*vtimer), VR_TIMER_OBJECT);
+    vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
     if (!vtimer) {
         vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, sizeof(*vtimer));
         goto fail_init;
@@ -8,7 +8,9 @@
 #include <vr_hash.h>
 #include <vrouter.h>
 
-#define VR_HENTRIES_PER_BUCKET 4
+#if defined(__SSE2__) && !defined(__KERNEL__)
+#include <emmintrin.h>
+#endif
 
 #define VR_HENTRY_FLAG_VALID             0x1
 #define VR_HENTRY_FLAG_DELETE_MARKED     0x2
@@ -16,7 +18,26 @@
 #define VR_HENTRY_FLAG_UNDER_DELETION    (VR_HENTRY_FLAG_DELETE_MARKED | \
                                             VR_HENTRY_FLAG_DELETE_PROCESSED)
 #define VR_HENTRY_FLAG_IN_FREE_LIST      0x8
+#define VR_HENTRY_FLAG_HIDDEN            0x10
 
+#define VR_HTABLE_MAX_OEXT               8
+
+#define VR_HTABLE_CBUCKET_ENTRIES        8
+#define VR_HTABLE_CUCKOO_MAX_DEPTH       64
+#define VR_HTABLE_CUCKOO_INVALID_SLOT    ((unsigned int)-1)
+
+/*
+ * Bucket of the optional cuckoo index. It holds 16 bit signatures of the
+ * keys and the index of the hentry each of them belongs to, and fits in a
+ * cache line. A key lives in one of two buckets, so a lookup touches at
+ * most two index cache lines plus the entries whose signature matches.
+ * A zero signature marks a free slot.
+ */
+struct vr_htable_cbucket {
+    uint16_t cb_sig[VR_HTABLE_CBUCKET_ENTRIES];
+    uint32_t cb_index[VR_HTABLE_CBUCKET_ENTRIES];
+    uint8_t cb_pad[16];
+};
 
 struct vr_htable {
     struct vrouter *ht_router;
@@ -32,6 +53,30 @@ struct vr_htable {
     vr_hentry_t *ht_free_oentry_head;
     unsigned int ht_used_oentries;
     unsigned int ht_used_entries;
+    /*
+     * Overflow table extensions added by vr_htable_grow_oentries. Their
+     * entries are numbered after the ones already present, so that the
+     * index of an entry never changes. ht_oext_start holds the overflow
+     * index of the first entry of each extension
+     */
+    unsigned int ht_oext_count;
+    unsigned int ht_oext_start[VR_HTABLE_MAX_OEXT];
+    struct vr_btable *ht_oext[VR_HTABLE_MAX_OEXT];
+    /*
+     * Cuckoo index. The entries themselves stay where the hash bucket
+     * and overflow chain put them, so that the layout seen by the users
+     * that map the table is not changed; the index only tells a lookup
+     * which entries to compare. ht_cslots maps a hentry index back to its
+     * slot in the index, ht_cversion is bumped around every displacement
+     * so that a lookup that raced with one can retry
+     */
+    struct vr_btable *ht_ctable;
+    struct vr_btable *ht_cslots;
+    unsigned int ht_centries;
+    unsigned int ht_cbuckets;
+    volatile unsigned int ht_cversion;
+    uint8_t ht_clock;
+    uint8_t ht_cfailed;
 };
 
 struct vr_hentry_delete_data {
@@ -43,6 +88,22 @@ struct vr_hentry_delete_data {
 
 void vr_htable_hentry_scheduled_delete(void *arg);
 
+static inline vr_hentry_t *
+vr_htable_get_oentry(struct vr_htable *table, unsigned int index)
+{
+    int i;
+
+    if (!table->ht_oext_count || (index < table->ht_oext_start[0]))
+        return vr_btable_get(table->ht_otable, index);
+
+    for (i = table->ht_oext_count - 1; i > 0; i--) {
+        if (index >= table->ht_oext_start[i])
+            break;
+    }
+
+    return vr_btable_get(table->ht_oext[i], index - table->ht_oext_start[i]);
+}
+
 int
 vr_htable_trav_range(vr_htable_t htable, unsigned int start,
         unsigned int range, htable_trav_cb cb, void *data)
@@ -143,6 +204,377 @@ vr_htable_put_free_oentry(struct vr_htable *table, vr_hentry_t *ent)
 }
 
 
+static inline bool
+vr_htable_cuckoo_enabled(struct vr_htable *table)
+{
+    return table->ht_ctable && !table->ht_cfailed;
+}
+
+static inline uint16_t
+vr_htable_cuckoo_sig(unsigned int hash)
+{
+    uint16_t sig = (hash * 0x9E3779B1U) >> 16;
+
+    return sig ? sig : 1;
+}
+
+static inline unsigned int
+vr_htable_cuckoo_alt_bucket(struct vr_htable *table, unsigned int bucket,
+        uint16_t sig)
+{
+    return (bucket ^ (sig * 0x5BD1E995U)) & (table->ht_cbuckets - 1);
+}
+
+static inline struct vr_htable_cbucket *
+vr_htable_get_cbucket(struct vr_htable *table, unsigned int bucket)
+{
+    return vr_btable_get(table->ht_ctable, bucket);
+}
+
+static inline unsigned int *
+vr_htable_get_cslot(struct vr_htable *table, unsigned int index)
+{
+    return vr_btable_get(table->ht_cslots, index);
+}
+
+/*
+ * Returns a mask with bit (2 * slot) set for every slot of the bucket
+ * whose signature is 'sig'
+ */
+static inline unsigned int
+vr_htable_cbucket_match(struct vr_htable_cbucket *cb, uint16_t sig)
+{
+#if defined(__SSE2__) && !defined(__KERNEL__)
+    __m128i sigs = _mm_loadu_si128((__m128i *)cb->cb_sig);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(sigs,
+                _mm_set1_epi16((short)sig))) & 0x5555;
+#else
+    unsigned int i, mask = 0;
+
+    for (i = 0; i < VR_HTABLE_CBUCKET_ENTRIES; i++) {
+        if (cb->cb_sig[i] == sig)
+            mask |= (1 << (2 * i));
+    }
+
+    return mask;
+#endif
+}
+
+static void
+vr_htable_cuckoo_lock(struct vr_htable *table)
+{
+    while (!vr_sync_bool_compare_and_swap_8u(&table->ht_clock, 0, 1))
+        vr_pause();
+}
+
+static void
+vr_htable_cuckoo_unlock(struct vr_htable *table)
+{
+    (void)vr_sync_bool_compare_and_swap_8u(&table->ht_clock, 1, 0);
+}
+
+static void
+vr_htable_cuckoo_set(struct vr_htable *table, unsigned int bucket,
+        unsigned int slot, uint16_t sig, unsigned int index)
+{
+    struct vr_htable_cbucket *cb = vr_htable_get_cbucket(table, bucket);
+
+    /* index first, so that a matching signature never has a stale index */
+    cb->cb_index[slot] = index;
+    vr_sync_synchronize();
+    cb->cb_sig[slot] = sig;
+    *vr_htable_get_cslot(table, index) =
+        (bucket * VR_HTABLE_CBUCKET_ENTRIES) + slot;
+}
+
+static int
+vr_htable_cbucket_free_slot(struct vr_htable *table, unsigned int bucket)
+{
+    unsigned int mask;
+
+    mask = vr_htable_cbucket_match(vr_htable_get_cbucket(table, bucket), 0);
+    if (!mask)
+        return -1;
+
+    return (vr_ffs_32(mask) - 1) >> 1;
+}
+
+/*
+ * Moves the entries along a cuckoo path until a free slot shows up in one
+ * of the alternate buckets, and returns the slot in 'bucket' that got
+ * freed. Entries are copied to their new slot before the old slot is
+ * reused, so an entry is always present in at least one of its buckets.
+ * Called with the index lock held.
+ */
+static int
+vr_htable_cuckoo_make_room(struct vr_htable *table, unsigned int bucket,
+        unsigned int hash)
+{
+    int free_slot;
+    unsigned int depth, i, tries, victim, dst_bucket, dst_slot;
+    unsigned int path_bucket[VR_HTABLE_CUCKOO_MAX_DEPTH];
+    unsigned int path_slot[VR_HTABLE_CUCKOO_MAX_DEPTH];
+    struct vr_htable_cbucket *cb;
+
+    for (depth = 0; depth < VR_HTABLE_CUCKOO_MAX_DEPTH; depth++) {
+        /* vary the victim, and never pick a slot already on the path */
+        for (tries = 0; tries < VR_HTABLE_CBUCKET_ENTRIES; tries++) {
+            victim = (hash + depth + tries) % VR_HTABLE_CBUCKET_ENTRIES;
+            for (i = 0; i < depth; i++) {
+                if ((path_bucket[i] == bucket) && (path_slot[i] == victim))
+                    break;
+            }
+            if (i == depth)
+                break;
+        }
+        if (tries == VR_HTABLE_CBUCKET_ENTRIES)
+            return -1;
+
+        cb = vr_htable_get_cbucket(table, bucket);
+
+        path_bucket[depth] = bucket;
+        path_slot[depth] = victim;
+
+        bucket = vr_htable_cuckoo_alt_bucket(table, bucket,
+                cb->cb_sig[victim]);
+        free_slot = vr_htable_cbucket_free_slot(table, bucket);
+        if (free_slot < 0)
+            continue;
+
+        table->ht_cversion++;
+        vr_sync_synchronize();
+
+        dst_bucket = bucket;
+        dst_slot = free_slot;
+        for (i = depth + 1; i > 0; i--) {
+            cb = vr_htable_get_cbucket(table, path_bucket[i - 1]);
+            vr_htable_cuckoo_set(table, dst_bucket, dst_slot,
+                    cb->cb_sig[path_slot[i - 1]],
+                    cb->cb_index[path_slot[i - 1]]);
+            dst_bucket = path_bucket[i - 1];
+            dst_slot = path_slot[i - 1];
+        }
+
+        vr_sync_synchronize();
+        table->ht_cversion++;
+
+        return path_slot[0];
+    }
+
+    return -1;
+}
+
+static void
+vr_htable_cuckoo_insert(struct vr_htable *table, unsigned int hash,
+        unsigned int index)
+{
+    int slot;
+    unsigned int bucket;
+    uint16_t sig = vr_htable_cuckoo_sig(hash);
+
+    if (!vr_htable_cuckoo_enabled(table))
+        return;
+
+    /* entries of an overflow extension added after the index was built */
+    if (index >= table->ht_centries) {
+        table->ht_cfailed = 1;
+        return;
+    }
+
+    vr_htable_cuckoo_lock(table);
+
+    bucket = hash & (table->ht_cbuckets - 1);
+    slot = vr_htable_cbucket_free_slot(table, bucket);
+    if (slot < 0) {
+        bucket = vr_htable_cuckoo_alt_bucket(table, bucket, sig);
+        slot = vr_htable_cbucket_free_slot(table, bucket);
+        if (slot < 0)
+            slot = vr_htable_cuckoo_make_room(table, bucket, hash);
+    }
+
+    if (slot >= 0) {
+        vr_htable_cuckoo_set(table, bucket, slot, sig, index);
+    } else {
+        /*
+         * Should not happen with the index sized at twice the table.
+         * Lookups fall back to the hash buckets and the overflow chains,
+         * which are always maintained, till the table is reset
+         */
+        table->ht_cfailed = 1;
+        vr_printf("vrouter: cuckoo index full, falling back to chaining\n");
+    }
+
+    vr_htable_cuckoo_unlock(table);
+
+    return;
+}
+
+static void
+vr_htable_cuckoo_remove(struct vr_htable *table, unsigned int index)
+{
+    unsigned int *cslot, slot;
+    struct vr_htable_cbucket *cb;
+
+    if (!vr_htable_cuckoo_enabled(table) || (index >= table->ht_centries))
+        return;
+
+    vr_htable_cuckoo_lock(table);
+
+    cslot = vr_htable_get_cslot(table, index);
+    slot = *cslot;
+    if (slot != VR_HTABLE_CUCKOO_INVALID_SLOT) {
+        cb = vr_htable_get_cbucket(table,
+                slot / VR_HTABLE_CBUCKET_ENTRIES);
+        slot %= VR_HTABLE_CBUCKET_ENTRIES;
+        if (cb->cb_index[slot] == index)
+            cb->cb_sig[slot] = 0;
+        *cslot = VR_HTABLE_CUCKOO_INVALID_SLOT;
+    }
+
+    vr_htable_cuckoo_unlock(table);
+
+    return;
+}
+
+static void
+vr_htable_cuckoo_reset(struct vr_htable *table)
+{
+    unsigned int i;
+
+    if (!table->ht_ctable)
+        return;
+
+    for (i = 0; i < table->ht_cbuckets; i++)
+        memset(vr_htable_get_cbucket(table, i), 0,
+                sizeof(struct vr_htable_cbucket));
+
+    for (i = 0; i < table->ht_centries; i++)
+        *vr_htable_get_cslot(table, i) = VR_HTABLE_CUCKOO_INVALID_SLOT;
+
+    /* the index can not cover entries of overflow extensions */
+    table->ht_cfailed = (table->ht_oext_count != 0);
+
+    return;
+}
+
+static vr_hentry_t *
+vr_htable_cuckoo_find(struct vr_htable *table, void *key,
+        unsigned int key_len, unsigned int hash)
+{
+    unsigned int i, version, mask, slot, ent_key_len;
+    unsigned int bucket[2];
+    uint16_t sig = vr_htable_cuckoo_sig(hash);
+    vr_hentry_t *ent;
+    vr_hentry_key ent_key;
+    struct vr_htable_cbucket *cb;
+
+    bucket[0] = hash & (table->ht_cbuckets - 1);
+    bucket[1] = vr_htable_cuckoo_alt_bucket(table, bucket[0], sig);
+
+    do {
+        version = table->ht_cversion;
+        vr_compiler_barrier();
+
+        for (i = 0; i < 2; i++) {
+            cb = vr_htable_get_cbucket(table, bucket[i]);
+            mask = vr_htable_cbucket_match(cb, sig);
+            while (mask) {
+                slot = (vr_ffs_32(mask) - 1) >> 1;
+                mask &= (mask - 1);
+
+                ent = __vr_htable_get_hentry_by_index((vr_htable_t)table,
+                        cb->cb_index[slot]);
+                if (!ent || ((ent->hentry_flags & (VR_HENTRY_FLAG_VALID |
+                                    VR_HENTRY_FLAG_HIDDEN)) !=
+                            VR_HENTRY_FLAG_VALID))
+                    continue;
+
+                ent_key = table->ht_get_key((vr_htable_t)table, ent,
+                        &ent_key_len);
+                if (!ent_key || (key_len != ent_key_len))
+                    continue;
+
+                if (memcmp(ent_key, key, key_len) == 0)
+                    return ent;
+            }
+        }
+
+        vr_compiler_barrier();
+        /* a displacement in progress could have hidden the entry */
+    } while ((version & 1) || (version != table->ht_cversion));
+
+    return NULL;
+}
+
+/*
+ * Builds the cuckoo index for the table. The index is an alternative to
+ * walking the hash bucket and the overflow chain on lookup, which gets
+ * expensive once the chains grow at high fill levels. The index writers
+ * serialize on a spin lock, so it is meant for hosts where the writers
+ * can not be preempted by one another on the same cpu.
+ */
+int
+vr_htable_cuckoo_init(vr_htable_t htable)
+{
+    unsigned int i, entries, key_len;
+    vr_hentry_t *ent;
+    vr_hentry_key key;
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (!table)
+        return -EINVAL;
+
+    if (table->ht_ctable)
+        return 0;
+
+    entries = table->ht_hentries + table->ht_oentries;
+
+    /* keep the index at most half full, rounded to a power of 2 */
+    table->ht_cbuckets = 1;
+    while ((table->ht_cbuckets * VR_HTABLE_CBUCKET_ENTRIES) < (2 * entries))
+        table->ht_cbuckets <<= 1;
+
+    table->ht_ctable = vr_btable_alloc(table->ht_cbuckets,
+            sizeof(struct vr_htable_cbucket));
+    if (!table->ht_ctable)
+        goto fail;
+
+    table->ht_cslots = vr_btable_alloc(entries, sizeof(unsigned int));
+    if (!table->ht_cslots)
+        goto fail;
+    table->ht_centries = entries;
+
+    vr_htable_cuckoo_reset(table);
+
+    /* the table could have been attached with entries already in it */
+    for (i = 0; i < entries; i++) {
+        ent = __vr_htable_get_hentry_by_index(htable, i);
+        if (!ent || !(ent->hentry_flags & VR_HENTRY_FLAG_VALID))
+            continue;
+
+        key = table->ht_get_key(htable, ent, &key_len);
+        if (!key)
+            continue;
+        if (!key_len)
+            key_len = table->ht_key_size;
+
+        vr_htable_cuckoo_insert(table, vr_hash(key, key_len, 0), i);
+    }
+
+    return 0;
+
+fail:
+    if (table->ht_ctable) {
+        vr_btable_free(table->ht_ctable);
+        table->ht_ctable = NULL;
+    }
+
+    return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+            table->ht_cbuckets);
+}
+
+
 /*
  * Returns the hash entry given an index. Does not validate whether the
  * entry is Valid or not
@@ -159,7 +591,7 @@ __vr_htable_get_hentry_by_index(vr_htable_t htable, unsigned int index)
         return vr_btable_get(table->ht_htable, index);
 
     if (index < (table->ht_oentries + table->ht_hentries))
-        return vr_btable_get(table->ht_otable, (index - table->ht_hentries));
+        return vr_htable_get_oentry(table, (index - table->ht_hentries));
 
     return NULL;
 }
@@ -360,6 +792,8 @@ vr_htable_reset(vr_htable_t htable, htable_trav_cb cb, void *data)
         }
     }
 
+    vr_htable_cuckoo_reset(table);
+
     return;
 }
 
@@ -377,6 +811,8 @@ vr_htable_release_hentry(vr_htable_t htable, vr_hentry_t *ent)
 
     (void)vr_sync_sub_and_fetch_32u(&table->ht_used_entries, 1);
 
+    vr_htable_cuckoo_remove(table, ent->hentry_index);
+
     /* Mark it as Invalid */
     ent->hentry_flags &= ~VR_HENTRY_FLAG_VALID;
 
@@ -418,6 +854,41 @@ vr_htable_release_hentry(vr_htable_t htable, vr_hentry_t *ent)
     return;
 }
 
+/*
+ * A hidden entry is skipped by the find routines, before its key is even
+ * looked at, so that a user can claim an entry, fill it and only then make
+ * it visible. Keeping the state in the hash entry means that the lookups
+ * need not touch any other part of the user's entry to know about it.
+ */
+static void
+vr_htable_hentry_set_flag(vr_hentry_t *ent, uint8_t set, uint8_t clear)
+{
+    uint8_t flags;
+
+    do {
+        flags = ent->hentry_flags;
+    } while (!vr_sync_bool_compare_and_swap_8u(&ent->hentry_flags,
+                flags, (flags & ~clear) | set));
+
+    return;
+}
+
+void
+vr_htable_hentry_hide(vr_hentry_t *ent)
+{
+    if (ent)
+        vr_htable_hentry_set_flag(ent, VR_HENTRY_FLAG_HIDDEN, 0);
+    return;
+}
+
+void
+vr_htable_hentry_unhide(vr_hentry_t *ent)
+{
+    if (ent)
+        vr_htable_hentry_set_flag(ent, 0, VR_HENTRY_FLAG_HIDDEN);
+    return;
+}
+
 vr_hentry_t *
 vr_htable_find_free_hentry(vr_htable_t htable, void *key, unsigned int key_size)
 {
@@ -450,6 +921,7 @@ vr_htable_find_free_hentry(vr_htable_t htable, void *key, unsigned int key_size)
                         VR_HENTRY_FLAG_VALID)) {
                 ent->hentry_bucket_index = VR_INVALID_HENTRY_INDEX;
                 (void)vr_sync_add_and_fetch_32u(&table->ht_used_entries, 1);
+                vr_htable_cuckoo_insert(table, hash, ent->hentry_index);
                 return ent;
             }
         }
@@ -487,6 +959,7 @@ vr_htable_find_free_hentry(vr_htable_t htable, void *key, unsigned int key_size)
                  */
                 ent->hentry_next_index = ent->hentry_next->hentry_index;
                 (void)vr_sync_add_and_fetch_32u(&table->ht_used_entries, 1);
+                vr_htable_cuckoo_insert(table, hash, o_ent->hentry_index);
                 return o_ent;
             }
         } while (1);
@@ -541,7 +1014,7 @@ vr_htable_find_duplicate_hentry_index(vr_htable_t htable, vr_hentry_t *hentry)
     tmp_hash = hash % table->ht_oentries;
     for (i = 0; i < table->ht_oentries; i++) {
         ind = table->ht_hentries + ((tmp_hash + i) % table->ht_oentries);
-        ent = vr_btable_get(table->ht_otable, ((tmp_hash + i) % table->ht_oentries));
+        ent = vr_htable_get_oentry(table, ((tmp_hash + i) % table->ht_oentries));
 
         if (ent->hentry_index == VR_INVALID_HENTRY_INDEX)
             continue;
@@ -563,27 +1036,20 @@ vr_htable_find_duplicate_hentry_index(vr_htable_t htable, vr_hentry_t *hentry)
     return -1;
 }
 
-vr_hentry_t *
-vr_htable_find_hentry(vr_htable_t htable, void *key, unsigned int key_len)
+static vr_hentry_t *
+__vr_htable_find_hentry(struct vr_htable *table, void *key,
+        unsigned int key_len, unsigned int hash)
 {
-    unsigned int hash, tmp_hash, ind, i, ent_key_len;
+    unsigned int tmp_hash, ind, i, ent_key_len;
     vr_hentry_t *ent, *o_ent;
     vr_hentry_key ent_key;
-    struct vr_htable *table = (struct vr_htable *)htable;
+    vr_htable_t htable = (vr_htable_t)table;
 
-    if (!table || !key)
-        return NULL;
-
-    if (!key_len) {
-        key_len = table->ht_key_size;
-        if (!key_len)
-            return NULL;
-    }
+    if (vr_htable_cuckoo_enabled(table))
+        return vr_htable_cuckoo_find(table, key, key_len, hash);
 
     ent = NULL;
 
-    hash = vr_hash(key, key_len, 0);
-
     /* Look into the hash table from hash*/
     tmp_hash = hash % table->ht_hentries;
     tmp_hash &= ~(table->ht_bucket_size - 1);
@@ -592,7 +1058,8 @@ vr_htable_find_hentry(vr_htable_t htable, void *key, unsigned int key_len)
         ind = tmp_hash + i;
 
         ent = vr_btable_get(table->ht_htable, ind);
-        if (!(ent->hentry_flags & VR_HENTRY_FLAG_VALID))
+        if ((ent->hentry_flags & (VR_HENTRY_FLAG_VALID |
+                        VR_HENTRY_FLAG_HIDDEN)) != VR_HENTRY_FLAG_VALID)
             continue;
 
         ent_key = table->ht_get_key(htable, ent, &ent_key_len);
@@ -606,7 +1073,8 @@ vr_htable_find_hentry(vr_htable_t htable, void *key, unsigned int key_len)
     for (o_ent = ent->hentry_next; o_ent; o_ent = o_ent->hentry_next) {
 
         /* Though in the list, can be under the deletion */
-        if (!(o_ent->hentry_flags & VR_HENTRY_FLAG_VALID))
+        if ((o_ent->hentry_flags & (VR_HENTRY_FLAG_VALID |
+                        VR_HENTRY_FLAG_HIDDEN)) != VR_HENTRY_FLAG_VALID)
             continue;
 
         ent_key = table->ht_get_key(htable, o_ent, &ent_key_len);
@@ -621,6 +1089,144 @@ vr_htable_find_hentry(vr_htable_t htable, void *key, unsigned int key_len)
     return NULL;
 }
 
+vr_hentry_t *
+vr_htable_find_hentry(vr_htable_t htable, void *key, unsigned int key_len)
+{
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (!table || !key)
+        return NULL;
+
+    if (!key_len) {
+        key_len = table->ht_key_size;
+        if (!key_len)
+            return NULL;
+    }
+
+    return __vr_htable_find_hentry(table, key, key_len,
+            vr_hash(key, key_len, 0));
+}
+
+/*
+ * Same as vr_htable_find_hentry, but with the hash already computed by
+ * vr_htable_hash. Used by the burst lookups, which hash all the keys and
+ * prefetch the buckets before resolving any of them
+ */
+vr_hentry_t *
+vr_htable_find_hentry_by_hash(vr_htable_t htable, void *key,
+        unsigned int key_len, unsigned int hash)
+{
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (!table || !key)
+        return NULL;
+
+    if (!key_len) {
+        key_len = table->ht_key_size;
+        if (!key_len)
+            return NULL;
+    }
+
+    return __vr_htable_find_hentry(table, key, key_len, hash);
+}
+
+/*
+ * Whether an entry found earlier is still visible and still holds key,
+ * for the users that carry an entry over from a burst lookup to the
+ * packet it was looked up for
+ */
+bool
+vr_htable_hentry_match(vr_htable_t htable, vr_hentry_t *ent, void *key,
+        unsigned int key_len)
+{
+    unsigned int ent_key_len;
+    vr_hentry_key ent_key;
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (!table || !ent || !key)
+        return false;
+
+    if (!key_len)
+        key_len = table->ht_key_size;
+
+    if ((ent->hentry_flags & (VR_HENTRY_FLAG_VALID |
+                    VR_HENTRY_FLAG_HIDDEN)) != VR_HENTRY_FLAG_VALID)
+        return false;
+
+    ent_key = table->ht_get_key(htable, ent, &ent_key_len);
+    if (!ent_key || (key_len != ent_key_len))
+        return false;
+
+    return !memcmp(ent_key, key, key_len);
+}
+
+unsigned int
+vr_htable_hash(vr_htable_t htable, void *key, unsigned int key_len)
+{
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (!key_len)
+        key_len = table->ht_key_size;
+
+    return vr_hash(key, key_len, 0);
+}
+
+/*
+ * Prefetches what a lookup of a key with this hash reads first: the two
+ * buckets of the cuckoo index if there is one, the hash bucket otherwise
+ */
+void
+vr_htable_prefetch_by_hash(vr_htable_t htable, unsigned int hash)
+{
+    unsigned int bucket;
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (vr_htable_cuckoo_enabled(table)) {
+        bucket = hash & (table->ht_cbuckets - 1);
+        vr_prefetch(vr_htable_get_cbucket(table, bucket));
+        vr_prefetch(vr_htable_get_cbucket(table,
+                    vr_htable_cuckoo_alt_bucket(table, bucket,
+                        vr_htable_cuckoo_sig(hash))));
+        return;
+    }
+
+    vr_prefetch(vr_htable_get_bucket_by_hash(htable, hash));
+
+    return;
+}
+
+vr_hentry_t *
+vr_htable_get_bucket_by_hash(vr_htable_t htable, unsigned int hash)
+{
+    unsigned int tmp_hash;
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    tmp_hash = hash % table->ht_hentries;
+    tmp_hash &= ~(table->ht_bucket_size - 1);
+
+    return vr_btable_get(table->ht_htable, tmp_hash);
+}
+
+/*
+ * Number of the hash buckets, and bucket of a key of this hash. Entry 'i'
+ * of bucket 'b' is the one of index (b * VR_HENTRIES_PER_BUCKET) + i
+ */
+unsigned int
+vr_htable_buckets(vr_htable_t htable)
+{
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    return table->ht_hentries / table->ht_bucket_size;
+}
+
+unsigned int
+vr_htable_bucket_by_hash(vr_htable_t htable, unsigned int hash)
+{
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    return (hash % table->ht_hentries) / table->ht_bucket_size;
+}
+
 unsigned int
 vr_htable_used_oflow_entries(vr_htable_t htable)
 {
@@ -646,6 +1252,7 @@ vr_htable_used_total_entries(vr_htable_t htable)
 unsigned int
 vr_htable_size(vr_htable_t htable)
 {
+    unsigned int i;
     struct vr_htable *table = (struct vr_htable *)htable;
     unsigned int size = 0;
 
@@ -654,6 +1261,8 @@ vr_htable_size(vr_htable_t htable)
             size = vr_btable_size(table->ht_htable);
         if (table->ht_otable)
             size += vr_btable_size(table->ht_otable);
+        for (i = 0; i < table->ht_oext_count; i++)
+            size += vr_btable_size(table->ht_oext[i]);
     }
 
     return size;
@@ -662,6 +1271,7 @@ vr_htable_size(vr_htable_t htable)
 void *
 vr_htable_get_address(vr_htable_t htable, uint64_t offset)
 {
+    unsigned int i;
     struct vr_htable *table = (struct vr_htable *)htable;
     unsigned int size = vr_btable_size(table->ht_htable);
     struct vr_btable *btable;
@@ -670,6 +1280,16 @@ vr_htable_get_address(vr_htable_t htable, uint64_t offset)
     if (offset >= size) {
         offset -= size;
         btable = table->ht_otable;
+
+        /* the extensions follow the overflow table, in order */
+        for (i = 0; i < table->ht_oext_count; i++) {
+            size = vr_btable_size(btable);
+            if (offset < size)
+                break;
+
+            offset -= size;
+            btable = table->ht_oext[i];
+        }
     }
 
     return vr_btable_get_address(btable, offset);
@@ -798,9 +1418,171 @@ vr_htable_attach(struct vrouter *router, unsigned int entries,
             entry_size, key_size, bucket_size, get_entry_key);
 }
 
+/*
+ * Rebuilds the overflow chains and the free list of a table attached to
+ * memory that a previous instance left entries in. The pointers in the
+ * entries mean nothing anymore, so the chains are put together again from
+ * the bucket index each valid overflow entry carries. Entries that were
+ * being deleted, or were hidden, are not brought back.
+ */
+static void
+vr_htable_rebuild(struct vr_htable *table)
+{
+    unsigned int i, bucket;
+    vr_hentry_t *ent, *head;
+
+    table->ht_free_oentry_head = NULL;
+    table->ht_used_entries = 0;
+    table->ht_used_oentries = 0;
+
+    for (i = 0; i < table->ht_hentries; i++) {
+        ent = vr_btable_get(table->ht_htable, i);
+        ent->hentry_next = NULL;
+        ent->hentry_bucket_index = VR_INVALID_HENTRY_INDEX;
+        if ((ent->hentry_flags & (VR_HENTRY_FLAG_VALID |
+                        VR_HENTRY_FLAG_HIDDEN)) == VR_HENTRY_FLAG_VALID) {
+            ent->hentry_flags = VR_HENTRY_FLAG_VALID;
+            table->ht_used_entries++;
+        } else {
+            ent->hentry_flags = 0;
+        }
+    }
+
+    /* backwards, so that the free list hands the entries out in order */
+    for (i = table->ht_oentries; i-- > 0; ) {
+        ent = vr_btable_get(table->ht_otable, i);
+        bucket = ent->hentry_bucket_index;
+        if (((ent->hentry_flags & (VR_HENTRY_FLAG_VALID |
+                            VR_HENTRY_FLAG_HIDDEN |
+                            VR_HENTRY_FLAG_UNDER_DELETION)) ==
+                    VR_HENTRY_FLAG_VALID) &&
+                (bucket < table->ht_hentries) &&
+                ((bucket % table->ht_bucket_size) ==
+                 (table->ht_bucket_size - 1))) {
+            head = vr_btable_get(table->ht_htable, bucket);
+            ent->hentry_flags = VR_HENTRY_FLAG_VALID;
+            ent->hentry_next = head->hentry_next;
+            ent->hentry_next_index = head->hentry_next_index;
+            head->hentry_next = ent;
+            head->hentry_next_index = ent->hentry_index;
+            table->ht_used_entries++;
+            table->ht_used_oentries++;
+        } else {
+            ent->hentry_flags = VR_HENTRY_FLAG_IN_FREE_LIST;
+            ent->hentry_bucket_index = VR_INVALID_HENTRY_INDEX;
+            ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+            ent->hentry_next = table->ht_free_oentry_head;
+            table->ht_free_oentry_head = ent;
+        }
+    }
+
+    return;
+}
+
+/*
+ * Attaches to memory that holds the entries of a table of the same
+ * geometry, as a previous instance left it, keeping the valid entries
+ */
+vr_htable_t
+vr_htable_restore(struct vrouter *router, unsigned int entries,
+        void *htable, unsigned int oentries, void *otable,
+        unsigned int entry_size, unsigned int key_size,
+        unsigned int bucket_size, get_hentry_key get_entry_key)
+{
+    struct vr_htable *table;
+
+    if (!entries || !htable || (oentries && !otable))
+        return NULL;
+
+    table = (struct vr_htable *)__vr_htable_create(router, entries, htable,
+            oentries, otable, entry_size, key_size, bucket_size,
+            get_entry_key);
+    if (!table)
+        return NULL;
+
+    vr_htable_rebuild(table);
+
+    return (vr_htable_t)table;
+}
+
+/*
+ * Adds 'oentries' overflow entries to the table, in 'mem' if the caller
+ * has the memory for them, or in freshly allocated memory otherwise. The
+ * existing entries are not touched, and the new ones are numbered after
+ * them, so this can be done while the table is in use. Callers serialize
+ * the growth of a table among themselves.
+ */
+int
+vr_htable_grow_oentries(vr_htable_t htable, unsigned int oentries, void *mem)
+{
+    unsigned int i, start, count;
+    vr_hentry_t *ent, *first = NULL, *prev = NULL, *head;
+    struct vr_btable *btable;
+    struct vr_htable *table = (struct vr_htable *)htable;
+    struct iovec iov;
+
+    /* without an overflow table there is no delete data to grow into */
+    if (!table || !oentries || !table->ht_otable)
+        return -EINVAL;
+
+    count = table->ht_oext_count;
+    if (count >= VR_HTABLE_MAX_OEXT)
+        return -ENOSPC;
+
+    if (!mem) {
+        btable = vr_btable_alloc(oentries, table->ht_entry_size);
+    } else {
+        iov.iov_base = mem;
+        iov.iov_len = table->ht_entry_size * oentries;
+        btable = vr_btable_attach(&iov, 1, table->ht_entry_size);
+    }
+
+    if (!btable)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, oentries);
+
+    start = table->ht_oentries;
+    for (i = 0; i < oentries; i++) {
+        ent = vr_btable_get(btable, i);
+        memset(ent, 0, table->ht_entry_size);
+        ent->hentry_index = table->ht_hentries + start + i;
+        ent->hentry_bucket_index = VR_INVALID_HENTRY_INDEX;
+        ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+        ent->hentry_flags = VR_HENTRY_FLAG_IN_FREE_LIST;
+        if (prev)
+            prev->hentry_next = ent;
+        else
+            first = ent;
+        prev = ent;
+    }
+
+    table->ht_oext[count] = btable;
+    table->ht_oext_start[count] = start;
+    vr_sync_synchronize();
+    table->ht_oext_count = count + 1;
+    vr_sync_synchronize();
+    table->ht_oentries = start + oentries;
+    vr_sync_synchronize();
+
+    if (vr_htable_cuckoo_enabled(table)) {
+        table->ht_cfailed = 1;
+        vr_printf("vrouter: cuckoo index does not cover grown table, "
+                "falling back to chaining\n");
+    }
+
+    /* the new entries only become reachable through the free list */
+    do {
+        head = table->ht_free_oentry_head;
+        prev->hentry_next = head;
+    } while (!vr_sync_bool_compare_and_swap_p(&table->ht_free_oentry_head,
+                head, first));
+
+    return 0;
+}
+
 void
 vr_htable_delete(vr_htable_t htable)
 {
+    unsigned int i;
     struct vr_htable *table = (struct vr_htable *)htable;
 
     if (!table)
@@ -812,9 +1594,18 @@ vr_htable_delete(vr_htable_t htable)
     if (table->ht_otable)
         vr_btable_free(table->ht_otable);
 
+    for (i = 0; i < table->ht_oext_count; i++)
+        vr_btable_free(table->ht_oext[i]);
+
     if (table->ht_dtable)
         vr_btable_free(table->ht_dtable);
 
+    if (table->ht_ctable)
+        vr_btable_free(table->ht_ctable);
+
+    if (table->ht_cslots)
+        vr_btable_free(table->ht_cslots);
+
     vr_free(table, VR_HTABLE_OBJECT);
 
     return;
@@ -838,3 +1629,36 @@ vr_hentry_t *vr_htable_get_bucket(vr_htable_t htable, void *key,
 	tmp_hash &= ~(table->ht_bucket_size - 1);
 	return vr_btable_get(table->ht_htable, tmp_hash);
 }
+
+/*
+ * Calls 'cb' for every valid entry of the bucket that 'key' hashes to,
+ * including the overflow entries chained off it. Unlike the find
+ * routines, the entries are not filtered through ht_get_key, nor skipped
+ * when hidden, so that callers get to see entries that are claimed but not
+ * yet published.
+ */
+void
+vr_htable_trav_bucket(vr_htable_t htable, void *key, unsigned int key_len,
+        htable_trav_cb cb, void *data)
+{
+    unsigned int i;
+    vr_hentry_t *head, *ent = NULL, *o_ent;
+    struct vr_htable *table = (struct vr_htable *)htable;
+
+    if (!table || !key || !cb)
+        return;
+
+    head = vr_htable_get_bucket(htable, key, key_len);
+    for (i = 0; i < table->ht_bucket_size; i++) {
+        ent = vr_btable_get(table->ht_htable, head->hentry_index + i);
+        if (ent->hentry_flags & VR_HENTRY_FLAG_VALID)
+            cb(htable, ent, ent->hentry_index, data);
+    }
+
+    for (o_ent = ent->hentry_next; o_ent; o_ent = o_ent->hentry_next) {
+        if (o_ent->hentry_flags & VR_HENTRY_FLAG_VALID)
+            cb(htable, o_ent, o_ent->hentry_index, data);
+    }
+
+    return;
+}
@@ -9,6 +9,9 @@
 #include "vr_message.h"
 #include "vr_btable.h"
 #include "vrouter.h"
+#include "vr_dst_cache.h"
+#include "vr_bridge.h"
+#include "vr_route.h"
 
 extern const char *ContrailBuildInfo;
 
@@ -28,3 +31,96 @@ vr_info_get_version(VR_INFO_ARGS)
     return 0;
 }
 
+int
+vr_info_get_dst_cache(VR_INFO_ARGS)
+{
+    uint64_t hits, misses;
+
+    VR_INFO_BUF_INIT();
+    vr_dst_cache_stats(&hits, &misses);
+    VI_PRINTF("Destination cache entries per cpu: %u\n", vr_dst_cache_entries);
+    VI_PRINTF("Hits: %llu\n", (unsigned long long)hits);
+    VI_PRINTF("Misses: %llu\n\n", (unsigned long long)misses);
+    return 0;
+}
+
+int
+vr_info_get_bridge_learn(VR_INFO_ARGS)
+{
+    struct vr_bridge_learn_stats stats;
+
+    VR_INFO_BUF_INIT();
+    vr_bridge_learn_stats(&stats);
+    VI_PRINTF("Asynchronous learns per interface a second: %u\n",
+            vr_bridge_learn_rate);
+    VI_PRINTF("Posted: %llu\n", (unsigned long long)stats.bls_posted);
+    VI_PRINTF("Held: %llu\n", (unsigned long long)stats.bls_held);
+    VI_PRINTF("Ring full: %llu\n", (unsigned long long)stats.bls_full);
+    VI_PRINTF("Learnt: %llu\n", (unsigned long long)stats.bls_learnt);
+    VI_PRINTF("Known: %llu\n", (unsigned long long)stats.bls_known);
+    VI_PRINTF("Rate limited: %llu\n",
+            (unsigned long long)stats.bls_rate_limited);
+    VI_PRINTF("Failed: %llu\n\n", (unsigned long long)stats.bls_failed);
+    return 0;
+}
+
+/*
+ * What the mtries take, for the vrf given as inbuf, or for all the vrfs
+ * with more than a default route or with something retired
+ */
+int
+vr_info_get_fib(VR_INFO_ARGS)
+{
+    int vrf = -1;
+    unsigned int i, j, f, max_vrfs;
+    unsigned int families[] = { AF_INET, AF_INET6 };
+    struct vr_fib_vrf_mem mem;
+    struct vrouter *router = vrouter_get(0);
+
+    VR_INFO_BUF_INIT();
+
+    if (msg_req->inbuf && msg_req->inbuf_len) {
+        vrf = 0;
+        for (i = 0; i < msg_req->inbuf_len; i++) {
+            if ((msg_req->inbuf[i] < '0') || (msg_req->inbuf[i] > '9') ||
+                    (vrf >= VR_MAX_VRFS)) {
+                VI_PRINTF("Invalid vrf\n");
+                return 0;
+            }
+            vrf = (vrf * 10) + (msg_req->inbuf[i] - '0');
+        }
+    }
+
+    max_vrfs = router ? router->vr_max_vrfs : 0;
+    VI_PRINTF("FIB memory (buckets by level, the root first)\n");
+    for (i = 0; i < max_vrfs; i++) {
+        if ((vrf >= 0) && (i != (unsigned int)vrf))
+            continue;
+
+        for (f = 0; f < ARRAYSIZE(families); f++) {
+            if (vr_inet_fib_vrf_mem(i, families[f], &mem))
+                continue;
+
+            if ((vrf < 0) && !mem.fvm_depth && !mem.fvm_retired_buckets &&
+                    !mem.fvm_retired_leaves)
+                continue;
+
+            VI_PRINTF("Vrf %u %s: depth %u, buckets ", i,
+                    (families[f] == AF_INET6) ? "inet6" : "inet",
+                    mem.fvm_depth);
+            for (j = 0; j < mem.fvm_depth; j++)
+                VI_PRINTF("%s%u", j ? "/" : "", mem.fvm_buckets[j]);
+            if (!mem.fvm_depth)
+                VI_PRINTF("0");
+            VI_PRINTF(", shared %u, leaves %u, bytes %llu\n",
+                    mem.fvm_shared_buckets, mem.fvm_leaves,
+                    (unsigned long long)mem.fvm_bytes);
+            VI_PRINTF("    Retired: buckets %u, leaves %u, bytes %llu\n",
+                    mem.fvm_retired_buckets, mem.fvm_retired_leaves,
+                    (unsigned long long)mem.fvm_retired_bytes);
+        }
+    }
+    VI_PRINTF("\n");
+
+    return 0;
+}
@@ -2495,6 +2495,7 @@ vr_interface_change(struct vr_interface *vif, vr_interface_req *req)
     vif->vif_nh_id = req->vifr_nh_id;
     vif->vif_qos_map_index = req->vifr_qos_map_index;
     vif->vif_isid = req->vifr_isid;
+    vif->vif_flow_quota = req->vifr_flow_quota;
     if (req->vifr_pbb_mac_size)
         VR_MAC_COPY(vif->vif_pbb_mac, req->vifr_pbb_mac);
 
@@ -2676,6 +2677,7 @@ vr_interface_add(vr_interface_req *req, bool need_response)
     vif->vif_nh_id = req->vifr_nh_id;
     vif->vif_qos_map_index = req->vifr_qos_map_index;
     vif->vif_isid = req->vifr_isid;
+    vif->vif_flow_quota = req->vifr_flow_quota;
     if (req->vifr_pbb_mac_size)
         VR_MAC_COPY(vif->vif_pbb_mac, req->vifr_pbb_mac);
 
@@ -2832,6 +2834,8 @@ vr_interface_add_response(vr_interface_req *req,
     req->vifr_dev_obytes += stats->vis_dev_obytes;
     req->vifr_dev_opackets += stats->vis_dev_opackets;
     req->vifr_dev_oerrors += stats->vis_dev_oerrors;
+
+    req->vifr_flow_quota_drops += stats->vis_flow_quota_drops;
 }
 
 static uint64_t
@@ -3052,6 +3056,7 @@ __vr_interface_make_req(vr_interface_req *req, struct vr_interface *intf,
     }
 
     req->vifr_isid = intf->vif_isid;
+    req->vifr_flow_quota = intf->vif_flow_quota;
     if (!IS_MAC_ZERO(intf->vif_pbb_mac) && req->vifr_pbb_mac) {
         req->vifr_pbb_mac_size = VR_ETHER_ALEN;
         VR_MAC_COPY(req->vifr_pbb_mac, intf->vif_pbb_mac);
@@ -3090,6 +3095,7 @@ __vr_interface_make_req(vr_interface_req *req, struct vr_interface *intf,
     req->vifr_dev_obytes = 0;
     req->vifr_dev_opackets = 0;
     req->vifr_dev_oerrors = 0;
+    req->vifr_flow_quota_drops = 0;
 
     /* call host callback if available */
     if (hif_ops->hif_stats_update) {
@@ -0,0 +1,496 @@
+/*
+ * vr_ip6_fib.c -- IPv6 forwarding table
+ */
+#include <vr_os.h>
+#include <vr_types.h>
+#include <vrouter.h>
+#include "vr_route.h"
+#include "vr_nexthop.h"
+#include "vr_flow.h"
+#include "vr_ip_mtrie.h"
+#include "vr_htable.h"
+#include "vr_ip6_fib.h"
+
+unsigned int vr_ip6_fib_entries = VR_DEF_IP6_FIB_ENTRIES;
+unsigned int vr_ip6_fib_oentries = VR_DEF_IP6_FIB_OENTRIES;
+
+static vr_htable_t ip6_fib_table;
+static struct vr_ip6_fib_vrf **ip6_fib_vrfs;
+static unsigned int ip6_fib_max_vrfs;
+/* the routes that the table has no entry for, of any vrf */
+static struct vr_ip6_fib_key ip6_fib_missing[VR_IP6_FIB_MISSING];
+static unsigned int ip6_fib_nmissing;
+/* by vrf, the missing routes beyond the ones kept track of */
+static unsigned int *ip6_fib_untracked;
+
+static vr_hentry_key
+ip6_fib_entry_key(vr_htable_t table, vr_hentry_t *entry,
+        unsigned int *key_len)
+{
+    struct vr_ip6_fib_entry *fe = (struct vr_ip6_fib_entry *)entry;
+
+    if (!fe || !(fe->fe_flags & VR_IP6_FIB_FLAG_VALID))
+        return NULL;
+
+    if (key_len)
+        *key_len = sizeof(fe->fe_key);
+
+    return &fe->fe_key;
+}
+
+static void
+ip6_fib_make_key(struct vr_ip6_fib_key *key, unsigned int vrf_id,
+        uint8_t *prefix, unsigned int prefix_len)
+{
+    unsigned int bytes = prefix_len / 8, bits = prefix_len % 8;
+
+    memset(key, 0, sizeof(*key));
+    memcpy(key->fk_prefix, prefix, bytes);
+    if (bits)
+        key->fk_prefix[bytes] = prefix[bytes] & (uint8_t)(0xFF << (8 - bits));
+    key->fk_vrf_id = vrf_id;
+    key->fk_prefix_len = prefix_len;
+
+    return;
+}
+
+/*
+ * Takes a reference of the nexthop of the route, or of the discard nexthop
+ * if that nexthop got deleted meanwhile, the same as the mtrie does
+ */
+static struct vr_nexthop *
+ip6_fib_get_nexthop(struct vr_nexthop *nh)
+{
+    struct vr_nexthop *tmp_nh;
+
+    tmp_nh = vrouter_get_nexthop(nh->nh_rid, nh->nh_id);
+    if (tmp_nh != nh) {
+        if (tmp_nh)
+            vrouter_put_nexthop(tmp_nh);
+
+        nh = vrouter_get_nexthop(nh->nh_rid, NH_DISCARD_ID);
+    }
+
+    return nh;
+}
+
+static void
+ip6_fib_set_entry(struct vr_ip6_fib_entry *fe, struct vr_route_req *rt)
+{
+    struct vr_nexthop *old_nh = fe->fe_nh;
+
+    fe->fe_nh = ip6_fib_get_nexthop(rt->rtr_nh);
+    fe->fe_label_flags = rt->rtr_req.rtr_label_flags;
+    fe->fe_label = rt->rtr_req.rtr_label;
+    fe->fe_bridge_index = rt->rtr_req.rtr_index;
+
+    if (old_nh)
+        vrouter_put_nexthop(old_nh);
+
+    return;
+}
+
+static int
+ip6_fib_missing_find(struct vr_ip6_fib_key *key)
+{
+    unsigned int i;
+
+    for (i = 0; i < ip6_fib_nmissing; i++) {
+        if (!memcmp(&ip6_fib_missing[i], key, sizeof(*key)))
+            return i;
+    }
+
+    return -1;
+}
+
+static void
+ip6_fib_missing_add(struct vr_ip6_fib_key *key)
+{
+    struct vr_ip6_fib_vrf *fv;
+
+    if (ip6_fib_missing_find(key) >= 0)
+        return;
+
+    if (ip6_fib_nmissing == VR_IP6_FIB_MISSING) {
+        ip6_fib_untracked[key->fk_vrf_id]++;
+        return;
+    }
+
+    memcpy(&ip6_fib_missing[ip6_fib_nmissing++], key, sizeof(*key));
+    fv = ip6_fib_vrfs[key->fk_vrf_id];
+    if (fv)
+        fv->fv_missing++;
+
+    return;
+}
+
+/* returns true if the route was missing, and is not any more */
+static bool
+ip6_fib_missing_del(struct vr_ip6_fib_key *key)
+{
+    int i;
+    struct vr_ip6_fib_vrf *fv;
+
+    i = ip6_fib_missing_find(key);
+    if (i < 0)
+        return false;
+
+    if ((unsigned int)i != --ip6_fib_nmissing)
+        memcpy(&ip6_fib_missing[i], &ip6_fib_missing[ip6_fib_nmissing],
+                sizeof(*key));
+
+    fv = ip6_fib_vrfs[key->fk_vrf_id];
+    if (fv && fv->fv_missing)
+        fv->fv_missing--;
+
+    return true;
+}
+
+static void
+ip6_fib_entry_free(vr_htable_t table, vr_hentry_t *hentry,
+        unsigned int index, void *data)
+{
+    struct vr_nexthop *nh;
+    struct vr_ip6_fib_entry *fe = (struct vr_ip6_fib_entry *)hentry;
+
+    if (!fe)
+        return;
+
+    fe->fe_flags = 0;
+
+    nh = fe->fe_nh;
+    fe->fe_nh = NULL;
+    if (nh)
+        vrouter_put_nexthop(nh);
+
+    vr_htable_release_hentry(table, hentry);
+
+    return;
+}
+
+static void
+ip6_fib_entry_free_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *defer = (struct vr_defer_data *)data;
+    struct vr_ip6_fib_entry *fe;
+
+    if (!defer)
+        return;
+
+    /* unless a reset of the table freed it meanwhile */
+    fe = (struct vr_ip6_fib_entry *)defer->vdd_data;
+    if (ip6_fib_table && (fe->fe_flags & VR_IP6_FIB_FLAG_DELETED))
+        ip6_fib_entry_free(ip6_fib_table, &fe->fe_hentry, 0, NULL);
+
+    return;
+}
+
+/*
+ * The lookups do not take a reference of the entry, so it stays, nexthop
+ * and all, until the ones that might have found it are done. Taking the
+ * key away keeps new lookups and adds from finding it meanwhile.
+ */
+static void
+ip6_fib_entry_free_defer(struct vr_ip6_fib_entry *fe)
+{
+    struct vr_defer_data *defer;
+
+    fe->fe_flags = VR_IP6_FIB_FLAG_DELETED;
+
+    defer = vr_get_defer_data(sizeof(*defer));
+    if (!defer) {
+        vr_delay_op();
+        ip6_fib_entry_free(ip6_fib_table, &fe->fe_hentry, 0, NULL);
+        return;
+    }
+
+    defer->vdd_data = (void *)fe;
+    vr_defer(vrouter_get(0), ip6_fib_entry_free_cb, (void *)defer);
+
+    return;
+}
+
+static struct vr_ip6_fib_vrf *
+ip6_fib_get_vrf(unsigned int vrf_id)
+{
+    unsigned int i;
+    struct vr_ip6_fib_vrf *fv;
+
+    if (vrf_id >= ip6_fib_max_vrfs)
+        return NULL;
+
+    fv = ip6_fib_vrfs[vrf_id];
+    if (fv)
+        return fv;
+
+    fv = vr_zalloc(sizeof(*fv), VR_MTRIE_TABLE_OBJECT);
+    if (!fv)
+        return NULL;
+
+    /* routes that went missing while the vrf could not be set up */
+    for (i = 0; i < ip6_fib_nmissing; i++) {
+        if (ip6_fib_missing[i].fk_vrf_id == vrf_id)
+            fv->fv_missing++;
+    }
+
+    vr_sync_synchronize();
+    ip6_fib_vrfs[vrf_id] = fv;
+
+    return fv;
+}
+
+/*
+ * Called by the mtrie once it took the route. The route request is what
+ * the mtrie made of it: the label, the bridge index and a reference of
+ * the nexthop.
+ */
+void
+ip6_fib_add(struct vr_route_req *rt)
+{
+    unsigned int len = rt->rtr_req.rtr_prefix_len;
+    struct vr_ip6_fib_key key;
+    struct vr_ip6_fib_vrf *fv;
+    struct vr_ip6_fib_entry *fe;
+
+    if (!ip6_fib_table || !rt->rtr_nh || !rt->rtr_req.rtr_prefix ||
+            (len > IP6_PREFIX_LEN))
+        return;
+
+    /* the mtrie is looked up for such vrfs anyway */
+    if (rt->rtr_req.rtr_vrf_id >= ip6_fib_max_vrfs)
+        return;
+
+    ip6_fib_make_key(&key, rt->rtr_req.rtr_vrf_id, rt->rtr_req.rtr_prefix,
+            len);
+    fv = ip6_fib_get_vrf(rt->rtr_req.rtr_vrf_id);
+    if (!fv) {
+        ip6_fib_missing_add(&key);
+        return;
+    }
+
+    fe = (struct vr_ip6_fib_entry *)vr_htable_find_hentry(ip6_fib_table,
+            &key, 0);
+    if (fe) {
+        ip6_fib_set_entry(fe, rt);
+        return;
+    }
+
+    fe = (struct vr_ip6_fib_entry *)vr_htable_find_free_hentry(ip6_fib_table,
+            &key, 0);
+    if (!fe) {
+        ip6_fib_missing_add(&key);
+        return;
+    }
+
+    memcpy(&fe->fe_key, &key, sizeof(key));
+    fe->fe_nh = NULL;
+    ip6_fib_set_entry(fe, rt);
+    /* the entry is looked at only once it is complete */
+    vr_sync_synchronize();
+    fe->fe_flags = VR_IP6_FIB_FLAG_VALID;
+
+    if (!fv->fv_routes[len]++)
+        fv->fv_lengths[len / 64] |= (1ULL << (len % 64));
+
+    /* in the table now, for lookups after its length is set */
+    vr_sync_synchronize();
+    ip6_fib_missing_del(&key);
+
+    return;
+}
+
+void
+ip6_fib_del(struct vr_route_req *rt)
+{
+    unsigned int len = rt->rtr_req.rtr_prefix_len;
+    struct vr_ip6_fib_key key;
+    struct vr_ip6_fib_vrf *fv;
+    struct vr_ip6_fib_entry *fe;
+
+    if (!ip6_fib_table || !rt->rtr_req.rtr_prefix ||
+            (len > IP6_PREFIX_LEN) ||
+            (rt->rtr_req.rtr_vrf_id >= ip6_fib_max_vrfs))
+        return;
+
+    ip6_fib_make_key(&key, rt->rtr_req.rtr_vrf_id, rt->rtr_req.rtr_prefix,
+            len);
+    if (ip6_fib_missing_del(&key))
+        return;
+
+    fe = NULL;
+    fv = ip6_fib_vrfs[rt->rtr_req.rtr_vrf_id];
+    if (fv)
+        fe = (struct vr_ip6_fib_entry *)vr_htable_find_hentry(ip6_fib_table,
+                &key, 0);
+
+    /* neither in the table nor kept track of, hence one of the untracked */
+    if (!fe) {
+        if (ip6_fib_untracked[rt->rtr_req.rtr_vrf_id])
+            ip6_fib_untracked[rt->rtr_req.rtr_vrf_id]--;
+        return;
+    }
+
+    ip6_fib_entry_free_defer(fe);
+
+    if (fv->fv_routes[len] && !--fv->fv_routes[len])
+        fv->fv_lengths[len / 64] &= ~(1ULL << (len % 64));
+
+    return;
+}
+
+/*
+ * Longest prefix match of the prefix of 'rt', amongst the routes of up to
+ * its prefix length. Returns NULL if the mtrie has to be looked up
+ * instead.
+ */
+struct vr_nexthop *
+ip6_fib_lookup(unsigned int vrf_id, struct vr_route_req *rt)
+{
+    int word;
+    unsigned int i, n, bit, len;
+    uint64_t lengths;
+    unsigned int hashes[VR_IP6_FIB_PROBES];
+    struct vr_ip6_fib_key keys[VR_IP6_FIB_PROBES];
+    struct vr_ip6_fib_vrf *fv;
+    struct vr_ip6_fib_entry *fe;
+    struct vr_nexthop *nh;
+
+    if (!ip6_fib_table || (vrf_id >= ip6_fib_max_vrfs) ||
+            !rt->rtr_req.rtr_prefix)
+        return NULL;
+
+    fv = ip6_fib_vrfs[vrf_id];
+    if (!fv || fv->fv_missing || ip6_fib_untracked[vrf_id])
+        return NULL;
+
+    len = rt->rtr_req.rtr_prefix_len;
+    if (len > IP6_PREFIX_LEN)
+        len = IP6_PREFIX_LEN;
+
+    word = len / 64;
+    lengths = fv->fv_lengths[word];
+    if ((len % 64) != 63)
+        lengths &= (1ULL << ((len % 64) + 1)) - 1;
+
+    while (1) {
+        /* hash the next lot of lengths, longest first, and prefetch them */
+        for (n = 0; n < VR_IP6_FIB_PROBES; ) {
+            if (!lengths) {
+                if (--word < 0)
+                    break;
+                lengths = fv->fv_lengths[word];
+                continue;
+            }
+
+            bit = 63 - vr_clz_64(lengths);
+            lengths &= ~(1ULL << bit);
+
+            ip6_fib_make_key(&keys[n], vrf_id, rt->rtr_req.rtr_prefix,
+                    (word * 64) + bit);
+            hashes[n] = vr_htable_hash(ip6_fib_table, &keys[n], 0);
+            vr_htable_prefetch_by_hash(ip6_fib_table, hashes[n]);
+            n++;
+        }
+
+        if (!n)
+            return NULL;
+
+        for (i = 0; i < n; i++) {
+            fe = (struct vr_ip6_fib_entry *)
+                vr_htable_find_hentry_by_hash(ip6_fib_table, &keys[i], 0,
+                        hashes[i]);
+            if (!fe)
+                continue;
+
+            /* under deletion */
+            nh = fe->fe_nh;
+            if (!nh)
+                continue;
+
+            rt->rtr_req.rtr_label_flags = fe->fe_label_flags;
+            rt->rtr_req.rtr_label = fe->fe_label;
+            rt->rtr_req.rtr_prefix_len = fe->fe_key.fk_prefix_len;
+            rt->rtr_req.rtr_index = fe->fe_bridge_index;
+            rt->rtr_nh = nh;
+
+            return nh;
+        }
+    }
+}
+
+void
+ip6_fib_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs,
+        bool soft_reset)
+{
+    unsigned int i;
+
+    if (!ip6_fib_table)
+        return;
+
+    vr_htable_reset(ip6_fib_table, ip6_fib_entry_free, NULL);
+
+    for (i = 0; i < ip6_fib_max_vrfs; i++) {
+        if (!ip6_fib_vrfs[i])
+            continue;
+
+        if (soft_reset) {
+            memset(ip6_fib_vrfs[i], 0, sizeof(struct vr_ip6_fib_vrf));
+        } else {
+            vr_free(ip6_fib_vrfs[i], VR_MTRIE_TABLE_OBJECT);
+            ip6_fib_vrfs[i] = NULL;
+        }
+    }
+    ip6_fib_nmissing = 0;
+    memset(ip6_fib_untracked, 0, sizeof(unsigned int) * ip6_fib_max_vrfs);
+
+    if (!soft_reset) {
+        vr_htable_delete(ip6_fib_table);
+        ip6_fib_table = NULL;
+        vr_free(ip6_fib_vrfs, VR_MTRIE_TABLE_OBJECT);
+        ip6_fib_vrfs = NULL;
+        vr_free(ip6_fib_untracked, VR_MTRIE_TABLE_OBJECT);
+        ip6_fib_untracked = NULL;
+        ip6_fib_max_vrfs = 0;
+    }
+
+    return;
+}
+
+int
+ip6_fib_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
+{
+    unsigned int size;
+
+    /* If table already exists, or is not wanted, dont create */
+    if (ip6_fib_table || !vr_ip6_fib_entries)
+        return 0;
+
+    size = sizeof(struct vr_ip6_fib_vrf *) * fs->rtb_max_vrfs;
+    ip6_fib_vrfs = vr_zalloc(size, VR_MTRIE_TABLE_OBJECT);
+    if (!ip6_fib_vrfs)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    size = sizeof(unsigned int) * fs->rtb_max_vrfs;
+    ip6_fib_untracked = vr_zalloc(size, VR_MTRIE_TABLE_OBJECT);
+    if (!ip6_fib_untracked) {
+        vr_free(ip6_fib_vrfs, VR_MTRIE_TABLE_OBJECT);
+        ip6_fib_vrfs = NULL;
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+    }
+
+    ip6_fib_table = vr_htable_create(vrouter_get(0), vr_ip6_fib_entries,
+            vr_ip6_fib_oentries, sizeof(struct vr_ip6_fib_entry),
+            sizeof(struct vr_ip6_fib_key), 0, ip6_fib_entry_key);
+    if (!ip6_fib_table) {
+        vr_free(ip6_fib_untracked, VR_MTRIE_TABLE_OBJECT);
+        ip6_fib_untracked = NULL;
+        vr_free(ip6_fib_vrfs, VR_MTRIE_TABLE_OBJECT);
+        ip6_fib_vrfs = NULL;
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                vr_ip6_fib_entries);
+    }
+
+    ip6_fib_max_vrfs = fs->rtb_max_vrfs;
+
+    return 0;
+}
@@ -12,6 +12,8 @@
 #include "vr_bridge.h"
 #include "vr_datapath.h"
 #include "vr_ip_mtrie.h"
+#include "vr_ip6_fib.h"
+#include "vr_dst_cache.h"
 
 extern unsigned int vr_vrfs;
 
@@ -41,6 +43,24 @@ struct ip_mtrie **vn_rtable[2];
 static int algo_init_done = 0;
 static vr_route_req dump_resp;
 
+#define MTRIE_BUCKET_BYTES      (sizeof(struct ip_bucket) + \
+        (IPBUCKET_LEVEL_SIZE * sizeof(struct ip_bucket_entry)))
+
+/*
+ * What each fib, a vrf and a family, has retired and waits for a grace
+ * period to free. Retired by the config thread and freed from the rcu
+ * callbacks, hence atomically updated.
+ */
+struct mtrie_fib_retired {
+    unsigned int mfr_buckets;
+    unsigned int mfr_leaves;
+};
+
+static struct mtrie_fib_retired *mtrie_fib_retired;
+static unsigned int mtrie_fibs;
+/* marks the leaves seen by a walk of vr_inet_fib_vrf_mem */
+static unsigned int mtrie_walk_gen;
+
 static int mtrie_debug = 0;
 
 static void
@@ -84,6 +104,37 @@ vrfid_to_mtrie(unsigned int vrf_id, unsigned int family)
 
 #define PREFIX_TO_INDEX(prefix, level) (prefix[level])
 
+static inline int
+mtrie_fib_index(unsigned int vrf_id, unsigned int family)
+{
+    return (vrf_id * 2) + ((family == AF_INET6) ? 1 : 0);
+}
+
+static void
+mtrie_fib_retire(int fib, unsigned int buckets, unsigned int leaves,
+        bool retire)
+{
+    struct mtrie_fib_retired *mfr;
+
+    if (!mtrie_fib_retired || (fib < 0) || ((unsigned int)fib >= mtrie_fibs))
+        return;
+
+    mfr = &mtrie_fib_retired[fib];
+    if (retire) {
+        if (buckets)
+            (void)vr_sync_add_and_fetch_32u(&mfr->mfr_buckets, buckets);
+        if (leaves)
+            (void)vr_sync_add_and_fetch_32u(&mfr->mfr_leaves, leaves);
+    } else {
+        if (buckets)
+            (void)vr_sync_sub_and_fetch_32u(&mfr->mfr_buckets, buckets);
+        if (leaves)
+            (void)vr_sync_sub_and_fetch_32u(&mfr->mfr_leaves, leaves);
+    }
+
+    return;
+}
+
 static inline unsigned int
 ip_bkt_get_max_level(int family)
 {
@@ -118,83 +169,253 @@ index_to_entry(struct ip_bucket *bkt, int index)
     return &bkt->bkt_data[index];
 }
 
-static void
-set_entry_to_bucket(struct ip_bucket_entry *ent, struct ip_bucket *bkt)
+static inline struct ip_bucket *
+entry_to_bucket(struct ip_bucket_entry *ent)
 {
-    struct vr_nexthop *tmp_nh = NULL;
+    if (ENTRY_IS_BUCKET(ent))
+        return PTR_TO_BUCKET(ENTRY_TO_PTR(ent));
+
+    return NULL;
+}
 
-    if (ENTRY_IS_NEXTHOP(ent)) {
-        /* save old... */
-        tmp_nh = ent->entry_nh_p;
+static inline struct ip_bucket_leaf *
+entry_to_leaf(struct ip_bucket_entry *ent)
+{
+    if (ENTRY_IS_NEXTHOP(ent) || ENTRY_IS_VDATA(ent))
+        return PTR_TO_LEAF(ENTRY_TO_PTR(ent));
+
+    return NULL;
+}
+
+static unsigned int
+entry_prefix_len(struct ip_bucket_entry *ent)
+{
+    struct ip_bucket *bkt;
+    struct ip_bucket_leaf *leaf;
+
+    bkt = entry_to_bucket(ent);
+    if (bkt)
+        return bkt->bkt_prefix_len;
+
+    leaf = entry_to_leaf(ent);
+    if (leaf)
+        return leaf->leaf_prefix_len;
+
+    return 0;
+}
+
+/*
+ * the nh pointer is something which will be retained. So, the leaf takes
+ * a reference of its own.
+ */
+static struct ip_bucket_leaf *
+mtrie_alloc_leaf(void *data, int data_is_nh, unsigned int prefix_len,
+        unsigned int label_flags, unsigned int label, unsigned int bridge_index,
+        int fib)
+{
+    struct vr_nexthop *nh, *tmp_nh;
+    struct ip_bucket_leaf *leaf;
+
+    leaf = vr_zalloc(sizeof(*leaf), VR_MTRIE_LEAF_OBJECT);
+    if (!leaf)
+        return NULL;
+
+    if (data_is_nh) {
+        nh = (struct vr_nexthop *)data;
+        if (nh) {
+            tmp_nh = vrouter_get_nexthop(nh->nh_rid, nh->nh_id);
+            if (tmp_nh != nh) {
+                /*
+                 * if the original nexthop was deleted, then there are
+                 * two cases
+                 *
+                 * 1. no new nexthop was created (& hence the null check)
+                 * 2. new nexthop has taken it's place (in which case, we
+                 *    need to put the reference we took above
+                 */
+                if (tmp_nh)
+                    vrouter_put_nexthop(tmp_nh);
+
+                nh = vrouter_get_nexthop(nh->nh_rid, NH_DISCARD_ID);
+            }
+        }
+        leaf->leaf_nh_p = nh;
+        leaf->leaf_type = ENTRY_TYPE_NEXTHOP;
+    } else {
+        leaf->leaf_vdata_p = data;
+        leaf->leaf_type = ENTRY_TYPE_VDATA;
     }
-    /* update... */
-    ent->entry_long_i = (uintptr_t) bkt;
-    /* set entry_type */
-    ent->entry_type = ENTRY_TYPE_BUCKET;
-    /* release old */
-    if (tmp_nh)
-        vrouter_put_nexthop(tmp_nh);
 
+    leaf->leaf_refcnt = 1;
+    leaf->leaf_prefix_len = prefix_len;
+    leaf->leaf_label_flags = label_flags;
+    leaf->leaf_label = label;
+    leaf->leaf_bridge_index = bridge_index;
+    leaf->leaf_fib = fib;
+
+    return leaf;
+}
+
+static void
+mtrie_free_leaf(struct ip_bucket_leaf *leaf)
+{
+    if ((leaf->leaf_type == ENTRY_TYPE_NEXTHOP) && leaf->leaf_nh_p)
+        vrouter_put_nexthop(leaf->leaf_nh_p);
+
+    if (leaf->leaf_retired)
+        mtrie_fib_retire(leaf->leaf_fib, 0, 1, false);
+    vr_free(leaf, VR_MTRIE_LEAF_OBJECT);
+
+    return;
+}
+
+static void
+mtrie_free_leaf_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *vdd = (struct vr_defer_data *)data;
+
+    if (!vdd)
+        return;
+
+    mtrie_free_leaf((struct ip_bucket_leaf *)(vdd->vdd_data));
+
+    return;
+}
+
+static inline void
+mtrie_hold_leaf(struct ip_bucket_leaf *leaf)
+{
+    (void)vr_sync_add_and_fetch_32u(&leaf->leaf_refcnt, 1);
     return;
 }
 
 /*
- * the nh pointer is something which will be retained. So, call this function
- * with an nh * that you are willing to forget about in your function
+ * Whilst a batch of routes is being programmed, the leaves and the buckets
+ * that the batch retires are collected here, as tagged entries, and are
+ * reclaimed together after a single grace period once the batch is done.
+ * Only the config thread, which programs the batch, adds to the list; the
+ * rcu callbacks that free buckets put their leaves the usual way.
  */
-static void
-set_entry_to_nh(struct ip_bucket_entry *entry, struct vr_nexthop *nh)
+#define MTRIE_RECLAIM_ENTRIES   126
+
+struct mtrie_reclaim {
+    struct mtrie_reclaim *mr_next;
+    unsigned int mr_count;
+    struct ip_bucket_entry mr_entries[MTRIE_RECLAIM_ENTRIES];
+};
+
+static bool mtrie_batch;
+static struct mtrie_reclaim *mtrie_reclaim_list;
+
+static bool
+mtrie_reclaim_add(uintptr_t entry)
 {
-    struct vr_nexthop *tmp_nh;
-    int orig_entry_nh = ENTRY_IS_NEXTHOP(entry);
+    struct mtrie_reclaim *mr = mtrie_reclaim_list;
 
-    tmp_nh = vrouter_get_nexthop(nh->nh_rid, nh->nh_id);
-    if (tmp_nh != nh) {
-        /*
-         * if the original nexthop was deleted, then there are
-         * two cases
-         *
-         * 1. no new nexthop was created (& hence the null check)
-         * 2. new nexthop has taken it's place (in which case, we need to
-         *    put the reference we took above
-         */
-        if (tmp_nh)
-            vrouter_put_nexthop(tmp_nh);
+    if (!mtrie_batch)
+        return false;
+
+    if (!mr || (mr->mr_count == MTRIE_RECLAIM_ENTRIES)) {
+        mr = vr_zalloc(sizeof(*mr), VR_MTRIE_TABLE_OBJECT);
+        if (!mr)
+            return false;
 
-        nh = vrouter_get_nexthop(nh->nh_rid, NH_DISCARD_ID);
+        mr->mr_next = mtrie_reclaim_list;
+        mtrie_reclaim_list = mr;
     }
 
-    /* save the original */
-    tmp_nh = entry->entry_nh_p;
-    /* update the entry */
-    entry->entry_nh_p = nh;
-    /* set entry type */
-    entry->entry_type = ENTRY_TYPE_NEXTHOP;
+    mr->mr_entries[mr->mr_count++].entry_long_i = entry;
+
+    return true;
+}
 
-    /* ...and then take steps to release original */
-    if (tmp_nh && orig_entry_nh) {
-        vrouter_put_nexthop(tmp_nh);
+/* lookups might still be looking at the leaf, hence the deferred free */
+static void
+__mtrie_put_leaf(struct ip_bucket_leaf *leaf, bool batch)
+{
+    struct vr_defer_data *defer;
+
+    if (vr_sync_sub_and_fetch_32u(&leaf->leaf_refcnt, 1))
+        return;
+
+    leaf->leaf_retired = 1;
+    mtrie_fib_retire(leaf->leaf_fib, 0, 1, true);
+
+    if (batch && mtrie_reclaim_add((uintptr_t)leaf | leaf->leaf_type))
+        return;
+
+    if (!vr_not_ready) {
+        defer = vr_get_defer_data(sizeof(*defer));
+        if (defer) {
+            defer->vdd_data = leaf;
+            vr_defer(vrouter_get(0), mtrie_free_leaf_cb, (void *)defer);
+            return;
+        }
+
+        vr_delay_op();
     }
+    mtrie_free_leaf(leaf);
+
+    return;
+}
+
+static inline void
+mtrie_put_leaf(struct ip_bucket_leaf *leaf)
+{
+    __mtrie_put_leaf(leaf, true);
+    return;
+}
+
+static void
+set_entry_to_bucket(struct ip_bucket_entry *ent, struct ip_bucket *bkt)
+{
+    struct ip_bucket_leaf *tmp_leaf;
+
+    /* save old... */
+    tmp_leaf = entry_to_leaf(ent);
+    /* update... */
+    ent->entry_long_i = (uintptr_t)bkt | ENTRY_TYPE_BUCKET;
+    /* release old */
+    if (tmp_leaf)
+        mtrie_put_leaf(tmp_leaf);
 
     return;
 }
 
 static void
-set_entry_to_vdata(struct ip_bucket_entry *entry, void *data)
+set_entry_to_leaf(struct ip_bucket_entry *ent, struct ip_bucket_leaf *leaf)
 {
-    /* update the entry */
-    entry->entry_vdata_p = data;
-    /* set entry type */
-    entry->entry_type = ENTRY_TYPE_VDATA;
+    struct ip_bucket_leaf *tmp_leaf;
+
+    mtrie_hold_leaf(leaf);
+    tmp_leaf = entry_to_leaf(ent);
+    ent->entry_long_i = (uintptr_t)leaf | leaf->leaf_type;
+    if (tmp_leaf)
+        mtrie_put_leaf(tmp_leaf);
+
+    return;
 }
 
-static inline struct ip_bucket *
-entry_to_bucket(struct ip_bucket_entry *ent)
+/* entries are the same if they resolve to the same */
+static bool
+mtrie_entry_equal(struct ip_bucket_entry *ent1, struct ip_bucket_entry *ent2)
 {
-    if (ENTRY_IS_BUCKET(ent))
-        return PTR_TO_BUCKET(ent->entry_long_i);
+    struct ip_bucket_leaf *leaf1, *leaf2;
 
-    return NULL;
+    if (ent1->entry_long_i == ent2->entry_long_i)
+        return true;
+
+    leaf1 = entry_to_leaf(ent1);
+    leaf2 = entry_to_leaf(ent2);
+    if (!leaf1 || !leaf2)
+        return false;
+
+    return ((leaf1->leaf_type == leaf2->leaf_type) &&
+            (leaf1->leaf_data.vdata_p == leaf2->leaf_data.vdata_p) &&
+            (leaf1->leaf_prefix_len == leaf2->leaf_prefix_len) &&
+            (leaf1->leaf_label_flags == leaf2->leaf_label_flags) &&
+            (leaf1->leaf_label == leaf2->leaf_label) &&
+            (leaf1->leaf_bridge_index == leaf2->leaf_bridge_index));
 }
 
 static void
@@ -202,32 +423,25 @@ mtrie_free_entry(struct ip_bucket_entry *entry, unsigned int level)
 {
     unsigned int i;
     struct ip_bucket *bkt;
+    struct ip_bucket_leaf *leaf;
 
     if (!ENTRY_IS_BUCKET(entry)) {
-        if (ENTRY_IS_NEXTHOP(entry)) {
-            vrouter_put_nexthop(entry->entry_nh_p);
-            entry->entry_nh_p = NULL;
-        } else {
-            entry->entry_vdata_p = NULL;
-        }
+        leaf = entry_to_leaf(entry);
+        entry->entry_long_i = 0;
+        /* might be an rcu callback, which has no business with the batch */
+        if (leaf)
+            __mtrie_put_leaf(leaf, false);
         return;
     }
 
     bkt = entry_to_bucket(entry);
+    entry->entry_long_i = 0;
     if (!bkt)
         return;
 
-    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
-        if (ENTRY_IS_BUCKET(&bkt->bkt_data[i])) {
-            mtrie_free_entry(&bkt->bkt_data[i], level + 1);
-        } else {
-            if (ENTRY_IS_NEXTHOP(&bkt->bkt_data[i])) {
-                vrouter_put_nexthop(bkt->bkt_data[i].entry_nh_p);
-            }
-        }
-    }
+    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++)
+        mtrie_free_entry(&bkt->bkt_data[i], level + 1);
 
-    entry->entry_bkt_p = NULL;
     vr_free(bkt, VR_MTRIE_BUCKET_OBJECT);
 
     return;
@@ -238,6 +452,9 @@ mtrie_free_bkt(struct ip_bucket *bkt)
 {
     unsigned int i;
 
+    if (bkt->bkt_retired)
+        mtrie_fib_retire(bkt->bkt_fib, bkt->bkt_retired, 0, false);
+
     for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
         mtrie_free_entry(&bkt->bkt_data[i], 0);
     }
@@ -260,15 +477,42 @@ mtrie_free_bkt_cb(struct vrouter *router, void *data)
     return;
 }
 
+/* the bucket and the buckets under it */
+static unsigned int
+mtrie_bkt_count(struct ip_bucket *bkt)
+{
+    unsigned int i, count = 1;
+    struct ip_bucket *child;
+
+    for (i = 0; i < bkt->bkt_size; i++) {
+        child = entry_to_bucket(&bkt->bkt_data[i]);
+        if (child)
+            count += mtrie_bkt_count(child);
+    }
+
+    return count;
+}
+
 static int
 mtrie_free_bkt_defer(struct vrouter *router, struct ip_bucket *bkt)
 {
 
     struct vr_defer_data *defer;
 
+    /* out of the tree already, so that nothing changes under it */
+    bkt->bkt_retired = mtrie_bkt_count(bkt);
+    mtrie_fib_retire(bkt->bkt_fib, bkt->bkt_retired, 0, true);
+
+    if (mtrie_reclaim_add((uintptr_t)bkt | ENTRY_TYPE_BUCKET))
+        return 0;
+
     defer = vr_get_defer_data(sizeof(*defer));
-    if (!defer)
+    if (!defer) {
+        /* freed right away, or along with its parent, by the caller */
+        mtrie_fib_retire(bkt->bkt_fib, bkt->bkt_retired, 0, false);
+        bkt->bkt_retired = 0;
         return -ENOMEM;
+    }
 
     defer->vdd_data = bkt;
     vr_defer(router, mtrie_free_bkt_cb, (void *)defer);
@@ -276,40 +520,105 @@ mtrie_free_bkt_defer(struct vrouter *router, struct ip_bucket *bkt)
     return 0;
 }
 
+static void
+mtrie_reclaim_free(struct mtrie_reclaim *mr)
+{
+    unsigned int i;
+    struct mtrie_reclaim *next;
+    struct ip_bucket_entry *ent;
+
+    while (mr) {
+        for (i = 0; i < mr->mr_count; i++) {
+            ent = &mr->mr_entries[i];
+            if (ENTRY_IS_BUCKET(ent))
+                mtrie_free_bkt(entry_to_bucket(ent));
+            else
+                mtrie_free_leaf(entry_to_leaf(ent));
+        }
+
+        next = mr->mr_next;
+        vr_free(mr, VR_MTRIE_TABLE_OBJECT);
+        mr = next;
+    }
+
+    return;
+}
+
+static void
+mtrie_reclaim_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *vdd = (struct vr_defer_data *)data;
+
+    if (!vdd)
+        return;
+
+    mtrie_reclaim_free((struct mtrie_reclaim *)(vdd->vdd_data));
+
+    return;
+}
+
+static void
+mtrie_batch_start(struct vr_rtable *_unused)
+{
+    mtrie_batch = true;
+    return;
+}
+
+static void
+mtrie_batch_end(struct vr_rtable *_unused)
+{
+    struct vr_defer_data *defer;
+    struct mtrie_reclaim *mr = mtrie_reclaim_list;
+
+    mtrie_batch = false;
+    mtrie_reclaim_list = NULL;
+    if (!mr)
+        return;
+
+    if (!vr_not_ready) {
+        defer = vr_get_defer_data(sizeof(*defer));
+        if (defer) {
+            defer->vdd_data = mr;
+            vr_defer(vrouter_get(0), mtrie_reclaim_cb, (void *)defer);
+            return;
+        }
+
+        vr_delay_op();
+    }
+    mtrie_reclaim_free(mr);
+
+    return;
+}
+
 static void
 mtrie_delete_bkt(struct ip_bucket_entry *ent, int defer_delete, int data_is_nh)
 {
     struct ip_bucket *bkt;
     struct ip_bucket_entry *tmp_ent;
+    struct ip_bucket_leaf *leaf;
 
     if (!ENTRY_IS_BUCKET(ent)) {
-        if (ENTRY_IS_NEXTHOP(ent)) {
-            vrouter_put_nexthop(ent->entry_nh_p);
-            ent->entry_nh_p = NULL;
-        } else {
-            ent->entry_vdata_p = NULL;
-        }
+        leaf = entry_to_leaf(ent);
+        ent->entry_long_i = 0;
+        if (leaf)
+            mtrie_put_leaf(leaf);
         return;
     }
 
     bkt = entry_to_bucket(ent);
-    /* copy the values from one of the bkt entries */
+    /* take over the leaf of one of the bkt entries */
     tmp_ent = index_to_entry(bkt, 0);
+    leaf = entry_to_leaf(tmp_ent);
+    if (leaf)
+        set_entry_to_leaf(ent, leaf);
+    else
+        ent->entry_long_i = 0;
 
-    if (data_is_nh) {
-        set_entry_to_nh(ent, tmp_ent->entry_nh_p);
-    } else {
-        set_entry_to_vdata(ent, tmp_ent->entry_vdata_p);
-    }
-    ent->entry_prefix_len = tmp_ent->entry_prefix_len;
-    ent->entry_label_flags = tmp_ent->entry_label_flags;
-    ent->entry_label = tmp_ent->entry_label;
-    ent->entry_bridge_index = tmp_ent->entry_bridge_index;
     if (defer_delete) {
         mtrie_free_bkt_defer(vrouter_get(0), bkt);
     } else {
         if (!vr_not_ready) {
-            if (!mtrie_free_bkt_defer(tmp_ent->entry_nh_p->nh_router, bkt))
+            if (!mtrie_free_bkt_defer(vrouter_get(0), bkt))
                 return;
 
             vr_delay_op();
@@ -326,75 +635,65 @@ mtrie_delete_bkt(struct ip_bucket_entry *ent, int defer_delete, int data_is_nh)
  */
 static struct ip_bucket *
 mtrie_alloc_bucket(struct mtrie_bkt_info *ip_bkt_info, unsigned char level,
-                   struct ip_bucket_entry *parent, int data_is_nh)
+                   struct ip_bucket_entry *parent, int fib)
 {
     unsigned int                bkt_size;
     unsigned int                i;
     struct ip_bucket           *bkt;
-    struct ip_bucket_entry     *ent;
+    struct ip_bucket_leaf      *leaf;
 
     bkt_size = ip_bkt_info[level].bi_size;
     bkt = vr_zalloc(sizeof(struct ip_bucket)
                     + sizeof(struct ip_bucket_entry) * bkt_size,
                     VR_MTRIE_BUCKET_OBJECT);
-    bkt->bkt_size = bkt_size;
     if (!bkt)
         return NULL;
 
-    for (i = 0; i < bkt_size; i++) {
-        ent = &bkt->bkt_data[i];
-        if (data_is_nh) {
-            set_entry_to_nh(ent, parent->entry_nh_p);
-        } else {
-            set_entry_to_vdata(ent, parent->entry_vdata_p);
-        }
-        ent->entry_prefix_len = parent->entry_prefix_len;
-        ent->entry_label_flags = parent->entry_label_flags;
-        ent->entry_label = parent->entry_label;
-        ent->entry_bridge_index = parent->entry_bridge_index;
+    bkt->bkt_size = bkt_size;
+    bkt->bkt_prefix_len = entry_prefix_len(parent);
+    bkt->bkt_fib = fib;
+
+    /* all the entries share the leaf of the parent */
+    leaf = entry_to_leaf(parent);
+    if (leaf) {
+        (void)vr_sync_add_and_fetch_32u(&leaf->leaf_refcnt, bkt_size);
+        for (i = 0; i < bkt_size; i++)
+            bkt->bkt_data[i].entry_long_i = parent->entry_long_i;
     }
 
     return bkt;
 }
 
 static void
-add_to_tree(struct ip_bucket_entry *ent, int level, struct vr_route_req *rt)
+add_to_tree(struct ip_bucket_entry *ent, int level, struct vr_route_req *rt,
+        struct ip_bucket_leaf *leaf)
 {
     unsigned int i;
     struct ip_bucket      *bkt;
     struct mtrie_bkt_info *ip_bkt_info;
 
-    if (ent->entry_prefix_len > rt->rtr_req.rtr_prefix_len)
+    if (entry_prefix_len(ent) > rt->rtr_req.rtr_prefix_len)
         return;
 
-    ent->entry_prefix_len = rt->rtr_req.rtr_prefix_len;
-
     if (!ENTRY_IS_BUCKET(ent)) {
         /* a less specific entry, which needs to be replaced */
-        if (ENTRY_IS_NEXTHOP(ent)) {
-            set_entry_to_nh(ent, rt->rtr_nh);
-        } else {
-            set_entry_to_vdata(ent, (void *)rt->rtr_nh);
-        }
-        ent->entry_label_flags = rt->rtr_req.rtr_label_flags;
-        ent->entry_label = rt->rtr_req.rtr_label;
-        ent->entry_bridge_index = rt->rtr_req.rtr_index;
-
+        set_entry_to_leaf(ent, leaf);
         return;
     }
 
+    /* Assured that this is valid bucket now */
+    bkt = entry_to_bucket(ent);
+    bkt->bkt_prefix_len = rt->rtr_req.rtr_prefix_len;
+
     if (level >= (ip_bkt_get_max_level(rt->rtr_req.rtr_family) - 1))
         return;
 
     ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
-
-    /* Assured that this is valid bucket now */
-    bkt = entry_to_bucket(ent);
     level++;
 
     for (i = 0; i < ip_bkt_info[level].bi_size; i++) {
         ent = index_to_entry(bkt, i);
-        add_to_tree(ent, level, rt);
+        add_to_tree(ent, level, rt, leaf);
     }
 
     return;
@@ -402,38 +701,26 @@ add_to_tree(struct ip_bucket_entry *ent, int level, struct vr_route_req *rt)
 
 static void
 mtrie_reset_entry(struct ip_bucket_entry *ent, int level,
-                  void *data, int data_is_nh)
+                  struct ip_bucket_leaf *leaf)
 {
     struct ip_bucket_entry cp_ent;
     struct ip_bucket *bkt;
-    struct vr_nexthop *nh;
-    struct vrouter *vrouter;
 
     memcpy(&cp_ent, ent, sizeof(cp_ent));
 
     /* remove from the tree */
-    if (data) {
-        if (data_is_nh) {
-            nh = (struct vr_nexthop *) data;
-            set_entry_to_nh(ent, nh);
-        } else {
-            set_entry_to_vdata(ent, data);
-        }
-    }
+    if (leaf)
+        set_entry_to_leaf(ent, leaf);
+    else
+        ent->entry_long_i = 0;
 
     /* ...and then work with the copy */
     bkt = entry_to_bucket(&cp_ent);
     if (!bkt)
         return;
 
-    if (data_is_nh) {
-        nh = (struct vr_nexthop *) data;
-        vrouter = nh->nh_router;
-    } else {
-        vrouter = vrouter_get(0);
-    }
     if (!vr_not_ready) {
-        if (!mtrie_free_bkt_defer(vrouter, bkt))
+        if (!mtrie_free_bkt_defer(vrouter_get(0), bkt))
             return;
         vr_delay_op();
     }
@@ -459,45 +746,51 @@ mtrie_reset_entry(struct ip_bucket_entry *ent, int level,
 static int
 __mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt, int data_is_nh)
 {
-    int ret, index = 0, level, err_level = 0, fin;
+    int ret = 0, index = 0, level, err_level = 0, fin, fib = -1;
     unsigned char i;
     struct ip_bucket *bkt;
     struct ip_bucket_entry *ent, *err_ent = NULL;
-    void *data, *err_data = NULL;
+    struct ip_bucket_leaf *leaf, *err_leaf = NULL;
     struct mtrie_bkt_info *ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
 
+    if (data_is_nh)
+        fib = mtrie_fib_index(rt->rtr_req.rtr_vrf_id, rt->rtr_req.rtr_family);
+
+    /* the one leaf of the route, held till the route is in */
+    leaf = mtrie_alloc_leaf((void *)rt->rtr_nh, data_is_nh,
+            rt->rtr_req.rtr_prefix_len, rt->rtr_req.rtr_label_flags,
+            rt->rtr_req.rtr_label, rt->rtr_req.rtr_index, fib);
+    if (!leaf)
+        return -ENOMEM;
+
     ent = &mtrie->root;
 
-    data = (void *)ent->entry_long_i;
     for (level = 0; level < ip_bkt_get_max_level(rt->rtr_req.rtr_family); level++) {
         if (!ENTRY_IS_BUCKET(ent)) {
-            bkt = mtrie_alloc_bucket(ip_bkt_info, level, ent, data_is_nh);
-            set_entry_to_bucket(ent, bkt);
+            bkt = mtrie_alloc_bucket(ip_bkt_info, level, ent, fib);
+            if (!bkt) {
+                ret = -ENOMEM;
+                goto exit_ret;
+            }
 
             if (!err_ent) {
                 err_ent = ent;
-                err_data = data;
                 err_level = level;
+                /* keep what the entry was, to get back to it */
+                err_leaf = entry_to_leaf(ent);
+                if (err_leaf)
+                    mtrie_hold_leaf(err_leaf);
             }
-        }
 
-        bkt = entry_to_bucket(ent);
-        if (!bkt) {
-
-            ret = -ENOMEM;
-            goto exit_ret;
+            set_entry_to_bucket(ent, bkt);
         }
 
+        bkt = entry_to_bucket(ent);
         index = rt_to_index(rt, level);
         ent = index_to_entry(bkt, index);
 
         if (rt->rtr_req.rtr_prefix_len > ip_bkt_info[level].bi_pfx_len) {
-            if (!ENTRY_IS_BUCKET(ent)) {
-                data = (void *)ent->entry_long_i;
-            }
-
             continue;
-
         } else {
             /*
              * cover all the indices for which this route is the best
@@ -516,18 +809,23 @@ __mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt, int data_is_nh)
             for (; ((i <= (ip_bkt_info[level].bi_size-1)) && fin);
                                                         i++, fin--) {
                 ent = index_to_entry(bkt, i);
-                add_to_tree(ent, level, rt);
+                add_to_tree(ent, level, rt, leaf);
              }
 
              break;
         }
     }
 
-    return 0;
+    goto exit;
 
 exit_ret:
     if (err_ent)
-        mtrie_reset_entry(err_ent, err_level, err_data, data_is_nh);
+        mtrie_reset_entry(err_ent, err_level, err_leaf);
+
+exit:
+    if (err_leaf)
+        mtrie_put_leaf(err_leaf);
+    mtrie_put_leaf(leaf);
 
     return ret;
 }
@@ -538,11 +836,12 @@ exit_ret:
  * immediately deleted; defer delete is useful in multithreaded scenarios where the
  * delete happens in a rcu callback context thus avoiding taking locks.
  * The flag data_is_nh is used to indicate if the mtrie is created with nexthop nodes
- * or void * data nodes;
+ * or void * data nodes; 'leaf' is what the entries of the route are replaced with.
  */
 static int
 __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
-                unsigned char level, int defer_delete, int data_is_nh)
+                unsigned char level, int defer_delete, int data_is_nh,
+                struct ip_bucket_leaf *leaf)
 {
     unsigned int        index, i, fin;
     struct ip_bucket    *bkt;
@@ -551,17 +850,8 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
 
     if (!ENTRY_IS_BUCKET(ent)) {
         /* Cleanup the entry as it is valid */
-        if (ent->entry_prefix_len == rt->rtr_req.rtr_prefix_len) {
-            ent->entry_label_flags = rt->rtr_req.rtr_label_flags;
-            ent->entry_label = rt->rtr_req.rtr_label;
-            ent->entry_prefix_len = rt->rtr_req.rtr_replace_plen;
-
-            if (ENTRY_IS_NEXTHOP(ent)) {
-                set_entry_to_nh(ent, rt->rtr_nh);
-            } else {
-                set_entry_to_vdata(ent, (void *)rt->rtr_nh);
-            }
-            ent->entry_bridge_index = rt->rtr_req.rtr_index;
+        if (entry_prefix_len(ent) == rt->rtr_req.rtr_prefix_len) {
+            set_entry_to_leaf(ent, leaf);
             return 0;
         } else {
             return -ENOENT;
@@ -573,7 +863,7 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
 
     if (rt->rtr_req.rtr_prefix_len > ip_bkt_info[level].bi_pfx_len) {
         tmp_ent = index_to_entry(bkt, index);
-        __mtrie_delete(rt, tmp_ent, level + 1, defer_delete, data_is_nh);
+        __mtrie_delete(rt, tmp_ent, level + 1, defer_delete, data_is_nh, leaf);
     } else {
         if ((rt->rtr_req.rtr_prefix_len >
                 (ip_bkt_info[level].bi_pfx_len - ip_bkt_info[level].bi_bits)) &&
@@ -592,20 +882,14 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
          for (i = index; i < fin; i++) {
             tmp_ent = index_to_entry(bkt, i);
 
-            if (tmp_ent->entry_prefix_len == rt->rtr_req.rtr_prefix_len) {
-                tmp_ent->entry_label_flags = rt->rtr_req.rtr_label_flags;
-                tmp_ent->entry_label = rt->rtr_req.rtr_label;
-                tmp_ent->entry_prefix_len = rt->rtr_req.rtr_replace_plen;
-
+            if (entry_prefix_len(tmp_ent) == rt->rtr_req.rtr_prefix_len) {
                 if (!ENTRY_IS_BUCKET(tmp_ent)) {
-                    if (ENTRY_IS_NEXTHOP(tmp_ent)) {
-                        set_entry_to_nh(tmp_ent, rt->rtr_nh);
-                    } else {
-                        set_entry_to_vdata(tmp_ent, (void *)rt->rtr_nh);
-                    }
-                    tmp_ent->entry_bridge_index = rt->rtr_req.rtr_index;
+                    set_entry_to_leaf(tmp_ent, leaf);
                 } else {
-                    __mtrie_delete(rt, tmp_ent, level + 1, defer_delete, data_is_nh);
+                    entry_to_bucket(tmp_ent)->bkt_prefix_len =
+                        rt->rtr_req.rtr_replace_plen;
+                    __mtrie_delete(rt, tmp_ent, level + 1, defer_delete,
+                            data_is_nh, leaf);
                 }
             }
         }
@@ -613,8 +897,7 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
 
     /* check if current bucket neds to be deleted */
     for (i = 1; i < ip_bkt_info[level].bi_size; i++) {
-        if (memcmp(bkt->bkt_data + i, bkt->bkt_data,
-                        sizeof(struct ip_bucket_entry)))
+        if (!mtrie_entry_equal(bkt->bkt_data + i, bkt->bkt_data))
             return 0;
     }
 
@@ -639,6 +922,7 @@ mtrie_dumper_make_response(struct vr_message_dumper *dumper, vr_route_req *resp,
         struct ip_bucket_entry *ent, int8_t *prefix, unsigned int prefix_len)
 {
     vr_route_req *req = (vr_route_req *)dumper->dump_req;
+    struct ip_bucket_leaf *leaf = entry_to_leaf(ent);
      struct vr_route_req lreq;
 
     resp->rtr_vrf_id = req->rtr_vrf_id;
@@ -649,10 +933,10 @@ mtrie_dumper_make_response(struct vr_message_dumper *dumper, vr_route_req *resp,
     resp->rtr_marker = NULL;
     resp->rtr_prefix_len = prefix_len;
     resp->rtr_rid = req->rtr_rid;
-    resp->rtr_label_flags = ent->entry_label_flags;
-    resp->rtr_label = ent->entry_label;
-    resp->rtr_nh_id = ent->entry_nh_p->nh_id;
-    resp->rtr_index = ent->entry_bridge_index;
+    resp->rtr_label_flags = leaf->leaf_label_flags;
+    resp->rtr_label = leaf->leaf_label;
+    resp->rtr_nh_id = leaf->leaf_nh_p->nh_id;
+    resp->rtr_index = leaf->leaf_bridge_index;
     if (resp->rtr_index != VR_BE_INVALID_INDEX) {
         resp->rtr_mac = vr_zalloc(VR_ETHER_ALEN, VR_ROUTE_REQ_MAC_OBJECT);
         resp->rtr_mac_size = VR_ETHER_ALEN;
@@ -664,11 +948,18 @@ mtrie_dumper_make_response(struct vr_message_dumper *dumper, vr_route_req *resp,
         resp->rtr_mac_size = 0;
         resp->rtr_mac = NULL;
     }
-    resp->rtr_replace_plen = ent->entry_prefix_len;
+    resp->rtr_replace_plen = leaf->leaf_prefix_len;
 
     return;
 }
 
+/*
+ * The marker of a dump is the prefix of the last route that was dumped,
+ * and its bytes are the indices of the entries that the walk took in each
+ * level to get there. A chunk hence resumes by going straight down that
+ * path, and carries on with the entries past it on the way back up; it
+ * does not go through what earlier chunks dumped.
+ */
 static int
 mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *orig_ent,
         int8_t *prefix, int level)
@@ -677,6 +968,7 @@ mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *orig_
     uint32_t rt_prefix[4];
     struct ip_bucket *bkt;
     struct ip_bucket_entry *ent;
+    struct ip_bucket_leaf *leaf;
     struct mtrie_bkt_info *ip_bkt_info;
     vr_route_req *req = dumper->dump_req;
 
@@ -704,7 +996,7 @@ mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *orig_
             if (mtrie_dump_entry(dumper, ent, prefix, level + 1) < 0)
                 return -1;
         }
-    } else if (orig_ent->entry_nh_p) {
+    } else if ((leaf = entry_to_leaf(orig_ent)) && leaf->leaf_nh_p) {
         if (!dumper->dump_been_to_marker) {
             dumper->dump_been_to_marker = 1;
 
@@ -799,6 +1091,7 @@ mtrie_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
 {
     int vrf_id = rt->rtr_req.rtr_vrf_id;
     struct ip_mtrie *rtable;
+    struct ip_bucket_leaf *leaf;
     struct vr_route_req lreq;
 
     rtable = vrfid_to_mtrie(vrf_id, rt->rtr_req.rtr_family);
@@ -828,7 +1121,20 @@ mtrie_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
         rt->rtr_req.rtr_label &= 0xFFFFFF;
     }
 
-    __mtrie_delete(rt, &rtable->root, 0, 0, 1);
+    leaf = mtrie_alloc_leaf((void *)rt->rtr_nh, 1,
+            rt->rtr_req.rtr_replace_plen, rt->rtr_req.rtr_label_flags,
+            rt->rtr_req.rtr_label, rt->rtr_req.rtr_index,
+            mtrie_fib_index(vrf_id, rt->rtr_req.rtr_family));
+    if (!leaf) {
+        vrouter_put_nexthop(rt->rtr_nh);
+        return -ENOMEM;
+    }
+
+    __mtrie_delete(rt, &rtable->root, 0, 0, 1, leaf);
+    mtrie_put_leaf(leaf);
+    if (rt->rtr_req.rtr_family == AF_INET6)
+        ip6_fib_del(rt);
+    vr_dst_cache_invalidate();
     vrouter_put_nexthop(rt->rtr_nh);
 
    return 0;
@@ -965,7 +1271,8 @@ __mtrie_lookup(struct vr_route_req *rt, struct ip_bucket *bkt, unsigned int leve
 {
     unsigned int i, limit, index;
 
-    struct ip_bucket_entry *ent;
+    struct ip_bucket_entry ent;
+    struct ip_bucket_leaf *leaf;
     struct mtrie_bkt_info *ip_bkt_info;
     void *ret_data = NULL;
 
@@ -999,26 +1306,31 @@ __mtrie_lookup(struct vr_route_req *rt, struct ip_bucket *bkt, unsigned int leve
      * from a lesser specific prefix and hence a match.
      */
     for (i = 0; i < ip_bkt_info[level].bi_size; i++) {
-        ent = index_to_entry(bkt, (index + i) % ip_bkt_info[level].bi_size);
+        /* the entry can change under us, so look at it only once */
+        ent = *index_to_entry(bkt, (index + i) % ip_bkt_info[level].bi_size);
+
+        if (!ENTRY_IS_BUCKET(&ent)) {
+            leaf = entry_to_leaf(&ent);
+            if (!leaf)
+                continue;
 
-        if (!ENTRY_IS_BUCKET(ent)) {
             if (i >= limit) {
-                if (ent->entry_prefix_len >= rt->rtr_req.rtr_prefix_len)
+                if (leaf->leaf_prefix_len >= rt->rtr_req.rtr_prefix_len)
                     continue;
             }
 
-            if (ent->entry_prefix_len > rt->rtr_req.rtr_prefix_len)
+            if (leaf->leaf_prefix_len > rt->rtr_req.rtr_prefix_len)
                 continue;
 
-            rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
-            rt->rtr_req.rtr_label = ent->entry_label;
-            rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-            rt->rtr_req.rtr_index = ent->entry_bridge_index;
-            ret_data = (void *)ent->entry_long_i;
+            rt->rtr_req.rtr_label_flags = leaf->leaf_label_flags;
+            rt->rtr_req.rtr_label = leaf->leaf_label;
+            rt->rtr_req.rtr_prefix_len = leaf->leaf_prefix_len;
+            rt->rtr_req.rtr_index = leaf->leaf_bridge_index;
+            ret_data = leaf->leaf_data.vdata_p;
             rt->rtr_nh = (struct vr_nexthop *) ret_data;
             break;
         } else {
-            bkt = ent->entry_bkt_p;
+            bkt = entry_to_bucket(&ent);
             ret_data = __mtrie_lookup(rt, bkt, level + 1);
             if (ret_data)
                 break;
@@ -1038,13 +1350,19 @@ static struct vr_nexthop *
 mtrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
 {
     unsigned int level = 0;
-    uintptr_t ptr;
 
     struct ip_mtrie *table;
     struct ip_bucket *bkt;
-    struct ip_bucket_entry *ent;
+    struct ip_bucket_entry ent;
+    struct ip_bucket_leaf *leaf;
     struct vr_nexthop *default_nh, *ret_nh;
 
+    if (rt->rtr_req.rtr_family == AF_INET6) {
+        ret_nh = ip6_fib_lookup(vrf_id, rt);
+        if (ret_nh)
+            return ret_nh;
+    }
+
     default_nh = ip4_default_nh;
     table = vrfid_to_mtrie(vrf_id, rt->rtr_req.rtr_family);
     if (!table) {
@@ -1052,24 +1370,24 @@ mtrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
         return default_nh;
     }
 
-    ent = &table->root;
-    ptr = ent->entry_long_i;
-    if (!ptr) {
+    ent = table->root;
+    if (!ENTRY_TO_PTR(&ent)) {
         rt->rtr_nh = default_nh;
         return default_nh;
     }
 
-    if (ENTRY_IS_NEXTHOP(ent)) {
-        rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
-        rt->rtr_req.rtr_label = ent->entry_label;
-        rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-        rt->rtr_req.rtr_index = ent->entry_bridge_index;
-        ret_nh = ent->entry_nh_p;
+    if (ENTRY_IS_NEXTHOP(&ent)) {
+        leaf = entry_to_leaf(&ent);
+        rt->rtr_req.rtr_label_flags = leaf->leaf_label_flags;
+        rt->rtr_req.rtr_label = leaf->leaf_label;
+        rt->rtr_req.rtr_prefix_len = leaf->leaf_prefix_len;
+        rt->rtr_req.rtr_index = leaf->leaf_bridge_index;
+        ret_nh = leaf->leaf_nh_p;
         rt->rtr_nh = ret_nh;
         return ret_nh;
     }
 
-    bkt = ent->entry_bkt_p;
+    bkt = entry_to_bucket(&ent);
     if (!bkt) {
         rt->rtr_nh = default_nh;
         return default_nh;
@@ -1132,6 +1450,9 @@ mtrie_add(struct vr_rtable * _unused, struct vr_route_req *rt)
     }
 
     ret = __mtrie_add(mtrie, rt, 1);
+    if (!ret && (rt->rtr_req.rtr_family == AF_INET6))
+        ip6_fib_add(rt);
+    vr_dst_cache_invalidate();
     vrouter_put_nexthop(rt->rtr_nh);
     return ret;
 }
@@ -1175,6 +1496,8 @@ mtrie_alloc_vrf(unsigned int vrf_id, unsigned int family)
 {
     struct ip_mtrie *mtrie;
     struct ip_mtrie **mtrie_table;
+    struct ip_bucket_leaf *leaf;
+    struct vr_nexthop *nh;
     int index = 0;
 
     if (family == AF_INET6)
@@ -1182,13 +1505,20 @@ mtrie_alloc_vrf(unsigned int vrf_id, unsigned int family)
 
     mtrie = vr_zalloc(sizeof(struct ip_mtrie), VR_MTRIE_OBJECT);
     if (mtrie) {
-        mtrie->root.entry_nh_p = vrouter_get_nexthop(0, NH_DISCARD_ID);
-        mtrie->root.entry_bridge_index =  VR_BE_INVALID_INDEX;
-        mtrie->root.entry_type = ENTRY_TYPE_NEXTHOP;
+        nh = vrouter_get_nexthop(0, NH_DISCARD_ID);
+        leaf = mtrie_alloc_leaf((void *)nh, 1, 0, 0, 0xFFFFFF,
+                VR_BE_INVALID_INDEX, mtrie_fib_index(vrf_id, family));
+        if (nh)
+            vrouter_put_nexthop(nh);
+        if (!leaf) {
+            vr_free(mtrie, VR_MTRIE_OBJECT);
+            return NULL;
+        }
+
+        /* the reference of the allocation is the one of the root */
+        mtrie->root.entry_long_i = (uintptr_t)leaf | leaf->leaf_type;
         mtrie_table = vn_rtable[index];
         mtrie_table[vrf_id] = mtrie;
-        mtrie->root.entry_label = 0xFFFFFF;
-        mtrie->root.entry_label_flags = 0;
     }
 
     return mtrie;
@@ -1211,6 +1541,7 @@ mtrie_free_vrf(struct vr_rtable *rtable, unsigned int vrf_id)
         mtrie_free_entry(&mtrie->root, 0);
         vrf_tables[vrf_id] = NULL;
         vr_free(mtrie, VR_MTRIE_OBJECT);
+        vr_dst_cache_invalidate();
     }
 
     return;
@@ -1268,6 +1599,12 @@ mtrie_algo_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs,
         vn_rtable[0] = vn_rtable[1] = NULL;
         vr_free(rtable->algo_data, VR_MTRIE_TABLE_OBJECT);
         rtable->algo_data = NULL;
+
+        if (mtrie_fib_retired) {
+            vr_free(mtrie_fib_retired, VR_MTRIE_STATS_OBJECT);
+            mtrie_fib_retired = NULL;
+            mtrie_fibs = 0;
+        }
     }
 
     algo_init_done = 0;
@@ -1337,6 +1674,109 @@ cleanup:
     return ret;
 }
 
+static void
+mtrie_walk_mem(struct ip_bucket *bkt, unsigned int level,
+        struct vr_fib_vrf_mem *mem)
+{
+    bool shared = true;
+    unsigned int i;
+    struct ip_bucket *child;
+    struct ip_bucket_leaf *leaf;
+    struct vr_nexthop *nh = NULL;
+
+    mem->fvm_buckets[level]++;
+    if (mem->fvm_depth < level + 1)
+        mem->fvm_depth = level + 1;
+
+    for (i = 0; i < bkt->bkt_size; i++) {
+        child = entry_to_bucket(&bkt->bkt_data[i]);
+        if (child) {
+            shared = false;
+            if (level + 1 < VR_FIB_MAX_LEVELS)
+                mtrie_walk_mem(child, level + 1, mem);
+            continue;
+        }
+
+        leaf = entry_to_leaf(&bkt->bkt_data[i]);
+        if (!leaf) {
+            shared = false;
+            continue;
+        }
+
+        if (leaf->leaf_walk != mtrie_walk_gen) {
+            leaf->leaf_walk = mtrie_walk_gen;
+            mem->fvm_leaves++;
+        }
+
+        if (!i)
+            nh = leaf->leaf_nh_p;
+        else if (leaf->leaf_nh_p != nh)
+            shared = false;
+    }
+
+    if (shared)
+        mem->fvm_shared_buckets++;
+
+    return;
+}
+
+/*
+ * What the mtrie of a vrf takes for a family. Walks the mtrie, hence is
+ * to be called from the config thread, which is the one that changes it.
+ */
+int
+vr_inet_fib_vrf_mem(unsigned int vrf_id, unsigned int family,
+        struct vr_fib_vrf_mem *mem)
+{
+    unsigned int i, buckets = 0;
+    int fib;
+    struct ip_mtrie *mtrie;
+    struct ip_bucket *bkt;
+    struct ip_bucket_leaf *leaf;
+
+    memset(mem, 0, sizeof(*mem));
+    if (!vn_rtable[0] || !vn_rtable[1])
+        return -ENOENT;
+
+    mtrie = vrfid_to_mtrie(vrf_id, family);
+    if (!mtrie)
+        return -ENOENT;
+
+    /* generation 0 is that of the leaves never walked */
+    if (!++mtrie_walk_gen)
+        mtrie_walk_gen++;
+
+    bkt = entry_to_bucket(&mtrie->root);
+    if (bkt) {
+        mtrie_walk_mem(bkt, 0, mem);
+    } else {
+        leaf = entry_to_leaf(&mtrie->root);
+        if (leaf) {
+            leaf->leaf_walk = mtrie_walk_gen;
+            mem->fvm_leaves = 1;
+        }
+    }
+
+    for (i = 0; i < VR_FIB_MAX_LEVELS; i++)
+        buckets += mem->fvm_buckets[i];
+
+    mem->fvm_bytes = sizeof(*mtrie) +
+        ((uint64_t)buckets * MTRIE_BUCKET_BYTES) +
+        ((uint64_t)mem->fvm_leaves * sizeof(struct ip_bucket_leaf));
+
+    fib = mtrie_fib_index(vrf_id, family);
+    if (mtrie_fib_retired && ((unsigned int)fib < mtrie_fibs)) {
+        mem->fvm_retired_buckets = mtrie_fib_retired[fib].mfr_buckets;
+        mem->fvm_retired_leaves = mtrie_fib_retired[fib].mfr_leaves;
+        mem->fvm_retired_bytes =
+            ((uint64_t)mem->fvm_retired_buckets * MTRIE_BUCKET_BYTES) +
+            ((uint64_t)mem->fvm_retired_leaves *
+             sizeof(struct ip_bucket_leaf));
+    }
+
+    return 0;
+}
+
 struct vr_nexthop *
 vr_inet_route_lookup(unsigned int vrf_id, struct vr_route_req *rt)
 {
@@ -1345,6 +1785,97 @@ vr_inet_route_lookup(unsigned int vrf_id, struct vr_route_req *rt)
     return mtrie_lookup(vrf_id, rt);
 }
 
+/*
+ * Longest prefix match of a burst of IPv4 host addresses (in network byte
+ * order) of one vrf. The burst is walked down the mtrie a level at a time:
+ * the entries of a level are prefetched for all the addresses before any
+ * of them is read, so that the misses of the burst overlap instead of
+ * being taken one after the other. res[i] gets the route that
+ * vr_inet_route_lookup would find for ips[i].
+ */
+void
+vr_inet_route_lookup_burst(unsigned int vrf_id, uint32_t *ips,
+        struct vr_route_result *res, unsigned int num)
+{
+    unsigned int i, j, count, level, pending;
+    uint8_t *prefix;
+    struct ip_mtrie *table;
+    struct ip_bucket *bkt;
+    struct ip_bucket_leaf *leaf;
+    struct ip_bucket_entry ents[VR_INET_LOOKUP_BURST_MAX];
+
+    /* the default of a vrf without a table comes with no label */
+    for (i = 0; i < num; i++) {
+        res[i].rr_nh = ip4_default_nh;
+        res[i].rr_label = 0;
+        res[i].rr_index = VR_BE_INVALID_INDEX;
+        res[i].rr_label_flags = 0;
+        res[i].rr_prefix_len = 0;
+    }
+
+    if (!vn_rtable[0] || !vn_rtable[1]) {
+        for (i = 0; i < num; i++)
+            res[i].rr_nh = NULL;
+        return;
+    }
+
+    table = vrfid_to_mtrie(vrf_id, AF_INET);
+    if (!table)
+        return;
+
+    for (i = 0; i < num; i += count) {
+        count = num - i;
+        if (count > VR_INET_LOOKUP_BURST_MAX)
+            count = VR_INET_LOOKUP_BURST_MAX;
+
+        for (j = 0; j < count; j++)
+            ents[j] = table->root;
+
+        for (level = 0; level < IP4_BKT_LEVELS; level++) {
+            pending = 0;
+            for (j = 0; j < count; j++) {
+                bkt = entry_to_bucket(&ents[j]);
+                if (!bkt)
+                    continue;
+
+                prefix = (uint8_t *)&ips[i + j];
+                vr_prefetch(index_to_entry(bkt, PREFIX_TO_INDEX(prefix, level)));
+                pending++;
+            }
+
+            if (!pending)
+                break;
+
+            for (j = 0; j < count; j++) {
+                bkt = entry_to_bucket(&ents[j]);
+                if (!bkt)
+                    continue;
+
+                prefix = (uint8_t *)&ips[i + j];
+                ents[j] = *index_to_entry(bkt, PREFIX_TO_INDEX(prefix, level));
+                leaf = entry_to_leaf(&ents[j]);
+                if (leaf)
+                    vr_prefetch(leaf);
+            }
+        }
+
+        /* an empty entry is a miss, as it is for mtrie_lookup */
+        for (j = 0; j < count; j++) {
+            leaf = entry_to_leaf(&ents[j]);
+            if (!leaf || !leaf->leaf_nh_p)
+                continue;
+
+            res[i + j].rr_nh = leaf->leaf_nh_p;
+            res[i + j].rr_label = leaf->leaf_label;
+            res[i + j].rr_index = leaf->leaf_bridge_index;
+            res[i + j].rr_label_flags = leaf->leaf_label_flags;
+            res[i + j].rr_prefix_len = leaf->leaf_prefix_len;
+        }
+    }
+
+    return;
+}
+
 int
 mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
 {
@@ -1367,6 +1898,17 @@ mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
         goto init_fail;
     }
 
+    if (!mtrie_fib_retired) {
+        table_memory = 2 * sizeof(struct mtrie_fib_retired) *
+            fs->rtb_max_vrfs;
+        mtrie_fib_retired = vr_zalloc(table_memory, VR_MTRIE_STATS_OBJECT);
+        if (!mtrie_fib_retired && (ret = -ENOMEM)) {
+            vr_module_error(ret, __FUNCTION__, __LINE__, table_memory);
+            goto init_fail;
+        }
+        mtrie_fibs = 2 * fs->rtb_max_vrfs;
+    }
+
     rtable->algo_add = mtrie_add;
     rtable->algo_del = mtrie_delete;
     rtable->algo_lookup = mtrie_lookup;
@@ -1374,6 +1916,8 @@ mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
     rtable->algo_dump = mtrie_dump;
     rtable->algo_stats_get = mtrie_stats_get;
     rtable->algo_stats_dump = mtrie_stats_dump;
+    rtable->algo_batch_start = mtrie_batch_start;
+    rtable->algo_batch_end = mtrie_batch_end;
 
     vr_inet_vrf_stats = mtrie_stats;
     /* local cache */
@@ -1405,14 +1949,18 @@ struct ip_mtrie *
 vdata_mtrie_init (unsigned int prefix_len, void *data)
 {
     struct ip_mtrie *mtrie;
+    struct ip_bucket_leaf *leaf;
 
     mtrie = vr_zalloc(sizeof(struct ip_mtrie), VR_MTRIE_OBJECT);
     if (mtrie) {
-        mtrie->root.entry_type = ENTRY_TYPE_VDATA;
-        mtrie->root.entry_prefix_len = prefix_len;
-        mtrie->root.entry_vdata_p = data;
-        mtrie->root.entry_bridge_index =  VR_BE_INVALID_INDEX;
-        mtrie->root.entry_label = 0xFFFFFF;
+        leaf = mtrie_alloc_leaf(data, 0, prefix_len, 0, 0xFFFFFF,
+                VR_BE_INVALID_INDEX, -1);
+        if (!leaf) {
+            vr_free(mtrie, VR_MTRIE_OBJECT);
+            return NULL;
+        }
+
+        mtrie->root.entry_long_i = (uintptr_t)leaf | leaf->leaf_type;
     }
 
     return mtrie;
@@ -1437,21 +1985,23 @@ vdata_mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt)
 void *
 vdata_mtrie_lookup(struct ip_mtrie *mtrie, struct vr_route_req *rt)
 {
-    struct ip_bucket_entry *ent;
+    struct ip_bucket_entry ent;
     struct ip_bucket *bkt;
+    struct ip_bucket_leaf *leaf;
     void *ret = NULL;
 
     if (!mtrie)
         return NULL;
 
-    ent = &mtrie->root;
+    ent = mtrie->root;
 
-    if (ENTRY_IS_VDATA(ent)) {
-        rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-        return ent->entry_vdata_p;
+    if (ENTRY_IS_VDATA(&ent)) {
+        leaf = entry_to_leaf(&ent);
+        rt->rtr_req.rtr_prefix_len = leaf->leaf_prefix_len;
+        return leaf->leaf_vdata_p;
     }
 
-    bkt = ent->entry_bkt_p;
+    bkt = entry_to_bucket(&ent);
     mtrie_debug = 1;
     ret = __mtrie_lookup(rt, bkt, 0);
     mtrie_debug = 0;
@@ -1464,7 +2014,19 @@ vdata_mtrie_lookup(struct ip_mtrie *mtrie, struct vr_route_req *rt)
 int
 vdata_mtrie_delete(struct ip_mtrie *mtrie, struct vr_route_req *rt)
 {
-    return __mtrie_delete(rt, &mtrie->root, 0, 1, 0);
+    int ret;
+    struct ip_bucket_leaf *leaf;
+
+    leaf = mtrie_alloc_leaf((void *)rt->rtr_nh, 0,
+            rt->rtr_req.rtr_replace_plen, rt->rtr_req.rtr_label_flags,
+            rt->rtr_req.rtr_label, rt->rtr_req.rtr_index, -1);
+    if (!leaf)
+        return -ENOMEM;
+
+    ret = __mtrie_delete(rt, &mtrie->root, 0, 1, 0, leaf);
+    mtrie_put_leaf(leaf);
+
+    return ret;
 }
 
 /*
@@ -35,6 +35,7 @@ struct vr_nexthop *ip4_default_nh;
 struct vr_nexthop *ip6_default_nh;
 
 unsigned int vr_nexthops = VR_DEF_NEXTHOPS;
+unsigned int vr_ecmp_table_size = 0;
 
 struct vr_nexthop *
 __vrouter_get_nexthop(struct vrouter *router, unsigned int index)
@@ -114,6 +115,17 @@ vrouter_free_nexthop(struct vr_nexthop *nh)
             nh->nh_component_ecmp = NULL;
         }
 
+        if (nh->nh_component_table) {
+            nh->nh_component_table_size = 0;
+            vr_free(nh->nh_component_table, VR_NEXTHOP_COMPONENT_OBJECT);
+            nh->nh_component_table = NULL;
+        }
+
+        if (nh->nh_component_load) {
+            vr_free(nh->nh_component_load, VR_NEXTHOP_COMPONENT_OBJECT);
+            nh->nh_component_load = NULL;
+        }
+
     } else if ((nh->nh_type == NH_TUNNEL) &&
             (nh->nh_flags & NH_FLAG_TUNNEL_UDP) &&
             (nh->nh_family == AF_INET6)) {
@@ -605,6 +617,102 @@ nh_udp_tunnel6_helper(struct vr_packet *pkt, struct vr_nexthop *nh,
     return true;
 }
 
+/*
+ * nh_tunnel_hdr_build - builds the outer headers of an IPv4 tunnel
+ * nexthop, GRE ones if 'dport' is 0 and UDP ones otherwise
+ */
+static void
+nh_tunnel_hdr_build(struct vr_nexthop *nh, unsigned int sip,
+        unsigned int dip, unsigned short dport)
+{
+    unsigned int sum;
+    unsigned short *w;
+    struct vr_ip *ip;
+    struct vr_gre *gre;
+    struct vr_udp *udp;
+    struct vr_nh_tun_hdr *nth = &nh->nh_tun_hdr;
+
+    memset(nth, 0, sizeof(*nth));
+
+    ip = (struct vr_ip *)nth->nth_hdr;
+    ip->ip_version = 4;
+    ip->ip_hl = 5;
+    ip->ip_proto = dport ? VR_IP_PROTO_UDP : VR_IP_PROTO_GRE;
+    ip->ip_saddr = sip;
+    ip->ip_daddr = dip;
+
+    /* the fragment offset and the addresses do not change by packet */
+    w = (unsigned short *)ip;
+    sum = w[3] + w[6] + w[7] + w[8] + w[9];
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+    nth->nth_csum = sum & 0xFFFF;
+
+    if (dport) {
+        udp = (struct vr_udp *)(ip + 1);
+        udp->udp_dport = htons(dport);
+        nth->nth_len = sizeof(struct vr_ip) + sizeof(struct vr_udp);
+    } else {
+        gre = (struct vr_gre *)(ip + 1);
+        gre->gre_proto = VR_GRE_PROTO_MPLS_NO;
+        nth->nth_len = sizeof(struct vr_ip) + sizeof(struct vr_gre);
+    }
+
+    return;
+}
+
+/*
+ * nh_tunnel_hdr_push - pushes the outer headers of 'nh' and patches what
+ * changes by packet in. The UDP source port, 'sport', is in network order,
+ * as is 'id'. Returns the IP header, NULL if the packet has no room.
+ */
+static struct vr_ip *
+nh_tunnel_hdr_push(struct vr_packet *pkt, struct vr_nexthop *nh,
+        unsigned short id, unsigned short sport,
+        struct vr_forwarding_class_qos *qos, bool csum)
+{
+    unsigned int sum;
+    unsigned short *w;
+    struct vr_ip *ip;
+    struct vr_udp *udp;
+    struct vr_nh_tun_hdr *nth = &nh->nh_tun_hdr;
+
+    ip = (struct vr_ip *)pkt_push(pkt, nth->nth_len);
+    if (!ip)
+        return NULL;
+
+    memcpy(ip, nth->nth_hdr, nth->nth_len);
+    ip->ip_len = htons(pkt_len(pkt));
+    ip->ip_id = id;
+    if (qos) {
+        ip->ip_tos = VR_IP_DSCP(qos->vfcq_dscp);
+        pkt->vp_queue = qos->vfcq_queue_id;
+        pkt->vp_priority = qos->vfcq_dotonep_qos;
+    }
+
+    if (vr_pkt_is_diag(pkt)) {
+        ip->ip_ttl = pkt->vp_ttl;
+    } else {
+        ip->ip_ttl = 64;
+    }
+
+    if (ip->ip_proto == VR_IP_PROTO_UDP) {
+        udp = (struct vr_udp *)(ip + 1);
+        udp->udp_sport = sport;
+        udp->udp_length = htons(pkt_len(pkt) - sizeof(struct vr_ip));
+    }
+
+    if (csum) {
+        w = (unsigned short *)ip;
+        sum = nth->nth_csum + w[0] + w[1] + w[2] + w[4];
+        sum = (sum >> 16) + (sum & 0xFFFF);
+        sum += (sum >> 16);
+        ip->ip_csum = ~sum & 0xFFFF;
+    }
+
+    return ip;
+}
+
 static bool
 nh_pbb_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
         struct vr_forwarding_md *fmd, uint8_t *dmac, uint8_t *smac,
@@ -642,9 +750,14 @@ nh_pbb_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
     return true;
 }
 
+/*
+ * nh_vxlan_tunnel_helper - adds the VXLAN, UDP and IP headers, those of
+ * 'nh' when it is a VXLAN nexthop, or of 'sip' and 'dip'
+ */
 static bool
 nh_vxlan_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
-        struct vr_forwarding_md *fmd, unsigned int sip, unsigned int dip)
+        struct vr_forwarding_md *fmd, struct vr_nexthop *nh,
+        unsigned int sip, unsigned int dip)
 {
     unsigned short udp_src_port = VR_VXLAN_UDP_SRC_PORT;
 
@@ -681,6 +794,10 @@ nh_vxlan_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
     vxlanh->vxlan_flags = htonl(VR_VXLAN_IBIT);
 
     qos = vr_qos_get_forwarding_class(router, *pkt, fmd);
+    if (nh && nh->nh_tun_hdr.nth_len)
+        return nh_tunnel_hdr_push(*pkt, nh, htons(vr_generate_unique_ip_id()),
+                htons(udp_src_port), qos, true) != NULL;
+
     return nh_udp_tunnel_helper(*pkt, htons(udp_src_port),
             htons(VR_VXLAN_UDP_DST_PORT), sip, dip, qos);
 }
@@ -690,6 +807,20 @@ nh_mcast_clone(struct vr_packet *pkt, unsigned short head_room)
 {
     struct vr_packet *clone_pkt;
 
+    /*
+     * Replicas differ only in the headers that are pushed in front of
+     * them. Where the host can, copy the headers alone, and share the
+     * payload amongst the replicas instead of copying it for each.
+     */
+    if (vr_pclone_head) {
+        clone_pkt = vr_pclone_head(pkt, head_room);
+        if (!clone_pkt) {
+            PKT_LOG(VP_DROP_PCOW_FAIL, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            return NULL;
+        }
+        goto done;
+    }
+
     /* Clone the packet */
     clone_pkt = vr_pclone(pkt);
     if (!clone_pkt) {
@@ -703,6 +834,7 @@ nh_mcast_clone(struct vr_packet *pkt, unsigned short head_room)
         return NULL;
     }
 
+done:
     /* Copy the ttl from old packet */
     clone_pkt->vp_ttl = pkt->vp_ttl;
 
@@ -880,18 +1012,44 @@ nh_composite_ecmp_select_by_rflow(struct vr_packet *pkt,
     return index;
 }
 
+/*
+ * the member a hash maps to, through the member table if the composite has
+ * one. A hash that falls on a member without a nexthop is spread over the
+ * active members instead
+ */
+static int
+nh_composite_ecmp_member(struct vr_nexthop *nh, unsigned int hash_ecmp)
+{
+    unsigned int hash;
+    struct vr_component_nh *cnhp = nh->nh_component_nh;
+
+    if (nh->nh_component_table)
+        hash = nh->nh_component_table[hash_ecmp %
+            nh->nh_component_table_size];
+    else
+        hash = hash_ecmp % nh->nh_component_cnt;
+
+    if (cnhp[hash].cnh || !nh->nh_component_ecmp_cnt)
+        return cnhp[hash].cnh_ecmp_index;
+
+    cnhp = nh->nh_component_ecmp;
+    hash_ecmp %= nh->nh_component_ecmp_cnt;
+    if (!cnhp[hash_ecmp].cnh)
+        return -1;
+
+    return cnhp[hash_ecmp].cnh_ecmp_index;
+}
+
 static int
 nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
         struct vr_forwarding_md *fmd)
 {
     bool hash_computed = false;
     int ret = -1, ecmp_index = -1;
-    unsigned int hash, hash_ecmp, count, rflow_src_info;
+    unsigned int hash, hash_ecmp, rflow_src_info;
 
     struct vr_flow flow, *flowp = &flow;
     struct vr_flow_entry *fe = NULL;
-    struct vr_nexthop *cnh = NULL;
-    struct vr_component_nh *cnhp = nh->nh_component_nh;
     struct vr_ip *ip;
     struct vr_ip6 *ip6;
     struct vr_packet *pkt_c;
@@ -899,8 +1057,6 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
     if (!nh || !fmd || (!nh->nh_component_cnt))
         return ret;
 
-    count = nh->nh_component_cnt;
-
     if (fmd->fmd_flow_index >= 0) {
         fe = vr_flow_get_entry(nh->nh_router, fmd->fmd_flow_index);
         if (fe) {
@@ -1012,18 +1168,9 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
     if (ecmp_index == -1) {
         if (!hash_computed)
             hash_ecmp = vr_hash(flowp, flowp->flow_key_len, 0);
-        hash = hash_ecmp % count;
-        ecmp_index = cnhp[hash].cnh_ecmp_index;
-        cnh = cnhp[hash].cnh;
-        if (!cnh) {
-            if (nh->nh_component_ecmp_cnt) {
-                cnhp = nh->nh_component_ecmp;
-                hash_ecmp %= nh->nh_component_ecmp_cnt;
-                ecmp_index = cnhp[hash_ecmp].cnh_ecmp_index;
-                if (!(cnh = cnhp[hash_ecmp].cnh))
-                    return -1;
-            }
-        }
+        ecmp_index = nh_composite_ecmp_member(nh, hash_ecmp);
+        if (ecmp_index == -1)
+            return -1;
     }
 
     if (fe)
@@ -1034,11 +1181,37 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
     return 0;
 }
 
+/*
+ * pick the member of a flow that starts a new flowlet again, from the hash
+ * of the flow salted with the time it was idle for
+ */
+static void
+nh_composite_ecmp_flowlet(struct vr_nexthop *nh, struct vr_forwarding_md *fmd,
+        uint32_t idle)
+{
+    int ecmp_index;
+    struct vr_flow_entry *fe;
+
+    fe = vr_flow_get_entry(nh->nh_router, fmd->fmd_flow_index);
+    if (!fe)
+        return;
+
+    ecmp_index = nh_composite_ecmp_member(nh,
+            vr_hash(&fe->fe_key, fe->fe_key.flow_key_len, idle));
+    if ((ecmp_index < 0) || (ecmp_index == fmd->fmd_ecmp_nh_index))
+        return;
+
+    (void)vr_flow_update_ecmp_index(nh->nh_router, fe, ecmp_index, fmd);
+
+    return;
+}
+
 static nh_processing_t
 nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
                   struct vr_forwarding_md *fmd)
 {
     int ret = 0, drop_reason = VP_DROP_INVALID_NH;
+    uint32_t idle;
     struct vr_nexthop *member_nh = NULL;
     struct vr_vrf_stats *stats = NULL;
 
@@ -1054,6 +1227,14 @@ nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
             stats->vrf_ecmp_composites++;
     }
 
+    /* every packet of the flow counts, to tell how long it was idle for */
+    if (nh->nh_component_flowlet_gap && (fmd->fmd_flow_index >= 0)) {
+        idle = vr_flow_idle_usecs(nh->nh_router, fmd->fmd_flow_index);
+        if ((idle > nh->nh_component_flowlet_gap) &&
+                (fmd->fmd_ecmp_nh_index >= 0))
+            nh_composite_ecmp_flowlet(nh, fmd, idle);
+    }
+
     if ((fmd->fmd_ecmp_nh_index >= 0) &&
             (fmd->fmd_ecmp_nh_index < nh->nh_component_cnt)) {
         member_nh = nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh;
@@ -1089,6 +1270,12 @@ nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
         vr_fmd_set_label(fmd, nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh_label,
                VR_LABEL_TYPE_UNKNOWN);
     }
+
+    if (nh->nh_component_load && (pkt->vp_cpu < vr_num_cpus))
+        nh->nh_component_load[(pkt->vp_cpu *
+                NH_ECMP_LOAD_STRIDE(nh->nh_component_cnt)) +
+            fmd->fmd_ecmp_nh_index]++;
+
     nh_output(pkt, member_nh, fmd);
     return NH_PROCESSING_COMPLETE;
 
@@ -2012,7 +2199,7 @@ nh_composite_fabric(struct vr_packet *pkt, struct vr_nexthop *nh,
                     }
                 }
                 if (nh_vxlan_tunnel_helper(nh->nh_router, &new_pkt,
-                                        fmd, sip, dip) == false) {
+                                        fmd, NULL, sip, dip) == false) {
                     PKT_LOG(VP_DROP_PUSH, pkt, 0, VR_NEXTHOP_C, __LINE__);
                     vr_pfree(new_pkt, VP_DROP_PUSH);
                     break;
@@ -2315,8 +2502,8 @@ nh_vxlan_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
         }
     }
 
-    if (nh_vxlan_tunnel_helper(nh->nh_router, &pkt, fmd, nh->nh_vxlan_tun_sip,
-                nh->nh_vxlan_tun_dip) == false)
+    if (nh_vxlan_tunnel_helper(nh->nh_router, &pkt, fmd, nh,
+                nh->nh_vxlan_tun_sip, nh->nh_vxlan_tun_dip) == false)
         goto send_fail;
 
     pkt_set_network_header(pkt, pkt->vp_data);
@@ -2613,7 +2800,14 @@ nh_mpls_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     else
         pkt->vp_type = VP_TYPE_IP;
 
-    if (nh_udp_tunnel_helper(pkt, htons(udp_src_port),
+    /* with vr_mudp, the headers of the nexthop are GRE ones */
+    if (!vr_mudp && nh->nh_tun_hdr.nth_len) {
+        if (!nh_tunnel_hdr_push(pkt, nh, htons(vr_generate_unique_ip_id()),
+                    htons(udp_src_port), qos, true)) {
+            PKT_LOG(reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            goto send_fail;
+        }
+    } else if (nh_udp_tunnel_helper(pkt, htons(udp_src_port),
                              htons(VR_MPLS_OVER_UDP_DST_PORT),
                              tun_sip, tun_dip, qos) == false) {
         PKT_LOG(reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
@@ -2682,7 +2876,6 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
 
     int tun_encap_rewrite;
     struct vr_forwarding_class_qos *qos;
-    struct vr_gre *gre_hdr;
     struct vr_ip *ip;
     struct vr_interface *vif;
     struct vr_vrf_stats *stats = NULL;
@@ -2806,24 +2999,6 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
             goto send_fail;
     }
 
-    gre_hdr = (struct vr_gre *)pkt_push(pkt, sizeof(struct vr_gre));
-    if (!gre_hdr) {
-        drop_reason = VP_DROP_PUSH;
-        PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
-        goto send_fail;
-    }
-
-    gre_hdr->gre_flags = 0;
-    gre_hdr->gre_proto = VR_GRE_PROTO_MPLS_NO;
-
-    ip = (struct vr_ip *)pkt_push(pkt, sizeof(struct vr_ip));
-    if (!ip) {
-        drop_reason = VP_DROP_PUSH;
-        PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
-        goto send_fail;
-    }
-    pkt_set_network_header(pkt, pkt->vp_data);
-
     if (pkt->vp_type == VP_TYPE_IPOIP)
         pkt->vp_type = VP_TYPE_IP;
     else if (pkt->vp_type == VP_TYPE_IP6OIP)
@@ -2836,34 +3011,15 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     else
         pkt->vp_type = VP_TYPE_IP;
 
-    ip->ip_version = 4;
-    ip->ip_hl = 5;
-    if (qos) {
-        ip->ip_tos = VR_IP_DSCP(qos->vfcq_dscp);
-        pkt->vp_queue = qos->vfcq_queue_id;
-        pkt->vp_priority = qos->vfcq_dotonep_qos;
-    } else {
-        ip->ip_tos = 0;
-    }
-
-    ip->ip_id = id;
-    ip->ip_frag_off = 0;
-
-    if (vr_pkt_is_diag(pkt)) {
-        ip->ip_ttl = pkt->vp_ttl;
-    } else {
-        ip->ip_ttl = 64;
-    }
-
-    ip->ip_proto = VR_IP_PROTO_GRE;
-    ip->ip_saddr = nh->nh_gre_tun_sip;
-    ip->ip_daddr = nh->nh_gre_tun_dip;
-    ip->ip_len = htons(pkt_len(pkt));
     /* checksum will be calculated for tunneled packet in linux_xmit_segment */
-    if (!vr_pkt_type_is_overlay(pkt->vp_type)) {
-        ip->ip_csum = 0;
-        ip->ip_csum = vr_ip_csum(ip);
+    ip = nh_tunnel_hdr_push(pkt, nh, id, 0, qos,
+            !vr_pkt_type_is_overlay(pkt->vp_type));
+    if (!ip) {
+        drop_reason = VP_DROP_PUSH;
+        PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+        goto send_fail;
     }
+    pkt_set_network_header(pkt, pkt->vp_data);
 
     /* slap l2 header */
     if (nh->nh_flags & NH_FLAG_CRYPT_TRAFFIC) {
@@ -3259,6 +3415,8 @@ vr_nexthop_delete(vr_nexthop_req *req)
         vr_offload_nexthop_del(nh);
         vrouter_put_nexthop(nh);
         nh->nh_destructor(nh);
+        /* source validation results of the flows depend on the nexthops */
+        vr_flow_rpf_invalidate();
     }
 
     ret = vr_send_response(ret);
@@ -3411,11 +3569,157 @@ nh_composite_mcast_validate(struct vr_component_nh *component_nh,
     return 0;
 }
 
+/* the smallest prime that is not less than 'size' */
+static unsigned int
+nh_ecmp_table_prime(unsigned int size)
+{
+    unsigned int d;
+
+    if (size > NH_ECMP_TABLE_MAX_SIZE)
+        return NH_ECMP_TABLE_MAX_SIZE;
+    if (size < 2)
+        return 2;
+
+    for (;; size++) {
+        for (d = 2; d * d <= size; d++) {
+            if (!(size % d))
+                break;
+        }
+
+        if (d * d > size)
+            return size;
+    }
+}
+
+/* the greatest common divisor of the weights of the members with a nexthop */
+static unsigned int
+nh_ecmp_weight_gcd(struct vr_component_nh *component_nh, unsigned int cnt)
+{
+    unsigned int i, a, b, t, gcd = 0;
+
+    for (i = 0; i < cnt; i++) {
+        if (!component_nh[i].cnh)
+            continue;
+
+        a = component_nh[i].cnh_weight;
+        b = gcd;
+        while (b) {
+            t = a % b;
+            a = b;
+            b = t;
+        }
+        gcd = a;
+    }
+
+    return gcd ? gcd : 1;
+}
+
+/* the buckets a round of nh_composite_ecmp_table hands out */
+static unsigned int
+nh_ecmp_weight_round(struct vr_component_nh *component_nh, unsigned int cnt)
+{
+    unsigned int i, gcd, round = 0;
+
+    gcd = nh_ecmp_weight_gcd(component_nh, cnt);
+    for (i = 0; i < cnt; i++) {
+        if (component_nh[i].cnh)
+            round += component_nh[i].cnh_weight / gcd;
+    }
+
+    return round;
+}
+
+/*
+ * the bucket to member table of a resilient ECMP composite, of 'size'
+ * buckets, 'size' a prime. Only the members with a nexthop get buckets, as
+ * many a round as their weight over the gcd of the weights, one a turn.
+ */
+static unsigned short *
+nh_composite_ecmp_table(struct vr_component_nh *component_nh,
+        unsigned int cnt, unsigned int size)
+{
+    unsigned int i, j, gcd, hash, left, active = 0, filled = 0;
+    unsigned int *pos, *skip, *credit;
+    unsigned short *table, *members;
+
+    table = vr_zalloc(size * sizeof(*table), VR_NEXTHOP_COMPONENT_OBJECT);
+    if (!table)
+        return NULL;
+
+    pos = vr_zalloc(cnt * (3 * sizeof(unsigned int) +
+                sizeof(unsigned short)), VR_NEXTHOP_COMPONENT_OBJECT);
+    if (!pos) {
+        vr_free(table, VR_NEXTHOP_COMPONENT_OBJECT);
+        return NULL;
+    }
+    skip = pos + cnt;
+    credit = skip + cnt;
+    members = (unsigned short *)(credit + cnt);
+
+    /*
+     * a member starts at its offset and steps by its skip, which, the
+     * size being prime, visits all the buckets
+     */
+    for (i = 0; i < cnt; i++) {
+        if (!component_nh[i].cnh)
+            continue;
+
+        hash = vr_hash_2words(component_nh[i].cnh->nh_id,
+                component_nh[i].cnh_label, 0);
+        members[active] = i;
+        pos[active] = hash % size;
+        skip[active] = (vr_hash_2words(component_nh[i].cnh->nh_id,
+                    component_nh[i].cnh_label, hash) % (size - 1)) + 1;
+        active++;
+    }
+
+    if (!active) {
+        vr_free(pos, VR_NEXTHOP_COMPONENT_OBJECT);
+        vr_free(table, VR_NEXTHOP_COMPONENT_OBJECT);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++)
+        table[i] = (unsigned short)-1;
+
+    gcd = nh_ecmp_weight_gcd(component_nh, cnt);
+    while (filled < size) {
+        left = 0;
+        for (j = 0; j < active; j++) {
+            credit[j] = component_nh[members[j]].cnh_weight / gcd;
+            left += credit[j];
+        }
+
+        while (left && (filled < size)) {
+            for (j = 0; (j < active) && (filled < size); j++) {
+                if (!credit[j])
+                    continue;
+
+                while (table[pos[j]] != (unsigned short)-1)
+                    pos[j] = (pos[j] + skip[j]) % size;
+
+                table[pos[j]] = members[j];
+                pos[j] = (pos[j] + skip[j]) % size;
+                credit[j]--;
+                left--;
+                filled++;
+            }
+        }
+    }
+
+    vr_free(pos, VR_NEXTHOP_COMPONENT_OBJECT);
+
+    return table;
+}
+
 static int
 nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 {
     int ret = 0;
-    unsigned int i, j = 0, active = 0;
+    bool weighted = false;
+    unsigned int i, j = 0, active = 0, table_size = 0, weight = 0;
+    unsigned short *ecmp_table = NULL;
+    uint64_t *ecmp_load = NULL;
     struct vr_nexthop *tmp_nh;
     struct vr_component_nh *component_nh = NULL, *component_ecmp = NULL;
 
@@ -3424,6 +3728,32 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
         goto exit_add;
     }
 
+    /* flowlets need the last seen times of the flows */
+    if (req->nhr_flowlet_gap) {
+        if (!(req->nhr_flags & NH_FLAG_COMPOSITE_ECMP) ||
+                (req->nhr_flowlet_gap > NH_ECMP_FLOWLET_MAX_GAP) ||
+                !nh->nh_router->vr_flow_last_seen) {
+            ret = -EINVAL;
+            goto exit_add;
+        }
+    }
+
+    /* no weights is all of them 1 */
+    if (req->nhr_weight_list_size) {
+        if (req->nhr_weight_list_size != req->nhr_nh_list_size) {
+            ret = -EINVAL;
+            goto exit_add;
+        }
+
+        for (i = 0; i < req->nhr_weight_list_size; i++) {
+            if ((req->nhr_weight_list[i] < 1) ||
+                    (req->nhr_weight_list[i] > NH_ECMP_MAX_WEIGHT)) {
+                ret = -EINVAL;
+                goto exit_add;
+            }
+        }
+    }
+
     if (req->nhr_nh_list_size) {
         component_nh = vr_zalloc(req->nhr_nh_list_size *
                 sizeof(struct vr_component_nh), VR_NEXTHOP_COMPONENT_OBJECT);
@@ -3436,8 +3766,15 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
             component_nh[i].cnh = vrouter_get_nexthop(req->nhr_rid,
                     req->nhr_nh_list[i]);
             component_nh[i].cnh_label = req->nhr_label_list[i];
-            if (component_nh[i].cnh)
+            component_nh[i].cnh_weight = req->nhr_weight_list_size ?
+                req->nhr_weight_list[i] : 1;
+            if (component_nh[i].cnh) {
+                /* equal weights, whatever they are, weigh nothing */
+                if (active && (component_nh[i].cnh_weight != weight))
+                    weighted = true;
+                weight = component_nh[i].cnh_weight;
                 active++;
+            }
 
             if (req->nhr_flags & NH_FLAG_COMPOSITE_ECMP) {
                 component_nh[i].cnh_ecmp_index = i;
@@ -3470,6 +3807,34 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
                     /* nh->nh_component_ecmp[j++].cnh_ecmp_index = i */
                 }
             }
+
+            /* the hash modulo the members cannot weigh them */
+            if (active && (vr_ecmp_table_size || weighted)) {
+                table_size = vr_ecmp_table_size ?
+                    vr_ecmp_table_size : NH_ECMP_TABLE_DEF_SIZE;
+                if (weighted && (table_size <
+                            nh_ecmp_weight_round(component_nh,
+                                req->nhr_nh_list_size)))
+                    table_size = nh_ecmp_weight_round(component_nh,
+                            req->nhr_nh_list_size);
+                table_size = nh_ecmp_table_prime(table_size);
+                ecmp_table = nh_composite_ecmp_table(component_nh,
+                        req->nhr_nh_list_size, table_size);
+                if (!ecmp_table) {
+                    ret = -ENOMEM;
+                    goto exit_add;
+                }
+            }
+
+            if (req->nhr_flowlet_gap) {
+                ecmp_load = vr_zalloc(vr_num_cpus * sizeof(uint64_t) *
+                        NH_ECMP_LOAD_STRIDE(req->nhr_nh_list_size),
+                        VR_NEXTHOP_COMPONENT_OBJECT);
+                if (!ecmp_load) {
+                    ret = -ENOMEM;
+                    goto exit_add;
+                }
+            }
         }
     }
 
@@ -3489,7 +3854,19 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
             nh->nh_component_ecmp = NULL;
             nh->nh_component_ecmp_cnt = 0;
         }
+
+        if (nh->nh_component_table) {
+            vr_free(nh->nh_component_table, VR_NEXTHOP_COMPONENT_OBJECT);
+            nh->nh_component_table = NULL;
+            nh->nh_component_table_size = 0;
+        }
+
+        if (nh->nh_component_load) {
+            vr_free(nh->nh_component_load, VR_NEXTHOP_COMPONENT_OBJECT);
+            nh->nh_component_load = NULL;
+        }
     }
+    nh->nh_component_flowlet_gap = 0;
 
     /* Nh list of size 0 is valid */
     if (req->nhr_nh_list_size == 0)
@@ -3499,6 +3876,12 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
     if (component_ecmp) {
         nh->nh_component_ecmp = component_ecmp;
     }
+    if (ecmp_table) {
+        nh->nh_component_table_size = table_size;
+        nh->nh_component_table = ecmp_table;
+    }
+    nh->nh_component_load = ecmp_load;
+    nh->nh_component_flowlet_gap = req->nhr_flowlet_gap;
     nh->nh_component_cnt = req->nhr_nh_list_size;
 
 exit_add:
@@ -3537,6 +3920,14 @@ exit_add:
         if (component_ecmp) {
             vr_free(component_ecmp, VR_NEXTHOP_COMPONENT_OBJECT);
         }
+
+        if (ecmp_table) {
+            vr_free(ecmp_table, VR_NEXTHOP_COMPONENT_OBJECT);
+        }
+
+        if (ecmp_load) {
+            vr_free(ecmp_load, VR_NEXTHOP_COMPONENT_OBJECT);
+        }
     }
 
     return ret;
@@ -3603,6 +3994,7 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 
     /* Reset the nh valid underlay vif count on every add or update*/
     nh->nh_valid_underlay_dev_count = 0;
+    nh->nh_tun_hdr.nth_len = 0;
 
     if (nh->nh_flags & NH_FLAG_TUNNEL_UNDERLAY_ECMP) {
         for (i = 0; i < VR_MAX_PHY_INF; i++) {
@@ -3636,6 +4028,7 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 
         nh->nh_gre_tun_sip = req->nhr_tun_sip;
         nh->nh_gre_tun_dip = req->nhr_tun_dip;
+        nh_tunnel_hdr_build(nh, nh->nh_gre_tun_sip, nh->nh_gre_tun_dip, 0);
         nh->nh_validate_src = nh_gre_tunnel_validate_src;
         if (nh->nh_flags & NH_FLAG_TUNNEL_UNDERLAY_ECMP) {
             nh->nh_gre_tun_encap_len = req->nhr_encap_len;
@@ -3701,6 +4094,8 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 
         nh->nh_udp_tun_sip = req->nhr_tun_sip;
         nh->nh_udp_tun_dip = req->nhr_tun_dip;
+        nh_tunnel_hdr_build(nh, nh->nh_udp_tun_sip, nh->nh_udp_tun_dip,
+                VR_MPLS_OVER_UDP_DST_PORT);
         nh->nh_validate_src = nh_mpls_udp_tunnel_validate_src;
         if (nh->nh_flags & NH_FLAG_TUNNEL_UNDERLAY_ECMP) {
             nh->nh_udp_tun_encap_len = req->nhr_encap_len;
@@ -3726,6 +4121,8 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 
         nh->nh_vxlan_tun_sip = req->nhr_tun_sip;
         nh->nh_vxlan_tun_dip = req->nhr_tun_dip;
+        nh_tunnel_hdr_build(nh, nh->nh_vxlan_tun_sip, nh->nh_vxlan_tun_dip,
+                VR_VXLAN_UDP_DST_PORT);
         nh->nh_validate_src = nh_vxlan_tunnel_validate_src;
         if (nh->nh_flags & NH_FLAG_TUNNEL_UNDERLAY_ECMP) {
             nh->nh_vxlan_tun_encap_len = req->nhr_encap_len;
@@ -4095,6 +4492,10 @@ error:
         nh->nh_destructor(nh);
 
 generate_resp:
+    /* a change leaves the nexthop changed, even one that failed half way */
+    if (change)
+        vr_flow_rpf_invalidate();
+
     ret = vr_send_response(ret);
 
     return ret;
@@ -4114,6 +4515,15 @@ vr_nexthop_req_get_size(void *req_p)
     if (req->nhr_label_list_size)
         size += (4 * req->nhr_label_list_size);
 
+    if (req->nhr_weight_list_size)
+        size += (4 * req->nhr_weight_list_size);
+
+    if (req->nhr_bucket_list_size)
+        size += (4 * req->nhr_bucket_list_size);
+
+    if (req->nhr_load_list_size)
+        size += (8 * req->nhr_load_list_size);
+
     if (req->nhr_encap_oif_id_size)
         size += (4 * req->nhr_encap_oif_id_size);
 
@@ -4134,7 +4544,7 @@ vr_nexthop_req_get_size(void *req_p)
 static int
 vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
 {
-    unsigned int i;
+    unsigned int i, j;
     unsigned char *encap = NULL;
     struct vr_nexthop *cnh;
 
@@ -4212,6 +4622,53 @@ vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
 
                 req->nhr_label_list[i] = nh->nh_component_nh[i].cnh_label;
             }
+
+            if (nh->nh_flags & NH_FLAG_COMPOSITE_ECMP) {
+                req->nhr_weight_list_size = req->nhr_nh_list_size;
+                req->nhr_weight_list =
+                    vr_zalloc(req->nhr_weight_list_size * sizeof(unsigned int),
+                            VR_NEXTHOP_REQ_LIST_OBJECT);
+                if (!req->nhr_weight_list)
+                    return -ENOMEM;
+
+                for (i = 0; i < req->nhr_weight_list_size; i++)
+                    req->nhr_weight_list[i] =
+                        nh->nh_component_nh[i].cnh_weight;
+            }
+
+            /* the buckets of each member, the share of the traffic it gets */
+            if (nh->nh_component_table) {
+                req->nhr_bucket_list_size = req->nhr_nh_list_size;
+                req->nhr_bucket_list =
+                    vr_zalloc(req->nhr_bucket_list_size * sizeof(unsigned int),
+                            VR_NEXTHOP_REQ_LIST_OBJECT);
+                if (!req->nhr_bucket_list)
+                    return -ENOMEM;
+
+                for (i = 0; i < nh->nh_component_table_size; i++) {
+                    j = nh->nh_component_table[i];
+                    if (j < req->nhr_bucket_list_size)
+                        req->nhr_bucket_list[j]++;
+                }
+            }
+
+            /* the packets each member was sent, of all the cpus */
+            if (nh->nh_component_load) {
+                req->nhr_load_list_size = req->nhr_nh_list_size;
+                req->nhr_load_list =
+                    vr_zalloc(req->nhr_load_list_size * sizeof(uint64_t),
+                            VR_NEXTHOP_REQ_LIST_OBJECT);
+                if (!req->nhr_load_list)
+                    return -ENOMEM;
+
+                for (i = 0; i < vr_num_cpus; i++) {
+                    for (j = 0; j < req->nhr_load_list_size; j++)
+                        req->nhr_load_list[j] += nh->nh_component_load[(i *
+                                NH_ECMP_LOAD_STRIDE(nh->nh_component_cnt)) + j];
+                }
+            }
+
+            req->nhr_flowlet_gap = nh->nh_component_flowlet_gap;
         }
 
         break;
@@ -4461,6 +4918,24 @@ vr_nexthop_req_destroy(vr_nexthop_req *req)
         req->nhr_label_list_size = 0;
     }
 
+    if (req->nhr_weight_list_size && req->nhr_weight_list) {
+        vr_free(req->nhr_weight_list, VR_NEXTHOP_REQ_LIST_OBJECT);
+        req->nhr_weight_list = NULL;
+        req->nhr_weight_list_size = 0;
+    }
+
+    if (req->nhr_bucket_list_size && req->nhr_bucket_list) {
+        vr_free(req->nhr_bucket_list, VR_NEXTHOP_REQ_LIST_OBJECT);
+        req->nhr_bucket_list = NULL;
+        req->nhr_bucket_list_size = 0;
+    }
+
+    if (req->nhr_load_list_size && req->nhr_load_list) {
+        vr_free(req->nhr_load_list, VR_NEXTHOP_REQ_LIST_OBJECT);
+        req->nhr_load_list = NULL;
+        req->nhr_load_list_size = 0;
+    }
+
     if (req->nhr_tun_sip6) {
         vr_free(req->nhr_tun_sip6, VR_NETWORK_ADDRESS_OBJECT);
         req->nhr_tun_sip6 = NULL;
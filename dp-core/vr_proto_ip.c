@@ -14,6 +14,7 @@
 #include "vr_ip_mtrie.h"
 #include "vr_fragment.h"
 #include "vr_bridge.h"
+#include "vr_dst_cache.h"
 
 static unsigned short vr_ip_id;
 
@@ -22,6 +23,9 @@ extern struct vr_nexthop *vr_inet6_ip_lookup(unsigned short, uint8_t *);
 
 struct vr_nexthop *
 vr_inet_ip_lookup(unsigned short vrf, uint32_t ip);
+void
+vr_inet_ip_lookup_burst(unsigned short vrf, uint32_t *ips,
+        struct vr_nexthop **nhs, unsigned int num);
 struct vr_nexthop *
 vr_inet_src_lookup(unsigned short vrf, struct vr_packet *pkt);
 bool
@@ -61,6 +65,84 @@ vr_inet_ip_lookup(unsigned short vrf, uint32_t ip)
     return vr_inet_route_lookup(vrf, &rt);
 }
 
+/*
+ * vr_inet_ip_lookup of a burst of addresses of one vrf, with the mtrie
+ * walks of up to VR_INET_LOOKUP_BURST_MAX of them interleaved
+ */
+void
+vr_inet_ip_lookup_burst(unsigned short vrf, uint32_t *ips,
+        struct vr_nexthop **nhs, unsigned int num)
+{
+    unsigned int i, j, cnt;
+    struct vr_route_result res[VR_INET_LOOKUP_BURST_MAX];
+
+    for (i = 0; i < num; i += cnt) {
+        cnt = num - i;
+        if (cnt > VR_INET_LOOKUP_BURST_MAX)
+            cnt = VR_INET_LOOKUP_BURST_MAX;
+
+        vr_inet_route_lookup_burst(vrf, &ips[i], res, cnt);
+        for (j = 0; j < cnt; j++)
+            nhs[i + j] = res[j].rr_nh;
+    }
+
+    return;
+}
+
+/*
+ * Looks the destinations of a burst of packets received on a VM interface
+ * that forwards without flows up in one go, and leaves the routes found in
+ * the destination cache of the cpu, where vr_forward picks them up as it
+ * routes each packet. Only untagged IPv4 unicast is handled here,
+ * everything else is left to the per packet path. Returns the number of
+ * packets looked up.
+ */
+unsigned int
+vr_inet_route_prefetch_burst(struct vr_interface *vif,
+        struct vr_packet **pkts, unsigned int num)
+{
+    unsigned int i, nips = 0;
+    uint32_t gen;
+    uint32_t ips[VR_INET_LOOKUP_BURST_MAX];
+    struct vr_route_result res[VR_INET_LOOKUP_BURST_MAX];
+    struct vr_eth *eth;
+    struct vr_ip *ip;
+
+    if (!vif || !vif_is_virtual(vif) || vif_is_service(vif) ||
+            (vif->vif_flags & VIF_FLAG_POLICY_ENABLED))
+        return 0;
+
+    if (num > VR_INET_LOOKUP_BURST_MAX)
+        num = VR_INET_LOOKUP_BURST_MAX;
+
+    for (i = 0; i < num; i++) {
+        if (!pkts[i] ||
+                (pkt_head_len(pkts[i]) < (VR_ETHER_HLEN + sizeof(struct vr_ip))))
+            continue;
+
+        eth = (struct vr_eth *)pkt_data(pkts[i]);
+        if (ntohs(eth->eth_proto) != VR_ETH_PROTO_IP)
+            continue;
+
+        ip = (struct vr_ip *)(eth + 1);
+        if (!vr_ip_is_ip4(ip) || IS_BMCAST_IP(ip->ip_daddr))
+            continue;
+
+        ips[nips++] = ip->ip_daddr;
+    }
+
+    if (!nips)
+        return 0;
+
+    /* read before the lookup, so that a route changing meanwhile wins */
+    gen = vr_dst_cache_gen;
+    vr_sync_synchronize();
+    vr_inet_route_lookup_burst(vif->vif_vrf, ips, res, nips);
+    vr_dst_cache_fill(vif->vif_vrf, gen, ips, res, nips);
+
+    return nips;
+}
+
 struct vr_nexthop *
 vr_inet_src_lookup(unsigned short vrf, struct vr_packet *pkt)
 {
@@ -285,7 +367,7 @@ vr_forward(struct vrouter *router, struct vr_packet *pkt,
     rt.rtr_req.rtr_nh_id = 0;
     rt.rtr_req.rtr_marker_size = 0;
 
-    nh = vr_inet_route_lookup(fmd->fmd_dvrf, &rt);
+    nh = vr_dst_cache_lookup(fmd->fmd_dvrf, &rt);
     if (!nh) {
         PKT_LOG(VP_DROP_INVALID_NH, pkt, 0, VR_PROTO_IP_C, __LINE__);
         vr_pfree(pkt, VP_DROP_INVALID_NH);
@@ -10,6 +10,7 @@
 #include "vr_message.h"
 #include "vr_sandesh.h"
 #include "vr_offloads_dp.h"
+#include "vr_dst_cache.h"
 
 unsigned int vr_vrfs = VR_DEF_VRFS;
 
@@ -17,6 +18,8 @@ extern int mtrie_algo_init(struct vr_rtable *, struct rtable_fspec *);
 extern void mtrie_algo_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
 extern int bridge_table_init(struct vr_rtable *, struct rtable_fspec *);
 extern void bridge_table_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
+extern int ip6_fib_init(struct vr_rtable *, struct rtable_fspec *);
+extern void ip6_fib_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
 
 static int inet_rtb_family_init(struct rtable_fspec *fs, struct vrouter *router);
 static void inet_rtb_family_deinit(struct rtable_fspec *fs, struct vrouter *router, bool soft_reset);
@@ -61,6 +64,8 @@ static struct rtable_fspec rtable_families[] = {
         .route_del = inet_route_del,
         .algo_init = mtrie_algo_init,
         .algo_deinit = mtrie_algo_deinit,
+        .fib_init = ip6_fib_init,
+        .fib_deinit = ip6_fib_deinit,
     }
 };
 
@@ -164,6 +169,189 @@ vr_route_add(vr_route_req *req)
     return ret;
 }
 
+/*
+ * The routes of a batch are put in the order of their prefix lengths,
+ * shortest first for an add and longest first for a delete, so that a
+ * route is programmed over the less specific ones it covers rather than
+ * having them rewrite its buckets after it, and so that the buckets of a
+ * delete collapse bottom up
+ */
+static unsigned int *
+vr_route_batch_order(vr_route_req *req, bool longest_first)
+{
+    unsigned int i, len, sum, max_len;
+    unsigned int count[(RT_IP_ADDR_SIZE(AF_INET6) * 8) + 2];
+    unsigned int *order;
+
+    max_len = RT_IP_ADDR_SIZE(req->rtr_family) * 8;
+    order = vr_zalloc(req->rtr_batch_prefix_len_size * sizeof(*order),
+            VR_ROUTE_TABLE_OBJECT);
+    if (!order)
+        return NULL;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < req->rtr_batch_prefix_len_size; i++) {
+        len = req->rtr_batch_prefix_len[i];
+        if (len > max_len) {
+            vr_free(order, VR_ROUTE_TABLE_OBJECT);
+            return NULL;
+        }
+
+        if (longest_first)
+            len = max_len - len;
+        count[len + 1]++;
+    }
+
+    for (sum = 0, i = 0; i <= max_len + 1; i++) {
+        sum += count[i];
+        count[i] = sum;
+    }
+
+    for (i = 0; i < req->rtr_batch_prefix_len_size; i++) {
+        len = req->rtr_batch_prefix_len[i];
+        if (longest_first)
+            len = max_len - len;
+        order[count[len]++] = i;
+    }
+
+    return order;
+}
+
+/*
+ * Adds or deletes the routes of one vrf that came in the lists of a single
+ * request, in one go. The mtrie reclaims whatever the batch retired after
+ * one grace period. The request is answered once, with the first error, but
+ * every route that got programmed is broadcast on its own, as a single add
+ * or delete would have been, so that listeners see what the table holds.
+ */
+static int
+vr_route_batch(vr_route_req *req)
+{
+    int ret = 0, rret;
+    bool add = (req->h_op == SANDESH_OP_ADD);
+    unsigned int i, n, addr_size;
+    unsigned int *order = NULL;
+    uint32_t rt_prefix[4];
+    struct vrouter *router;
+    struct vr_rtable *rtable;
+    struct rtable_fspec *fs;
+    struct vr_route_req vr_req;
+
+    n = req->rtr_batch_prefix_len_size;
+    if ((req->rtr_family != AF_INET) && (req->rtr_family != AF_INET6)) {
+        ret = -EINVAL;
+        goto generate_response;
+    }
+
+    fs = vr_get_family(req->rtr_family);
+    router = vrouter_get(req->rtr_rid);
+    if (!fs || !router || !router->vr_inet_rtable) {
+        ret = -ENOENT;
+        goto generate_response;
+    }
+    rtable = router->vr_inet_rtable;
+
+    addr_size = RT_IP_ADDR_SIZE(req->rtr_family);
+    if ((n > VR_ROUTE_BATCH_MAX) ||
+            (req->rtr_batch_prefix_size != (n * addr_size)) ||
+            (req->rtr_batch_nh_id_size != n) ||
+            (req->rtr_batch_label_size &&
+             (req->rtr_batch_label_size != n)) ||
+            (req->rtr_batch_label_flags_size &&
+             (req->rtr_batch_label_flags_size != n)) ||
+            (req->rtr_batch_replace_plen_size &&
+             (req->rtr_batch_replace_plen_size != n)) ||
+            (req->rtr_batch_mac_size &&
+             (req->rtr_batch_mac_size != (n * VR_ETHER_ALEN)))) {
+        ret = -EINVAL;
+        goto generate_response;
+    }
+
+    order = vr_route_batch_order(req, !add);
+    if (!order) {
+        ret = -EINVAL;
+        goto generate_response;
+    }
+
+    if (rtable->algo_batch_start)
+        rtable->algo_batch_start(rtable);
+
+    for (i = 0; i < n; i++) {
+        vr_req.rtr_req = *req;
+        vr_req.rtr_nh = NULL;
+        vr_req.rtr_req.rtr_marker = NULL;
+        vr_req.rtr_req.rtr_marker_size = 0;
+        vr_req.rtr_req.rtr_batch_prefix = NULL;
+        vr_req.rtr_req.rtr_batch_prefix_size = 0;
+        vr_req.rtr_req.rtr_batch_prefix_len = NULL;
+        vr_req.rtr_req.rtr_batch_prefix_len_size = 0;
+        vr_req.rtr_req.rtr_batch_nh_id = NULL;
+        vr_req.rtr_req.rtr_batch_nh_id_size = 0;
+        vr_req.rtr_req.rtr_batch_label = NULL;
+        vr_req.rtr_req.rtr_batch_label_size = 0;
+        vr_req.rtr_req.rtr_batch_label_flags = NULL;
+        vr_req.rtr_req.rtr_batch_label_flags_size = 0;
+        vr_req.rtr_req.rtr_batch_replace_plen = NULL;
+        vr_req.rtr_req.rtr_batch_replace_plen_size = 0;
+        vr_req.rtr_req.rtr_batch_mac = NULL;
+        vr_req.rtr_req.rtr_batch_mac_size = 0;
+
+        vr_req.rtr_req.rtr_prefix = (uint8_t *)&rt_prefix;
+        vr_req.rtr_req.rtr_prefix_size = addr_size;
+        memcpy(vr_req.rtr_req.rtr_prefix,
+                req->rtr_batch_prefix + (order[i] * addr_size), addr_size);
+        vr_req.rtr_req.rtr_prefix_len = req->rtr_batch_prefix_len[order[i]];
+        vr_req.rtr_req.rtr_nh_id = req->rtr_batch_nh_id[order[i]];
+        vr_req.rtr_req.rtr_label = req->rtr_batch_label_size ?
+            req->rtr_batch_label[order[i]] : 0;
+        vr_req.rtr_req.rtr_label_flags = req->rtr_batch_label_flags_size ?
+            req->rtr_batch_label_flags[order[i]] : 0;
+        vr_req.rtr_req.rtr_replace_plen = req->rtr_batch_replace_plen_size ?
+            req->rtr_batch_replace_plen[order[i]] : 0;
+        if (req->rtr_batch_mac_size) {
+            vr_req.rtr_req.rtr_mac = (int8_t *)req->rtr_batch_mac +
+                (order[i] * VR_ETHER_ALEN);
+            vr_req.rtr_req.rtr_mac_size = VR_ETHER_ALEN;
+        } else {
+            vr_req.rtr_req.rtr_mac = NULL;
+            vr_req.rtr_req.rtr_mac_size = 0;
+        }
+
+        if (add) {
+            rret = fs->route_add(fs, &vr_req);
+            if (!rret) {
+                rret = vr_offload_route_add(&vr_req.rtr_req);
+                if (rret)
+                    fs->route_del(fs, &vr_req);
+            }
+        } else {
+            rret = fs->route_del(fs, &vr_req);
+            if (!rret)
+                vr_offload_route_del(&vr_req.rtr_req);
+        }
+
+        /* the rest of the batch is programmed, and the first error told */
+        if (rret) {
+            if (!ret)
+                ret = rret;
+            continue;
+        }
+
+        vr_send_broadcast(VR_ROUTE_OBJECT_ID, &vr_req, req->h_op, 0);
+    }
+
+    if (rtable->algo_batch_end)
+        rtable->algo_batch_end(rtable);
+
+generate_response:
+    if (order)
+        vr_free(order, VR_ROUTE_TABLE_OBJECT);
+
+    vr_send_response(ret);
+
+    return ret;
+}
+
 int
 vr_route_get(vr_route_req *req)
 {
@@ -289,11 +477,17 @@ vr_route_req_process(void *s_req)
 
     switch (req->h_op) {
     case SANDESH_OP_ADD:
-        vr_route_add(req);
+        if (req->rtr_batch_prefix_len_size)
+            vr_route_batch(req);
+        else
+            vr_route_add(req);
         break;
 
     case SANDESH_OP_DEL:
-        vr_route_delete(req);
+        if (req->rtr_batch_prefix_len_size)
+            vr_route_batch(req);
+        else
+            vr_route_delete(req);
         break;
 
     case SANDESH_OP_GET:
@@ -501,6 +695,10 @@ static void
 inet_rtb_family_deinit(struct rtable_fspec *fs, struct vrouter *router,
                                                         bool soft_reset)
 {
+    /* the table is gone already if the other family got to it first */
+    if (fs->fib_deinit)
+        fs->fib_deinit(router->vr_inet_rtable, fs, soft_reset);
+
     if (router->vr_inet_rtable) {
         fs->algo_deinit(router->vr_inet_rtable, fs, soft_reset);
         if (!soft_reset) {
@@ -531,6 +729,13 @@ inet_rtb_family_init(struct rtable_fspec *fs, struct vrouter *router)
     if (ret)
         return vr_module_error(ret, __FUNCTION__, __LINE__, 0);
 
+    if (fs->fib_init) {
+        ret = fs->fib_init(router->vr_inet_rtable, fs);
+        if (ret)
+            return vr_module_error(ret, __FUNCTION__, __LINE__,
+                    fs->rtb_family);
+    }
+
     return 0;
 }
 
@@ -629,6 +834,8 @@ vr_fib_exit(struct vrouter *router, bool soft_reset)
         fs->rtb_family_deinit(fs, router, soft_reset);
     }
 
+    vr_dst_cache_exit(router, soft_reset);
+
     return;
 }
 
@@ -644,6 +851,10 @@ vr_fib_mem(struct vrouter *router)
 
     router->vr_max_vrfs = vr_vrfs;
 
+    ret = vr_dst_cache_init(router);
+    if (ret)
+        return ret;
+
     size = (int)ARRAYSIZE(rtable_families);
     for (i = 0; i < size; i++) {
         fs = &rtable_families[i];
@@ -658,6 +869,7 @@ vr_fib_mem(struct vrouter *router)
     return 0;
 
 exit_init:
+    vr_dst_cache_exit(router, false);
     if (!i)
         return ret;
 
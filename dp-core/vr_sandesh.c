@@ -76,7 +76,8 @@ struct sandesh_object_md sandesh_md[] = {
     },
     [VR_FLOW_TABLE_DATA_OBJECT_ID]         =   {
         .obj_len                =       ((4 * sizeof(vr_flow_table_data)) +
-                    (VR_FLOW_MAX_CPUS * sizeof(unsigned int))),
+                    (VR_FLOW_MAX_CPUS * sizeof(unsigned int)) +
+                    (3 * VR_FLOW_MAX_CPUS * sizeof(uint64_t))),
         .obj_type_string        =       "vr_flow_table_data",
     },
     [VR_MEM_STATS_OBJECT_ID]    =   {
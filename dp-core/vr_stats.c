@@ -239,12 +239,16 @@ vr_mem_stats_get(void)
                 stats_block[VR_ASSEMBLER_TABLE_OBJECT].ms_free);
         response->vms_bridge_mac_object += (stats_block[VR_BRIDGE_MAC_OBJECT].ms_alloc -
                 stats_block[VR_BRIDGE_MAC_OBJECT].ms_free);
+        response->vms_bridge_learn_object += (stats_block[VR_BRIDGE_LEARN_OBJECT].ms_alloc -
+                stats_block[VR_BRIDGE_LEARN_OBJECT].ms_free);
         response->vms_btable_object += (stats_block[VR_BTABLE_OBJECT].ms_alloc -
                 stats_block[VR_BTABLE_OBJECT].ms_free);
         response->vms_build_info_object += (stats_block[VR_BUILD_INFO_OBJECT].ms_alloc -
                 stats_block[VR_BUILD_INFO_OBJECT].ms_free);
         response->vms_defer_object += (stats_block[VR_DEFER_OBJECT].ms_alloc -
                 stats_block[VR_DEFER_OBJECT].ms_free);
+        response->vms_dst_cache_object += (stats_block[VR_DST_CACHE_OBJECT].ms_alloc -
+                stats_block[VR_DST_CACHE_OBJECT].ms_free);
         response->vms_drop_stats_object += (stats_block[VR_DROP_STATS_OBJECT].ms_alloc -
                 stats_block[VR_DROP_STATS_OBJECT].ms_free);
         response->vms_drop_stats_req_object += (stats_block[VR_DROP_STATS_REQ_OBJECT].ms_alloc -
@@ -333,6 +337,8 @@ vr_mem_stats_get(void)
                 stats_block[VR_MTRIE_STATS_OBJECT].ms_free);
         response->vms_mtrie_table_object += (stats_block[VR_MTRIE_TABLE_OBJECT].ms_alloc -
                 stats_block[VR_MTRIE_TABLE_OBJECT].ms_free);
+        response->vms_mtrie_leaf_object += (stats_block[VR_MTRIE_LEAF_OBJECT].ms_alloc -
+                stats_block[VR_MTRIE_LEAF_OBJECT].ms_free);
         response->vms_network_address_object += (stats_block[VR_NETWORK_ADDRESS_OBJECT].ms_alloc -
                 stats_block[VR_NETWORK_ADDRESS_OBJECT].ms_free);
         response->vms_nexthop_object += (stats_block[VR_NEXTHOP_OBJECT].ms_alloc -
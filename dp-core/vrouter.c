@@ -69,6 +69,18 @@ int vr_genetlink_group_id = 0;
 
 unsigned int vr_memory_alloc_checks = 0;
 unsigned int vr_priority_tagging = 0;
+/*
+ * Warm restart. When vr_warm_restart is set, the host keeps the flow and
+ * bridge tables across a restart of the datapath, and tells the next
+ * instance which of them it found intact (vr_flow_table_restored,
+ * vr_bridge_table_restored). The restored entries are revalidated
+ * vr_warm_restart_window seconds later, once the agent has replayed its
+ * configuration.
+ */
+unsigned int vr_warm_restart = 0;
+unsigned int vr_warm_restart_window = VR_WARM_RESTART_DEF_WINDOW;
+unsigned int vr_flow_table_restored = 0;
+unsigned int vr_bridge_table_restored = 0;
 
 struct vr_module {
     char *mod_name;
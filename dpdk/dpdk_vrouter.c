@@ -35,6 +35,9 @@
 #include "vr_uvhost.h"
 #include "vr_bridge.h"
 #include "vr_mem.h"
+#include "vr_flow_log.h"
+#include "vr_ip6_fib.h"
+#include "vr_dst_cache.h"
 #include "nl_util.h"
 #include "vr_offloads.h"
 
@@ -83,10 +86,44 @@ enum vr_opt_index {
     BRIDGE_ENTRIES_OPT_INDEX,
 #define BRIDGE_OENTRIES_OPT     "vr_bridge_oentries"
     BRIDGE_OENTRIES_OPT_INDEX,
+#define BRIDGE_LEARN_RATE_OPT   "vr_bridge_learn_rate"
+    BRIDGE_LEARN_RATE_OPT_INDEX,
 #define FLOW_ENTRIES_OPT        "vr_flow_entries"
     FLOW_ENTRIES_OPT_INDEX,
 #define OFLOW_ENTRIES_OPT       "vr_oflow_entries"
     OFLOW_ENTRIES_OPT_INDEX,
+#define OFLOW_ENTRIES_MAX_OPT   "vr_oflow_entries_max"
+    OFLOW_ENTRIES_MAX_OPT_INDEX,
+#define FLOW_CUCKOO_OPT         "vr_flow_cuckoo"
+    FLOW_CUCKOO_OPT_INDEX,
+#define FLOW_AGING_TIMEOUT_OPT  "vr_flow_aging_timeout"
+    FLOW_AGING_TIMEOUT_OPT_INDEX,
+#define FLOW_RPF_CACHE_OPT      "vr_flow_rpf_cache"
+    FLOW_RPF_CACHE_OPT_INDEX,
+#define FLOW_FLOWLET_OPT        "vr_flow_flowlet"
+    FLOW_FLOWLET_OPT_INDEX,
+#define FLOW_LOG_RECORDS_OPT    "vr_flow_log_records"
+    FLOW_LOG_RECORDS_OPT_INDEX,
+#define FLOW_LOG_THRESHOLD_OPT  "vr_flow_log_threshold"
+    FLOW_LOG_THRESHOLD_OPT_INDEX,
+#define FLOW_HOLD_QUEUE_LEN_OPT "vr_flow_hold_queue_len"
+    FLOW_HOLD_QUEUE_LEN_OPT_INDEX,
+#define FLOW_HOLD_POOL_NODES_OPT "vr_flow_hold_pool_nodes"
+    FLOW_HOLD_POOL_NODES_OPT_INDEX,
+#define FLOW_HOLD_POOL_QUEUES_OPT "vr_flow_hold_pool_queues"
+    FLOW_HOLD_POOL_QUEUES_OPT_INDEX,
+#define WARM_RESTART_OPT        "vr_warm_restart"
+    WARM_RESTART_OPT_INDEX,
+#define WARM_RESTART_WINDOW_OPT "vr_warm_restart_window"
+    WARM_RESTART_WINDOW_OPT_INDEX,
+#define IP6_FIB_ENTRIES_OPT     "vr_ip6_fib_entries"
+    IP6_FIB_ENTRIES_OPT_INDEX,
+#define IP6_FIB_OENTRIES_OPT    "vr_ip6_fib_oentries"
+    IP6_FIB_OENTRIES_OPT_INDEX,
+#define DST_CACHE_ENTRIES_OPT   "vr_dst_cache_entries"
+    DST_CACHE_ENTRIES_OPT_INDEX,
+#define ECMP_TABLE_SIZE_OPT     "vr_ecmp_table_size"
+    ECMP_TABLE_SIZE_OPT_INDEX,
 #define MPLS_LABELS_OPT         "vr_mpls_labels"
     MPLS_LABELS_OPT_INDEX,
 #define NEXTHOPS_OPT            "vr_nexthops"
@@ -131,6 +168,7 @@ enum vr_opt_index {
 /* dp-core parameters */
 extern unsigned int vr_bridge_entries;
 extern unsigned int vr_bridge_oentries;
+extern unsigned int vr_bridge_learn_rate;
 extern unsigned int vr_mpls_labels;
 extern unsigned int vr_nexthops;
 extern unsigned int vr_vrfs;
@@ -723,6 +761,9 @@ dpdk_argv_update(void)
                 vr_flow_entries);
     RTE_LOG(INFO, VROUTER, "Flow Table overflow limit:   %" PRIu32 "\n",
                 vr_oflow_entries);
+    if (vr_oflow_entries_max > vr_oflow_entries)
+        RTE_LOG(INFO, VROUTER, "Flow Table overflow growth:  %" PRIu32 "\n",
+                vr_oflow_entries_max);
     RTE_LOG(INFO, VROUTER, "MPLS labels limit:           %" PRIu32 "\n",
                 vr_mpls_labels);
     RTE_LOG(INFO, VROUTER, "Nexthops limit:              %" PRIu32 "\n",
@@ -843,6 +884,24 @@ dpdk_init(void)
             rte_strerror(-ret), -ret);
         return ret;
     }
+
+    /* sized for as many lcores as there can be, and the aging timer */
+    if (vr_flow_log_records) {
+        if (!vr_flow_log_mem_size(VR_MAX_CPUS_DPDK + 1)) {
+            RTE_LOG(ERR, VROUTER, "Error initializing flow log: %u records "
+                "per ring do not fit in %llu bytes\n", vr_flow_log_records,
+                VR_FLOW_LOG_MAX_SIZE);
+            return -EINVAL;
+        }
+
+        ret = vr_dpdk_table_mem_init(VR_MEM_FLOW_LOG_OBJECT, 0,
+                vr_flow_log_mem_size(VR_MAX_CPUS_DPDK + 1), 0, 0);
+        if (ret < 0) {
+            RTE_LOG(ERR, VROUTER, "Error initializing flow log: %s (%d)\n",
+                rte_strerror(-ret), -ret);
+            return ret;
+        }
+    }
     //converting it into dpdk understandable arguments
     ret = dpdk_argv_update();
     if (ret == -1) {
@@ -1063,10 +1122,44 @@ static struct option long_options[] = {
                                                     NULL,                   0},
     [BRIDGE_OENTRIES_OPT_INDEX]     =   {BRIDGE_OENTRIES_OPT,   required_argument,
                                                     NULL,                   0},
+    [BRIDGE_LEARN_RATE_OPT_INDEX]   =   {BRIDGE_LEARN_RATE_OPT, required_argument,
+                                                    NULL,                   0},
     [FLOW_ENTRIES_OPT_INDEX]        =   {FLOW_ENTRIES_OPT,      required_argument,
                                                     NULL,                   0},
     [OFLOW_ENTRIES_OPT_INDEX]       =   {OFLOW_ENTRIES_OPT,     required_argument,
                                                     NULL,                   0},
+    [OFLOW_ENTRIES_MAX_OPT_INDEX]   =   {OFLOW_ENTRIES_MAX_OPT, required_argument,
+                                                    NULL,                   0},
+    [FLOW_CUCKOO_OPT_INDEX]         =   {FLOW_CUCKOO_OPT,       no_argument,
+                                                    NULL,                   0},
+    [FLOW_AGING_TIMEOUT_OPT_INDEX]  =   {FLOW_AGING_TIMEOUT_OPT, required_argument,
+                                                    NULL,                   0},
+    [FLOW_RPF_CACHE_OPT_INDEX]      =   {FLOW_RPF_CACHE_OPT,    no_argument,
+                                                    NULL,                   0},
+    [FLOW_FLOWLET_OPT_INDEX]        =   {FLOW_FLOWLET_OPT,      no_argument,
+                                                    NULL,                   0},
+    [FLOW_LOG_RECORDS_OPT_INDEX]    =   {FLOW_LOG_RECORDS_OPT,  required_argument,
+                                                    NULL,                   0},
+    [FLOW_LOG_THRESHOLD_OPT_INDEX]  =   {FLOW_LOG_THRESHOLD_OPT, required_argument,
+                                                    NULL,                   0},
+    [FLOW_HOLD_QUEUE_LEN_OPT_INDEX] =   {FLOW_HOLD_QUEUE_LEN_OPT, required_argument,
+                                                    NULL,                   0},
+    [FLOW_HOLD_POOL_NODES_OPT_INDEX] =  {FLOW_HOLD_POOL_NODES_OPT, required_argument,
+                                                    NULL,                   0},
+    [FLOW_HOLD_POOL_QUEUES_OPT_INDEX] = {FLOW_HOLD_POOL_QUEUES_OPT, required_argument,
+                                                    NULL,                   0},
+    [WARM_RESTART_OPT_INDEX]        =   {WARM_RESTART_OPT,      no_argument,
+                                                    NULL,                   0},
+    [WARM_RESTART_WINDOW_OPT_INDEX] =   {WARM_RESTART_WINDOW_OPT, required_argument,
+                                                    NULL,                   0},
+    [IP6_FIB_ENTRIES_OPT_INDEX]     =   {IP6_FIB_ENTRIES_OPT,   required_argument,
+                                                    NULL,                   0},
+    [IP6_FIB_OENTRIES_OPT_INDEX]    =   {IP6_FIB_OENTRIES_OPT,  required_argument,
+                                                    NULL,                   0},
+    [DST_CACHE_ENTRIES_OPT_INDEX]   =   {DST_CACHE_ENTRIES_OPT, required_argument,
+                                                    NULL,                   0},
+    [ECMP_TABLE_SIZE_OPT_INDEX]     =   {ECMP_TABLE_SIZE_OPT,   required_argument,
+                                                    NULL,                   0},
     [MPLS_LABELS_OPT_INDEX]         =   {MPLS_LABELS_OPT,       required_argument,
                                                     NULL,                   0},
     [NEXTHOPS_OPT_INDEX]            =   {NEXTHOPS_OPT,          required_argument,
@@ -1132,8 +1225,25 @@ Usage(void)
         "\n"
         "    --"BRIDGE_ENTRIES_OPT" NUM   Bridge table limit\n"
         "    --"BRIDGE_OENTRIES_OPT" NUM  Bridge table overflow limit\n"
+        "    --"BRIDGE_LEARN_RATE_OPT" NUM Asynchronous MAC learns per interface a second, 0 inline\n"
         "    --"FLOW_ENTRIES_OPT" NUM     Flow table limit\n"
         "    --"OFLOW_ENTRIES_OPT" NUM    Flow overflow table limit\n"
+        "    --"OFLOW_ENTRIES_MAX_OPT" NUM Flow overflow table limit to grow to\n"
+        "    --"FLOW_CUCKOO_OPT"        Look flows up through a cuckoo index\n"
+        "    --"FLOW_AGING_TIMEOUT_OPT" SECS Age flows idle for SECS in the datapath\n"
+        "    --"FLOW_RPF_CACHE_OPT"     Cache the source validation results of flows\n"
+        "    --"FLOW_FLOWLET_OPT"       Keep the last seen times of flows, for flowlets\n"
+        "    --"FLOW_LOG_RECORDS_OPT" NUM Records per ring of the flow stats log\n"
+        "    --"FLOW_LOG_THRESHOLD_OPT" NUM Packets of a flow between two log records\n"
+        "    --"FLOW_HOLD_QUEUE_LEN_OPT" NUM Packets a flow in hold can hold\n"
+        "    --"FLOW_HOLD_POOL_NODES_OPT" NUM Held packets each lcore has room for\n"
+        "    --"FLOW_HOLD_POOL_QUEUES_OPT" NUM Flows in hold each lcore has queues for\n"
+        "    --"WARM_RESTART_OPT"       Keep the flow and bridge tables across restarts\n"
+        "    --"WARM_RESTART_WINDOW_OPT" SECS Time the agent has to program them again\n"
+        "    --"IP6_FIB_ENTRIES_OPT" NUM  IPv6 forwarding table limit, 0 for none\n"
+        "    --"IP6_FIB_OENTRIES_OPT" NUM IPv6 forwarding overflow table limit\n"
+        "    --"DST_CACHE_ENTRIES_OPT" NUM Route lookup cache entries per lcore, 0 for none\n"
+        "    --"ECMP_TABLE_SIZE_OPT" NUM  Resilient member table buckets of ECMP nexthops\n"
         "    --"MPLS_LABELS_OPT" NUM      MPLS table limit\n"
         "    --"NEXTHOPS_OPT" NUM         Nexthop table limit\n"
         "    --"VRFS_OPT" NUM             VRF tables limit\n"
@@ -1261,6 +1371,13 @@ parse_long_opts(int opt_flow_index, char *optarg)
         }
         break;
 
+    case BRIDGE_LEARN_RATE_OPT_INDEX:
+        vr_bridge_learn_rate = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_bridge_learn_rate = 0;
+        }
+        break;
+
     case FLOW_ENTRIES_OPT_INDEX:
         vr_flow_entries = (unsigned int)strtoul(optarg, NULL, 0);
         if (errno != 0) {
@@ -1278,6 +1395,106 @@ parse_long_opts(int opt_flow_index, char *optarg)
         }
         break;
 
+    case OFLOW_ENTRIES_MAX_OPT_INDEX:
+        vr_oflow_entries_max = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_oflow_entries_max = 0;
+        }
+        break;
+
+    case FLOW_CUCKOO_OPT_INDEX:
+        vr_flow_cuckoo = 1;
+        break;
+
+    case FLOW_AGING_TIMEOUT_OPT_INDEX:
+        vr_flow_aging_timeout = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_flow_aging_timeout = 0;
+        }
+        break;
+
+    case FLOW_RPF_CACHE_OPT_INDEX:
+        vr_flow_rpf_cache = 1;
+        break;
+
+    case FLOW_FLOWLET_OPT_INDEX:
+        vr_flow_flowlet = 1;
+        break;
+
+    case FLOW_LOG_RECORDS_OPT_INDEX:
+        vr_flow_log_records = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_flow_log_records = 0;
+        }
+        break;
+
+    case FLOW_LOG_THRESHOLD_OPT_INDEX:
+        vr_flow_log_threshold = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0 || !vr_flow_log_threshold) {
+            vr_flow_log_threshold = VR_FLOW_LOG_DEF_THRESHOLD;
+        }
+        break;
+
+    case FLOW_HOLD_QUEUE_LEN_OPT_INDEX:
+        vr_flow_hold_queue_len = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0 || !vr_flow_hold_queue_len) {
+            vr_flow_hold_queue_len = VR_DEF_FLOW_QUEUE_ENTRIES;
+        }
+        break;
+
+    case FLOW_HOLD_POOL_NODES_OPT_INDEX:
+        vr_flow_hold_pool_nodes = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_flow_hold_pool_nodes = VR_DEF_FLOW_HOLD_POOL_NODES;
+        }
+        break;
+
+    case FLOW_HOLD_POOL_QUEUES_OPT_INDEX:
+        vr_flow_hold_pool_queues = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_flow_hold_pool_queues = VR_DEF_FLOW_HOLD_POOL_QUEUES;
+        }
+        break;
+
+    case IP6_FIB_ENTRIES_OPT_INDEX:
+        vr_ip6_fib_entries = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_ip6_fib_entries = VR_DEF_IP6_FIB_ENTRIES;
+        }
+        break;
+
+    case IP6_FIB_OENTRIES_OPT_INDEX:
+        vr_ip6_fib_oentries = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_ip6_fib_oentries = VR_DEF_IP6_FIB_OENTRIES;
+        }
+        break;
+
+    case DST_CACHE_ENTRIES_OPT_INDEX:
+        vr_dst_cache_entries = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_dst_cache_entries = VR_DEF_DST_CACHE_ENTRIES;
+        }
+        break;
+
+    case ECMP_TABLE_SIZE_OPT_INDEX:
+        vr_ecmp_table_size = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_ecmp_table_size = 0;
+        }
+        break;
+
+    case WARM_RESTART_OPT_INDEX:
+        vr_warm_restart = 1;
+        break;
+
+    case WARM_RESTART_WINDOW_OPT_INDEX:
+        vr_warm_restart_window = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_warm_restart_window = VR_WARM_RESTART_DEF_WINDOW;
+        }
+        break;
+
     case MEMORY_ALLOC_CHECKS_OPT_INDEX:
         vr_memory_alloc_checks = 1;
         break;
@@ -1459,6 +1676,7 @@ parse_no_arg_cli(int opt_flow_index, int optind, char *argv[])
         opt_flow_index == HELP_OPT_INDEX ||
         opt_flow_index == OFFLOADS_OPT_INDEX ||
         opt_flow_index == MEMORY_ALLOC_CHECKS_OPT_INDEX ||
+        opt_flow_index == FLOW_CUCKOO_OPT_INDEX ||
         opt_flow_index == VERSION_OPT_INDEX ||
         opt_flow_index == VTEST_VLAN_OPT_INDEX ||
         opt_flow_index == VR_DPDK_LOG_OPT_INDEX ||
@@ -1593,6 +1811,7 @@ main(int argc, char *argv[])
     dpdk_fragment_assembler_exit();
     dpdk_netlink_exit();
     vr_dpdk_host_exit();
+    vr_dpdk_table_mem_exit();
     dpdk_exit();
 
     rte_exit(ret, "vRouter/DPDK is stopped.\n");
@@ -503,6 +503,10 @@ dpdk_timer(struct rte_timer *tim, void *arg)
     struct vr_timer *vtimer = (struct vr_timer*)arg;
 
     vtimer->vt_timer(vtimer->vt_vr_arg);
+
+    /* as with the kernel timers, the callback can ask not to be re-armed */
+    if (vtimer->vt_stop_timer)
+        rte_timer_stop(tim);
 }
 
 static int
@@ -634,12 +638,9 @@ dpdk_delay_op(void)
 static void
 dpdk_rcu_cb(struct rcu_head *rh)
 {
-    int i;
     struct vr_dpdk_rcu_cb_data *cb_data;
     struct vr_defer_data *defer;
     struct vr_flow_queue *vfq;
-    struct vr_packet_node *pnode;
-
 
     cb_data = CONTAINER_OF(rcd_rcu, struct vr_dpdk_rcu_cb_data, rh);
 
@@ -649,16 +650,13 @@ dpdk_rcu_cb(struct rcu_head *rh)
         defer = (struct vr_defer_data *)cb_data->rcd_user_data;
         vfq = ((struct vr_flow_defer_data *)defer->vdd_data)->vfdd_flow_queue;
         if (vfq) {
-            for (i = 0; i < VR_MAX_FLOW_QUEUE_ENTRIES; i++) {
-                pnode = &vfq->vfq_pnodes[i];
-                if (pnode->pl_packet) {
-                    RTE_LOG_DP(DEBUG, VROUTER, "%s: lcore %u passing RCU callback "
-                            "to lcore %u\n", __func__, rte_lcore_id(),
-                            VR_DPDK_PACKET_LCORE_ID);
-                    vr_dpdk_lcore_cmd_post(VR_DPDK_PACKET_LCORE_ID,
-                            VR_DPDK_LCORE_RCU_CMD, (uintptr_t)rh);
-                    return;
-                }
+            if (vr_flow_queue_has_packets(vfq)) {
+                RTE_LOG_DP(DEBUG, VROUTER, "%s: lcore %u passing RCU callback "
+                        "to lcore %u\n", __func__, rte_lcore_id(),
+                        VR_DPDK_PACKET_LCORE_ID);
+                vr_dpdk_lcore_cmd_post(VR_DPDK_PACKET_LCORE_ID,
+                        VR_DPDK_LCORE_RCU_CMD, (uintptr_t)rh);
+                return;
             }
             RTE_LOG_DP(DEBUG, VROUTER, "%s: lcore %u passing RCU callback to lcore %u\n",
                     __func__, rte_lcore_id(), VR_DPDK_PACKET_LCORE_ID);
@@ -846,6 +844,100 @@ dpdk_pcow(struct vr_packet **pktp, unsigned short head_room)
     return 0;
 }
 
+/*
+ * Bytes past the network header, or the data, that a replica keeps a
+ * private copy of. Replicas change their headers, and share the rest.
+ */
+#define VR_DPDK_PCLONE_HEAD_LEN     128
+
+/* VRouter callback */
+static struct vr_packet *
+dpdk_pclone_head(struct vr_packet *pkt, unsigned short head_room)
+{
+    unsigned short start, end, data_off;
+    uint32_t frag_len;
+    struct rte_mbuf *m, *m_head, *m_clone = NULL;
+    struct vr_packet *pkt_head;
+
+    m = vr_dpdk_pkt_to_mbuf(pkt);
+
+    start = pkt->vp_data;
+    if (pkt->vp_network_h && (pkt->vp_network_h < start))
+        start = pkt->vp_network_h;
+    end = RTE_MAX(pkt->vp_data, pkt->vp_network_h) + VR_DPDK_PCLONE_HEAD_LEN;
+    if (end > pkt->vp_tail)
+        end = pkt->vp_tail;
+    data_off = RTE_MAX(RTE_PKTMBUF_HEADROOM,
+            head_room + (pkt->vp_data - start));
+
+    m_head = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
+    if (!m_head)
+        return NULL;
+
+    /* headers too long for the room of an mbuf: copy it all */
+    if (data_off + (end - pkt->vp_data) > m_head->buf_len) {
+        rte_pktmbuf_free(m_head);
+        pkt_head = dpdk_pclone(pkt);
+        if (pkt_head && dpdk_pcow(&pkt_head, head_room)) {
+            vr_pfree(pkt_head, VP_DROP_PCOW_FAIL);
+            return NULL;
+        }
+        return pkt_head;
+    }
+
+    frag_len = rte_pktmbuf_pkt_len(m) - rte_pktmbuf_data_len(m);
+    if (end < pkt->vp_tail) {
+        m_clone = rte_pktmbuf_clone(m, vr_dpdk.rss_mempool);
+        if (!m_clone)
+            goto fail;
+        m_clone->data_off = end;
+        m_clone->data_len = pkt->vp_tail - end;
+        m_clone->nb_segs = m->nb_segs;
+    } else if (frag_len) {
+        m_clone = rte_pktmbuf_clone(m->next, vr_dpdk.rss_mempool);
+        if (!m_clone)
+            goto fail;
+        m_clone->nb_segs = m->nb_segs - 1;
+    }
+
+    rte_memcpy((char *)m_head->buf_addr + data_off - (pkt->vp_data - start),
+            pkt->vp_head + start, end - start);
+    m_head->data_off = data_off;
+    m_head->data_len = end - pkt->vp_data;
+    m_head->port = m->port;
+    m_head->ol_flags = m->ol_flags;
+#ifdef IND_ATTACHED_MBUF
+    m_head->ol_flags &= (~IND_ATTACHED_MBUF);
+#endif
+    m_head->packet_type = m->packet_type;
+    m_head->vlan_tci = m->vlan_tci;
+    m_head->hash = m->hash;
+    m_head->tx_offload = m->tx_offload;
+    m_head->pkt_len = pkt_head_len(pkt) + frag_len;
+    if (m_clone) {
+        m_clone->pkt_len = m_head->pkt_len - m_head->data_len;
+        m_head->next = m_clone;
+        m_head->nb_segs = 1 + m_clone->nb_segs;
+    }
+
+    pkt_head = vr_dpdk_mbuf_to_pkt(m_head);
+    *pkt_head = *pkt;
+    pkt_head->vp_cpu = vr_get_cpu();
+    pkt_head->vp_head = m_head->buf_addr;
+    pkt_head->vp_data = data_off;
+    pkt_head->vp_tail = data_off + m_head->data_len;
+    pkt_head->vp_len = m_head->data_len;
+    pkt_head->vp_end = m_head->buf_len;
+    if (pkt->vp_network_h)
+        pkt_head->vp_network_h += data_off - pkt->vp_data;
+
+    return pkt_head;
+
+fail:
+    rte_pktmbuf_free(m_head);
+    return NULL;
+}
+
 /*
  * dpdk_get_udp_src_port - return a source port for the outer UDP header.
  * The source port is based on a hash of the inner IP source/dest addresses,
@@ -1374,20 +1466,6 @@ dpdk_register_nic(struct vr_interface* vif __attribute__((unused)),
 {
 }
 
-static void
-dpdk_flow_bucket_lock(struct vr_flow_entry *fe)
-{
-    while (!vr_sync_bool_compare_and_swap_8u(&fe->fe_bucket_lock, 0, 1)) {
-        vr_pause();
-    }
-}
-
-static void
-dpdk_flow_bucket_unlock(struct vr_flow_entry *fe)
-{
-    vr_sync_bool_compare_and_swap_8u(&fe->fe_bucket_lock, 1, 0);
-}
-
 struct host_os dpdk_host = {
     .hos_printf                     =    dpdk_printf,
     .hos_malloc                     =    dpdk_malloc,
@@ -1403,6 +1481,7 @@ struct host_os dpdk_host = {
     .hos_pfree                      =    dpdk_pfree,
     .hos_preset                     =    dpdk_preset,
     .hos_pclone                     =    dpdk_pclone,
+    .hos_pclone_head                =    dpdk_pclone_head,
     .hos_pcopy                      =    dpdk_pcopy,
     .hos_pfrag_len                  =    dpdk_pfrag_len,
     .hos_phead_len                  =    dpdk_phead_len,
@@ -1444,11 +1523,10 @@ struct host_os dpdk_host = {
     .hos_is_frag_limit_exceeded     =    dpdk_is_frag_limit_exceeded,
     .hos_register_nic               =    dpdk_register_nic, /* not used with DPDK */
     .hos_nl_broadcast_supported     =    false,
+    .hos_table_mem_reserve          =    vr_dpdk_table_mem_reserve,
     .hos_offload_flow_create        =    dpdk_offload_flow_create,
     .hos_offload_flow_destroy       =    dpdk_offload_flow_destroy,
     .hos_offload_prepare            =    dpdk_offload_prepare,
-    .hos_flow_bucket_lock           =    dpdk_flow_bucket_lock,
-    .hos_flow_bucket_unlock         =    dpdk_flow_bucket_unlock,
     /* Below macro would be expanded for each callbacks registered in vr_info.h.
      * this would map the actual dpdk callback function with
      * vrouter_host(.hos_<fn. name>) */
@@ -794,6 +794,7 @@ vr_dpdk_lcore_vroute(struct vr_dpdk_lcore *lcore, struct vr_interface *vif,
     struct rte_mbuf *p_copy;
     struct vr_offload_flow *oflows[VR_DPDK_RX_BURST_SZ];
     struct vr_offload_flow **oflow = &oflows[0];
+    struct vr_packet *vr_pkts[VR_DPDK_RX_BURST_SZ];
     unsigned short vlan_id = VLAN_ID_INVALID;
     bool fabric = vif_is_fabric(vif);
     bool offloads = fabric && datapath_offloads;
@@ -804,6 +805,29 @@ vr_dpdk_lcore_vroute(struct vr_dpdk_lcore *lcore, struct vr_interface *vif,
     if (offloads)
         dpdk_offload_flow_burst_prefetch(pkts, oflows, nb_pkts);
 
+    /*
+     * For the VM interfaces, resolve the flows of the whole burst up
+     * front, so that the flow bucket misses of all the packets overlap
+     * rather than being taken one by one in vr_flow_lookup(). Interfaces
+     * without policy do not get to the flow table, their route lookups
+     * are what gets done for the whole burst instead.
+     */
+    if (!fabric) {
+        for (i = 0; i < nb_pkts; i++) {
+            if (unlikely(pkts[i]->ol_flags & PKT_RX_VLAN)) {
+                vr_pkts[i] = NULL;
+                continue;
+            }
+            vr_pkts[i] = vr_dpdk_packet_get(pkts[i], vif);
+        }
+
+        if (vif->vif_flags & VIF_FLAG_POLICY_ENABLED)
+            vr_flow_prefetch_burst(vrouter_get(vif->vif_rid), vif, vr_pkts,
+                    nb_pkts);
+        else
+            vr_inet_route_prefetch_burst(vif, vr_pkts, nb_pkts);
+    }
+
     if (unlikely(vif->vif_flags & VIF_FLAG_MONITORED)) {
         monitoring_tx_queue =
             &lcore->lcore_tx_queues[vr_dpdk.monitorings[vif->vif_idx]][0];
@@ -5,6 +5,9 @@
  * All rights reserved
  */
 
+/* For fallocate() */
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -15,9 +18,11 @@
 #include "vr_dpdk.h"
 #include "vr_btable.h"
 #include "vr_mem.h"
+#include "vr_flow_log.h"
 #include "nl_util.h"
 
 #include <rte_errno.h>
+#include <rte_hash_crc.h>
 
 #define MAX_LINE_SIZE   256
 #define HPI_MAX         16
@@ -30,11 +35,46 @@ struct vr_hugepage_info {
     uint32_t num_pages;
 } vr_hugepage_md[HPI_MAX];
 
-extern void *vr_flow_table, *vr_oflow_table;
+/*
+ * Warm restart. With --vr_warm_restart, a page after the flow and the
+ * bridge tables (and after the address space the flow table may grow
+ * into) describes the table to the next instance. The header is marked
+ * clean, with a checksum of the table, only on an orderly exit. A table
+ * whose header is not clean, or does not match the geometry the new
+ * instance is configured with, is cleared as on a cold start.
+ */
+#define VR_DPDK_TABLE_HDR_MAGIC         0x56525442
+#define VR_DPDK_TABLE_HDR_VERSION       1
+#define VR_DPDK_TABLE_HDR_SIZE          4096
+/* the checksum is computed in chunks that rte_hash_crc takes */
+#define VR_DPDK_TABLE_CRC_CHUNK         (1UL << 30)
+
+#define VR_DPDK_TABLE_RUNNING           1
+#define VR_DPDK_TABLE_CLEAN             2
+
+struct vr_dpdk_table_hdr {
+    uint32_t vth_magic;
+    uint16_t vth_version;
+    uint16_t vth_table;
+    uint32_t vth_state;
+    uint32_t vth_entry_size;
+    uint32_t vth_entries;
+    uint32_t vth_oentries;
+    uint64_t vth_size;
+    uint32_t vth_checksum;
+};
+
+static struct vr_dpdk_table_hdr *vr_dpdk_flow_hdr, *vr_dpdk_bridge_hdr;
+static void *vr_dpdk_flow_mem, *vr_dpdk_bridge_mem;
+/* the flow table file, kept open for as long as the table can grow */
+static int vr_dpdk_flow_fd = -1;
+
+extern void *vr_flow_table, *vr_oflow_table, *vr_oflow_ext_table;
 extern void *vr_bridge_table, *vr_obridge_table;
 extern unsigned char *vr_flow_path, *vr_bridge_table_path;
 char flow_mem_file[VR_UNIX_PATH_MAX];
 char bridge_mem_file[VR_UNIX_PATH_MAX];
+char flow_log_mem_file[VR_UNIX_PATH_MAX];
 
 static int
 vr_hugepage_info_init(void)
@@ -139,22 +179,77 @@ exit_func:
 }
 
 
+static uint32_t
+vr_dpdk_table_checksum(const void *mem, uint64_t size)
+{
+    uint32_t crc = 0, len;
+    const unsigned char *ptr = mem;
+
+    while (size) {
+        len = (size > VR_DPDK_TABLE_CRC_CHUNK) ?
+            VR_DPDK_TABLE_CRC_CHUNK : size;
+        crc = rte_hash_crc(ptr, len, crc);
+        ptr += len;
+        size -= len;
+    }
+
+    return crc;
+}
+
+/* whether the table a previous instance left behind can be used as it is */
+static bool
+vr_dpdk_table_hdr_valid(struct vr_dpdk_table_hdr *hdr, const void *mem,
+        unsigned int table, unsigned int entries, unsigned int oentries,
+        unsigned long size)
+{
+    if ((hdr->vth_magic != VR_DPDK_TABLE_HDR_MAGIC) ||
+            (hdr->vth_version != VR_DPDK_TABLE_HDR_VERSION) ||
+            (hdr->vth_table != table))
+        return false;
+
+    if (hdr->vth_state != VR_DPDK_TABLE_CLEAN) {
+        RTE_LOG(INFO, VROUTER, "Table %u was not saved on exit\n", table);
+        return false;
+    }
+
+    if ((hdr->vth_entries != entries) || (hdr->vth_oentries != oentries) ||
+            (hdr->vth_size != size) ||
+            (hdr->vth_entry_size != size / (entries + oentries))) {
+        RTE_LOG(INFO, VROUTER, "Table %u was saved with another size\n",
+                table);
+        return false;
+    }
+
+    if (hdr->vth_checksum != vr_dpdk_table_checksum(mem, size)) {
+        RTE_LOG(ERR, VROUTER, "Table %u checksum mismatch\n", table);
+        return false;
+    }
+
+    return true;
+}
+
 int
 vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         unsigned long size, unsigned int oentries, unsigned long osize)
 {
-    int ret, i, fd;
+    int ret, i, fd, flags = MAP_SHARED;
+    bool restored = false;
 
+    unsigned long reserve = 0, hdr_size = 0;
     void **table_p;
     char *shm_file;
     char *file_name, *touse_file_name = NULL;
     char *shmem_name, *hp_file_name;
     unsigned char **path;
+    unsigned int *restored_p = NULL;
+    struct vr_dpdk_table_hdr **hdr_p = NULL, *hdr;
+    void **mem_p = NULL;
 
     struct stat f_stat;
     struct vr_hugepage_info *hpi;
 
-    if (!oentries) {
+    /* the flow log has no overflow part */
+    if (!oentries && (table != VR_MEM_FLOW_LOG_OBJECT)) {
         oentries = (entries / 5 + 1023) & ~1023;
         osize = (size / entries) * oentries;
     }
@@ -169,6 +264,17 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         path = &vr_flow_path;
         vr_oflow_entries = oentries;
         shm_file = flow_mem_file;
+        restored_p = &vr_flow_table_restored;
+        hdr_p = &vr_dpdk_flow_hdr;
+        mem_p = &vr_dpdk_flow_mem;
+        /*
+         * Address space for the overflow table to grow into. It is not
+         * reserved nor touched till the table actually grows
+         */
+        if (vr_oflow_entries_max > oentries) {
+            reserve = (osize / oentries) * (vr_oflow_entries_max - oentries);
+            flags |= MAP_NORESERVE;
+        }
         break;
 
     case VR_MEM_BRIDGE_TABLE_OBJECT:
@@ -178,12 +284,26 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         path = &vr_bridge_table_path;
         vr_bridge_oentries = oentries;
         shm_file = bridge_mem_file;
+        restored_p = &vr_bridge_table_restored;
+        hdr_p = &vr_dpdk_bridge_hdr;
+        mem_p = &vr_dpdk_bridge_mem;
+        break;
+
+    case VR_MEM_FLOW_LOG_OBJECT:
+        shmem_name = "flow_log.shmem";
+        hp_file_name = "flow_log";
+        table_p = &vr_dpdk.flow_log;
+        path = &vr_flow_log_path;
+        shm_file = flow_log_mem_file;
         break;
 
     default:
         return -EINVAL;
     }
 
+    if (vr_warm_restart && hdr_p)
+        hdr_size = VR_DPDK_TABLE_HDR_SIZE;
+
     if (no_huge_set) {
         /* Create a shared memory under the socket directory. */
         ret = snprintf(shm_file, VR_UNIX_PATH_MAX, "%s/%s",
@@ -209,7 +329,7 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
             sprintf(file_name, "%s/%s", hpi->mnt, hp_file_name);
             if (stat(file_name, &f_stat) == -1) {
                 if (!touse_file_name) {
-                    if (hpi->size >= size) {
+                    if (hpi->size >= size + reserve + hdr_size) {
                         touse_file_name = file_name;
                     } else {
                         free(file_name);
@@ -232,7 +352,7 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         }
 
         if (no_huge_set) {
-            ret = ftruncate(fd, size);
+            ret = ftruncate(fd, size + reserve + hdr_size);
             if (ret == -1) {
                 RTE_LOG(ERR, VROUTER, "Error truncating file %s: %s (%d)\n",
                     touse_file_name, rte_strerror(errno), errno);
@@ -240,22 +360,133 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
             }
         }
 
-        *table_p = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                MAP_SHARED, fd, 0);
-        /* the file descriptor is no longer needed */
-        close(fd);
+        *table_p = mmap(NULL, size + reserve + hdr_size, PROT_READ | PROT_WRITE,
+                flags, fd, 0);
         if (*table_p == MAP_FAILED) {
+            ret = -errno;
+            close(fd);
             RTE_LOG(ERR, VROUTER, "Error mmapping file %s: %s (%d)\n",
-                touse_file_name, rte_strerror(errno), errno);
-            return -errno;
+                touse_file_name, rte_strerror(-ret), -ret);
+            return ret;
         }
-        memset(*table_p, 0, size);
+
+        /*
+         * the file descriptor is no longer needed, unless the pages of the
+         * reserved address space are to be allocated from it later
+         */
+        if (reserve)
+            vr_dpdk_flow_fd = fd;
+        else
+            close(fd);
         *path = (unsigned char *)touse_file_name;
+
+        if (hdr_size) {
+            hdr = (struct vr_dpdk_table_hdr *)
+                ((unsigned char *)*table_p + size + reserve);
+            restored = vr_dpdk_table_hdr_valid(hdr, *table_p, table,
+                    entries, oentries, size);
+
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->vth_magic = VR_DPDK_TABLE_HDR_MAGIC;
+            hdr->vth_version = VR_DPDK_TABLE_HDR_VERSION;
+            hdr->vth_table = table;
+            hdr->vth_entry_size = size / (entries + oentries);
+            hdr->vth_entries = entries;
+            hdr->vth_oentries = oentries;
+            hdr->vth_size = size;
+            /* anything but an orderly exit leaves the table to a cold start */
+            hdr->vth_state = VR_DPDK_TABLE_RUNNING;
+            rte_wmb();
+
+            *hdr_p = hdr;
+            *mem_p = *table_p;
+            *restored_p = restored;
+        }
+
+        if (restored) {
+            RTE_LOG(INFO, VROUTER, "Reusing table %u in %s\n", table,
+                    touse_file_name);
+        } else {
+            memset(*table_p, 0, size);
+        }
     }
 
     return 0;
 }
 
+/*
+ * Allocates the pages behind a part of the address space that the flow
+ * table maps for its overflow table to grow into, before it is touched.
+ * That space is mapped with MAP_NORESERVE, and touching a page of it with
+ * no hugepage left to back it raises SIGBUS rather than failing the
+ * growth.
+ */
+int
+vr_dpdk_table_mem_reserve(void *mem, unsigned long len)
+{
+    int ret;
+    off_t offset;
+
+    if ((vr_dpdk_flow_fd < 0) || !vr_dpdk.flow_table ||
+            ((unsigned char *)mem < (unsigned char *)vr_dpdk.flow_table))
+        return -EINVAL;
+
+    offset = (unsigned char *)mem - (unsigned char *)vr_dpdk.flow_table;
+    ret = fallocate(vr_dpdk_flow_fd, 0, offset, len);
+    if (ret == -1) {
+        ret = -errno;
+        RTE_LOG(ERR, VROUTER, "Error allocating %lu bytes of flow table "
+                "at offset %lu: %s (%d)\n", len, (unsigned long)offset,
+                rte_strerror(-ret), -ret);
+        return ret;
+    }
+
+    return 0;
+}
+
+static void
+vr_dpdk_table_mem_save(struct vr_dpdk_table_hdr *hdr, const void *mem,
+        unsigned int oentries)
+{
+    if (!hdr || !mem)
+        return;
+
+    /* a table that grew is not the one the next instance maps */
+    if (oentries != hdr->vth_oentries) {
+        RTE_LOG(INFO, VROUTER, "Table %u grew, not saving it\n",
+                hdr->vth_table);
+        return;
+    }
+
+    hdr->vth_checksum = vr_dpdk_table_checksum(mem, hdr->vth_size);
+    rte_wmb();
+    hdr->vth_state = VR_DPDK_TABLE_CLEAN;
+    rte_wmb();
+
+    RTE_LOG(INFO, VROUTER, "Table %u saved for a warm restart\n",
+            hdr->vth_table);
+
+    return;
+}
+
+/*
+ * Marks the tables clean for the next instance. Called once the vRouter
+ * is down, i.e nothing writes to the tables anymore.
+ */
+void
+vr_dpdk_table_mem_exit(void)
+{
+    if (!vr_warm_restart)
+        return;
+
+    vr_dpdk_table_mem_save(vr_dpdk_flow_hdr, vr_dpdk_flow_mem,
+            vr_oflow_entries);
+    vr_dpdk_table_mem_save(vr_dpdk_bridge_hdr, vr_dpdk_bridge_mem,
+            vr_bridge_oentries);
+
+    return;
+}
+
 int
 vr_dpdk_bridge_init(void)
 {
@@ -276,10 +507,14 @@ vr_dpdk_flow_init(void)
 
     vr_flow_table = vr_dpdk.flow_table;
     vr_oflow_table = vr_dpdk.flow_table + VR_FLOW_TABLE_SIZE;
+    if (vr_oflow_entries_max > vr_oflow_entries)
+        vr_oflow_ext_table = vr_oflow_table + VR_OFLOW_TABLE_SIZE;
 
     if (!vr_flow_table)
         return -1;
 
+    vr_flow_log_mem = vr_dpdk.flow_log;
+
     vr_flow_hold_limit = VR_DPDK_MAX_FLOW_TABLE_HOLD_COUNT;
     RTE_LOG(INFO, VROUTER, "Max HOLD flow entries set to %u\n",
             vr_flow_hold_limit);
@@ -32,6 +32,7 @@ extern "C" {
 
 #define BRIDGE_TABLE_DEV            "/dev/vr_bridge"
 #define FLOW_TABLE_DEV              "/dev/flow"
+#define FLOW_LOG_DEV                "/dev/vr_flow_log"
 
 #define CLEAN_SCREEN_CMD        "clear"
 
@@ -249,7 +250,7 @@ extern int vr_send_pbb_tunnel_add(struct nl_client *, unsigned int, int,
 
 extern void address_mask(uint8_t *, uint8_t, unsigned int);
 extern int vr_send_route_dump(struct nl_client *, unsigned int, unsigned int,
-        unsigned int, uint8_t *);
+        unsigned int, uint8_t *, int);
 extern int vr_send_route_get(struct nl_client *, unsigned int, unsigned int,
         unsigned int family, uint8_t *, unsigned int, uint8_t *);
 extern int vr_send_route_delete(struct nl_client *, unsigned int, unsigned int,
@@ -258,6 +259,9 @@ extern int vr_send_route_delete(struct nl_client *, unsigned int, unsigned int,
 extern int vr_send_route_add(struct nl_client *, unsigned int, unsigned int,
         unsigned int family, uint8_t *, unsigned int, unsigned int,
         int, uint8_t *, uint32_t, unsigned int);
+extern int vr_send_route_batch(struct nl_client *, unsigned int, unsigned int,
+        unsigned int, unsigned int, unsigned int, uint8_t *, int32_t *,
+        int32_t *, int32_t *, int32_t *, int32_t *, uint8_t *);
 extern vr_route_req *vr_route_req_get_copy(vr_route_req *);
 extern void vr_route_req_destroy(vr_route_req *);
 
@@ -86,6 +86,20 @@ struct vr_bridge_entry {
     unsigned char be_pack[VR_BRIDGE_ENTRY_PACK];
 } __attribute__packed__close__;
 
+/*
+ * The bridge table is mapped by the agent, so its entries keep their
+ * layout. Lookups go through an index that mirrors the hash buckets of the
+ * table instead, a cache line a bucket: the (mac, vrf) keys of the entries
+ * of the bucket, packed in 8 bytes each so that a vector compare matches
+ * them all at once, and the nexthops of the entries. A hit in the index
+ * needs no other line to get the nexthop; entries of the overflow chains
+ * are not in it, and are found by walking the chain as before.
+ */
+struct vr_bridge_index_line {
+    uint64_t bil_key[VR_HENTRIES_PER_BUCKET];
+    struct vr_nexthop *bil_nh[VR_HENTRIES_PER_BUCKET];
+};
+
 typedef enum {
     MAC_LEARN_FAILURE,
     MAC_LEARNT,
@@ -95,6 +109,76 @@ typedef enum {
 } mac_learn_t;
 
 
+/*
+ * Asynchronous MAC learning (enabled by vr_bridge_learn_rate, in learns
+ * per interface per second). A forwarding cpu that misses the source MAC
+ * of a packet does not add it to the bridge table itself. It posts the
+ * (vrf, mac, vif) of the packet, with the copy of the packet that is to
+ * be trapped to the agent, on a ring of its own, and moves on. A timer
+ * drains the rings in batches, adds the entries and traps the copies.
+ *
+ * Each ring has a single producer, its cpu, and a single consumer, the
+ * timer, so that posting is lock free. A cpu does not post the same MAC
+ * again for VR_BRIDGE_LEARN_HOLD_TICKS; the timer drops the learns of
+ * the MACs that are in the table by then, and those beyond the rate of
+ * their interface.
+ */
+#define VR_BRIDGE_LEARN_RING_SIZE       256
+#define VR_BRIDGE_LEARN_FILTER_SIZE     256
+#define VR_BRIDGE_LEARN_TICK_MSECS      10
+#define VR_BRIDGE_LEARN_HOLD_TICKS      10
+#define VR_BRIDGE_LEARN_BATCH           1024
+
+struct vr_bridge_learn_event {
+    struct vr_packet *ble_pkt;
+    unsigned short ble_vrf;
+    unsigned short ble_vif;
+    unsigned char ble_mac[VR_ETHER_ALEN];
+};
+
+struct vr_bridge_learn_filter {
+    uint32_t blf_hash;
+    uint32_t blf_tick;
+};
+
+struct vr_bridge_learn_ring {
+    /* written by the cpu of the ring */
+    volatile unsigned int blr_head;
+    uint64_t blr_posted;
+    uint64_t blr_held;
+    uint64_t blr_full;
+    struct vr_bridge_learn_filter blr_filter[VR_BRIDGE_LEARN_FILTER_SIZE];
+    /* written by the timer */
+    volatile unsigned int blr_tail;
+    struct vr_bridge_learn_event blr_events[VR_BRIDGE_LEARN_RING_SIZE];
+};
+
+struct vr_bridge_learn {
+    struct vrouter *bl_router;
+    struct vr_timer *bl_timer;
+    volatile uint32_t bl_ticks;
+    unsigned int bl_cpus;
+    unsigned int bl_vifs;
+    uint64_t bl_learnt;
+    uint64_t bl_known;
+    uint64_t bl_rate_limited;
+    uint64_t bl_failed;
+    /* learns of the current second, by interface index */
+    unsigned int *bl_vif_learns;
+    struct vr_bridge_learn_ring *bl_rings[];
+};
+
+struct vr_bridge_learn_stats {
+    uint64_t bls_posted;
+    uint64_t bls_held;
+    uint64_t bls_full;
+    uint64_t bls_learnt;
+    uint64_t bls_known;
+    uint64_t bls_rate_limited;
+    uint64_t bls_failed;
+};
+
+extern unsigned int vr_bridge_learn_rate;
 extern unsigned int vr_bridge_entries, vr_bridge_oentries;
 #define VR_BRIDGE_TABLE_SIZE        (vr_bridge_entries *\
         sizeof(struct vr_bridge_entry))
@@ -109,8 +193,11 @@ void *vr_bridge_get_va(struct vrouter *, uint64_t);
 unsigned int vr_bridge_table_size(struct vrouter *);
 mac_learn_t vr_bridge_learn(struct vrouter *, struct vr_packet *,
         struct vr_eth *, struct vr_forwarding_md *);
+void vr_bridge_learn_stats(struct vr_bridge_learn_stats *);
 struct vr_nexthop * __vrouter_bridge_lookup(unsigned int, unsigned char *);
+struct vr_nexthop *vr_bridge_lookup_fast(unsigned int, uint8_t *);
 
 void vr_compute_size_bridge_otable(void);
+void vr_bridge_table_revalidate(struct vrouter *);
 
 #endif
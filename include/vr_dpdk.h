@@ -670,6 +670,7 @@ struct vr_dpdk_global {
     void *netlink_sock;
     void *flow_table;
     void *bridge_table;
+    void *flow_log;
     /* Packet socket */
     void *packet_transport;
     /* Interface configuration mutex
@@ -825,6 +826,8 @@ void vr_dpdk_nl_send_bond_intf_state(struct vr_dpdk_bond_member_info *info,
 
 int vr_dpdk_table_mem_init(unsigned int, unsigned int, unsigned long,
         unsigned int, unsigned long);
+void vr_dpdk_table_mem_exit(void);
+int vr_dpdk_table_mem_reserve(void *, unsigned long);
 int vr_dpdk_flow_init(void);
 int vr_dpdk_bridge_init(void);
 
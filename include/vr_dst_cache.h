@@ -0,0 +1,83 @@
+/*
+ * vr_dst_cache.h -- per cpu cache of the route lookups of forwarded packets
+ */
+#ifndef __VR_DST_CACHE_H__
+#define __VR_DST_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "vr_flow.h"
+
+/*
+ * Packets that vr_forward() routes, those of relaxed policy and flow
+ * lookup bypassing nexthops and of vhost amongst them, pay a walk of the
+ * mtrie each. Every cpu keeps the results of its latest lookups in a
+ * small direct mapped cache, keyed by vrf and destination. The routes of
+ * a burst of packets looked up in one go are left in it too.
+ *
+ * The entries are not locked. A cpu gets to its cache with
+ * vr_get_cpu_local(), which on Linux also keeps the softirq datapath from
+ * running over the datapath that lh_work runs in process context.
+ *
+ * A change of any route bumps vr_dst_cache_gen, which invalidates all the
+ * entries of all the caches at once: an entry is good only while the
+ * generation it was filled in is the current one.
+ *
+ * The nexthop of an entry is not referenced. While the entry is good, the
+ * route it came from is in the mtrie, which holds a reference of the
+ * nexthop. Once the route is changed, what it held is released only after
+ * a grace period, by when the packets that could have seen the entry as
+ * good are done.
+ */
+#define VR_DEF_DST_CACHE_ENTRIES    256
+
+struct vr_dst_cache_entry {
+    uint32_t dce_gen;
+    uint16_t dce_vrf;
+    uint8_t dce_family;
+    uint8_t dce_prefix_len;
+    uint8_t dce_dst[VR_IP6_ADDRESS_LEN];
+    struct vr_nexthop *dce_nh;
+    uint32_t dce_label;
+    uint32_t dce_index;
+    uint16_t dce_label_flags;
+};
+
+struct vr_dst_cache {
+    uint64_t dc_hits;
+    uint64_t dc_misses;
+    struct vr_dst_cache_entry dc_entries[];
+};
+
+extern unsigned int vr_dst_cache_entries;
+extern volatile uint32_t vr_dst_cache_gen;
+
+struct vrouter;
+struct vr_route_req;
+struct vr_route_result;
+
+int vr_dst_cache_init(struct vrouter *);
+void vr_dst_cache_exit(struct vrouter *, bool);
+struct vr_nexthop *vr_dst_cache_lookup(unsigned int, struct vr_route_req *);
+void vr_dst_cache_fill(unsigned int, uint32_t, uint32_t *,
+        struct vr_route_result *, unsigned int);
+void vr_dst_cache_stats(uint64_t *, uint64_t *);
+
+/* called whenever a route changes */
+static inline void
+vr_dst_cache_invalidate(void)
+{
+    /* generation 0 is that of the entries never filled */
+    if (!vr_sync_add_and_fetch_32u(&vr_dst_cache_gen, 1))
+        (void)vr_sync_add_and_fetch_32u(&vr_dst_cache_gen, 1);
+
+    return;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VR_DST_CACHE_H__ */
@@ -69,6 +69,13 @@ typedef enum {
 #define VR_FLOW_FLAG_DELETE_MARKED  0x40
 #define VR_FLOW_BGP_SERVICE         0x80
 
+/* fe_insert_state */
+#define VR_FLOW_INSERT_NONE             0
+#define VR_FLOW_INSERT_PENDING          1
+#define VR_FLOW_INSERT_ABORTED          2
+#define VR_FLOW_INSERT_RETRIES          8
+#define VR_FLOW_INSERT_SPINS            1024
+
 #define VR_FLOW_EXT_FLAG_FORCE_EVICT    0x0001
 /* Mock src UDP port used to set constant port value
  * for vtest(vrouter simulation framework) */
@@ -252,8 +259,6 @@ struct vr_flow {
  * no two values will differ by more than hold count.
  */
 struct vr_flow_table_info {
-    uint64_t vfti_burst_tokens;
-    uint64_t vfti_burst_used;
     uint64_t vfti_deleted;
     uint64_t vfti_changed;
     uint64_t vfti_action_count;
@@ -262,10 +267,162 @@ struct vr_flow_table_info {
     uint32_t vfti_burst_step_configured;
     uint32_t vfti_burst_interval_configured;
     uint32_t vfti_burst_tokens_configured;
-    struct vr_timer *vfti_timer;
+    uint32_t vfti_grow_scheduled;
+    uint32_t vfti_resizes;
+    uint64_t vfti_aged;
+    struct vr_flow_admission *vfti_admission;
+    void *vfti_admission_mem;
+    struct vr_flow_rpf_stats *vfti_rpf_stats;
+    void *vfti_rpf_stats_mem;
+    struct vr_flow_burst *vfti_burst;
     uint32_t vfti_hold_count[];
 };
 
+/*
+ * New flow admission, per cpu. Once the flows in hold cross
+ * vr_flow_hold_limit, a cpu admits new flows only against its own share
+ * of the configured burst tokens. The cpu refills them itself, adding
+ * its share of the burst step for every burst interval (not second)
+ * elapsed since the last refill. The hold count is sampled every
+ * VR_FLOW_HOLD_COUNT_REFRESH new flows rather than summed for each of
+ * them. Nothing here is written by another cpu on the new flow path, and
+ * the blocks are cache line aligned (vfti_admission_mem holds what was
+ * allocated) so that each cpu gets its own line.
+ */
+#define VR_FLOW_HOLD_COUNT_REFRESH      32
+
+struct vr_flow_admission {
+    uint64_t vfa_tokens;
+    uint64_t vfa_refill_msecs;
+    uint64_t vfa_admitted;
+    uint64_t vfa_burst_admitted;
+    uint64_t vfa_dropped;
+    uint32_t vfa_hold_count;
+    uint32_t vfa_checks;
+} __attribute__aligned__(VR_CACHE_LINE_SIZE);
+
+/*
+ * Flow aging in the datapath (enabled by vr_flow_aging_timeout, in
+ * seconds). Every flow that gets inserted is put on a two level timer
+ * wheel that is advanced, one tick a second, from a vr_timer. The wheel
+ * follows the monotonic clock rather than counting timer runs, so that it
+ * catches up with a timer that ran late. When a flow
+ * expires, its packet count is compared with the one seen when it was
+ * last armed. A flow that moved is re-armed; a flow that has been idle
+ * for the timeout, along with its reverse flow if that is idle too, is
+ * evicted through the same path as closed tcp flows, which is how the
+ * agent comes to know about it.
+ *
+ * Nothing is added to the flow entry and nothing is done per packet:
+ * the wheel state of each flow index lives in a separate table that only
+ * the timer walks. Inserters just push the index on a lock free list,
+ * which the timer drains at the start of every tick. A flow that goes
+ * away is not taken off the wheel; it drops out when its slot comes up.
+ */
+#define VR_FLOW_AGING_TICK_MSECS        1000
+#define VR_FLOW_AGING_WHEEL_BITS        6
+#define VR_FLOW_AGING_WHEEL_SLOTS       (1 << VR_FLOW_AGING_WHEEL_BITS)
+#define VR_FLOW_AGING_WHEEL_MASK        (VR_FLOW_AGING_WHEEL_SLOTS - 1)
+#define VR_FLOW_AGING_WHEEL_LEVELS      2
+/* the longest a flow can be armed for, in ticks */
+#define VR_FLOW_AGING_MAX_TICKS         ((VR_FLOW_AGING_WHEEL_SLOTS - 1) * \
+                                            VR_FLOW_AGING_WHEEL_SLOTS)
+/*
+ * Flows looked at in a tick, at most: enough for every flow of the table
+ * to be looked at twice in a timeout, and no less than this. The flows of
+ * a slot that are left over are moved to the next slot, and the wheel
+ * keeps going.
+ */
+#define VR_FLOW_AGING_BUDGET            4096
+/* ticks the wheel is advanced by in one run of the timer, at most */
+#define VR_FLOW_AGING_CATCHUP_TICKS     VR_FLOW_AGING_WHEEL_SLOTS
+
+/* vfae_state */
+#define VR_FLOW_AGE_IDLE                0
+#define VR_FLOW_AGE_QUEUED              1
+#define VR_FLOW_AGE_ARMED               2
+
+struct vr_flow_age_entry {
+    uint32_t vfae_next;
+    uint32_t vfae_expires;
+    uint32_t vfae_seen;
+    uint32_t vfae_packets;
+    uint8_t vfae_gen_id;
+    uint8_t vfae_state;
+    uint16_t vfae_unused;
+};
+
+struct vr_flow_aging {
+    struct vrouter *vfag_router;
+    struct vr_timer *vfag_timer;
+    struct vr_btable *vfag_entries;
+    uint32_t vfag_incoming;
+    uint32_t vfag_now;
+    uint32_t vfag_timeout;
+    uint32_t vfag_budget;
+    uint64_t vfag_start_msecs;
+    uint32_t vfag_wheel[VR_FLOW_AGING_WHEEL_LEVELS][VR_FLOW_AGING_WHEEL_SLOTS];
+};
+
+/*
+ * Source validation results, by flow index (enabled by vr_flow_rpf_cache).
+ * Every packet of a flow has its source validated against the source
+ * nexthop of the flow. For an ECMP source that means the component the
+ * reverse flow points to, and a walk of all the components once that one
+ * does not match. A source found valid is remembered along with what the
+ * check depended on: the source nexthop, the incoming interface, the outer
+ * source, the ECMP index of the reverse flow and the E-Tree root state the
+ * packet came with. The next packet that comes with the same is taken as
+ * valid without looking at the nexthops again.
+ *
+ * The result holds for as long as the generation (vr_flow_rpf_gen) it
+ * was found in. Validation looks at nexthops only, so only changes and
+ * deletes of nexthops bump it, and only while the cache is on. A new
+ * nexthop does not, as no result can be keyed on an id not in use. Lookups
+ * re-read the generation after the key, so that an entry being rewritten
+ * by another cpu is not taken. The entries live outside the flow entry,
+ * whose layout is shared with the agent.
+ */
+struct vr_flow_rpf_entry {
+    struct vr_interface *vfre_vif;
+    uint32_t vfre_gen;
+    uint32_t vfre_src_ip;
+    uint32_t vfre_nh_id;
+    int8_t vfre_ecmp_index;
+    uint8_t vfre_flags_in;
+    uint8_t vfre_flags_out;
+    uint8_t vfre_unused;
+};
+
+/*
+ * Source validations run, and those answered by the rpf cache, per cpu.
+ * They are counted for every packet of a flow, so each cpu gets a line of
+ * its own, away from the admission state of the new flow path.
+ */
+struct vr_flow_rpf_stats {
+    uint64_t vfrs_validated;
+    uint64_t vfrs_cached;
+} __attribute__aligned__(VR_CACHE_LINE_SIZE);
+
+/*
+ * Flows restored on a warm restart. A bit is set in vfr_pending for each
+ * of them, and cleared when the agent programs the flow again. The gen id
+ * the restored entry carries is the previous instance's, hence the agent
+ * may program a pending flow with a gen id of its own, which the entry
+ * then takes. When the restart window ends, the flows still pending, i.e
+ * the ones the agent did not own up to, are evicted, and the timer is
+ * stopped.
+ */
+struct vr_flow_restore {
+    struct vrouter *vfr_router;
+    struct vr_timer *vfr_timer;
+    uint32_t *vfr_pending;
+    unsigned int vfr_entries;
+    unsigned int vfr_restored;
+    unsigned int vfr_evicted;
+    bool vfr_done;
+};
+
 /*
  * flow bytes and packets are of same width. this should be
  * ok since agent really has to take care of overflows. this
@@ -280,7 +437,19 @@ struct vr_flow_stats {
     uint8_t  flow_packets_oflow;
 } __attribute__packed__close__;
 
-#define VR_MAX_FLOW_QUEUE_ENTRIES   3U
+/*
+ * Packets held for a flow in hold. A flow holds up to vr_flow_hold_queue_len
+ * packets, of which the first VR_FLOW_QUEUE_RESERVED_ENTRIES are granted
+ * as long as the pool of the cpu has a node left, and the rest only while
+ * the pool is less than three quarters used.
+ */
+#define VR_MAX_FLOW_QUEUE_ENTRIES       32U
+#define VR_DEF_FLOW_QUEUE_ENTRIES       16U
+#define VR_FLOW_QUEUE_RESERVED_ENTRIES  3U
+
+/* per cpu sizes of the hold pool */
+#define VR_DEF_FLOW_HOLD_POOL_NODES     1024U
+#define VR_DEF_FLOW_HOLD_POOL_QUEUES    256U
 
 #define PN_FLAG_LABEL_IS_VXLAN_ID   0x1
 #define PN_FLAG_TO_ME               0x2
@@ -302,10 +471,51 @@ struct vr_packet_node {
     unsigned short pl_custom;
 };
 
+#define VR_FLOW_HOLD_NO_CPU             ((unsigned int)-1)
+
+struct vr_flow_hold_node {
+    struct vr_packet_node vfhn_pnode;
+    struct vr_flow_hold_node *vfhn_next;
+    unsigned int vfhn_cpu;
+};
+
+/*
+ * A slot is taken by the cpu that gets its index from vfq_entries, and the
+ * node is put in it only once it is filled
+ */
 struct vr_flow_queue {
+    struct vr_flow_queue *vfq_next;
+    unsigned int vfq_cpu;
     unsigned int vfq_index;
     unsigned int vfq_entries;
-    struct vr_packet_node vfq_pnodes[VR_MAX_FLOW_QUEUE_ENTRIES];
+    unsigned int vfq_limit;
+    struct vr_flow_hold_node *vfq_nodes[VR_MAX_FLOW_QUEUE_ENTRIES];
+};
+
+/* vfhp_drops */
+#define VR_FLOW_HOLD_DROP_LIMIT         0
+#define VR_FLOW_HOLD_DROP_SHARE         1
+#define VR_FLOW_HOLD_DROP_POOL          2
+#define VR_FLOW_HOLD_DROP_QUEUE         3
+#define VR_FLOW_HOLD_DROP_MAX           4
+
+/*
+ * Preallocated hold queues and packet nodes, per cpu. Only the cpu that
+ * owns the pool takes from it, without any atomics. Whoever is done with
+ * a queue or a node, on any cpu, gives it back to the returned list of its
+ * pool, which the owner takes over as a whole once it runs out.
+ */
+struct vr_flow_hold_pool {
+    struct vr_btable *vfhp_queue_table;
+    struct vr_btable *vfhp_node_table;
+    struct vr_flow_queue *vfhp_queues;
+    struct vr_flow_hold_node *vfhp_nodes;
+    struct vr_flow_queue *vfhp_returned_queues;
+    struct vr_flow_hold_node *vfhp_returned_nodes;
+    unsigned int vfhp_node_count;
+    unsigned int vfhp_nodes_taken;
+    unsigned int vfhp_nodes_returned;
+    uint64_t vfhp_drops[VR_FLOW_HOLD_DROP_MAX];
 };
 
 /*
@@ -389,7 +599,7 @@ struct vr_dummy_flow_entry {
     struct vr_mirror_meta_entry *fe_mme;
     unsigned int fe_tcp_ack;
     int8_t fe_underlay_ecmp_index;
-    uint8_t fe_bucket_lock;
+    uint8_t fe_insert_state;
 } __attribute__packed__close__;
 
 /*
@@ -397,6 +607,17 @@ struct vr_dummy_flow_entry {
  */
 #define VR_FLOW_ENTRY_PACK (256 - sizeof(struct vr_dummy_flow_entry))
 
+/*
+ * The fields that the per packet path reads (hash entry, key, flags,
+ * action, vrfs, reverse flow, stats, nexthop indices, source info) all
+ * live in the first two cache lines of an entry. Everything past
+ * VR_FLOW_ENTRY_HOT_SIZE (mirror metadata, tcp ack, the insertion state,
+ * the pad) is touched only on the slow paths. The table is shared with
+ * the agent, so the fields can not be moved around; new per packet state
+ * has to be fit in the hot lines or kept out of the entry altogether.
+ */
+#define VR_FLOW_ENTRY_HOT_SIZE          128
+
 /* do not change. any field positions as it might lead to incompatibility */
 __attribute__packed__open__
 struct vr_flow_entry {
@@ -432,10 +653,13 @@ struct vr_flow_entry {
     struct vr_mirror_meta_entry *fe_mme;
     unsigned int fe_tcp_ack;
     int8_t fe_underlay_ecmp_index;
-    /* Note: Used only in the first entry of the bucket. May be used even if
-     * the whole entry is invalid. This is a spinlock to synchronize
-     * vr_add_flow and vr_flow_lookup and avoid duplicate entries. */
-    uint8_t fe_bucket_lock;
+    /*
+     * Insertion state of a freshly claimed entry (VR_FLOW_INSERT_*).
+     * Concurrent inserters of the same key use this byte to elect a
+     * single winner without taking any lock. Lookups do not look at it:
+     * the entry is kept hidden in the hash table until it is published.
+     */
+    uint8_t fe_insert_state;
     unsigned char fe_pack[VR_FLOW_ENTRY_PACK];
 } __attribute__packed__close__;
 
@@ -453,7 +677,46 @@ struct vr_flow_entry {
 
 #define VR_DEF_FLOW_ENTRIES   (512 * 1024)
 
+/* Number of keys hashed and prefetched together by vr_flow_lookup_burst */
+#define VR_FLOW_LOOKUP_BURST_MAX    32
+
+/*
+ * The flows that a cpu resolved for the packets of the burst it is
+ * working through (vr_flow_prefetch_burst), in the order of the burst,
+ * for vr_flow_lookup to take up instead of walking the bucket again.
+ * An entry is taken only if it still holds the key of the packet.
+ */
+struct vr_flow_burst {
+    unsigned int vfb_count;
+    unsigned int vfb_next;
+    struct vr_packet *vfb_pkt[VR_FLOW_LOOKUP_BURST_MAX];
+    unsigned int vfb_index[VR_FLOW_LOOKUP_BURST_MAX];
+};
+
 extern unsigned int vr_flow_entries, vr_oflow_entries;
+extern unsigned int vr_oflow_entries_max;
+extern unsigned int vr_flow_cuckoo;
+extern unsigned int vr_flow_aging_timeout;
+extern unsigned int vr_flow_rpf_cache;
+extern volatile uint32_t vr_flow_rpf_gen;
+extern unsigned int vr_flow_flowlet;
+extern unsigned int vr_flow_hold_queue_len;
+extern unsigned int vr_flow_hold_pool_nodes;
+extern unsigned int vr_flow_hold_pool_queues;
+
+/* called whenever a nexthop changes, or goes */
+static inline void
+vr_flow_rpf_invalidate(void)
+{
+    if (!vr_flow_rpf_cache)
+        return;
+
+    /* generation 0 is that of the entries never filled */
+    if (!vr_sync_add_and_fetch_32u(&vr_flow_rpf_gen, 1))
+        (void)vr_sync_add_and_fetch_32u(&vr_flow_rpf_gen, 1);
+
+    return;
+}
 
 #define VR_FLOW_TABLE_SIZE   (vr_flow_entries * sizeof(struct vr_flow_entry))
 #define VR_OFLOW_TABLE_SIZE  (vr_oflow_entries * sizeof(struct vr_flow_entry))
@@ -490,6 +753,7 @@ struct vr_flow_trap_arg {
 struct vr_packet;
 struct vrouter;
 struct vr_ip;
+struct vr_interface;
 struct vr_ip6;
 
 extern int vr_flow_init(struct vrouter *);
@@ -504,6 +768,10 @@ void *vr_flow_get_va(struct vrouter *, uint64_t);
 unsigned int vr_flow_table_size(struct vrouter *);
 
 struct vr_flow_entry *vr_flow_get_entry(struct vrouter *, int);
+unsigned int vr_flow_lookup_burst(struct vrouter *, struct vr_flow **,
+        struct vr_flow_entry **, unsigned int *, unsigned int);
+unsigned int vr_flow_prefetch_burst(struct vrouter *, struct vr_interface *,
+        struct vr_packet **, unsigned int);
 flow_result_t vr_flow_lookup(struct vrouter *, struct vr_flow *,
                              struct vr_packet *, struct vr_forwarding_md *);
 
@@ -548,6 +816,7 @@ bool vr_valid_link_local_port(struct vrouter *, int, int, int);
 int vr_inet_form_flow(struct vrouter *, unsigned short,
                 struct vr_packet *, uint16_t, struct vr_flow *, uint8_t,
                 unsigned short);
+bool vr_flow_queue_has_packets(struct vr_flow_queue *);
 int vr_flow_flush_pnode(struct vrouter *, struct vr_packet_node *,
                 struct vr_flow_entry *, struct vr_forwarding_md *);
 void vr_flow_fill_pnode(struct vr_packet_node *, struct vr_packet *,
@@ -564,6 +833,7 @@ int vr_flow_update_ecmp_index(struct vrouter *, struct vr_flow_entry *,
         unsigned int, struct vr_forwarding_md *);
 uint32_t vr_flow_get_rflow_src_info(struct vrouter *, struct
         vr_flow_entry *);
+uint32_t vr_flow_idle_usecs(struct vrouter *, int);
 unsigned int vr_flow_table_burst_step_configured(struct vrouter *);
 unsigned int vr_flow_table_burst_tokens_configured(struct vrouter *);
 unsigned int vr_flow_table_burst_time_configured(struct vrouter *);
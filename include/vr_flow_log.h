@@ -0,0 +1,154 @@
+/*
+ * vr_flow_log.h -- flow statistics change log
+ */
+#ifndef __VR_FLOW_LOG_H__
+#define __VR_FLOW_LOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The flow statistics change log is a set of single producer rings, one
+ * per cpu and one for the flow aging timer, in memory that is shared with
+ * the agent and the utilities the same way the flow table is. Instead of
+ * walking the whole flow table to find the flows whose statistics moved,
+ * a reader follows the rings.
+ *
+ * A record is appended for the first packet of a flow, every
+ * vr_flow_log_threshold packets after that, whenever the tcp state of the
+ * flow changes and, when the datapath ages flows, for every flow that the
+ * aging timer finds to have moved and for every flow that it ages. The
+ * records carry the absolute counters of the flow, so that a reader that
+ * missed some of them does not get its deltas wrong.
+ *
+ * The readers map the memory read only and keep their own position in
+ * each ring. The producer never waits for them: a reader that falls more
+ * than a ring behind loses records, which it finds out about through the
+ * sequence number stamped in each record. A record is invalidated before
+ * it is rewritten and stamped with its sequence number only after, so a
+ * reader that sees the same sequence number before and after copying a
+ * record has a consistent copy of it.
+ *
+ * Memory layout:
+ *
+ *   struct vr_flow_log_info            (at offset 0)
+ *   struct vr_flow_log_ring[rings]     (at vfli_ring_offset)
+ *   struct vr_flow_log_record[rings][records] (at vfli_record_offset)
+ */
+#define VR_FLOW_LOG_MAGIC               0x464c4f47
+#define VR_FLOW_LOG_VERSION             1
+
+#define VR_FLOW_LOG_DEF_THRESHOLD       64
+/* bounds on the records of a ring, and on the log as a whole */
+#define VR_FLOW_LOG_MAX_RECORDS         (1U << 24)
+#define VR_FLOW_LOG_MAX_SIZE            (1ULL << 31)
+#define VR_FLOW_LOG_SEQ_INVALID         ((uint64_t)-1)
+
+/* vflr_reason */
+#define VR_FLOW_LOG_REASON_NEW          1
+#define VR_FLOW_LOG_REASON_THRESHOLD    2
+#define VR_FLOW_LOG_REASON_TCP          3
+#define VR_FLOW_LOG_REASON_PERIODIC     4
+#define VR_FLOW_LOG_REASON_AGED         5
+
+/* the ring of the flow aging timer, which is the last one */
+#define VR_FLOW_LOG_RING_TIMER          (-1)
+
+struct vr_flow_log_info {
+    uint32_t vfli_magic;
+    uint16_t vfli_version;
+    uint16_t vfli_rings;
+    uint32_t vfli_records;
+    uint32_t vfli_record_size;
+    uint32_t vfli_ring_offset;
+    uint32_t vfli_record_offset;
+    uint32_t vfli_threshold;
+    uint32_t vfli_unused[9];
+};
+
+/* one cache line per ring, written only by its producer */
+struct vr_flow_log_ring {
+    uint64_t vfrg_head;
+    uint64_t vfrg_unused[7];
+};
+
+struct vr_flow_log_record {
+    uint64_t vflr_seq;
+    uint32_t vflr_index;
+    uint32_t vflr_bytes;
+    uint32_t vflr_packets;
+    uint16_t vflr_bytes_oflow;
+    uint16_t vflr_tcp_flags;
+    uint8_t vflr_packets_oflow;
+    uint8_t vflr_gen_id;
+    uint8_t vflr_reason;
+    uint8_t vflr_unused[5];
+};
+
+#define VR_FLOW_LOG_UNIT                sizeof(struct vr_flow_log_record)
+
+/* datapath side */
+struct vrouter;
+struct vr_flow_entry;
+struct vr_btable;
+
+struct vr_flow_log {
+    struct vr_btable *vfl_table;
+    unsigned int vfl_rings;
+    unsigned int vfl_records;
+    unsigned int vfl_ring_units;
+    unsigned int vfl_record_units;
+    unsigned int vfl_threshold_mask;
+    unsigned int vfl_size;
+};
+
+extern unsigned int vr_flow_log_records;
+extern unsigned int vr_flow_log_threshold;
+extern void *vr_flow_log_mem;
+extern unsigned char *vr_flow_log_path;
+
+unsigned int vr_flow_log_mem_size(unsigned int);
+void vr_flow_log_append(struct vrouter *, int, struct vr_flow_entry *,
+        unsigned int, uint8_t);
+void *vr_flow_log_get_va(struct vrouter *, uint64_t);
+unsigned int vr_flow_log_size(struct vrouter *);
+int vr_flow_log_init(struct vrouter *);
+void vr_flow_log_exit(struct vrouter *);
+
+/*
+ * Reader side, in libvrutil. The reader turns the records into deltas
+ * against what it last saw of each flow.
+ */
+struct vr_flow_log_delta {
+    uint32_t vfld_index;
+    uint8_t vfld_gen_id;
+    uint8_t vfld_reason;
+    uint16_t vfld_tcp_flags;
+    uint64_t vfld_bytes;
+    uint64_t vfld_packets;
+};
+
+struct vr_flow_log_flow;
+
+struct vr_flow_log_reader {
+    const struct vr_flow_log_info *vflrd_info;
+    const unsigned char *vflrd_mem;
+    size_t vflrd_size;
+    uint64_t *vflrd_positions;
+    struct vr_flow_log_flow *vflrd_flows;
+    unsigned int vflrd_flow_entries;
+    uint64_t vflrd_lost;
+};
+
+int vr_flow_log_reader_init(struct vr_flow_log_reader *, const void *,
+        size_t, unsigned int);
+int vr_flow_log_read(struct vr_flow_log_reader *,
+        void (*)(const struct vr_flow_log_delta *, void *), void *);
+void vr_flow_log_reader_exit(struct vr_flow_log_reader *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VR_FLOW_LOG_H__ */
@@ -8,6 +8,7 @@
 #include "vr_os.h"
 
 #define VR_INVALID_HENTRY_INDEX ((unsigned int)-1)
+#define VR_HENTRIES_PER_BUCKET 4
 
 struct vrouter;
 
@@ -33,6 +34,9 @@ vr_htable_t vr_htable_create(struct vrouter *, unsigned int , unsigned int,
 vr_htable_t vr_htable_attach(struct vrouter *, unsigned int, void *,
         unsigned int, void *, unsigned int , unsigned int ,
         unsigned int , get_hentry_key);
+vr_htable_t vr_htable_restore(struct vrouter *, unsigned int, void *,
+        unsigned int, void *, unsigned int , unsigned int ,
+        unsigned int , get_hentry_key);
 
 unsigned int vr_htable_used_oflow_entries(vr_htable_t);
 unsigned int vr_htable_used_total_entries(vr_htable_t);
@@ -42,6 +46,8 @@ int vr_htable_find_duplicate_hentry_index(vr_htable_t , vr_hentry_t *);
 vr_hentry_t *vr_htable_get_hentry_by_index(vr_htable_t , unsigned int );
 vr_hentry_t *__vr_htable_get_hentry_by_index(vr_htable_t , unsigned int );
 vr_hentry_t *vr_htable_find_free_hentry(vr_htable_t , void *, unsigned int );
+void vr_htable_hentry_hide(vr_hentry_t *);
+void vr_htable_hentry_unhide(vr_hentry_t *);
 int vr_htable_trav_range(vr_htable_t, unsigned int, unsigned int,
         htable_trav_cb , void *);
 int vr_htable_trav(vr_htable_t, unsigned int , htable_trav_cb , void *);
@@ -49,9 +55,26 @@ void vr_htable_reset(vr_htable_t, htable_trav_cb , void *);
 void vr_htable_release_hentry(vr_htable_t, vr_hentry_t *);
 unsigned int vr_htable_size(vr_htable_t);
 void *vr_htable_get_address(vr_htable_t, uint64_t);
+int vr_htable_cuckoo_init(vr_htable_t);
+int vr_htable_grow_oentries(vr_htable_t, unsigned int, void *);
 
 /* Gets the first entry of the bucket associated with key. Note: it
  * might be not VALID */
 vr_hentry_t *vr_htable_get_bucket(vr_htable_t, void * key, unsigned int key_len);
+void vr_htable_trav_bucket(vr_htable_t, void *, unsigned int, htable_trav_cb,
+        void *);
+
+/* Split lookup, so that a burst of keys can be hashed and have their
+ * buckets prefetched before any of them is resolved */
+unsigned int vr_htable_hash(vr_htable_t, void *, unsigned int);
+vr_hentry_t *vr_htable_get_bucket_by_hash(vr_htable_t, unsigned int);
+/* for the users that keep a structure of their own per bucket */
+unsigned int vr_htable_buckets(vr_htable_t);
+unsigned int vr_htable_bucket_by_hash(vr_htable_t, unsigned int);
+void vr_htable_prefetch_by_hash(vr_htable_t, unsigned int);
+vr_hentry_t *vr_htable_find_hentry_by_hash(vr_htable_t, void *, unsigned int,
+        unsigned int);
+bool vr_htable_hentry_match(vr_htable_t, vr_hentry_t *, void *,
+        unsigned int);
 
 #endif
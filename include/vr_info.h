@@ -28,6 +28,9 @@
     X(CONF_DEL_DDP, conf_del_ddp, DPDK) \
     X(CONF_LOG, conf_log, DPDK) \
     X(CONF_LOG_LIST, conf_log_list, DPDK) \
+    X(INFO_DST_CACHE, info_get_dst_cache, VR_COMMON) \
+    X(INFO_BRIDGE_LEARN, info_get_bridge_learn, VR_COMMON) \
+    X(INFO_FIB, info_get_fib, VR_COMMON) \
 
 /* Define all supported platforms.
  * When a new platforms added, define like below.
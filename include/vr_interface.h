@@ -213,6 +213,11 @@ struct vr_interface_stats {
     uint64_t vis_dev_obytes;
     uint64_t vis_dev_opackets;
     uint64_t vis_dev_oerrors;
+    /* new flows admitted against the vif flow quota in this interval */
+    uint64_t vis_flow_quota_msecs;
+    uint32_t vis_flow_quota_used;
+    /* new flows refused for being over the quota */
+    uint64_t vis_flow_quota_drops;
 
     uint64_t *vis_queue_ierrors_to_lcore;
 };
@@ -442,6 +447,8 @@ struct vr_interface {
     uint8_t vif_fat_flow_ipv6_exclude_list_size;
     uint8_t vif_fat_flow_ipv4_exclude_list_size;
     unsigned int vif_l3mh_loip;
+    /* new flows per burst interval and cpu once over the hold limit */
+    unsigned int vif_flow_quota;
 };
 
 struct vr_interface_settings {
@@ -513,6 +520,8 @@ extern void vif_detach(struct vr_interface *vif);
 extern int vif_delete(struct vr_interface *);
 extern struct vr_interface *vif_find(struct vrouter *, char *);
 extern unsigned int vif_get_mtu(struct vr_interface *);
+extern struct vr_interface_stats *vif_get_stats(struct vr_interface *,
+        unsigned short);
 extern void vif_set_xconnect(struct vr_interface *);
 extern void vif_remove_xconnect(struct vr_interface *);
 extern int vif_xconnect(struct vr_interface *, struct vr_packet *,
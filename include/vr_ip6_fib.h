@@ -0,0 +1,92 @@
+/*
+ * vr_ip6_fib.h -- IPv6 forwarding table
+ */
+#ifndef __VR_IP6_FIB_H__
+#define __VR_IP6_FIB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "vr_htable.h"
+#include "vr_flow.h"
+
+/*
+ * The IPv6 FIB sits next to the mtrie, which stays the table that the
+ * routes are programmed into, dumped and got from. Every route that the
+ * mtrie takes for AF_INET6 is also kept in one hash table, keyed by its
+ * vrf, prefix length and prefix. A lookup probes that table once for each
+ * of the prefix lengths that the vrf has routes of, longest first. The
+ * first hit is the longest prefix match. The buckets of up to
+ * VR_IP6_FIB_PROBES lengths are prefetched before the first of them is
+ * resolved, so a vrf with the usual /128 host, /64 subnet and default
+ * routes is looked up in a couple of dependent fetches, where the mtrie
+ * takes up to 16.
+ *
+ * The mtrie is looked up instead when no route matched (the mtrie knows
+ * what the default of the vrf is), and for a vrf that has a route the
+ * table had no room for. Up to VR_IP6_FIB_MISSING such routes are kept
+ * track of, so that the vrf is looked up in the table again once they are
+ * deleted, or make it to the table when added again. Beyond that, each
+ * vrf only counts its missing routes, and a delete of a route that the
+ * table does not have takes one off the count of its vrf. Only the vrfs
+ * that lost routes fall back to the mtrie, until the count drops to 0. A
+ * change to a route that is not kept track of counts it again, which
+ * errs on the side of the mtrie.
+ */
+#define VR_DEF_IP6_FIB_ENTRIES          (64 * 1024)
+#define VR_DEF_IP6_FIB_OENTRIES         (8 * 1024)
+#define VR_IP6_FIB_PROBES               8
+#define VR_IP6_FIB_LENGTHS              ((VR_IP6_ADDRESS_LEN * 8) + 1)
+#define VR_IP6_FIB_LENGTH_WORDS         ((VR_IP6_FIB_LENGTHS + 63) / 64)
+#define VR_IP6_FIB_MISSING              64
+
+#define VR_IP6_FIB_FLAG_VALID           0x01
+#define VR_IP6_FIB_FLAG_DELETED         0x02
+
+__attribute__packed__open__
+struct vr_ip6_fib_key {
+    uint8_t fk_prefix[VR_IP6_ADDRESS_LEN];
+    uint32_t fk_vrf_id;
+    uint8_t fk_prefix_len;
+    uint8_t fk_unused[3];
+} __attribute__packed__close__;
+
+__attribute__packed__open__
+struct vr_ip6_fib_entry {
+    vr_hentry_t fe_hentry;
+    struct vr_ip6_fib_key fe_key;
+    struct vr_nexthop *fe_nh;
+    uint32_t fe_label;
+    uint32_t fe_bridge_index;
+    uint8_t fe_label_flags;
+    uint8_t fe_flags;
+    uint8_t fe_unused[1];
+} __attribute__packed__close__;
+
+/* the prefix lengths that a vrf has routes of */
+struct vr_ip6_fib_vrf {
+    uint64_t fv_lengths[VR_IP6_FIB_LENGTH_WORDS];
+    /* routes of the vrf that did not make it to the table */
+    unsigned int fv_missing;
+    unsigned int fv_routes[VR_IP6_FIB_LENGTHS];
+};
+
+extern unsigned int vr_ip6_fib_entries;
+extern unsigned int vr_ip6_fib_oentries;
+
+struct vr_rtable;
+struct rtable_fspec;
+struct vr_route_req;
+
+int ip6_fib_init(struct vr_rtable *, struct rtable_fspec *);
+void ip6_fib_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
+void ip6_fib_add(struct vr_route_req *);
+void ip6_fib_del(struct vr_route_req *);
+struct vr_nexthop *ip6_fib_lookup(unsigned int, struct vr_route_req *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VR_IP6_FIB_H__ */
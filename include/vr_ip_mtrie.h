@@ -14,37 +14,64 @@ struct ip_bucket;
 #define ENTRY_TYPE_BUCKET      1
 #define ENTRY_TYPE_NEXTHOP     2
 #define ENTRY_TYPE_VDATA       3
+#define ENTRY_TYPE_MASK        0x3
 
-#define ENTRY_IS_BUCKET(EPtr)        ((EPtr)->entry_type == ENTRY_TYPE_BUCKET)
-#define ENTRY_IS_NEXTHOP(EPtr)       ((EPtr)->entry_type == ENTRY_TYPE_NEXTHOP)
-#define ENTRY_IS_VDATA(EPtr)         ((EPtr)->entry_type == ENTRY_TYPE_VDATA)
+#define ENTRY_TYPE(EPtr)             ((EPtr)->entry_long_i & ENTRY_TYPE_MASK)
+#define ENTRY_IS_BUCKET(EPtr)        (ENTRY_TYPE(EPtr) == ENTRY_TYPE_BUCKET)
+#define ENTRY_IS_NEXTHOP(EPtr)       (ENTRY_TYPE(EPtr) == ENTRY_TYPE_NEXTHOP)
+#define ENTRY_IS_VDATA(EPtr)         (ENTRY_TYPE(EPtr) == ENTRY_TYPE_VDATA)
+#define ENTRY_TO_PTR(EPtr)           \
+    ((EPtr)->entry_long_i & ~(uintptr_t)ENTRY_TYPE_MASK)
 
 #define PTR_TO_BUCKET(ptr)           ((struct ip_bucket *)(ptr))
-#define PTR_TO_NEXTHOP(ptr)          ((struct vr_nexthop *)(ptr))
-#define PTR_TO_VDATA(ptr)            ((void *)(ptr))
+#define PTR_TO_LEAF(ptr)             ((struct ip_bucket_leaf *)(ptr))
 
-struct ip_bucket_entry {
+/*
+ * What a route resolves to. All the entries that a route covers point to
+ * the one leaf, which goes away a grace period after the last of them
+ * stopped pointing to it.
+ *
+ * Leaves and buckets carry the fib (the vrf and family) they are accounted
+ * to, -1 for those of the vdata mtries, so that what waits for a grace
+ * period to be freed is known by vrf. leaf_walk is for the walks that
+ * count the leaves of a vrf.
+ */
+struct ip_bucket_leaf {
     union {
         struct vr_nexthop *nexthop_p;
-        struct ip_bucket  *bucket_p;
         void              *vdata_p;
-        uintptr_t         long_i;
-    } entry_data;                  
-
-    unsigned char entry_type;
-    unsigned int entry_prefix_len:8;
-    unsigned int entry_label_flags:5;
-    unsigned int entry_label:24;
-    unsigned int entry_bridge_index;
+    } leaf_data;
+
+    unsigned int leaf_refcnt;
+    unsigned int leaf_bridge_index;
+    unsigned int leaf_label:24;
+    unsigned int leaf_prefix_len:8;
+    unsigned char leaf_label_flags;
+    unsigned char leaf_type;
+    unsigned char leaf_retired;
+    int leaf_fib;
+    unsigned int leaf_walk;
 };
 
-#define entry_nh_p      entry_data.nexthop_p
-#define entry_bkt_p     entry_data.bucket_p
-#define entry_long_i    entry_data.long_i
-#define entry_vdata_p   entry_data.vdata_p
+#define leaf_nh_p       leaf_data.nexthop_p
+#define leaf_vdata_p    leaf_data.vdata_p
+
+/*
+ * A bucket entry is a pointer to either the bucket of the next level or
+ * a leaf, with the type of what it points to in its low bits. Buckets
+ * thus take 8 bytes an entry, i.e. 2KB for 256 entries.
+ */
+struct ip_bucket_entry {
+    uintptr_t entry_long_i;
+};
 
 struct ip_bucket {
     unsigned int bkt_size;
+    /* length of the route that the entry pointing to the bucket is of */
+    unsigned int bkt_prefix_len;
+    int bkt_fib;
+    /* buckets freed along with this one, once it has been retired */
+    unsigned int bkt_retired;
     struct ip_bucket_entry bkt_data[];
 };
 
@@ -52,7 +79,8 @@ struct ip_bucket {
  * IpMtrie
  *
  * IpMtrie ensures that an IPv4 lookup can be performed in 3 data fetches. 
- * IPv6 lookup will require 15 data fetches.
+ * IPv6 lookup will require 15 data fetches, hence IPv6 lookups try the
+ * IPv6 FIB (vr_ip6_fib.h) first.
  * 
  */
 struct ip_mtrie {
@@ -14,7 +14,8 @@ extern "C" {
 
 #define VR_MEM_FLOW_TABLE_OBJECT    0
 #define VR_MEM_BRIDGE_TABLE_OBJECT  1
-#define VR_MEM_MAX_OBJECT           2
+#define VR_MEM_FLOW_LOG_OBJECT      2
+#define VR_MEM_MAX_OBJECT           3
 
 struct vr_mem_object {
     struct vrouter *vmo_router;
@@ -22,7 +23,7 @@ struct vr_mem_object {
 };
 
 #define MEM_DEV_MINOR_START         0
-#define MEM_DEV_NUM_DEVS            2
+#define MEM_DEV_NUM_DEVS            3
 
 #define ROUTER_FROM_MINOR(minor)    (((minor) >> 7) & 0xFF)
 #define OBJECT_FROM_MINOR(minor)    ((minor) & 0x7F)
@@ -87,6 +87,53 @@ enum nexthop_type {
 
 #define NH_ECMP_PACKET_HELD                 (-2)
 
+/*
+ * Resilient ECMP (enabled by vr_ecmp_table_size). An ECMP composite maps
+ * the hash of a packet to a member through a table of that many buckets,
+ * rounded up to a prime, rather than by the hash modulo its members. The
+ * table is filled the Maglev way: each active member walks the buckets in
+ * a permutation of its own, derived from its nexthop and label, and the
+ * members take turns claiming the next free bucket of theirs. A member
+ * that joins or leaves thus moves about 1/N of the buckets, instead of
+ * most of them, and the flows and flowless traffic of the other members
+ * stay where they are.
+ *
+ * Members may be given weights, from 1 to NH_ECMP_MAX_WEIGHT. The weights
+ * are divided by their greatest common divisor, and each round a member
+ * gets as many claims as its weight. The claims are spent one bucket a
+ * turn, round robin amongst the members that have some left, so that a
+ * round cut short by a full table shortchanges no member by more than a
+ * bucket a turn. The share of a member of the table, and of the traffic,
+ * thus follows its weight. A composite with unequal weights always gets a
+ * table, of NH_ECMP_TABLE_DEF_SIZE buckets when vr_ecmp_table_size is not
+ * set, and never of fewer buckets than a round hands out.
+ */
+#define NH_ECMP_TABLE_MAX_SIZE              65521
+#define NH_ECMP_TABLE_DEF_SIZE              1021
+#define NH_ECMP_MAX_WEIGHT                  256
+
+/*
+ * Flowlets (enabled by nhr_flowlet_gap, in microseconds, on an ECMP
+ * composite). The member of a flow is otherwise picked once, by its first
+ * packet, and kept for as long as the flow lives. A flow that has been
+ * idle for longer than the gap of the composite starts a new flowlet, for
+ * which the member is picked again, from the hash of the flow salted with
+ * the idle time. The packets in flight on the old member are by then
+ * gone, so that the flow is not reordered. The idle time comes from the
+ * last seen times the flow table keeps, by flow index, when
+ * vr_flow_flowlet is set.
+ *
+ * The members of a composite are expected to reach the same endpoint by
+ * different paths: a flow that is moved to a member that goes elsewhere
+ * loses its state at the other end.
+ *
+ * ECMP composites with flowlets count the packets they send through each
+ * member, by cpu, in rows of whole cache lines, to tell how flowlets
+ * spread the load.
+ */
+#define NH_ECMP_FLOWLET_MAX_GAP             (10 * 1000 * 1000)
+#define NH_ECMP_LOAD_STRIDE(cnt)            (((cnt) + 7) & ~7U)
+
 struct vr_packet;
 
 struct vr_forwarding_md;
@@ -94,9 +141,26 @@ struct vr_forwarding_md;
 struct vr_component_nh {
     int cnh_label;
     int cnh_ecmp_index;
+    unsigned int cnh_weight;
     struct vr_nexthop *cnh;
 };
 
+/*
+ * The outer headers of an IPv4 GRE, MPLS over UDP or VXLAN tunnel
+ * nexthop, IP and then GRE or UDP, built by nh_tunnel_add(). A packet gets
+ * them in one copy and has its length, id, tos, ttl and source port
+ * patched in. Of the IP checksum only the words that change by packet are
+ * left to sum; nth_csum is the sum of the others.
+ */
+#define VR_NH_TUN_HDR_MAX_LEN               28
+
+struct vr_nh_tun_hdr {
+    uint8_t nth_len;
+    uint8_t nth_unused;
+    uint16_t nth_csum;
+    uint8_t nth_hdr[VR_NH_TUN_HDR_MAX_LEN];
+};
+
 typedef enum {
     NH_PROCESSING_COMPLETE,
     NH_PROCESSING_INCOMPLETE,
@@ -160,12 +224,17 @@ struct vr_nexthop {
             unsigned short cnt;
             unsigned short ecmp_cnt;
             unsigned short ecmp_config_hash;
+            unsigned int ecmp_table_size;
+            unsigned int flowlet_gap;
             struct vr_component_nh *component;
             struct vr_component_nh *ecmp_active;
+            unsigned short *ecmp_table;
+            uint64_t *ecmp_load;
         } nh_composite;
 
     } nh_u;
 
+    struct vr_nh_tun_hdr nh_tun_hdr;
     struct vrouter      *nh_router;
     struct vr_nexthop   *nh_direct_nh;
     int                 (*nh_validate_src)(struct vr_packet *,
@@ -212,6 +281,10 @@ struct vr_nexthop {
 #define nh_component_ecmp_cnt   nh_u.nh_composite.ecmp_cnt
 #define nh_component_ecmp       nh_u.nh_composite.ecmp_active
 #define nh_ecmp_config_hash     nh_u.nh_composite.ecmp_config_hash
+#define nh_component_table      nh_u.nh_composite.ecmp_table
+#define nh_component_table_size nh_u.nh_composite.ecmp_table_size
+#define nh_component_flowlet_gap nh_u.nh_composite.flowlet_gap
+#define nh_component_load       nh_u.nh_composite.ecmp_load
 
 #define nh_pbb_mac         nh_u.nh_pbb_tun.tun_pbb_mac
 #define nh_pbb_label       nh_u.nh_pbb_tun.tun_pbb_label
@@ -230,6 +303,8 @@ vr_nexthop_is_vcp(struct vr_nexthop *nh)
     return false;
 }
 
+extern unsigned int vr_ecmp_table_size;
+
 extern int vr_nexthop_init(struct vrouter *);
 extern void vr_nexthop_exit(struct vrouter *, bool);
 extern struct vr_nexthop *__vrouter_get_nexthop(struct vrouter *, unsigned int);
@@ -11,6 +11,9 @@
 #define __attribute__packed__close__                    __attribute__((__packed__))
 #define __attribute__format__(...)                      __attribute__((format(__VA_ARGS__)))
 #define __attribute__unused__                           __attribute__((unused))
+#define __attribute__aligned__(a)                       __attribute__((aligned(a)))
+
+#define VR_CACHE_LINE_SIZE                              64
 
 #define vr_sync_sub_and_fetch_16u(a, b)                 __sync_sub_and_fetch((a), (b))
 #define vr_sync_sub_and_fetch_32u(a, b)                 __sync_sub_and_fetch((a), (b))
@@ -35,9 +38,12 @@
 #define vr_sync_lock_test_and_set_p(a, b)               __sync_lock_test_and_set((a), (b))
 #define vr_sync_synchronize                             __sync_synchronize
 #define vr_ffs_32(a)                                    __builtin_ffs(a)
+#define vr_clz_64(a)                                    __builtin_clzll(a)
 #define vr_likely(a)                                    __builtin_expect(!!(a), 1)
 #define vr_unlikely(a)                                  __builtin_expect(!!(a), 0)
 #define vr_pause                                        __builtin_ia32_pause
+#define vr_prefetch(a)                                  __builtin_prefetch((a))
+#define vr_compiler_barrier()                           __asm__ __volatile__("" ::: "memory")
 
 #if defined(__linux__)
 #ifdef __KERNEL__
@@ -14,6 +14,8 @@ extern "C" {
 #include "vr_types.h"
 
 #define VR_NUM_ROUTES_PER_DUMP  20
+/* routes that one batched add or delete request can carry */
+#define VR_ROUTE_BATCH_MAX      1024
 #define VR_DEF_VRFS             4096
 #define VR_MAX_VRFS             65536
 
@@ -28,6 +30,8 @@ extern "C" {
 
 struct vrouter;
 struct rtable_fspec;
+struct vr_interface;
+struct vr_packet;
 
 struct vr_route_req {
     vr_route_req        rtr_req;
@@ -87,6 +91,9 @@ struct vr_rtable {
     struct vr_vrf_stats *(*algo_stats)(unsigned short, unsigned int);
     int (*algo_stats_get)(vr_vrf_stats_req *, vr_vrf_stats_req *);
     int (*algo_stats_dump)(struct vr_rtable *, vr_vrf_stats_req *);
+    /* bracket the routes of a batch, reclaiming what they retire at the end */
+    void (*algo_batch_start)(struct vr_rtable *);
+    void (*algo_batch_end)(struct vr_rtable *);
     unsigned int algo_max_vrfs;
     void *algo_data;
     struct vr_vrf_stats **vrf_stats;
@@ -107,6 +114,41 @@ struct rtable_fspec {
 
     algo_init_decl algo_init;
     algo_deinit_decl algo_deinit;
+    /* a forwarding table that the family keeps next to the algorithm */
+    algo_init_decl fib_init;
+    algo_deinit_decl fib_deinit;
+};
+
+/*
+ * What the mtrie of a vrf takes, for one family. Buckets are counted by
+ * level, the root bucket being level 0; depth is the number of buckets
+ * the longest lookup goes through. Shared buckets are the ones all of
+ * whose entries resolve to the same nexthop. Retired buckets and leaves
+ * are those out of the mtrie that wait for a grace period to be freed.
+ */
+#define VR_FIB_MAX_LEVELS           16
+
+struct vr_fib_vrf_mem {
+    unsigned int fvm_buckets[VR_FIB_MAX_LEVELS];
+    unsigned int fvm_leaves;
+    unsigned int fvm_depth;
+    unsigned int fvm_shared_buckets;
+    unsigned int fvm_retired_buckets;
+    unsigned int fvm_retired_leaves;
+    uint64_t fvm_bytes;
+    uint64_t fvm_retired_bytes;
+};
+
+/* Number of addresses walked down the mtrie together by the burst lookups */
+#define VR_INET_LOOKUP_BURST_MAX    32
+
+/* what the burst lookups resolve an address to */
+struct vr_route_result {
+    struct vr_nexthop *rr_nh;
+    uint32_t rr_label;
+    uint32_t rr_index;
+    uint16_t rr_label_flags;
+    uint8_t rr_prefix_len;
 };
 
 extern int vr_fib_init(struct vrouter *);
@@ -114,6 +156,12 @@ extern int vr_fib_mem(struct vrouter *);
 extern void vr_fib_exit(struct vrouter *, bool);
 extern int vr_route_add(vr_route_req *);
 extern struct vr_nexthop *vr_inet_route_lookup(unsigned int, struct vr_route_req *);
+extern void vr_inet_route_lookup_burst(unsigned int, uint32_t *,
+        struct vr_route_result *, unsigned int);
+extern unsigned int vr_inet_route_prefetch_burst(struct vr_interface *,
+        struct vr_packet **, unsigned int);
+extern int vr_inet_fib_vrf_mem(unsigned int, unsigned int,
+        struct vr_fib_vrf_mem *);
 extern int bridge_entry_add(struct rtable_fspec *, struct vr_route_req *);
 
 int vr_nexthop_update_offload_vrfstats(uint32_t , uint32_t, uint64_t *);
@@ -111,6 +111,7 @@ enum vr_malloc_objects_t {
     VR_MTRIE_BUCKET_OBJECT,
     VR_MTRIE_STATS_OBJECT,
     VR_MTRIE_TABLE_OBJECT,
+    VR_MTRIE_LEAF_OBJECT,
     VR_NETWORK_ADDRESS_OBJECT,
     VR_NEXTHOP_OBJECT,
     VR_NEXTHOP_COMPONENT_OBJECT,
@@ -134,6 +135,8 @@ enum vr_malloc_objects_t {
     VR_VRF_TABLE_ENTRY_OBJECT,
     VR_VRF_TABLE_OBJECT,
     VR_INFO_REQ_OBJECT,
+    VR_DST_CACHE_OBJECT,
+    VR_BRIDGE_LEARN_OBJECT,
     VR_VROUTER_MAX_OBJECT,
 };
 
@@ -187,6 +190,7 @@ struct host_os {
     struct vr_packet *(*hos_pexpand_head)(struct vr_packet *, unsigned int);
     void (*hos_pfree)(struct vr_packet *, unsigned short);
     struct vr_packet *(*hos_pclone)(struct vr_packet *);
+    struct vr_packet *(*hos_pclone_head)(struct vr_packet *, unsigned short);
     void (*hos_preset)(struct vr_packet *);
     int (*hos_pcopy)(unsigned char *, struct vr_packet *, unsigned int,
             unsigned int);
@@ -196,6 +200,13 @@ struct host_os {
     unsigned int (*hos_pgso_size)(struct vr_packet *);
 
     unsigned int (*hos_get_cpu)(void);
+    /*
+     * Bracket the use of per cpu state that only its cpu changes, and
+     * without atomics, on hosts where the datapath can be preempted on
+     * its cpu by the datapath itself. Optional.
+     */
+    unsigned int (*hos_get_cpu_local)(void);
+    void (*hos_put_cpu_local)(void);
     int (*hos_schedule_work)(unsigned int, void (*)(void *), void *);
     void (*hos_delay_op)(void);
     void (*hos_defer)(struct vrouter *, vr_defer_cb, void *);
@@ -243,13 +254,12 @@ struct host_os {
     bool hos_nl_broadcast_supported;
     int (*hos_huge_page_config)(uint64_t *, int, int *, int, int *, int, int8_t *, uint32_t *);
     void *(*hos_huge_page_mem_get)(int, unsigned char **);
+    int (*hos_table_mem_reserve)(void *, unsigned long);
     int (*hos_offload_flow_create)(struct vr_offload_flow *oflow);
     int (*hos_offload_flow_destroy)(struct vr_offload_flow *oflow);
     void (*hos_offload_prepare)(struct vr_packet *pkt, struct vr_forwarding_md *fmd);
     void (*hos_set_dump_packets)(int);
     int (*hos_get_dump_packets)(void);
-    void (*hos_flow_bucket_lock)(struct vr_flow_entry *);
-    void (*hos_flow_bucket_unlock)(struct vr_flow_entry *);
     /* Register vr_info callback functions. */
     FOREACH_VR_INFO_CB_DECLARATION();
 };
@@ -276,6 +286,7 @@ FOREACH_VR_INFO_DECLARATION_COMMON()
 #define vr_pexpand_head                 vrouter_host->hos_pexpand_head
 #define vr_pfree                        vrouter_host->hos_pfree
 #define vr_pclone                       vrouter_host->hos_pclone
+#define vr_pclone_head                  vrouter_host->hos_pclone_head
 #define vr_preset                       vrouter_host->hos_preset
 #define vr_pcopy                        vrouter_host->hos_pcopy
 #define vr_pfrag_len                    vrouter_host->hos_pfrag_len
@@ -315,16 +326,33 @@ FOREACH_VR_INFO_DECLARATION_COMMON()
 #define vr_nl_broadcast_supported       vrouter_host->hos_nl_broadcast_supported
 #define vr_huge_page_config             vrouter_host->hos_huge_page_config
 #define vr_huge_page_mem_get            vrouter_host->hos_huge_page_mem_get
+#define vr_table_mem_reserve            vrouter_host->hos_table_mem_reserve
 #define vr_offload_flow_destroy         vrouter_host->hos_offload_flow_destroy
 #define vr_offload_flow_create          vrouter_host->hos_offload_flow_create
 #define vr_offload_prepare              vrouter_host->hos_offload_prepare
 #define vr_set_dump_packets             vrouter_host->hos_set_dump_packets
 #define vr_get_dump_packets             vrouter_host->hos_get_dump_packets
-#define vr_flow_bucket_lock             vrouter_host->hos_flow_bucket_lock
-#define vr_flow_bucket_unlock           vrouter_host->hos_flow_bucket_unlock
 
 extern struct host_os *vrouter_host;
 
+static inline unsigned int
+vr_get_cpu_local(void)
+{
+    if (vrouter_host->hos_get_cpu_local)
+        return vrouter_host->hos_get_cpu_local();
+
+    return vr_get_cpu();
+}
+
+static inline void
+vr_put_cpu_local(void)
+{
+    if (vrouter_host->hos_put_cpu_local)
+        vrouter_host->hos_put_cpu_local();
+
+    return;
+}
+
 struct vr_malloc_stats {
     int64_t ms_size;
     int64_t ms_alloc;
@@ -335,6 +363,13 @@ struct vr_malloc_stats {
 
 extern unsigned int vr_memory_alloc_checks;
 
+#define VR_WARM_RESTART_DEF_WINDOW  60
+
+extern unsigned int vr_warm_restart;
+extern unsigned int vr_warm_restart_window;
+extern unsigned int vr_flow_table_restored;
+extern unsigned int vr_bridge_table_restored;
+
 __attribute__packed__open__
 struct vr_malloc_md {
     char vmm_magic[3];
@@ -400,6 +435,12 @@ struct vrouter {
     vr_htable_t vr_flow_table;
     struct vr_flow_table_info *vr_flow_table_info;
     unsigned int vr_flow_table_info_size;
+    struct vr_flow_aging *vr_flow_aging;
+    struct vr_flow_log *vr_flow_log;
+    struct vr_flow_restore *vr_flow_restore;
+    struct vr_flow_hold_pool *vr_flow_hold_pool;
+    struct vr_btable *vr_flow_rpf;
+    struct vr_btable *vr_flow_last_seen;
 
     unsigned int vr_max_labels;
     struct vr_btable *vr_ilm;
@@ -17,9 +17,10 @@
 
 #include "vrouter.h"
 #include "vr_mem.h"
+#include "vr_flow_log.h"
 
 #define MEM_DEV_MINOR_START         0
-#define MEM_DEV_NUM_DEVS            2
+#define MEM_DEV_NUM_DEVS            3
 
 void vr_shmem_exit(void);
 int vr_shmem_init(void);
@@ -339,6 +340,10 @@ mem_fault(struct vm_fault *vmf)
         va = vr_bridge_get_va(router, offset << PAGE_SHIFT);
         break;
 
+    case VR_MEM_FLOW_LOG_OBJECT:
+        va = vr_flow_log_get_va(router, offset << PAGE_SHIFT);
+        break;
+
     default:
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4,18,0))
         return -EFAULT;
@@ -379,6 +384,10 @@ mem_dev_mmap(struct file *fp, struct vm_area_struct *vma)
         table_size = vr_bridge_table_size(router);
         break;
 
+    case VR_MEM_FLOW_LOG_OBJECT:
+        table_size = vr_flow_log_size(router);
+        break;
+
     default:
         return -EINVAL;
     }
@@ -31,6 +31,9 @@
 #include "vr_bridge.h"
 #include "vr_packet.h"
 #include "vr_flow.h"
+#include "vr_flow_log.h"
+#include "vr_ip6_fib.h"
+#include "vr_dst_cache.h"
 #include "vr_buildinfo.h"
 #include "vr_mem.h"
 
@@ -38,6 +41,7 @@ unsigned int vr_num_cpus = 1;
 
 extern unsigned int vr_bridge_entries;
 extern unsigned int vr_bridge_oentries;
+extern unsigned int vr_bridge_learn_rate;
 extern unsigned int vr_mpls_labels;
 extern unsigned int vr_nexthops;
 extern unsigned int vr_vrfs;
@@ -333,6 +337,46 @@ lh_pclone(struct vr_packet *pkt)
     return pkt_clone;
 }
 
+/*
+ * a copy of the packet with headers of its own, and head_room more room in
+ * front of them, that shares the paged data with the packet
+ */
+static struct vr_packet *
+lh_pclone_head(struct vr_packet *pkt, unsigned short head_room)
+{
+    int data_off;
+    struct sk_buff *skb, *skb_c;
+    struct vr_packet *pkt_c;
+
+    skb = vp_os_packet(pkt);
+    /* what was pushed in front of skb->data has to be in the copy too */
+    skb->data = pkt->vp_head + pkt->vp_data;
+    skb->len = (skb_tail_pointer(skb) - skb->data) + skb->data_len;
+
+    skb_c = pskb_copy(skb, GFP_ATOMIC);
+    if (!skb_c)
+        return NULL;
+
+    /* the head of the copy is not shared, and grows without the data */
+    if (skb_cow_head(skb_c, head_room)) {
+        kfree_skb(skb_c);
+        return NULL;
+    }
+
+    pkt_c = (struct vr_packet *)skb_c->cb;
+    pkt_c->vp_cpu = vr_get_cpu();
+    pkt_c->vp_head = skb_c->head;
+    pkt_c->vp_data = skb_c->data - skb_c->head;
+    pkt_c->vp_tail = skb_tail_pointer(skb_c) - skb_c->head;
+    pkt_c->vp_end = skb_end_pointer(skb_c) - skb_c->head;
+
+    data_off = pkt_c->vp_data - pkt->vp_data;
+    pkt_c->vp_network_h += data_off;
+    pkt_c->vp_inner_network_h += data_off;
+
+    return pkt_c;
+}
+
 
 static void
 lh_preset(struct vr_packet *pkt)
@@ -443,6 +487,27 @@ lh_get_cpu(void)
     return cpu;
 }
 
+/*
+ * The datapath also runs from process context (lh_work), with the bottom
+ * halves enabled, where the softirq datapath can preempt it on the same
+ * cpu. Keeping the bottom halves off also keeps the task on the cpu.
+ */
+static unsigned int
+lh_get_cpu_local(void)
+{
+    local_bh_disable();
+
+    return smp_processor_id();
+}
+
+static void
+lh_put_cpu_local(void)
+{
+    local_bh_enable();
+
+    return;
+}
+
 void
 lh_pfree_skb(struct sk_buff *skb, struct vr_interface *vif,
              unsigned short reason)
@@ -2320,6 +2385,7 @@ struct host_os linux_host = {
     .hos_pexpand_head               =       lh_pexpand_head,
     .hos_preset                     =       lh_preset,
     .hos_pclone                     =       lh_pclone,
+    .hos_pclone_head                =       lh_pclone_head,
     .hos_pcopy                      =       lh_pcopy,
     .hos_pfrag_len                  =       lh_pfrag_len,
     .hos_phead_len                  =       lh_phead_len,
@@ -2327,6 +2393,8 @@ struct host_os linux_host = {
     .hos_pgso_size                  =       lh_pgso_size,
 
     .hos_get_cpu                    =       lh_get_cpu,
+    .hos_get_cpu_local              =       lh_get_cpu_local,
+    .hos_put_cpu_local              =       lh_put_cpu_local,
     .hos_schedule_work              =       lh_schedule_work,
     .hos_delay_op                   =       lh_delay_op,
     .hos_defer                      =       lh_defer,
@@ -2665,11 +2733,39 @@ module_param(vr_flow_entries, uint, S_IRUGO);
 MODULE_PARM_DESC(vr_flow_entries, "Number of entries in the flow table. Default is "__stringify(VR_DEF_FLOW_ENTRIES));
 module_param(vr_oflow_entries, uint, S_IRUGO);
 MODULE_PARM_DESC(vr_oflow_entries, "Number of overflow entries in the flow table.");
+module_param(vr_oflow_entries_max, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_oflow_entries_max, "Number of overflow entries the flow table may grow to while in use. Default is 0 (no growth)");
+module_param(vr_flow_aging_timeout, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_aging_timeout, "Seconds a flow has to be idle for to be aged by the datapath. Default is 0 (aging left to the agent)");
+module_param(vr_flow_rpf_cache, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_rpf_cache, "Remember the source validation results of the flows with ECMP sources. Default is 0");
+module_param(vr_flow_flowlet, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_flowlet, "Keep the last seen times of flows, for ECMP composites to move idle flows between members. Default is 0");
+module_param(vr_flow_log_records, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_log_records, "Records in each ring of the flow statistics change log. Default is 0 (no log)");
+module_param(vr_flow_log_threshold, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_log_threshold, "Packets of a flow between two records in the flow statistics change log. Default is 64");
+module_param(vr_flow_hold_queue_len, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_hold_queue_len, "Packets a flow in hold can hold. Default is "__stringify(VR_DEF_FLOW_QUEUE_ENTRIES)", at most "__stringify(VR_MAX_FLOW_QUEUE_ENTRIES));
+module_param(vr_flow_hold_pool_nodes, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_hold_pool_nodes, "Held packets each cpu has room for. Default is "__stringify(VR_DEF_FLOW_HOLD_POOL_NODES));
+module_param(vr_flow_hold_pool_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_flow_hold_pool_queues, "Flows in hold each cpu has queues for. Default is "__stringify(VR_DEF_FLOW_HOLD_POOL_QUEUES));
 
 module_param(vr_bridge_entries, uint, S_IRUGO);
 MODULE_PARM_DESC(vr_bridge_entries, "Number of entries in the bridge table. Default is "__stringify(VR_DEF_BRIDGE_ENTRIES));
 module_param(vr_bridge_oentries, uint, S_IRUGO);
 MODULE_PARM_DESC(vr_bridge_oentries, "Number of overflow entries in the bridge table.");
+module_param(vr_bridge_learn_rate, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_bridge_learn_rate, "MACs learnt per interface per second by a timer rather than by the packet path. Default is 0 (learnt by the packet path)");
+module_param(vr_ip6_fib_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_ip6_fib_entries, "Number of entries in the IPv6 forwarding table. Default is "__stringify(VR_DEF_IP6_FIB_ENTRIES)", 0 to look IPv6 routes up in the mtrie only");
+module_param(vr_ip6_fib_oentries, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_ip6_fib_oentries, "Number of overflow entries in the IPv6 forwarding table. Default is "__stringify(VR_DEF_IP6_FIB_OENTRIES));
+module_param(vr_dst_cache_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_dst_cache_entries, "Number of entries in the route lookup cache of each cpu, a power of 2. Default is "__stringify(VR_DEF_DST_CACHE_ENTRIES)", 0 to disable");
+module_param(vr_ecmp_table_size, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_ecmp_table_size, "Buckets of the resilient member table of each ECMP nexthop, rounded up to a prime, at most "__stringify(NH_ECMP_TABLE_MAX_SIZE)". Default is 0 (members picked by the hash modulo their number)");
 
 module_param(vif_bridge_entries, uint, S_IRUGO);
 MODULE_PARM_DESC(vif_bridge_entries, "Number of entries in the per interface bridge table. Default is "__stringify(VIF_BRIDGE_ENTRIES));
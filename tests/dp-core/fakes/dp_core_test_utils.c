@@ -0,0 +1,154 @@
+/*
+ * dp_core_test_utils.c -- requests and fixtures shared by the dp-core
+ * unit tests
+ *
+ * The requests are built the way the agent sends them and handed to the
+ * same handlers the sandesh layer calls.
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <string.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_nexthop.h"
+#include "vr_bridge.h"
+#include "vr_route.h"
+#include "vr_packet.h"
+#include "vr_flow.h"
+
+#include "dp_core_test_utils.h"
+
+extern int vr_route_delete(vr_route_req *);
+extern void vr_flow_req_process(void *);
+extern struct vr_flow_entry *vr_find_flow(struct vrouter *, struct vr_flow *,
+        uint8_t, unsigned int *);
+
+void
+dp_test_nexthop_req_fill(vr_nexthop_req *req, int id, int type,
+        unsigned short family, int flags)
+{
+    memset(req, 0, sizeof(*req));
+    req->h_op = SANDESH_OP_ADD;
+    req->nhr_id = id;
+    req->nhr_type = type;
+    req->nhr_family = family;
+    req->nhr_flags = NH_FLAG_VALID | flags;
+
+    return;
+}
+
+int
+dp_test_discard_nexthop_add(int id, unsigned short family)
+{
+    vr_nexthop_req req;
+
+    dp_test_nexthop_req_fill(&req, id, NH_DISCARD, family, 0);
+    return vr_nexthop_add(&req);
+}
+
+void
+dp_test_bridge_req_fill(vr_route_req *req, unsigned int vrf, uint8_t *mac,
+        int nh_id)
+{
+    memset(req, 0, sizeof(*req));
+    req->h_op = SANDESH_OP_ADD;
+    req->rtr_family = AF_BRIDGE;
+    req->rtr_vrf_id = vrf;
+    req->rtr_mac = (int8_t *)mac;
+    req->rtr_mac_size = VR_ETHER_ALEN;
+    req->rtr_nh_id = nh_id;
+    req->rtr_index = VR_BE_INVALID_INDEX;
+
+    return;
+}
+
+int
+dp_test_bridge_add(unsigned int vrf, uint8_t *mac, int nh_id)
+{
+    vr_route_req req;
+
+    dp_test_bridge_req_fill(&req, vrf, mac, nh_id);
+    return vr_route_add(&req);
+}
+
+int
+dp_test_bridge_delete(unsigned int vrf, uint8_t *mac, int nh_id)
+{
+    vr_route_req req;
+
+    dp_test_bridge_req_fill(&req, vrf, mac, nh_id);
+    req.h_op = SANDESH_OP_DEL;
+    return vr_route_delete(&req);
+}
+
+void
+dp_test_flow_req_fill(vr_flow_req *req, int nh_id, uint32_t sip,
+        uint32_t dip, uint8_t proto, uint16_t sport, uint16_t dport)
+{
+    memset(req, 0, sizeof(*req));
+    req->fr_op = FLOW_OP_FLOW_SET;
+    req->fr_index = -1;
+    req->fr_rindex = -1;
+    req->fr_flags = VR_FLOW_FLAG_ACTIVE;
+    req->fr_family = AF_INET;
+    req->fr_flow_sip_l = sip;
+    req->fr_flow_dip_l = dip;
+    req->fr_flow_proto = proto;
+    req->fr_flow_sport = sport;
+    req->fr_flow_dport = dport;
+    req->fr_flow_nh_id = nh_id;
+    req->fr_action = VR_FLOW_ACTION_FORWARD;
+    req->fr_ecmp_nh_index = -1;
+    req->fr_src_nh_index = -1;
+    req->fr_underlay_ecmp_index = -1;
+
+    return;
+}
+
+void
+dp_test_flow_add(int nh_id, uint32_t sip, uint32_t dip, uint8_t proto,
+        uint16_t sport, uint16_t dport)
+{
+    vr_flow_req req;
+
+    dp_test_flow_req_fill(&req, nh_id, sip, dip, proto, sport, dport);
+    vr_flow_req_process(&req);
+
+    return;
+}
+
+struct vr_flow_entry *
+dp_test_flow_find(int nh_id, uint32_t sip, uint32_t dip, uint8_t proto,
+        uint16_t sport, uint16_t dport, unsigned int *index)
+{
+    struct vr_flow key;
+
+    vr_inet_fill_flow(&key, nh_id, sip, dip, proto, sport, dport,
+            VR_FLOW_KEY_ALL);
+
+    return vr_find_flow(vrouter_get(0), &key, VP_TYPE_IP, index);
+}
+
+int
+dp_test_vrouter_init(int discard_nh_id, unsigned short family)
+{
+    int ret;
+
+    ret = vrouter_init();
+    if (ret)
+        return ret;
+
+    if (discard_nh_id == -1)
+        return 0;
+
+    return dp_test_discard_nexthop_add(discard_nh_id, family);
+}
+
+int
+dp_test_vrouter_exit(void **state)
+{
+    vrouter_exit(false);
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * dp_core_test_utils.h -- requests and fixtures shared by the dp-core
+ * unit tests
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#ifndef __DP_CORE_TEST_UTILS_H__
+#define __DP_CORE_TEST_UTILS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_flow.h"
+
+/* a valid nexthop add request of 'type', with no encap or members */
+void dp_test_nexthop_req_fill(vr_nexthop_req *req, int id, int type,
+        unsigned short family, int flags);
+int dp_test_discard_nexthop_add(int id, unsigned short family);
+
+/* a bridge route add request of 'mac' in 'vrf', to nexthop 'nh_id' */
+void dp_test_bridge_req_fill(vr_route_req *req, unsigned int vrf,
+        uint8_t *mac, int nh_id);
+int dp_test_bridge_add(unsigned int vrf, uint8_t *mac, int nh_id);
+int dp_test_bridge_delete(unsigned int vrf, uint8_t *mac, int nh_id);
+
+/* a forwarding flow set request of an IPv4 5-tuple behind 'nh_id' */
+void dp_test_flow_req_fill(vr_flow_req *req, int nh_id, uint32_t sip,
+        uint32_t dip, uint8_t proto, uint16_t sport, uint16_t dport);
+void dp_test_flow_add(int nh_id, uint32_t sip, uint32_t dip, uint8_t proto,
+        uint16_t sport, uint16_t dport);
+struct vr_flow_entry *dp_test_flow_find(int nh_id, uint32_t sip,
+        uint32_t dip, uint8_t proto, uint16_t sport, uint16_t dport,
+        unsigned int *index);
+
+/*
+ * brings up router 0 with the table sizes the test has set and, for a
+ * 'discard_nh_id' other than -1, adds a discard nexthop of 'family'
+ */
+int dp_test_vrouter_init(int discard_nh_id, unsigned short family);
+/* tears router 0 down. Fits as a cmocka setup or teardown */
+int dp_test_vrouter_exit(void **state);
+
+#endif /* __DP_CORE_TEST_UTILS_H__ */
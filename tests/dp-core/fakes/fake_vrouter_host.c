@@ -0,0 +1,318 @@
+/*
+ * fake_vrouter_host.c -- a host for running dp-core in unit tests
+ *
+ * Memory comes from libc, work and deferred callbacks run at once on the
+ * calling thread, and timers never fire. There are no packets, and
+ * interfaces only exist in dp-core.
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_interface.h"
+
+#include "fake_vrouter_host.h"
+
+#define FAKE_PAGE_SIZE      4096
+
+unsigned int vr_num_cpus = FAKE_VROUTER_HOST_CPUS;
+const char *ContrailBuildInfo = "{\"build-info\": [{\"build-version\": \"test\"}]}";
+
+static __thread unsigned int fake_cpu;
+static bool fake_table_mem_reserve_fails;
+
+void
+fake_vrouter_host_set_cpu(unsigned int cpu)
+{
+    fake_cpu = cpu % vr_num_cpus;
+    return;
+}
+
+void
+fake_vrouter_host_fail_table_mem_reserve(bool fail)
+{
+    fake_table_mem_reserve_fails = fail;
+    return;
+}
+
+static int
+fake_printf(const char *format, ...)
+{
+    return 0;
+}
+
+static void *
+fake_malloc(unsigned int size, unsigned int object)
+{
+    return malloc(size);
+}
+
+static void *
+fake_zalloc(unsigned int size, unsigned int object)
+{
+    return calloc(size, 1);
+}
+
+static void
+fake_free(void *mem, unsigned int object)
+{
+    if (mem)
+        free(mem);
+    return;
+}
+
+static uint64_t
+fake_vtop(void *address)
+{
+    return (uint64_t)(uintptr_t)address;
+}
+
+static void *
+fake_page_alloc(unsigned int size)
+{
+    void *mem;
+
+    size = (size + FAKE_PAGE_SIZE - 1) & ~(FAKE_PAGE_SIZE - 1);
+    mem = aligned_alloc(FAKE_PAGE_SIZE, size);
+    if (mem)
+        memset(mem, 0, size);
+
+    return mem;
+}
+
+static void
+fake_page_free(void *address, unsigned int size)
+{
+    if (address)
+        free(address);
+    return;
+}
+
+static unsigned int
+fake_get_cpu(void)
+{
+    return fake_cpu;
+}
+
+static int
+fake_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
+{
+    fn(arg);
+    return 0;
+}
+
+static void
+fake_delay_op(void)
+{
+    return;
+}
+
+static void
+fake_defer(struct vrouter *router, vr_defer_cb user_cb, void *data)
+{
+    user_cb(router, data);
+    free(data);
+    return;
+}
+
+static void *
+fake_get_defer_data(unsigned int len)
+{
+    if (!len)
+        return NULL;
+
+    return malloc(len);
+}
+
+static void
+fake_put_defer_data(void *data)
+{
+    if (data)
+        free(data);
+    return;
+}
+
+static void
+fake_get_time(uint64_t *sec, uint64_t *usec)
+{
+    struct timespec ts;
+
+    *sec = *usec = 0;
+    if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+        return;
+
+    *sec = ts.tv_sec;
+    *usec = ts.tv_nsec / 1000;
+
+    return;
+}
+
+static void
+fake_get_mono_time(uint64_t *sec, uint64_t *nsec)
+{
+    struct timespec ts;
+
+    *sec = *nsec = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return;
+
+    *sec = ts.tv_sec;
+    *nsec = ts.tv_nsec;
+
+    return;
+}
+
+static int
+fake_create_timer(struct vr_timer *vtimer)
+{
+    return 0;
+}
+
+static int
+fake_restart_timer(struct vr_timer *vtimer)
+{
+    return 0;
+}
+
+static void
+fake_delete_timer(struct vr_timer *vtimer)
+{
+    return;
+}
+
+static int
+fake_table_mem_reserve(void *mem, unsigned long len)
+{
+    if (fake_table_mem_reserve_fails)
+        return -ENOMEM;
+
+    return 0;
+}
+
+static void
+fake_register_nic(struct vr_interface *vif, vr_interface_req *vifr)
+{
+    return;
+}
+
+static struct host_os fake_host = {
+    .hos_printf             =       fake_printf,
+    .hos_malloc             =       fake_malloc,
+    .hos_zalloc             =       fake_zalloc,
+    .hos_free               =       fake_free,
+    .hos_vtop               =       fake_vtop,
+    .hos_page_alloc         =       fake_page_alloc,
+    .hos_page_free          =       fake_page_free,
+
+    .hos_get_cpu            =       fake_get_cpu,
+    .hos_schedule_work      =       fake_schedule_work,
+    .hos_delay_op           =       fake_delay_op,
+    .hos_defer              =       fake_defer,
+    .hos_get_defer_data     =       fake_get_defer_data,
+    .hos_put_defer_data     =       fake_put_defer_data,
+    .hos_get_time           =       fake_get_time,
+    .hos_get_mono_time      =       fake_get_mono_time,
+    .hos_create_timer       =       fake_create_timer,
+    .hos_restart_timer      =       fake_restart_timer,
+    .hos_delete_timer       =       fake_delete_timer,
+    .hos_table_mem_reserve  =       fake_table_mem_reserve,
+    .hos_register_nic       =       fake_register_nic,
+};
+
+struct host_os *
+vrouter_get_host(void)
+{
+    return &fake_host;
+}
+
+static int
+fake_hif_add(struct vr_interface *vif)
+{
+    return 0;
+}
+
+static int
+fake_hif_del(struct vr_interface *vif)
+{
+    return 0;
+}
+
+static int
+fake_hif_add_tap(struct vr_interface *vif, vr_interface_req *vifr)
+{
+    return 0;
+}
+
+static int
+fake_hif_del_tap(struct vr_interface *vif)
+{
+    return 0;
+}
+
+static int
+fake_hif_get_settings(struct vr_interface *vif,
+        struct vr_interface_settings *settings)
+{
+    return -EINVAL;
+}
+
+static unsigned int
+fake_hif_get_mtu(struct vr_interface *vif)
+{
+    return vif->vif_mtu;
+}
+
+static unsigned short
+fake_hif_get_encap(struct vr_interface *vif)
+{
+    return VIF_ENCAP_TYPE_ETHER;
+}
+
+/* interfaces can be added, but never get packets */
+static struct vr_host_interface_ops fake_hif_ops = {
+    .hif_add                =       fake_hif_add,
+    .hif_del                =       fake_hif_del,
+    .hif_add_tap            =       fake_hif_add_tap,
+    .hif_del_tap            =       fake_hif_del_tap,
+    .hif_get_settings       =       fake_hif_get_settings,
+    .hif_get_mtu            =       fake_hif_get_mtu,
+    .hif_get_encap          =       fake_hif_get_encap,
+};
+
+struct vr_host_interface_ops *
+vr_host_interface_init(void)
+{
+    return &fake_hif_ops;
+}
+
+void
+vr_host_interface_exit(void)
+{
+    return;
+}
+
+void
+vr_host_vif_init(struct vrouter *router)
+{
+    return;
+}
+
+void
+vhost_remove_xconnect(void)
+{
+    return;
+}
+
+void
+get_random_bytes(void *buf, int nbytes)
+{
+    memset(buf, 0, nbytes);
+    return;
+}
@@ -0,0 +1,18 @@
+/*
+ * fake_vrouter_host.h -- a host for running dp-core in unit tests
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#ifndef __FAKE_VROUTER_HOST_H__
+#define __FAKE_VROUTER_HOST_H__
+
+#include <stdbool.h>
+
+#define FAKE_VROUTER_HOST_CPUS      4
+
+/* the cpu vr_get_cpu() returns to the calling thread */
+void fake_vrouter_host_set_cpu(unsigned int cpu);
+/* makes hos_table_mem_reserve fail, as a host out of pages would */
+void fake_vrouter_host_fail_table_mem_reserve(bool fail);
+
+#endif /* __FAKE_VROUTER_HOST_H__ */
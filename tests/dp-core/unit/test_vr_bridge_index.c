@@ -0,0 +1,189 @@
+/*
+ * test_vr_bridge_index.c -- lookups through the bridge table index
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_nexthop.h"
+#include "vr_bridge.h"
+#include "vr_hash.h"
+
+#include "fake_vrouter_host.h"
+#include "dp_core_test_utils.h"
+
+#include <cmocka.h>
+
+#define GROUP_NAME "vr_bridge_index"
+
+#define BRIDGE_TEST_ENTRIES     1024
+#define BRIDGE_TEST_NH_ID       10
+
+extern unsigned int vr_bridge_entries;
+extern struct vr_bridge_entry *vr_find_bridge_entry(struct vr_bridge_entry_key *);
+extern struct vr_bridge_entry *vr_find_free_bridge_entry(unsigned int, char *);
+
+static uint8_t bridge_test_zero_mac[VR_ETHER_ALEN];
+
+static void
+bridge_test_mac(uint8_t *mac, unsigned int i)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    mac[2] = 0x00;
+    mac[3] = (i >> 16) & 0xff;
+    mac[4] = (i >> 8) & 0xff;
+    mac[5] = i & 0xff;
+
+    return;
+}
+
+static struct vr_bridge_entry *
+bridge_test_find(unsigned int vrf, uint8_t *mac)
+{
+    struct vr_bridge_entry_key key;
+
+    memset(&key, 0, sizeof(key));
+    VR_MAC_COPY(key.be_mac, mac);
+    key.be_vrf_id = vrf;
+
+    return vr_find_bridge_entry(&key);
+}
+
+/* a mac of vrf 0 whose key hashes to the bucket of the zero key */
+static void
+bridge_test_zero_bucket_mac(uint8_t *mac)
+{
+    unsigned int i, zero_bucket;
+    struct vr_bridge_entry_key key;
+
+    memset(&key, 0, sizeof(key));
+    zero_bucket = (vr_hash(&key, sizeof(key), 0) % vr_bridge_entries) /
+        VR_HENTRIES_PER_BUCKET;
+
+    for (i = 1; ; i++) {
+        bridge_test_mac(key.be_mac, i);
+        if (((vr_hash(&key, sizeof(key), 0) % vr_bridge_entries) /
+                    VR_HENTRIES_PER_BUCKET) == zero_bucket)
+            break;
+    }
+
+    VR_MAC_COPY(mac, key.be_mac);
+    return;
+}
+
+static int
+bridge_test_group_setup(void **state)
+{
+    vr_bridge_entries = BRIDGE_TEST_ENTRIES;
+
+    return dp_test_vrouter_init(BRIDGE_TEST_NH_ID, AF_BRIDGE);
+}
+
+static void
+test_bridge_index_misses_the_zero_key_of_an_empty_table(void **state)
+{
+    /* GIVEN an empty bridge table, whose index slots all hold key 0 */
+
+    /* WHEN vrf 0 and the zero mac are looked up */
+
+    /* THEN nothing is found */
+    assert_null(bridge_test_find(0, bridge_test_zero_mac));
+    assert_null(vr_bridge_lookup_fast(0, bridge_test_zero_mac));
+}
+
+static void
+test_bridge_index_misses_the_zero_key_during_an_add(void **state)
+{
+    uint8_t mac[VR_ETHER_ALEN];
+    struct vr_bridge_entry *be;
+
+    /*
+     * GIVEN an entry being added to the bucket of the zero key, claimed
+     * and keyed, but whose index slot still holds key 0
+     */
+    bridge_test_zero_bucket_mac(mac);
+    be = vr_find_free_bridge_entry(0, (char *)mac);
+    assert_non_null(be);
+    VR_MAC_COPY(be->be_key.be_mac, mac);
+    be->be_key.be_vrf_id = 0;
+    be->be_flags = VR_BE_VALID_FLAG;
+
+    /* WHEN vrf 0 and the zero mac are looked up */
+
+    /* THEN the entry is not taken for theirs */
+    assert_null(bridge_test_find(0, bridge_test_zero_mac));
+    assert_null(vr_bridge_lookup_fast(0, bridge_test_zero_mac));
+
+    /* AND its own key finds it */
+    assert_ptr_equal(bridge_test_find(0, mac), be);
+
+    dp_test_bridge_delete(0, mac, BRIDGE_TEST_NH_ID);
+}
+
+static void
+test_bridge_index_finds_an_entry(void **state)
+{
+    uint8_t mac[VR_ETHER_ALEN];
+    struct vr_bridge_entry *be;
+    struct vr_nexthop *nh;
+
+    /* GIVEN an entry */
+    bridge_test_mac(mac, 1);
+    dp_test_bridge_add(1, mac, BRIDGE_TEST_NH_ID);
+
+    /* WHEN its key is looked up */
+    be = bridge_test_find(1, mac);
+    nh = vr_bridge_lookup_fast(1, mac);
+
+    /* THEN the entry and its nexthop are found */
+    assert_non_null(be);
+    assert_memory_equal(be->be_key.be_mac, mac, VR_ETHER_ALEN);
+    assert_int_equal(be->be_key.be_vrf_id, 1);
+    assert_non_null(nh);
+    assert_int_equal(nh->nh_id, BRIDGE_TEST_NH_ID);
+
+    /* AND not under another vrf */
+    assert_null(bridge_test_find(2, mac));
+    assert_null(vr_bridge_lookup_fast(2, mac));
+
+    dp_test_bridge_delete(1, mac, BRIDGE_TEST_NH_ID);
+}
+
+static void
+test_bridge_index_misses_a_deleted_entry(void **state)
+{
+    uint8_t mac[VR_ETHER_ALEN];
+
+    /* GIVEN an entry */
+    bridge_test_mac(mac, 2);
+    dp_test_bridge_add(1, mac, BRIDGE_TEST_NH_ID);
+    assert_non_null(bridge_test_find(1, mac));
+
+    /* WHEN it is deleted */
+    dp_test_bridge_delete(1, mac, BRIDGE_TEST_NH_ID);
+
+    /* THEN it is not found any more */
+    assert_null(bridge_test_find(1, mac));
+    assert_null(vr_bridge_lookup_fast(1, mac));
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_bridge_index_misses_the_zero_key_of_an_empty_table),
+        cmocka_unit_test(test_bridge_index_misses_the_zero_key_during_an_add),
+        cmocka_unit_test(test_bridge_index_finds_an_entry),
+        cmocka_unit_test(test_bridge_index_misses_a_deleted_entry),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests,
+            bridge_test_group_setup, dp_test_vrouter_exit);
+}
@@ -0,0 +1,204 @@
+/*
+ * test_vr_flow_grow.c -- online growth of the flow overflow table
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_packet.h"
+#include "vr_flow.h"
+
+#include "fake_vrouter_host.h"
+#include "dp_core_test_utils.h"
+
+#include <cmocka.h>
+
+#define GROUP_NAME "vr_flow_grow"
+
+#define FLOW_TEST_ENTRIES       1024
+#define FLOW_TEST_OENTRIES      1024
+#define FLOW_TEST_NH_ID         1
+/* more flows than the grown table can take */
+#define FLOW_TEST_FLOWS         (FLOW_TEST_ENTRIES + 4 * FLOW_TEST_OENTRIES)
+
+extern void *vr_oflow_ext_table;
+
+/* the address space a DPDK host maps beyond the overflow table */
+static struct vr_flow_entry flow_test_ext_table[2 * FLOW_TEST_OENTRIES];
+
+static void
+flow_test_add(uint32_t sip)
+{
+    dp_test_flow_add(FLOW_TEST_NH_ID, sip, 0x0a000001, VR_IP_PROTO_UDP,
+            1000, 53);
+    return;
+}
+
+static struct vr_flow_entry *
+flow_test_find(uint32_t sip, unsigned int *index)
+{
+    return dp_test_flow_find(FLOW_TEST_NH_ID, sip, 0x0a000001,
+            VR_IP_PROTO_UDP, 1000, 53, index);
+}
+
+/* adds 'count' flows and returns how many made it into the table */
+static unsigned int
+flow_test_fill(unsigned int count, unsigned int *max_index)
+{
+    unsigned int i, index, added = 0;
+
+    *max_index = 0;
+    for (i = 0; i < count; i++) {
+        flow_test_add(0x0b000000 + i);
+        if (!flow_test_find(0x0b000000 + i, &index))
+            continue;
+
+        added++;
+        if (index > *max_index)
+            *max_index = index;
+    }
+
+    return added;
+}
+
+static unsigned int
+flow_test_resizes(void)
+{
+    return vrouter_get(0)->vr_flow_table_info->vfti_resizes;
+}
+
+static int
+flow_test_setup(void **state)
+{
+    vr_flow_entries = FLOW_TEST_ENTRIES;
+    vr_oflow_entries = FLOW_TEST_OENTRIES;
+
+    return 0;
+}
+
+static int
+flow_test_teardown(void **state)
+{
+    dp_test_vrouter_exit(state);
+
+    vr_oflow_entries_max = 0;
+    vr_oflow_ext_table = NULL;
+    fake_vrouter_host_fail_table_mem_reserve(false);
+
+    return 0;
+}
+
+static void
+test_flow_table_does_not_grow_by_default(void **state)
+{
+    unsigned int added, max_index;
+
+    /* GIVEN no overflow entries limit */
+    assert_int_equal(dp_test_vrouter_init(-1, AF_INET), 0);
+
+    /* WHEN more flows than the table holds are added */
+    added = flow_test_fill(FLOW_TEST_FLOWS, &max_index);
+
+    /* THEN the overflow table keeps its size */
+    assert_int_equal(vr_oflow_entries, FLOW_TEST_OENTRIES);
+    assert_int_equal(flow_test_resizes(), 0);
+    assert_true(added <= FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+    assert_true(max_index < FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+}
+
+static void
+test_flow_table_grows_up_to_its_limit(void **state)
+{
+    unsigned int i, index, added, max_index;
+
+    /* GIVEN room for three times the initial overflow entries */
+    vr_oflow_entries_max = 3 * FLOW_TEST_OENTRIES;
+    assert_int_equal(dp_test_vrouter_init(-1, AF_INET), 0);
+
+    /* WHEN more flows than the grown table holds are added */
+    added = flow_test_fill(FLOW_TEST_FLOWS, &max_index);
+
+    /* THEN the overflow table grew twice, by its initial size */
+    assert_int_equal(vr_oflow_entries, 3 * FLOW_TEST_OENTRIES);
+    assert_int_equal(flow_test_resizes(), 2);
+
+    /* AND the flows took the new entries */
+    assert_true(added > FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+    assert_true(max_index >= FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+    assert_true(max_index < FLOW_TEST_ENTRIES + 3 * FLOW_TEST_OENTRIES);
+
+    /* AND the flows added before the growth are where they were */
+    for (i = 0; i < FLOW_TEST_ENTRIES / 2; i++) {
+        assert_non_null(flow_test_find(0x0b000000 + i, &index));
+        assert_true(index < FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+    }
+}
+
+static void
+test_flow_table_grows_into_the_host_address_space(void **state)
+{
+    unsigned int added, max_index;
+    struct vr_flow_entry *fe;
+
+    /* GIVEN a host that maps the space to grow into */
+    vr_oflow_entries_max = 2 * FLOW_TEST_OENTRIES;
+    vr_oflow_ext_table = flow_test_ext_table;
+    assert_int_equal(dp_test_vrouter_init(-1, AF_INET), 0);
+
+    /* WHEN the overflow table fills up */
+    added = flow_test_fill(FLOW_TEST_FLOWS, &max_index);
+
+    /* THEN it grows into that space */
+    assert_int_equal(vr_oflow_entries, 2 * FLOW_TEST_OENTRIES);
+    assert_int_equal(flow_test_resizes(), 1);
+    assert_true(added > FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+
+    fe = vr_flow_get_entry(vrouter_get(0),
+            FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+    assert_ptr_equal(fe, &flow_test_ext_table[0]);
+}
+
+static void
+test_flow_table_gives_up_growth_without_pages(void **state)
+{
+    unsigned int added, max_index;
+
+    /* GIVEN a host out of pages for the space to grow into */
+    vr_oflow_entries_max = 2 * FLOW_TEST_OENTRIES;
+    vr_oflow_ext_table = flow_test_ext_table;
+    fake_vrouter_host_fail_table_mem_reserve(true);
+    assert_int_equal(dp_test_vrouter_init(-1, AF_INET), 0);
+
+    /* WHEN the overflow table fills up */
+    added = flow_test_fill(FLOW_TEST_FLOWS, &max_index);
+
+    /* THEN it keeps its size, and stops trying to grow */
+    assert_int_equal(vr_oflow_entries, FLOW_TEST_OENTRIES);
+    assert_int_equal(vr_oflow_entries_max, FLOW_TEST_OENTRIES);
+    assert_int_equal(flow_test_resizes(), 0);
+    assert_true(added <= FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+    assert_true(max_index < FLOW_TEST_ENTRIES + FLOW_TEST_OENTRIES);
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_flow_table_does_not_grow_by_default,
+                flow_test_setup, flow_test_teardown),
+        cmocka_unit_test_setup_teardown(test_flow_table_grows_up_to_its_limit,
+                flow_test_setup, flow_test_teardown),
+        cmocka_unit_test_setup_teardown(test_flow_table_grows_into_the_host_address_space,
+                flow_test_setup, flow_test_teardown),
+        cmocka_unit_test_setup_teardown(test_flow_table_gives_up_growth_without_pages,
+                flow_test_setup, flow_test_teardown),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests, NULL, NULL);
+}
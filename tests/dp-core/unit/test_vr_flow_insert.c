@@ -0,0 +1,175 @@
+/*
+ * test_vr_flow_insert.c -- races between the inserters of a flow
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_packet.h"
+#include "vr_flow.h"
+
+#include "fake_vrouter_host.h"
+#include "dp_core_test_utils.h"
+
+#include <cmocka.h>
+
+#define GROUP_NAME "vr_flow_insert"
+
+#define FLOW_TEST_ENTRIES       1024
+#define FLOW_TEST_OENTRIES      1024
+#define FLOW_TEST_NH_ID         1
+#define FLOW_TEST_THREADS       FAKE_VROUTER_HOST_CPUS
+#define FLOW_TEST_ROUNDS        512
+
+
+struct flow_test_inserter {
+    pthread_t fti_thread;
+    unsigned int fti_cpu;
+};
+
+static unsigned int flow_test_arrived;
+
+static void
+flow_test_add(uint32_t sip, uint16_t sport)
+{
+    dp_test_flow_add(FLOW_TEST_NH_ID, sip, 0x0a000001, VR_IP_PROTO_TCP,
+            sport, 80);
+    return;
+}
+
+/* the active entries of the table that hold the key */
+static unsigned int
+flow_test_count(uint32_t sip, uint16_t sport, unsigned int *index)
+{
+    unsigned int i, found = 0;
+    struct vr_flow key;
+    struct vr_flow_entry *fe;
+    struct vrouter *router = vrouter_get(0);
+
+    vr_inet_fill_flow(&key, FLOW_TEST_NH_ID, sip, 0x0a000001,
+            VR_IP_PROTO_TCP, sport, 80, VR_FLOW_KEY_ALL);
+
+    for (i = 0; i < vr_flow_entries + vr_oflow_entries; i++) {
+        fe = vr_flow_get_entry(router, i);
+        if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE))
+            continue;
+
+        if ((fe->fe_key.flow_key_len != key.flow_key_len) ||
+                memcmp(&fe->fe_key, &key, key.flow_key_len))
+            continue;
+
+        *index = i;
+        found++;
+    }
+
+    return found;
+}
+
+static bool
+flow_test_found_at(uint32_t sip, uint16_t sport, unsigned int index)
+{
+    unsigned int found_index = (unsigned int)-1;
+
+    if (!dp_test_flow_find(FLOW_TEST_NH_ID, sip, 0x0a000001,
+                VR_IP_PROTO_TCP, sport, 80, &found_index))
+        return false;
+
+    return found_index == index;
+}
+
+static void *
+flow_test_inserter(void *arg)
+{
+    unsigned int i;
+    struct flow_test_inserter *inserter = (struct flow_test_inserter *)arg;
+
+    fake_vrouter_host_set_cpu(inserter->fti_cpu);
+
+    /*
+     * all the threads add the same key at once, a round at a time. They
+     * spin rather than sleep at the start of a round, so that they leave
+     * it together.
+     */
+    for (i = 0; i < FLOW_TEST_ROUNDS; i++) {
+        (void)__sync_add_and_fetch(&flow_test_arrived, 1);
+        while (__sync_fetch_and_add(&flow_test_arrived, 0) <
+                (i + 1) * FLOW_TEST_THREADS)
+            sched_yield();
+
+        flow_test_add(0x0b000000 + i, 1000);
+    }
+
+    return NULL;
+}
+
+static int
+flow_test_group_setup(void **state)
+{
+    vr_flow_entries = FLOW_TEST_ENTRIES;
+    vr_oflow_entries = FLOW_TEST_OENTRIES;
+
+    return dp_test_vrouter_init(-1, AF_INET);
+}
+
+static void
+test_flow_add_of_a_present_key_adds_no_entry(void **state)
+{
+    unsigned int index;
+
+    /* GIVEN a flow in the table */
+    flow_test_add(0x0c000001, 2000);
+    assert_int_equal(flow_test_count(0x0c000001, 2000, &index), 1);
+
+    /* WHEN the agent adds it again */
+    flow_test_add(0x0c000001, 2000);
+
+    /* THEN the table still holds it once, where it was */
+    assert_int_equal(flow_test_count(0x0c000001, 2000, &index), 1);
+    assert_true(flow_test_found_at(0x0c000001, 2000, index));
+}
+
+static void
+test_flow_concurrent_adds_insert_once(void **state)
+{
+    unsigned int i, index;
+    struct flow_test_inserter inserters[FLOW_TEST_THREADS];
+
+    /* GIVEN as many inserters as cpus */
+    flow_test_arrived = 0;
+
+    /* WHEN they all add the same keys at the same time */
+    for (i = 0; i < FLOW_TEST_THREADS; i++) {
+        inserters[i].fti_cpu = i;
+        assert_int_equal(pthread_create(&inserters[i].fti_thread, NULL,
+                    flow_test_inserter, &inserters[i]), 0);
+    }
+
+    for (i = 0; i < FLOW_TEST_THREADS; i++)
+        pthread_join(inserters[i].fti_thread, NULL);
+
+    /* THEN each key got a single entry, the one lookups find */
+    for (i = 0; i < FLOW_TEST_ROUNDS; i++) {
+        assert_int_equal(flow_test_count(0x0b000000 + i, 1000, &index), 1);
+        assert_true(flow_test_found_at(0x0b000000 + i, 1000, index));
+    }
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_flow_add_of_a_present_key_adds_no_entry),
+        cmocka_unit_test(test_flow_concurrent_adds_insert_once),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests,
+            flow_test_group_setup, dp_test_vrouter_exit);
+}
@@ -0,0 +1,354 @@
+/*
+ * test_vr_nexthop_ecmp.c -- the bucket tables of ECMP composites
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_nexthop.h"
+
+#include "fake_vrouter_host.h"
+#include "dp_core_test_utils.h"
+
+#include <cmocka.h>
+
+#define GROUP_NAME "vr_nexthop_ecmp"
+
+#define ECMP_TEST_MEMBERS       4
+#define ECMP_TEST_MEMBER_ID     10
+/* no nexthop of this id, hence a member without a nexthop */
+#define ECMP_TEST_MISSING_ID    100
+
+static unsigned int ecmp_test_composite_id = 200;
+
+/* adds an ECMP composite of 'members' and returns it */
+static struct vr_nexthop *
+ecmp_test_composite_add(int *members, int *weights, unsigned int cnt)
+{
+    int labels[ECMP_TEST_MEMBERS * 2];
+    unsigned int i, id = ecmp_test_composite_id++;
+    vr_nexthop_req req;
+
+    for (i = 0; i < cnt; i++)
+        labels[i] = 1000 + i;
+
+    dp_test_nexthop_req_fill(&req, id, NH_COMPOSITE, AF_INET,
+            NH_FLAG_COMPOSITE_ECMP);
+    req.nhr_nh_list = members;
+    req.nhr_nh_list_size = cnt;
+    req.nhr_label_list = labels;
+    req.nhr_label_list_size = cnt;
+    req.nhr_weight_list = weights;
+    req.nhr_weight_list_size = weights ? cnt : 0;
+    vr_nexthop_add(&req);
+
+    return __vrouter_get_nexthop(vrouter_get(0), id);
+}
+
+/* the buckets of each member of 'nh' */
+static void
+ecmp_test_count_buckets(struct vr_nexthop *nh, unsigned int *counts)
+{
+    unsigned int i;
+
+    memset(counts, 0, nh->nh_component_cnt * sizeof(*counts));
+    for (i = 0; i < nh->nh_component_table_size; i++) {
+        assert_true(nh->nh_component_table[i] < nh->nh_component_cnt);
+        counts[nh->nh_component_table[i]]++;
+    }
+
+    return;
+}
+
+static int
+ecmp_test_group_setup(void **state)
+{
+    int i, ret;
+
+    ret = dp_test_vrouter_init(-1, AF_INET);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < ECMP_TEST_MEMBERS; i++) {
+        ret = dp_test_discard_nexthop_add(ECMP_TEST_MEMBER_ID + i, AF_INET);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int
+ecmp_test_teardown(void **state)
+{
+    vr_ecmp_table_size = 0;
+    return 0;
+}
+
+static void
+test_ecmp_table_spreads_members_evenly(void **state)
+{
+    unsigned int i, counts[ECMP_TEST_MEMBERS];
+    int members[ECMP_TEST_MEMBERS] = { 10, 11, 12, 13 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN a resilient ECMP table size, which is not a prime */
+    vr_ecmp_table_size = 100;
+
+    /* WHEN a composite of equal members is added */
+    nh = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+
+    /* THEN its table is of the next prime, and evenly shared */
+    assert_non_null(nh);
+    assert_non_null(nh->nh_component_table);
+    assert_int_equal(nh->nh_component_table_size, 101);
+
+    ecmp_test_count_buckets(nh, counts);
+    for (i = 0; i < ECMP_TEST_MEMBERS; i++)
+        assert_in_range(counts[i], 101 / ECMP_TEST_MEMBERS,
+                101 / ECMP_TEST_MEMBERS + 1);
+}
+
+static void
+test_ecmp_table_skips_members_without_nexthop(void **state)
+{
+    unsigned int counts[ECMP_TEST_MEMBERS];
+    int members[ECMP_TEST_MEMBERS] = { 10, ECMP_TEST_MISSING_ID, 12, 13 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN a resilient ECMP table size */
+    vr_ecmp_table_size = 101;
+
+    /* WHEN a member of the composite has no nexthop */
+    nh = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+
+    /* THEN it gets no bucket, and the others share the table */
+    assert_non_null(nh);
+    assert_non_null(nh->nh_component_table);
+
+    ecmp_test_count_buckets(nh, counts);
+    assert_int_equal(counts[1], 0);
+    assert_int_equal(counts[0] + counts[2] + counts[3], 101);
+    assert_in_range(counts[0], 33, 34);
+    assert_in_range(counts[2], 33, 34);
+    assert_in_range(counts[3], 33, 34);
+}
+
+static void
+test_ecmp_table_moves_few_buckets_on_member_loss(void **state)
+{
+    unsigned int i, moved = 0;
+    int members[ECMP_TEST_MEMBERS] = { 10, 11, 12, 13 };
+    unsigned short before[101];
+    struct vr_nexthop *nh;
+
+    /* GIVEN the table of a composite of four members */
+    vr_ecmp_table_size = 101;
+    nh = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+    assert_non_null(nh);
+    assert_int_equal(nh->nh_component_table_size, 101);
+    memcpy(before, nh->nh_component_table, sizeof(before));
+
+    /* WHEN the nexthop of a member goes away */
+    members[2] = ECMP_TEST_MISSING_ID;
+    nh = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+    assert_non_null(nh);
+    assert_int_equal(nh->nh_component_table_size, 101);
+
+    /* THEN its buckets move, and few of the others */
+    for (i = 0; i < 101; i++) {
+        if (before[i] == 2) {
+            assert_int_not_equal(nh->nh_component_table[i], 2);
+        } else if (nh->nh_component_table[i] != before[i]) {
+            moved++;
+        }
+    }
+    assert_true(moved <= 101 / ECMP_TEST_MEMBERS);
+}
+
+static void
+test_ecmp_table_is_the_same_for_the_same_members(void **state)
+{
+    int members[ECMP_TEST_MEMBERS] = { 10, 11, 12, 13 };
+    struct vr_nexthop *first, *second;
+
+    /* GIVEN a resilient ECMP table size */
+    vr_ecmp_table_size = 101;
+
+    /* WHEN two composites of the same members are added */
+    first = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+    second = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+
+    /* THEN they share their buckets alike */
+    assert_non_null(first);
+    assert_non_null(second);
+    assert_int_equal(first->nh_component_table_size,
+            second->nh_component_table_size);
+    assert_memory_equal(first->nh_component_table,
+            second->nh_component_table,
+            first->nh_component_table_size * sizeof(unsigned short));
+}
+
+static void
+test_ecmp_table_is_off_by_default(void **state)
+{
+    int members[ECMP_TEST_MEMBERS] = { 10, 11, 12, 13 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN no resilient ECMP table size */
+
+    /* WHEN a composite of equal members is added */
+    nh = ecmp_test_composite_add(members, NULL, ECMP_TEST_MEMBERS);
+
+    /* THEN the hash is taken modulo its members */
+    assert_non_null(nh);
+    assert_null(nh->nh_component_table);
+    assert_int_equal(nh->nh_component_table_size, 0);
+}
+
+static void
+test_ecmp_table_follows_weights(void **state)
+{
+    unsigned int i, size, counts[ECMP_TEST_MEMBERS];
+    int members[ECMP_TEST_MEMBERS] = { 10, 11, 12, 13 };
+    int weights[ECMP_TEST_MEMBERS] = { 1, 2, 3, 4 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN no resilient ECMP table size */
+
+    /* WHEN a composite of unequal weights is added */
+    nh = ecmp_test_composite_add(members, weights, ECMP_TEST_MEMBERS);
+
+    /* THEN it gets a table of the default size */
+    assert_non_null(nh);
+    assert_non_null(nh->nh_component_table);
+    size = nh->nh_component_table_size;
+    assert_int_equal(size, NH_ECMP_TABLE_DEF_SIZE);
+
+    /* AND the share of each member is within a bucket of its weight */
+    ecmp_test_count_buckets(nh, counts);
+    for (i = 0; i < ECMP_TEST_MEMBERS; i++)
+        assert_in_range(counts[i] * 10, size * weights[i] - 10,
+                size * weights[i] + 10);
+}
+
+static void
+test_ecmp_table_divides_weights_by_their_gcd(void **state)
+{
+    unsigned int counts[3];
+    int members[3] = { 10, 11, 12 };
+    int weights[3] = { 200, 100, 50 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN a resilient ECMP table smaller than the sum of the weights */
+    vr_ecmp_table_size = 5;
+
+    /* WHEN a composite of weights with a common divisor is added */
+    nh = ecmp_test_composite_add(members, weights, 3);
+
+    /* THEN a round of the reduced weights fits in the table */
+    assert_non_null(nh);
+    assert_non_null(nh->nh_component_table);
+    assert_int_equal(nh->nh_component_table_size, 7);
+
+    ecmp_test_count_buckets(nh, counts);
+    assert_int_equal(counts[0], 4);
+    assert_int_equal(counts[1], 2);
+    assert_int_equal(counts[2], 1);
+}
+
+static void
+test_ecmp_table_holds_weight_sums_above_its_size(void **state)
+{
+    unsigned int i, size, counts[3];
+    int members[3] = { 10, 11, 12 };
+    int weights[3] = { NH_ECMP_MAX_WEIGHT, NH_ECMP_MAX_WEIGHT - 1, 1 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN a resilient ECMP table much smaller than the weights sum */
+    vr_ecmp_table_size = 13;
+
+    /* WHEN a composite of coprime weights is added */
+    nh = ecmp_test_composite_add(members, weights, 3);
+
+    /* THEN the table holds at least a whole round */
+    assert_non_null(nh);
+    assert_non_null(nh->nh_component_table);
+    size = nh->nh_component_table_size;
+    assert_true(size >= 2 * NH_ECMP_MAX_WEIGHT);
+
+    /* AND no member, the lightest included, is shortchanged */
+    ecmp_test_count_buckets(nh, counts);
+    for (i = 0; i < 3; i++)
+        assert_true(counts[i] >= (unsigned int)weights[i]);
+    assert_int_equal(counts[0] + counts[1] + counts[2], size);
+}
+
+static void
+test_ecmp_table_ignores_equal_weights(void **state)
+{
+    int members[ECMP_TEST_MEMBERS] = { 10, 11, 12, 13 };
+    int weights[ECMP_TEST_MEMBERS] = { 3, 3, 3, 3 };
+    struct vr_nexthop *nh;
+
+    /* GIVEN no resilient ECMP table size */
+
+    /* WHEN a composite of equal weights is added */
+    nh = ecmp_test_composite_add(members, weights, ECMP_TEST_MEMBERS);
+
+    /* THEN it needs no table */
+    assert_non_null(nh);
+    assert_null(nh->nh_component_table);
+}
+
+static void
+test_ecmp_table_rejects_out_of_range_weights(void **state)
+{
+    int members[2] = { 10, 11 };
+    int weights[2] = { 1, NH_ECMP_MAX_WEIGHT + 1 };
+    unsigned int id = ecmp_test_composite_id;
+
+    /* GIVEN a weight above NH_ECMP_MAX_WEIGHT */
+
+    /* WHEN a composite with it is added */
+    (void)ecmp_test_composite_add(members, weights, 2);
+
+    /* THEN the composite is not created */
+    assert_null(__vrouter_get_nexthop(vrouter_get(0), id));
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_teardown(test_ecmp_table_spreads_members_evenly,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_skips_members_without_nexthop,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_moves_few_buckets_on_member_loss,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_is_the_same_for_the_same_members,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_is_off_by_default,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_follows_weights,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_divides_weights_by_their_gcd,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_holds_weight_sums_above_its_size,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_ignores_equal_weights,
+                ecmp_test_teardown),
+        cmocka_unit_test_teardown(test_ecmp_table_rejects_out_of_range_weights,
+                ecmp_test_teardown),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests,
+            ecmp_test_group_setup, dp_test_vrouter_exit);
+}
@@ -0,0 +1,295 @@
+/*
+ * test_vr_nexthop_tunnel.c -- the prebuilt outer headers of tunnel nexthops
+ *
+ * Copyright (c) 2020 Juniper Networks, Inc. All rights reserved.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "vr_os.h"
+#include "vr_types.h"
+#include "vrouter.h"
+#include "vr_interface.h"
+#include "vr_nexthop.h"
+#include "vr_packet.h"
+#include "vr_mpls.h"
+
+#include "fake_vrouter_host.h"
+#include "dp_core_test_utils.h"
+
+#include <cmocka.h>
+
+#define GROUP_NAME "vr_nexthop_tunnel"
+
+#define TUNNEL_TEST_FABRIC_IDX  0
+#define TUNNEL_TEST_NH_ID       10
+/* addresses whose sums carry out of 16 bits */
+#define TUNNEL_TEST_SIP         0xfffefdfc
+#define TUNNEL_TEST_DIP         0xfbfaf9f8
+
+static int
+tunnel_test_nexthop_add(int id, int flags, unsigned int sip,
+        unsigned int dip)
+{
+    int oif = TUNNEL_TEST_FABRIC_IDX;
+    int8_t encap[VR_ETHER_HLEN] = { 0 };
+    vr_nexthop_req req;
+
+    dp_test_nexthop_req_fill(&req, id, NH_TUNNEL, AF_INET, flags);
+    req.nhr_encap_oif_id = &oif;
+    req.nhr_encap_oif_id_size = 1;
+    req.nhr_encap = encap;
+    req.nhr_encap_size = sizeof(encap);
+    req.nhr_tun_sip = sip;
+    req.nhr_tun_dip = dip;
+
+    return vr_nexthop_add(&req);
+}
+
+static struct vr_nexthop *
+tunnel_test_nexthop(int id)
+{
+    return __vrouter_get_nexthop(vrouter_get(0), id);
+}
+
+/*
+ * copies the outer headers of 'nh' to 'hdr' and patches the fields that
+ * change by packet in, the way they are pushed. Returns the checksum the
+ * prebuilt sum makes of them.
+ */
+static unsigned short
+tunnel_test_push(struct vr_nexthop *nh, unsigned short *hdr,
+        unsigned short len, unsigned short id, unsigned char tos,
+        unsigned char ttl)
+{
+    unsigned int sum;
+    struct vr_ip *ip = (struct vr_ip *)hdr;
+
+    memcpy(hdr, nh->nh_tun_hdr.nth_hdr, nh->nh_tun_hdr.nth_len);
+    ip->ip_len = htons(len);
+    ip->ip_id = htons(id);
+    ip->ip_tos = tos;
+    ip->ip_ttl = ttl;
+
+    sum = nh->nh_tun_hdr.nth_csum + hdr[0] + hdr[1] + hdr[2] + hdr[4];
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+
+    return ~sum & 0xFFFF;
+}
+
+/* the prebuilt sum of 'nh' against vr_ip_csum, over packets of all kinds */
+static void
+tunnel_test_assert_csum(struct vr_nexthop *nh)
+{
+    unsigned int i;
+    unsigned short csum;
+    unsigned short hdr[VR_NH_TUN_HDR_MAX_LEN / 2];
+    static const struct {
+        unsigned short len;
+        unsigned short id;
+        unsigned char tos;
+        unsigned char ttl;
+    } packets[] = {
+        { 64, 0, 0, 64 },
+        { 1514, 0x1234, 0, 64 },
+        { 9000, 0xffff, VR_IP_DSCP(46), 64 },
+        { 0xffff, 0xfffe, 0xff, 0xff },
+        { 28, 1, 0xfc, 1 },
+    };
+
+    for (i = 0; i < sizeof(packets) / sizeof(packets[0]); i++) {
+        csum = tunnel_test_push(nh, hdr, packets[i].len, packets[i].id,
+                packets[i].tos, packets[i].ttl);
+        assert_int_equal(csum, vr_ip_csum((struct vr_ip *)hdr));
+    }
+
+    return;
+}
+
+static int
+tunnel_test_group_setup(void **state)
+{
+    int ret;
+    vr_interface_req req;
+
+    ret = dp_test_vrouter_init(-1, AF_INET);
+    if (ret)
+        return ret;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.vifr_idx = TUNNEL_TEST_FABRIC_IDX;
+    req.vifr_type = VIF_TYPE_PHYSICAL;
+    req.vifr_transport = VIF_TRANSPORT_ETH;
+    req.vifr_name = "eth0";
+    req.vifr_vrf = 0;
+    req.vifr_mir_id = -1;
+    req.vifr_os_idx = -1;
+
+    return vr_interface_add(&req, false);
+}
+
+static void
+test_tunnel_gre_header_is_prebuilt(void **state)
+{
+    struct vr_nexthop *nh;
+    struct vr_ip *ip;
+    struct vr_gre *gre;
+
+    /* GIVEN an MPLSoGRE tunnel */
+    tunnel_test_nexthop_add(TUNNEL_TEST_NH_ID, NH_FLAG_TUNNEL_GRE,
+            TUNNEL_TEST_SIP, TUNNEL_TEST_DIP);
+
+    /* WHEN its outer headers are looked at */
+    nh = tunnel_test_nexthop(TUNNEL_TEST_NH_ID);
+    assert_non_null(nh);
+    ip = (struct vr_ip *)nh->nh_tun_hdr.nth_hdr;
+    gre = (struct vr_gre *)(ip + 1);
+
+    /* THEN they are an IP and a GRE header, to the tunnel end points */
+    assert_int_equal(nh->nh_tun_hdr.nth_len,
+            sizeof(struct vr_ip) + sizeof(struct vr_gre));
+    assert_int_equal(ip->ip_version, 4);
+    assert_int_equal(ip->ip_hl, 5);
+    assert_int_equal(ip->ip_proto, VR_IP_PROTO_GRE);
+    assert_int_equal(ip->ip_frag_off, 0);
+    assert_int_equal(ip->ip_saddr, TUNNEL_TEST_SIP);
+    assert_int_equal(ip->ip_daddr, TUNNEL_TEST_DIP);
+    assert_int_equal(gre->gre_proto, VR_GRE_PROTO_MPLS_NO);
+
+    /* AND their checksum is the one vr_ip_csum makes */
+    tunnel_test_assert_csum(nh);
+}
+
+static void
+test_tunnel_mpls_udp_header_is_prebuilt(void **state)
+{
+    struct vr_nexthop *nh;
+    struct vr_ip *ip;
+    struct vr_udp *udp;
+
+    /* GIVEN an MPLSoUDP tunnel */
+    tunnel_test_nexthop_add(TUNNEL_TEST_NH_ID + 1, NH_FLAG_TUNNEL_UDP_MPLS,
+            TUNNEL_TEST_SIP, TUNNEL_TEST_DIP);
+
+    /* WHEN its outer headers are looked at */
+    nh = tunnel_test_nexthop(TUNNEL_TEST_NH_ID + 1);
+    assert_non_null(nh);
+    ip = (struct vr_ip *)nh->nh_tun_hdr.nth_hdr;
+    udp = (struct vr_udp *)(ip + 1);
+
+    /* THEN they are an IP and a UDP header, to the MPLSoUDP port */
+    assert_int_equal(nh->nh_tun_hdr.nth_len,
+            sizeof(struct vr_ip) + sizeof(struct vr_udp));
+    assert_int_equal(ip->ip_proto, VR_IP_PROTO_UDP);
+    assert_int_equal(ip->ip_saddr, TUNNEL_TEST_SIP);
+    assert_int_equal(ip->ip_daddr, TUNNEL_TEST_DIP);
+    assert_int_equal(udp->udp_dport, htons(VR_MPLS_OVER_UDP_DST_PORT));
+    assert_int_equal(udp->udp_csum, 0);
+
+    /* AND their checksum is the one vr_ip_csum makes */
+    tunnel_test_assert_csum(nh);
+}
+
+static void
+test_tunnel_vxlan_header_is_prebuilt(void **state)
+{
+    struct vr_nexthop *nh;
+    struct vr_ip *ip;
+    struct vr_udp *udp;
+
+    /* GIVEN a VXLAN tunnel */
+    tunnel_test_nexthop_add(TUNNEL_TEST_NH_ID + 2, NH_FLAG_TUNNEL_VXLAN,
+            TUNNEL_TEST_SIP, TUNNEL_TEST_DIP);
+
+    /* WHEN its outer headers are looked at */
+    nh = tunnel_test_nexthop(TUNNEL_TEST_NH_ID + 2);
+    assert_non_null(nh);
+    ip = (struct vr_ip *)nh->nh_tun_hdr.nth_hdr;
+    udp = (struct vr_udp *)(ip + 1);
+
+    /* THEN they are an IP and a UDP header, to the VXLAN port */
+    assert_int_equal(nh->nh_tun_hdr.nth_len,
+            sizeof(struct vr_ip) + sizeof(struct vr_udp));
+    assert_int_equal(ip->ip_proto, VR_IP_PROTO_UDP);
+    assert_int_equal(udp->udp_dport, htons(VR_VXLAN_UDP_DST_PORT));
+
+    /* AND their checksum is the one vr_ip_csum makes */
+    tunnel_test_assert_csum(nh);
+}
+
+static void
+test_tunnel_header_follows_a_change_of_end_points(void **state)
+{
+    struct vr_nexthop *nh;
+    struct vr_ip *ip;
+
+    /* GIVEN an MPLSoGRE tunnel */
+    tunnel_test_nexthop_add(TUNNEL_TEST_NH_ID + 3, NH_FLAG_TUNNEL_GRE,
+            TUNNEL_TEST_SIP, TUNNEL_TEST_DIP);
+
+    /* WHEN the agent moves its end points */
+    tunnel_test_nexthop_add(TUNNEL_TEST_NH_ID + 3, NH_FLAG_TUNNEL_GRE,
+            0x0a000001, 0x0a000002);
+
+    /* THEN its outer headers go to the new ones */
+    nh = tunnel_test_nexthop(TUNNEL_TEST_NH_ID + 3);
+    assert_non_null(nh);
+    ip = (struct vr_ip *)nh->nh_tun_hdr.nth_hdr;
+    assert_int_equal(ip->ip_saddr, 0x0a000001);
+    assert_int_equal(ip->ip_daddr, 0x0a000002);
+
+    /* AND their checksum is the one vr_ip_csum makes */
+    tunnel_test_assert_csum(nh);
+}
+
+static void
+test_tunnel_header_is_dropped_with_the_device(void **state)
+{
+    int oif = TUNNEL_TEST_FABRIC_IDX + 1;
+    vr_nexthop_req req;
+    struct vr_nexthop *nh;
+
+    /* GIVEN an MPLSoGRE tunnel */
+    tunnel_test_nexthop_add(TUNNEL_TEST_NH_ID + 4, NH_FLAG_TUNNEL_GRE,
+            TUNNEL_TEST_SIP, TUNNEL_TEST_DIP);
+    nh = tunnel_test_nexthop(TUNNEL_TEST_NH_ID + 4);
+    assert_non_null(nh);
+    assert_int_not_equal(nh->nh_tun_hdr.nth_len, 0);
+
+    /* WHEN the agent moves it to an interface that does not exist */
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.nhr_id = TUNNEL_TEST_NH_ID + 4;
+    req.nhr_type = NH_TUNNEL;
+    req.nhr_family = AF_INET;
+    req.nhr_flags = NH_FLAG_VALID | NH_FLAG_TUNNEL_GRE;
+    req.nhr_encap_oif_id = &oif;
+    req.nhr_encap_oif_id_size = 1;
+    req.nhr_tun_sip = TUNNEL_TEST_SIP;
+    req.nhr_tun_dip = TUNNEL_TEST_DIP;
+    vr_nexthop_add(&req);
+
+    /* THEN it has no outer headers left to push */
+    nh = tunnel_test_nexthop(TUNNEL_TEST_NH_ID + 4);
+    assert_non_null(nh);
+    assert_int_equal(nh->nh_tun_hdr.nth_len, 0);
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tunnel_gre_header_is_prebuilt),
+        cmocka_unit_test(test_tunnel_mpls_udp_header_is_prebuilt),
+        cmocka_unit_test(test_tunnel_vxlan_header_is_prebuilt),
+        cmocka_unit_test(test_tunnel_header_follows_a_change_of_end_points),
+        cmocka_unit_test(test_tunnel_header_is_dropped_with_the_device),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests,
+            tunnel_test_group_setup, dp_test_vrouter_exit);
+}
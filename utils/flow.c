@@ -47,6 +47,7 @@
 #include "vr_packet.h"
 #include "vr_message.h"
 #include "vr_mem.h"
+#include "vr_flow_log.h"
 
 #define TABLE_FLAG_VALID        0x1
 
@@ -113,6 +114,12 @@ struct flow_table {
     u_int64_t ft_total_entries;
     unsigned int ft_burst_free_tokens;
     unsigned int ft_hold_entries;
+    uint64_t ft_aged;
+    uint64_t ft_hold_drops[4];
+    unsigned int ft_hold_pool_nodes;
+    unsigned int ft_hold_pool_used;
+    uint64_t ft_rpf_validated;
+    uint64_t ft_rpf_cached;
     unsigned int ft_num_entries;
     unsigned int ft_flags;
     unsigned int ft_cpus;
@@ -120,9 +127,24 @@ struct flow_table {
     unsigned int ft_hold_stat_count;
     unsigned int ft_oflow_entries;
     u_int32_t ft_hold_stat[128];
+    unsigned int ft_admission_stat_count;
+    u_int64_t ft_admitted[128];
+    u_int64_t ft_burst_admitted[128];
+    u_int64_t ft_admission_drops[128];
     char flow_table_path[256];
+    void *ft_log;
+    unsigned int ft_log_size;
+    struct vr_flow_log_reader ft_log_reader;
 } main_table;
 
+struct flow_log_rate {
+    uint64_t flr_packets;
+    uint64_t flr_bytes;
+    unsigned int flr_records;
+    unsigned int flr_new;
+    unsigned int flr_aged;
+};
+
 struct flow_md {
     unsigned int fmd_index;
     unsigned int fmd_gen_id;
@@ -1205,7 +1227,31 @@ flow_dump_table(struct flow_table *ft)
         if (i != (ft->ft_hold_stat_count - 1))
             printf(" ");
     }
-    printf(")(oflows %u)\n\n", ft->ft_hold_oflows);
+    printf(")(oflows %u)\n", ft->ft_hold_oflows);
+
+    if (ft->ft_aged)
+        printf("(Aged by datapath %" PRIu64 ")\n", ft->ft_aged);
+
+    if (ft->ft_hold_pool_nodes)
+        printf("(Hold pool: used %u of %u, drops: queue full %" PRIu64
+                " pool pressure %" PRIu64 " pool empty %" PRIu64
+                " no queue %" PRIu64 ")\n", ft->ft_hold_pool_used,
+                ft->ft_hold_pool_nodes, ft->ft_hold_drops[0],
+                ft->ft_hold_drops[1], ft->ft_hold_drops[2],
+                ft->ft_hold_drops[3]);
+
+    if (ft->ft_rpf_validated || ft->ft_rpf_cached)
+        printf("(Source validations: run %" PRIu64 " cached %" PRIu64 ")\n",
+                ft->ft_rpf_validated, ft->ft_rpf_cached);
+
+    printf("(Admitted/Burst/Dropped New Flows/CPU: ");
+    for (i = 0; i < ft->ft_admission_stat_count; i++) {
+        printf("%" PRIu64 "/%" PRIu64 "/%" PRIu64, ft->ft_admitted[i],
+                ft->ft_burst_admitted[i], ft->ft_admission_drops[i]);
+        if (i != (ft->ft_admission_stat_count - 1))
+            printf(" ");
+    }
+    printf(")\n\n");
 
     flow_dump_legend();
 
@@ -1681,6 +1727,54 @@ flow_stats(void)
     }
 }
 
+static void
+flow_log_rate_cb(const struct vr_flow_log_delta *delta, void *arg)
+{
+    struct flow_log_rate *flr = (struct flow_log_rate *)arg;
+
+    flr->flr_packets += delta->vfld_packets;
+    flr->flr_bytes += delta->vfld_bytes;
+    flr->flr_records++;
+    if (delta->vfld_reason == VR_FLOW_LOG_REASON_NEW)
+        flr->flr_new++;
+    else if (delta->vfld_reason == VR_FLOW_LOG_REASON_AGED)
+        flr->flr_aged++;
+
+    return;
+}
+
+/*
+ * Traffic rates out of the flow statistics change log, when the datapath
+ * keeps one
+ */
+static void
+flow_log_rate(const char *fmt, struct timeval *now, int diff_ms)
+{
+    int ret;
+    uint64_t lost;
+    struct flow_log_rate flr;
+    struct flow_table *ft = &main_table;
+
+    if (!ft->ft_log)
+        return;
+
+    memset(&flr, 0, sizeof(flr));
+    lost = ft->ft_log_reader.vflrd_lost;
+    ret = vr_flow_log_read(&ft->ft_log_reader, flow_log_rate_cb, &flr);
+    if (ret <= 0)
+        return;
+
+    printf("%s.%03d:  Packets/s = %10" PRIu64 " Bytes/s = %12" PRIu64
+            " New = %6u Aged = %6u Records = %8u Lost = %8" PRIu64 "\n",
+            fmt, (int)now->tv_usec/1000,
+            flr.flr_packets * 1000 / diff_ms, flr.flr_bytes * 1000 / diff_ms,
+            flr.flr_new, flr.flr_aged, flr.flr_records,
+            ft->ft_log_reader.vflrd_lost - lost);
+    fflush(stdout);
+
+    return;
+}
+
 static void
 flow_rate(void)
 {
@@ -1751,6 +1845,8 @@ flow_rate(void)
             fflush(stdout);
         }
 
+        flow_log_rate(fmt, &now, diff_ms);
+
         last_time = now;
         hold_count_old = hold_count;
         processed_count_old = ft->ft_processed;
@@ -1772,11 +1868,55 @@ get_flow_table_map_counts(vr_flow_table_data *table, struct flow_table *ft)
     ft->ft_total_entries = table->ftable_used_entries;
     ft->ft_burst_free_tokens = table->ftable_burst_free_tokens;
     ft->ft_hold_entries = table->ftable_hold_entries;
+    ft->ft_aged = table->ftable_aged;
+    ft->ft_hold_drops[0] = table->ftable_hold_limit_drops;
+    ft->ft_hold_drops[1] = table->ftable_hold_share_drops;
+    ft->ft_hold_drops[2] = table->ftable_hold_pool_drops;
+    ft->ft_hold_drops[3] = table->ftable_hold_queue_drops;
+    ft->ft_hold_pool_nodes = table->ftable_hold_pool_nodes;
+    ft->ft_hold_pool_used = table->ftable_hold_pool_used;
+    ft->ft_rpf_validated = table->ftable_rpf_validated;
+    ft->ft_rpf_cached = table->ftable_rpf_cached;
 
 
     return 0;
 }
 
+/* the log is optional, so failing to map it is not fatal */
+static void
+flow_log_map(vr_flow_table_data *table)
+{
+    const char *mmap_error_msg;
+    struct flow_table *ft = &main_table;
+
+    if (ft->ft_log) {
+        vr_flow_log_reader_exit(&ft->ft_log_reader);
+        munmap(ft->ft_log, ft->ft_log_size);
+        ft->ft_log = NULL;
+        ft->ft_log_size = 0;
+    }
+
+    if (!table->ftable_log_size)
+        return;
+
+    mmap_error_msg = vr_table_map(table->ftable_dev, VR_MEM_FLOW_LOG_OBJECT,
+        table->ftable_log_file_path, table->ftable_log_size, &ft->ft_log);
+    if (mmap_error_msg) {
+        ft->ft_log = NULL;
+        return;
+    }
+
+    ft->ft_log_size = table->ftable_log_size;
+    if (vr_flow_log_reader_init(&ft->ft_log_reader, ft->ft_log,
+                ft->ft_log_size, ft->ft_num_entries)) {
+        munmap(ft->ft_log, ft->ft_log_size);
+        ft->ft_log = NULL;
+        ft->ft_log_size = 0;
+    }
+
+    return;
+}
+
 static int
 flow_table_map(vr_flow_table_data *table)
 {
@@ -1790,8 +1930,14 @@ flow_table_map(vr_flow_table_data *table)
         exit(ENODEV);
 
     if (ft->ft_entries != 0) {
-        get_flow_table_map_counts(table, ft);
-        return ft->ft_num_entries;
+        if (table->ftable_size == ft->ft_span) {
+            get_flow_table_map_counts(table, ft);
+            return ft->ft_num_entries;
+        }
+
+        /* the overflow table grew, map it again */
+        munmap(ft->ft_entries, ft->ft_span);
+        ft->ft_entries = NULL;
     }
 
     mmap_error_msg = vr_table_map(table->ftable_dev, VR_MEM_FLOW_TABLE_OBJECT,
@@ -1804,6 +1950,7 @@ flow_table_map(vr_flow_table_data *table)
 
     ft->ft_span = table->ftable_size;
     ft->ft_num_entries = ft->ft_span / sizeof(struct vr_flow_entry);
+    flow_log_map(table);
     ft->ft_processed = table->ftable_processed;
     ft->ft_created = table->ftable_created;
     ft->ft_hold_oflows = table->ftable_hold_oflows;
@@ -1814,6 +1961,15 @@ flow_table_map(vr_flow_table_data *table)
     ft->ft_changed = table->ftable_changed;
     ft->ft_burst_free_tokens = table->ftable_burst_free_tokens;
     ft->ft_hold_entries = table->ftable_hold_entries;
+    ft->ft_aged = table->ftable_aged;
+    ft->ft_hold_drops[0] = table->ftable_hold_limit_drops;
+    ft->ft_hold_drops[1] = table->ftable_hold_share_drops;
+    ft->ft_hold_drops[2] = table->ftable_hold_pool_drops;
+    ft->ft_hold_drops[3] = table->ftable_hold_queue_drops;
+    ft->ft_hold_pool_nodes = table->ftable_hold_pool_nodes;
+    ft->ft_hold_pool_used = table->ftable_hold_pool_used;
+    ft->ft_rpf_validated = table->ftable_rpf_validated;
+    ft->ft_rpf_cached = table->ftable_rpf_cached;
 
 
     if (table->ftable_hold_stat && table->ftable_hold_stat_size) {
@@ -1832,6 +1988,22 @@ flow_table_map(vr_flow_table_data *table)
         memset(ft->ft_hold_stat, 0, sizeof(ft->ft_hold_stat));
     }
 
+    ft->ft_admission_stat_count = 0;
+    if (table->ftable_admitted && table->ftable_burst_admitted &&
+            table->ftable_admission_drops) {
+        for (i = 0; i < table->ftable_admitted_size; i++) {
+            if ((i == (sizeof(ft->ft_admitted) / sizeof(ft->ft_admitted[0]))) ||
+                    (i >= table->ftable_burst_admitted_size) ||
+                    (i >= table->ftable_admission_drops_size))
+                break;
+
+            ft->ft_admitted[i] = table->ftable_admitted[i];
+            ft->ft_burst_admitted[i] = table->ftable_burst_admitted[i];
+            ft->ft_admission_drops[i] = table->ftable_admission_drops[i];
+        }
+        ft->ft_admission_stat_count = i;
+    }
+
     return ft->ft_num_entries;
 }
 
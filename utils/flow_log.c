@@ -0,0 +1,223 @@
+/*
+ * flow_log.c -- reader of the flow statistics change log
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include <vr_flow_log.h>
+
+/* what the reader last saw of a flow */
+struct vr_flow_log_flow {
+    uint64_t vflf_bytes;
+    uint64_t vflf_packets;
+    uint8_t vflf_gen_id;
+    uint8_t vflf_valid;
+};
+
+static const struct vr_flow_log_ring *
+vr_flow_log_reader_ring(struct vr_flow_log_reader *reader, unsigned int ring)
+{
+    return (const struct vr_flow_log_ring *)(reader->vflrd_mem +
+            reader->vflrd_info->vfli_ring_offset +
+            (ring * sizeof(struct vr_flow_log_ring)));
+}
+
+static const struct vr_flow_log_record *
+vr_flow_log_reader_record(struct vr_flow_log_reader *reader,
+        unsigned int ring, uint64_t seq)
+{
+    const struct vr_flow_log_info *vfli = reader->vflrd_info;
+
+    return (const struct vr_flow_log_record *)(reader->vflrd_mem +
+            vfli->vfli_record_offset +
+            (((uint64_t)ring * vfli->vfli_records) +
+             (seq & (vfli->vfli_records - 1))) * vfli->vfli_record_size);
+}
+
+/*
+ * Copies the record at 'seq' out of the ring. Returns false if the
+ * producer got to it, i.e the reader lost it.
+ */
+static bool
+vr_flow_log_reader_copy(struct vr_flow_log_reader *reader, unsigned int ring,
+        uint64_t seq, struct vr_flow_log_record *vflr)
+{
+    const volatile struct vr_flow_log_record *record =
+        vr_flow_log_reader_record(reader, ring, seq);
+
+    if (record->vflr_seq != seq)
+        return false;
+    __sync_synchronize();
+
+    memcpy(vflr, (const void *)record, sizeof(*vflr));
+    __sync_synchronize();
+
+    return record->vflr_seq == seq;
+}
+
+/*
+ * Turns a record into a delta against what was last seen of the flow.
+ * Records of a flow may come out of different rings in a different order
+ * than they went in, hence the older ones are just skipped.
+ */
+static void
+vr_flow_log_reader_delta(struct vr_flow_log_reader *reader,
+        const struct vr_flow_log_record *vflr,
+        struct vr_flow_log_delta *delta)
+{
+    uint64_t bytes, packets;
+    struct vr_flow_log_flow *flow;
+
+    memset(delta, 0, sizeof(*delta));
+    delta->vfld_index = vflr->vflr_index;
+    delta->vfld_gen_id = vflr->vflr_gen_id;
+    delta->vfld_reason = vflr->vflr_reason;
+    delta->vfld_tcp_flags = vflr->vflr_tcp_flags;
+
+    if (vflr->vflr_index >= reader->vflrd_flow_entries)
+        return;
+
+    bytes = ((uint64_t)vflr->vflr_bytes_oflow << 32) | vflr->vflr_bytes;
+    packets = ((uint64_t)vflr->vflr_packets_oflow << 32) |
+        vflr->vflr_packets;
+
+    flow = &reader->vflrd_flows[vflr->vflr_index];
+    if (flow->vflf_valid && (flow->vflf_gen_id == vflr->vflr_gen_id)) {
+        if (packets < flow->vflf_packets)
+            return;
+
+        delta->vfld_bytes = bytes - flow->vflf_bytes;
+        delta->vfld_packets = packets - flow->vflf_packets;
+    } else if (flow->vflf_valid ||
+            (vflr->vflr_reason == VR_FLOW_LOG_REASON_NEW)) {
+        /* a new flow, or the index got reused */
+        delta->vfld_bytes = bytes;
+        delta->vfld_packets = packets;
+    }
+    /* else a flow that was there before the reader, just note where it is */
+
+    flow->vflf_bytes = bytes;
+    flow->vflf_packets = packets;
+    flow->vflf_gen_id = vflr->vflr_gen_id;
+    flow->vflf_valid = (vflr->vflr_reason != VR_FLOW_LOG_REASON_AGED);
+
+    return;
+}
+
+/*
+ * Reads all the records appended since the last call, handing the delta
+ * each of them makes to 'cb'. Returns the number of records read.
+ */
+int
+vr_flow_log_read(struct vr_flow_log_reader *reader,
+        void (*cb)(const struct vr_flow_log_delta *, void *), void *arg)
+{
+    int count = 0;
+    unsigned int i, records;
+    uint64_t head, pos;
+    struct vr_flow_log_record vflr;
+    struct vr_flow_log_delta delta;
+    const volatile struct vr_flow_log_ring *vfrg;
+
+    if (!reader || !reader->vflrd_info)
+        return -EINVAL;
+
+    if (reader->vflrd_info->vfli_magic != VR_FLOW_LOG_MAGIC)
+        return -ENODEV;
+
+    records = reader->vflrd_info->vfli_records;
+    for (i = 0; i < reader->vflrd_info->vfli_rings; i++) {
+        vfrg = vr_flow_log_reader_ring(reader, i);
+        head = vfrg->vfrg_head;
+        __sync_synchronize();
+
+        pos = reader->vflrd_positions[i];
+        if (head - pos > records) {
+            reader->vflrd_lost += head - pos - records;
+            pos = head - records;
+        }
+
+        for (; pos < head; pos++) {
+            if (!vr_flow_log_reader_copy(reader, i, pos, &vflr)) {
+                reader->vflrd_lost++;
+                continue;
+            }
+
+            vr_flow_log_reader_delta(reader, &vflr, &delta);
+            if (cb)
+                cb(&delta, arg);
+            count++;
+        }
+
+        reader->vflrd_positions[i] = head;
+    }
+
+    return count;
+}
+
+void
+vr_flow_log_reader_exit(struct vr_flow_log_reader *reader)
+{
+    if (!reader)
+        return;
+
+    free(reader->vflrd_positions);
+    free(reader->vflrd_flows);
+    memset(reader, 0, sizeof(*reader));
+
+    return;
+}
+
+/*
+ * Sets a reader up on the log mapped at 'mem', tracking flows of up to
+ * 'flow_entries' indices. The reader starts at the current end of the
+ * rings.
+ */
+int
+vr_flow_log_reader_init(struct vr_flow_log_reader *reader, const void *mem,
+        size_t size, unsigned int flow_entries)
+{
+    unsigned int i;
+    const struct vr_flow_log_info *vfli = mem;
+
+    if (!reader || !mem || (size < sizeof(*vfli)))
+        return -EINVAL;
+
+    memset(reader, 0, sizeof(*reader));
+    if ((vfli->vfli_magic != VR_FLOW_LOG_MAGIC) ||
+            (vfli->vfli_version != VR_FLOW_LOG_VERSION))
+        return -ENODEV;
+
+    if (!vfli->vfli_rings || !vfli->vfli_records ||
+            (vfli->vfli_records & (vfli->vfli_records - 1)) ||
+            (vfli->vfli_record_size < sizeof(struct vr_flow_log_record)))
+        return -EINVAL;
+
+    if (((uint64_t)vfli->vfli_ring_offset +
+                (vfli->vfli_rings * sizeof(struct vr_flow_log_ring)) > size) ||
+            ((uint64_t)vfli->vfli_record_offset +
+             ((uint64_t)vfli->vfli_rings * vfli->vfli_records *
+              vfli->vfli_record_size) > size))
+        return -EINVAL;
+
+    reader->vflrd_info = vfli;
+    reader->vflrd_mem = mem;
+    reader->vflrd_size = size;
+    reader->vflrd_positions = calloc(vfli->vfli_rings, sizeof(uint64_t));
+    reader->vflrd_flows = calloc(flow_entries,
+            sizeof(struct vr_flow_log_flow));
+    if (!reader->vflrd_positions || (flow_entries && !reader->vflrd_flows)) {
+        vr_flow_log_reader_exit(reader);
+        return -ENOMEM;
+    }
+    reader->vflrd_flow_entries = flow_entries;
+
+    for (i = 0; i < vfli->vfli_rings; i++)
+        reader->vflrd_positions[i] =
+            vr_flow_log_reader_ring(reader, i)->vfrg_head;
+
+    return 0;
+}
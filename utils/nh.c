@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <getopt.h>
 
 #include <sys/types.h>
@@ -261,6 +262,86 @@ nh_print_newline_header(void)
     return;
 }
 
+/*
+ * the share of the traffic each member of an ECMP composite gets: that of
+ * its buckets when the composite has a member table, an equal one amongst
+ * the members with a nexthop otherwise
+ */
+static void
+nh_print_ecmp_distribution(vr_nexthop_req *req)
+{
+    unsigned int i, total = 0, printed = 0;
+
+    if (req->nhr_bucket_list_size) {
+        for (i = 0; i < req->nhr_bucket_list_size; i++)
+            total += req->nhr_bucket_list[i];
+    } else {
+        for (i = 0; i < req->nhr_nh_list_size; i++) {
+            if (req->nhr_nh_list[i] != -1)
+                total++;
+        }
+    }
+
+    if (!total)
+        return;
+
+    nh_print_newline_header();
+    printf("Distribution:");
+    for (i = 0; i < req->nhr_nh_list_size; i++) {
+        if (req->nhr_nh_list[i] == -1)
+            continue;
+
+        if (printed > 60) {
+            nh_print_newline_header();
+            printf("%14c", ' ');
+            printed = 0;
+        }
+
+        printed += printf(" %d:%.1f%%", req->nhr_nh_list[i],
+                (req->nhr_bucket_list_size ?
+                 req->nhr_bucket_list[i] : 1) * 100.0 / total);
+    }
+
+    if (req->nhr_bucket_list_size)
+        printf(" (%u buckets)", total);
+
+    return;
+}
+
+/* the gap of the flowlets of an ECMP composite, and the packets by member */
+static void
+nh_print_ecmp_load(vr_nexthop_req *req)
+{
+    unsigned int i, printed = 0;
+
+    if (req->nhr_flowlet_gap) {
+        nh_print_newline_header();
+        printf("Flowlet Gap: %u usecs", req->nhr_flowlet_gap);
+    }
+
+    if (!req->nhr_load_list_size)
+        return;
+
+    nh_print_newline_header();
+    printf("Load:");
+    for (i = 0; (i < req->nhr_load_list_size) &&
+            (i < req->nhr_nh_list_size); i++) {
+        if (req->nhr_nh_list[i] == -1)
+            continue;
+
+        if (printed > 60) {
+            nh_print_newline_header();
+            printf("%5c", ' ');
+            printed = 0;
+        }
+
+        printed += printf(" %d:%" PRIu64, req->nhr_nh_list[i],
+                req->nhr_load_list[i]);
+    }
+
+    return;
+}
+
 static void
 nexthop_req_process(void *s_req)
 {
@@ -399,12 +480,18 @@ nexthop_req_process(void *s_req)
             printed += printf(" %d", req->nhr_nh_list[i]);
             if (req->nhr_label_list[i] >= 0)
                 printed += printf("(%d)", req->nhr_label_list[i]);
+            if ((i < req->nhr_weight_list_size) &&
+                    (req->nhr_weight_list[i] != 1))
+                printed += printf("x%d", req->nhr_weight_list[i]);
         }
 
         if (req->nhr_nh_count &&
                 (req->nhr_nh_count - req->nhr_nh_list_size)) {
             printf(" and %u more components...\n",
                     req->nhr_nh_count - req->nhr_nh_list_size);
+        } else if (req->nhr_flags & NH_FLAG_COMPOSITE_ECMP) {
+            nh_print_ecmp_distribution(req);
+            nh_print_ecmp_load(req);
         }
     }
 
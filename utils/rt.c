@@ -44,6 +44,7 @@ static struct nl_client *cl;
 static int resp_code;
 
 static uint8_t rt_prefix[16], rt_marker[16];
+static int rt_marker_index = -1;
 
 static bool cmd_proxy_set = false;
 static bool cmd_trap_set = false;
@@ -332,6 +333,7 @@ route_req_process(void *s_req)
         printf("\n");
     } else {
         memcpy(rt_marker, rt->rtr_mac, VR_ETHER_ALEN);
+        rt_marker_index = rt->rtr_index;
         vr_bridge_print_route(rt->rtr_mac, rt->rtr_index,
                 rt->rtr_label_flags, rt->rtr_label, rt->rtr_nh_id, 0);
     }
@@ -453,7 +455,7 @@ op_retry:
         } else {
             dump = true;
             ret = vr_send_route_dump(cl, 0, cmd_vrf_id, cmd_family_id,
-                rt_marker);
+                rt_marker, rt_marker_index);
         }
 
         break;
@@ -95,3 +95,77 @@ vr_flow_table_data_table[17].field_name = "ftable_hold_entries"
 vr_flow_table_data_table[17].ProtoField = ProtoField.uint32
 vr_flow_table_data_table[17].base = base.DEC
 
+
+vr_flow_table_data_table[18] = {}
+vr_flow_table_data_table[18].field_name = "ftable_admitted"
+vr_flow_table_data_table[18].ProtoField = ProtoField.bytes
+vr_flow_table_data_table[18].base = base.SPACE
+
+vr_flow_table_data_table[19] = {}
+vr_flow_table_data_table[19].field_name = "ftable_burst_admitted"
+vr_flow_table_data_table[19].ProtoField = ProtoField.bytes
+vr_flow_table_data_table[19].base = base.SPACE
+
+vr_flow_table_data_table[20] = {}
+vr_flow_table_data_table[20].field_name = "ftable_admission_drops"
+vr_flow_table_data_table[20].ProtoField = ProtoField.bytes
+vr_flow_table_data_table[20].base = base.SPACE
+
+vr_flow_table_data_table[21] = {}
+vr_flow_table_data_table[21].field_name = "ftable_resizes"
+vr_flow_table_data_table[21].ProtoField = ProtoField.uint32
+vr_flow_table_data_table[21].base = base.DEC
+
+vr_flow_table_data_table[22] = {}
+vr_flow_table_data_table[22].field_name = "ftable_aged"
+vr_flow_table_data_table[22].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[22].base = base.DEC
+
+vr_flow_table_data_table[23] = {}
+vr_flow_table_data_table[23].field_name = "ftable_log_size"
+vr_flow_table_data_table[23].ProtoField = ProtoField.uint32
+vr_flow_table_data_table[23].base = base.DEC
+
+vr_flow_table_data_table[24] = {}
+vr_flow_table_data_table[24].field_name = "ftable_log_file_path"
+vr_flow_table_data_table[24].ProtoField = ProtoField.string
+
+vr_flow_table_data_table[25] = {}
+vr_flow_table_data_table[25].field_name = "ftable_hold_limit_drops"
+vr_flow_table_data_table[25].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[25].base = base.DEC
+
+vr_flow_table_data_table[26] = {}
+vr_flow_table_data_table[26].field_name = "ftable_hold_share_drops"
+vr_flow_table_data_table[26].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[26].base = base.DEC
+
+vr_flow_table_data_table[27] = {}
+vr_flow_table_data_table[27].field_name = "ftable_hold_pool_drops"
+vr_flow_table_data_table[27].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[27].base = base.DEC
+
+vr_flow_table_data_table[28] = {}
+vr_flow_table_data_table[28].field_name = "ftable_hold_queue_drops"
+vr_flow_table_data_table[28].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[28].base = base.DEC
+
+vr_flow_table_data_table[29] = {}
+vr_flow_table_data_table[29].field_name = "ftable_hold_pool_nodes"
+vr_flow_table_data_table[29].ProtoField = ProtoField.uint32
+vr_flow_table_data_table[29].base = base.DEC
+
+vr_flow_table_data_table[30] = {}
+vr_flow_table_data_table[30].field_name = "ftable_hold_pool_used"
+vr_flow_table_data_table[30].ProtoField = ProtoField.uint32
+vr_flow_table_data_table[30].base = base.DEC
+
+vr_flow_table_data_table[31] = {}
+vr_flow_table_data_table[31].field_name = "ftable_rpf_validated"
+vr_flow_table_data_table[31].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[31].base = base.DEC
+
+vr_flow_table_data_table[32] = {}
+vr_flow_table_data_table[32].field_name = "ftable_rpf_cached"
+vr_flow_table_data_table[32].ProtoField = ProtoField.uint64
+vr_flow_table_data_table[32].base = base.DEC
@@ -522,4 +522,14 @@ vif_req_table[93].field_name = "vifr_loopback_ip"
 vif_req_table[93].ProtoField = ProtoField.uint32
 vif_req_table[93].base = base.DEC
 
+vif_req_table[94] = {}
+vif_req_table[94].field_name = "vifr_flow_quota"
+vif_req_table[94].ProtoField = ProtoField.uint32
+vif_req_table[94].base = base.DEC
+
+vif_req_table[95] = {}
+vif_req_table[95].field_name = "vifr_flow_quota_drops"
+vif_req_table[95].ProtoField = ProtoField.uint64
+vif_req_table[95].base = base.DEC
+
 
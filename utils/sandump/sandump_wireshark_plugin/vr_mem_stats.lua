@@ -371,3 +371,17 @@ vr_mem_stats_table[72].field_name = "vms_interface_fat_flow_ipv6_exclude_list_ob
 vr_mem_stats_table[72].ProtoField = ProtoField.int64
 vr_mem_stats_table[72].base = base.DEC
 
+vr_mem_stats_table[73] = {}
+vr_mem_stats_table[73].field_name = "vms_mtrie_leaf_object"
+vr_mem_stats_table[73].ProtoField = ProtoField.int64
+vr_mem_stats_table[73].base = base.DEC
+
+vr_mem_stats_table[74] = {}
+vr_mem_stats_table[74].field_name = "vms_dst_cache_object"
+vr_mem_stats_table[74].ProtoField = ProtoField.int64
+vr_mem_stats_table[74].base = base.DEC
+
+vr_mem_stats_table[75] = {}
+vr_mem_stats_table[75].field_name = "vms_bridge_learn_object"
+vr_mem_stats_table[75].ProtoField = ProtoField.int64
+vr_mem_stats_table[75].base = base.DEC
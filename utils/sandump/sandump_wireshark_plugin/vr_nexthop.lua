@@ -224,3 +224,23 @@ nh_req_table[30] = {}
 nh_req_table[30].field_name = "nhr_encap_valid"
 nh_req_table[30].ProtoField = ProtoField.bytes
 nh_req_table[30].base = base.SPACE
+
+nh_req_table[31] = {}
+nh_req_table[31].field_name = "nhr_weight_list"
+nh_req_table[31].ProtoField = ProtoField.bytes
+nh_req_table[31].base = base.SPACE
+
+nh_req_table[32] = {}
+nh_req_table[32].field_name = "nhr_bucket_list"
+nh_req_table[32].ProtoField = ProtoField.bytes
+nh_req_table[32].base = base.SPACE
+
+nh_req_table[33] = {}
+nh_req_table[33].field_name = "nhr_flowlet_gap"
+nh_req_table[33].ProtoField = ProtoField.uint32
+nh_req_table[33].base = base.DEC
+
+nh_req_table[34] = {}
+nh_req_table[34].field_name = "nhr_load_list"
+nh_req_table[34].ProtoField = ProtoField.bytes
+nh_req_table[34].base = base.SPACE
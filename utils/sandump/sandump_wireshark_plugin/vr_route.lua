@@ -87,3 +87,38 @@ vr_route_table[14] = {}
 vr_route_table[14].field_name = "rtr_index"
 vr_route_table[14].ProtoField = ProtoField.int32
 vr_route_table[14].base = base.DEC
+
+vr_route_table[15] = {}
+vr_route_table[15].field_name = "rtr_batch_prefix"
+vr_route_table[15].ProtoField = ProtoField.bytes
+vr_route_table[15].base = base.SPACE
+
+vr_route_table[16] = {}
+vr_route_table[16].field_name = "rtr_batch_prefix_len"
+vr_route_table[16].ProtoField = ProtoField.bytes
+vr_route_table[16].base = base.SPACE
+
+vr_route_table[17] = {}
+vr_route_table[17].field_name = "rtr_batch_nh_id"
+vr_route_table[17].ProtoField = ProtoField.bytes
+vr_route_table[17].base = base.SPACE
+
+vr_route_table[18] = {}
+vr_route_table[18].field_name = "rtr_batch_label"
+vr_route_table[18].ProtoField = ProtoField.bytes
+vr_route_table[18].base = base.SPACE
+
+vr_route_table[19] = {}
+vr_route_table[19].field_name = "rtr_batch_label_flags"
+vr_route_table[19].ProtoField = ProtoField.bytes
+vr_route_table[19].base = base.SPACE
+
+vr_route_table[20] = {}
+vr_route_table[20].field_name = "rtr_batch_replace_plen"
+vr_route_table[20].ProtoField = ProtoField.bytes
+vr_route_table[20].base = base.SPACE
+
+vr_route_table[21] = {}
+vr_route_table[21].field_name = "rtr_batch_mac"
+vr_route_table[21].ProtoField = ProtoField.bytes
+vr_route_table[21].base = base.COLON
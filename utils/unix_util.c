@@ -63,6 +63,10 @@ vr_table_map(int major, unsigned int table, const char *table_path, size_t size,
             path = FLOW_TABLE_DEV;
             break;
 
+        case VR_MEM_FLOW_LOG_OBJECT:
+            path = FLOW_LOG_DEV;
+            break;
+
         default:
             snprintf(error_msg, ERROR_LEN, "Error: Invalid 'table' value: %u", table);
             return error_msg;
@@ -613,6 +613,11 @@ list_get_print(vr_interface_req *req)
         printf("ISID: %d Bmac: "MAC_FORMAT"\n",
                 req->vifr_isid, MAC_VALUE((uint8_t *)req->vifr_pbb_mac));
     }
+    if (req->vifr_flow_quota) {
+        vr_interface_print_head_space();
+        printf("Flow Quota: %u per burst interval  Quota Drops: %" PRIu64 "\n",
+                req->vifr_flow_quota, req->vifr_flow_quota_drops);
+    }
     vr_interface_print_head_space();
     printf("Drops:%" PRIu64 "\n", req->vifr_dpackets);
 
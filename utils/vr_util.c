@@ -1769,6 +1769,24 @@ vr_nexthop_req_destroy(vr_nexthop_req *req)
         req->nhr_label_list_size = 0;
     }
 
+    if (req->nhr_weight_list_size && req->nhr_weight_list) {
+        free(req->nhr_weight_list);
+        req->nhr_weight_list = NULL;
+        req->nhr_weight_list_size = 0;
+    }
+
+    if (req->nhr_bucket_list_size && req->nhr_bucket_list) {
+        free(req->nhr_bucket_list);
+        req->nhr_bucket_list = NULL;
+        req->nhr_bucket_list_size = 0;
+    }
+
+    if (req->nhr_load_list_size && req->nhr_load_list) {
+        free(req->nhr_load_list);
+        req->nhr_load_list = NULL;
+        req->nhr_load_list_size = 0;
+    }
+
     if (req->nhr_tun_sip6_size && req->nhr_tun_sip6) {
         free(req->nhr_tun_sip6);
         req->nhr_tun_sip6 = NULL;
@@ -1816,6 +1834,12 @@ vr_nexthop_req_get_copy(vr_nexthop_req *src)
     dst->nhr_nh_list_size = 0;
     dst->nhr_label_list = NULL;
     dst->nhr_label_list_size = 0;
+    dst->nhr_weight_list = NULL;
+    dst->nhr_weight_list_size = 0;
+    dst->nhr_bucket_list = NULL;
+    dst->nhr_bucket_list_size = 0;
+    dst->nhr_load_list = NULL;
+    dst->nhr_load_list_size = 0;
     dst->nhr_tun_sip6 = NULL;
     dst->nhr_tun_sip6_size = 0;
     dst->nhr_tun_dip6 = NULL;
@@ -1854,6 +1878,39 @@ vr_nexthop_req_get_copy(vr_nexthop_req *src)
         dst->nhr_label_list_size = src->nhr_label_list_size;
     }
 
+    /* weight list */
+    if (src->nhr_weight_list_size && src->nhr_weight_list) {
+        dst->nhr_weight_list = malloc(src->nhr_weight_list_size *
+                sizeof(uint32_t));
+        if (!dst->nhr_weight_list)
+            goto free_nh;
+        memcpy(dst->nhr_weight_list, src->nhr_weight_list,
+                src->nhr_weight_list_size * sizeof(uint32_t));
+        dst->nhr_weight_list_size = src->nhr_weight_list_size;
+    }
+
+    /* bucket list */
+    if (src->nhr_bucket_list_size && src->nhr_bucket_list) {
+        dst->nhr_bucket_list = malloc(src->nhr_bucket_list_size *
+                sizeof(uint32_t));
+        if (!dst->nhr_bucket_list)
+            goto free_nh;
+        memcpy(dst->nhr_bucket_list, src->nhr_bucket_list,
+                src->nhr_bucket_list_size * sizeof(uint32_t));
+        dst->nhr_bucket_list_size = src->nhr_bucket_list_size;
+    }
+
+    /* load list */
+    if (src->nhr_load_list_size && src->nhr_load_list) {
+        dst->nhr_load_list = malloc(src->nhr_load_list_size *
+                sizeof(uint64_t));
+        if (!dst->nhr_load_list)
+            goto free_nh;
+        memcpy(dst->nhr_load_list, src->nhr_load_list,
+                src->nhr_load_list_size * sizeof(uint64_t));
+        dst->nhr_load_list_size = src->nhr_load_list_size;
+    }
+
     /* ipv6 tunnel source */
     if (src->nhr_tun_sip6_size && src->nhr_tun_sip6) {
         dst->nhr_tun_sip6 = malloc(src->nhr_tun_sip6_size);
@@ -2232,6 +2289,22 @@ vr_route_req_get_copy(vr_route_req *src)
     dst->rtr_mac_size = 0;
     dst->rtr_mac = NULL;
 
+    /* the lists of a batch are never copied */
+    dst->rtr_batch_prefix_size = 0;
+    dst->rtr_batch_prefix = NULL;
+    dst->rtr_batch_prefix_len_size = 0;
+    dst->rtr_batch_prefix_len = NULL;
+    dst->rtr_batch_nh_id_size = 0;
+    dst->rtr_batch_nh_id = NULL;
+    dst->rtr_batch_label_size = 0;
+    dst->rtr_batch_label = NULL;
+    dst->rtr_batch_label_flags_size = 0;
+    dst->rtr_batch_label_flags = NULL;
+    dst->rtr_batch_replace_plen_size = 0;
+    dst->rtr_batch_replace_plen = NULL;
+    dst->rtr_batch_mac_size = 0;
+    dst->rtr_batch_mac = NULL;
+
     if (src->rtr_prefix_size && src->rtr_prefix) {
         dst->rtr_prefix = malloc(src->rtr_prefix_size);
         if (!dst->rtr_prefix)
@@ -2253,9 +2326,14 @@ free_rtr_req:
     return NULL;
 }
 
+/*
+ * 'marker' is the prefix, or the mac, of the last route received.
+ * 'marker_index' is the index that a bridge route came with, which lets
+ * the dump resume right after it.
+ */
 int
 vr_send_route_dump(struct nl_client *cl, unsigned int router_id, unsigned int vrf,
-        unsigned int family, uint8_t *marker)
+        unsigned int family, uint8_t *marker, int marker_index)
 {
     vr_route_req req;
 
@@ -2268,6 +2346,7 @@ vr_send_route_dump(struct nl_client *cl, unsigned int router_id, unsigned int vr
     if (family == AF_BRIDGE) {
         req.rtr_mac = marker;
         req.rtr_mac_size = VR_ETHER_ALEN;
+        req.rtr_index = marker_index;
     } else {
         req.rtr_prefix = marker;
         req.rtr_prefix_size = RT_IP_ADDR_SIZE(family);
@@ -2347,6 +2426,63 @@ vr_send_route_add(struct nl_client *cl,
             mac, replace_len,flags);
 }
 
+/*
+ * Adds, or deletes, 'count' routes of a vrf in one request. The prefixes
+ * are laid out back to back, as are the macs if there are any; labels,
+ * label flags and replace lengths can each be left out (NULL). The request
+ * has to fit in a message of the client, so the batch is to be sized
+ * accordingly, and can not be longer than VR_ROUTE_BATCH_MAX anyway.
+ */
+int
+vr_send_route_batch(struct nl_client *cl, unsigned int op,
+        unsigned int router_id, unsigned int vrf, unsigned int family,
+        unsigned int count, uint8_t *prefixes, int32_t *prefix_lens,
+        int32_t *nh_ids, int32_t *labels, int32_t *label_flags,
+        int32_t *replace_plens, uint8_t *macs)
+{
+    vr_route_req req;
+
+    if (((family != AF_INET) && (family != AF_INET6)) ||
+            !count || (count > VR_ROUTE_BATCH_MAX) ||
+            ((op != SANDESH_OP_ADD) && (op != SANDESH_OP_DEL)))
+        return -EINVAL;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = op;
+    req.rtr_rid = router_id;
+    req.rtr_vrf_id = vrf;
+    req.rtr_family = family;
+
+    req.rtr_batch_prefix = (int8_t *)prefixes;
+    req.rtr_batch_prefix_size = count * RT_IP_ADDR_SIZE(family);
+    req.rtr_batch_prefix_len = prefix_lens;
+    req.rtr_batch_prefix_len_size = count;
+    req.rtr_batch_nh_id = nh_ids;
+    req.rtr_batch_nh_id_size = count;
+
+    if (labels) {
+        req.rtr_batch_label = labels;
+        req.rtr_batch_label_size = count;
+    }
+
+    if (label_flags) {
+        req.rtr_batch_label_flags = label_flags;
+        req.rtr_batch_label_flags_size = count;
+    }
+
+    if (replace_plens) {
+        req.rtr_batch_replace_plen = replace_plens;
+        req.rtr_batch_replace_plen_size = count;
+    }
+
+    if (macs) {
+        req.rtr_batch_mac = (int8_t *)macs;
+        req.rtr_batch_mac_size = count * VR_ETHER_ALEN;
+    }
+
+    return vr_sendmsg(cl, &req, "vr_route_req");
+}
+
 /* vrf assign start */
 int
 vr_send_vrf_assign_dump(struct nl_client *cl, unsigned int router_id,
@@ -29,10 +29,13 @@ static bool dump_pending = false;
 static int dump_marker = -1;
 
 static int create_set, delete_set, dump_set, sock_dir_set;
-static int get_set, hbsl_set, hbsr_set, vrf_set;
+static int get_set, hbsl_set, hbsr_set, vrf_set, fib_set;
 static int help_set, cmd_set;
 static int vrf_op = -1;
 static int vrf_index = -1, vrf_flags, hbsl_idx, hbsr_idx;
+/* FIB memory comes from vr_info, a chunk of its buffer a message */
+static int buff_table_id;
+static char fib_vrf[16];
 
 static void
 vrf_req_process(void *s_req)
@@ -78,13 +81,57 @@ response_process(void *s)
     return;
 }
 
+static void
+vrf_info_process(void *s_req)
+{
+    vr_info_req *resp = (vr_info_req *)s_req;
+
+    if (resp->vdu_proc_info)
+        printf("%s", resp->vdu_proc_info);
+
+    if (resp->h_op == SANDESH_OP_DUMP) {
+        dump_marker = resp->vdu_index;
+        buff_table_id = resp->vdu_buff_table_id;
+    }
+
+    return;
+}
+
 static void
 vrf_fill_nl_callbacks()
 {
     nl_cb.vr_vrf_req_process = vrf_req_process;
+    nl_cb.vr_info_req_process = vrf_info_process;
     nl_cb.vr_response_process = response_process;
 }
 
+static int
+vr_vrf_fib_op(struct nl_client *cl)
+{
+    int ret;
+    uint8_t *inbuf = NULL;
+
+    if (vrf_op == SANDESH_OP_GET) {
+        snprintf(fib_vrf, sizeof(fib_vrf), "%d", vrf_index);
+        inbuf = (uint8_t *)fib_vrf;
+    }
+
+op_retry:
+    ret = vr_send_info_dump(cl, 0, dump_marker, buff_table_id, INFO_FIB, 0,
+            inbuf);
+    if (ret < 0)
+        return ret;
+
+    ret = vr_recvmsg(cl, true);
+    if (ret <= 0)
+        return ret;
+
+    if (dump_pending)
+        goto op_retry;
+
+    return 0;
+}
+
 static int
 vr_vrf_op(struct nl_client *cl)
 {
@@ -135,6 +182,7 @@ enum opt_vrf_index {
     DELETE_OPT_INDEX,
     DUMP_OPT_INDEX,
     GET_OPT_INDEX,
+    FIB_OPT_INDEX,
     HELP_OPT_INDEX,
     HBSL_OPT_INDEX,
     HBSR_OPT_INDEX,
@@ -148,6 +196,7 @@ static struct option long_options[] = {
     [DELETE_OPT_INDEX]      =       {"delete",  required_argument,  &delete_set,    1},
     [DUMP_OPT_INDEX]        =       {"dump",    no_argument,        &dump_set,      1},
     [GET_OPT_INDEX]         =       {"get",     required_argument,  &get_set,       1},
+    [FIB_OPT_INDEX]         =       {"fib",     no_argument,        &fib_set,       1},
     [HELP_OPT_INDEX]        =       {"help",    no_argument,        &help_set,      1},
     [HBSL_OPT_INDEX]        =       {"hbs-l",   required_argument,  &hbsl_set,      1},
     [HBSR_OPT_INDEX]        =       {"hbs-r",   required_argument,  &hbsr_set,      1},
@@ -172,10 +221,12 @@ Usage(void)
 {
     printf("Usage:  vrftable --dump\n");
     printf("        vrftable --get <index>\n");
+    printf("        vrftable --fib --dump|--get <index>\n");
     printf("        vrftable --help\n");
     printf("\n");
     printf("--dump  Dumps the vrf table\n");
     printf("--get   Dumps the vrf entry corresponding to index <index>\n");
+    printf("--fib   Shows the FIB memory of the vrfs instead\n");
     printf("--sock-dir  <netlink sock dir>\n");
     printf("--help  Prints this help message\n");
 
@@ -218,6 +269,9 @@ parse_long_opts(int opt_index, char *opt_arg)
             Usage();
         break;
 
+    case FIB_OPT_INDEX:
+        break;
+
     case HELP_OPT_INDEX:
         Usage();
         break;
@@ -255,6 +309,9 @@ validate_options(void)
     if (sum_op > 1 || vrf_op < 0)
         Usage();
 
+    if (fib_set && (vrf_op != SANDESH_OP_DUMP) && (vrf_op != SANDESH_OP_GET))
+        Usage();
+
     if (create_set)
         if (!hbsl_set || !hbsr_set)
             usage_internal();
@@ -340,8 +397,8 @@ int main(int argc, char *argv[])
 
     validate_options();
 
-    if ((vrf_op == SANDESH_OP_DUMP) ||
-            (vrf_op == SANDESH_OP_GET)) {
+    if (!fib_set && ((vrf_op == SANDESH_OP_DUMP) ||
+            (vrf_op == SANDESH_OP_GET))) {
         printf("VRF Table\n\n");
         printf("Flags: V=Valid, Hl=HBS Left Valid, Hr=HBS Right Valid\n\n");
         printf("   Vrf   Flags      HBS-L   HBS-R\n");
@@ -357,7 +414,10 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    vr_vrf_op(cl);
+    if (fib_set)
+        vr_vrf_fib_op(cl);
+    else
+        vr_vrf_op(cl);
 
     return 0;
 }
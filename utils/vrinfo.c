@@ -38,7 +38,8 @@ static int dump_marker = -1;
  * */
 static int buff_table_id, buffsz;
 
-static int help_set, ver_set, sock_dir_set;
+static int help_set, ver_set, dst_cache_set, bridge_learn_set, fib_set;
+static int sock_dir_set;
 static unsigned int core = (unsigned)-1;
 static unsigned int stats_index = 0;
 /* For few  CLI, Inbuf has to send to vrouter for processing(i.e kind of filter
@@ -50,6 +51,9 @@ static vr_info_msg_en msginfo;
 enum opt_index {
     HELP_OPT_INDEX,
     VER_OPT_INDEX,
+    DST_CACHE_OPT_INDEX,
+    BRIDGE_LEARN_OPT_INDEX,
+    FIB_OPT_INDEX,
     BUFFSZ_OPT_INDEX,
     SOCK_DIR_OPT_INDEX,
     MAX_OPT_INDEX,
@@ -58,6 +62,9 @@ enum opt_index {
 static struct option long_options[] = {
     [HELP_OPT_INDEX]    =   {"help",    no_argument,        &help_set,      1},
     [VER_OPT_INDEX]    =    {"version",    no_argument,        &ver_set,      1},
+    [DST_CACHE_OPT_INDEX] = {"dst-cache",  no_argument,        &dst_cache_set, 1},
+    [BRIDGE_LEARN_OPT_INDEX] = {"bridge-learn", no_argument,   &bridge_learn_set, 1},
+    [FIB_OPT_INDEX]     =   {"fib",     optional_argument,  &fib_set,       1},
     [BUFFSZ_OPT_INDEX]  =   {"buffsz",  required_argument,  &buffsz,        1},
     [SOCK_DIR_OPT_INDEX]  = {"sock-dir", required_argument, &sock_dir_set,  1},
     [MAX_OPT_INDEX]     =   {NULL,    0,                  NULL,              0},
@@ -68,6 +75,9 @@ Usage()
 {
     printf("Usage: dpdkinfo [--help]\n");
     printf("                 --version|-v           Show version information\n");
+    printf("                 --dst-cache            Show destination cache statistics\n");
+    printf("                 --bridge-learn         Show asynchronous MAC learning statistics\n");
+    printf("                 --fib[=<vrf>]          Show FIB memory of all vrfs or of <vrf>\n");
     printf("       Optional: --buffsz  <value>      Send output buffer size\n");
     exit(-EINVAL);
 }
@@ -75,7 +85,7 @@ Usage()
 static void
 validate_options(void)
 {
-    if(!ver_set) {
+    if(!ver_set && !dst_cache_set && !bridge_learn_set && !fib_set) {
         Usage();
     }
 
@@ -129,6 +139,21 @@ parse_long_opts(int opt_index, char *opt_arg)
     case VER_OPT_INDEX:
         msginfo = INFO_VER;
         break;
+    case DST_CACHE_OPT_INDEX:
+        msginfo = INFO_DST_CACHE;
+        break;
+    case BRIDGE_LEARN_OPT_INDEX:
+        msginfo = INFO_BRIDGE_LEARN;
+        break;
+    case FIB_OPT_INDEX:
+        msginfo = INFO_FIB;
+        if (opt_arg) {
+            /* the vrouter takes the vrf in decimal */
+            if (!*opt_arg || (strspn(opt_arg, "0123456789") != strlen(opt_arg)))
+                Usage();
+            vr_info_inbuf = (uint8_t *)opt_arg;
+        }
+        break;
     case SOCK_DIR_OPT_INDEX:
         vr_socket_dir = opt_arg;
         break;
@@ -41,12 +41,16 @@ mem_stats_req_process(void *s_req)
             stats->vms_assembler_table_object);
     printf("Bridge MAC                      %" PRIu64 "\n",
             stats->vms_bridge_mac_object);
+    printf("Bridge Learn                    %" PRIu64 "\n",
+            stats->vms_bridge_learn_object);
     printf("Btable                          %" PRIu64 "\n",
             stats->vms_btable_object);
     printf("Build Info                      %" PRIu64 "\n",
             stats->vms_build_info_object);
     printf("Defer                           %" PRIu64 "\n",
             stats->vms_defer_object);
+    printf("Destination Cache               %" PRIu64 "\n",
+            stats->vms_dst_cache_object);
     printf("Drop Stats                      %" PRIu64 "\n",
             stats->vms_drop_stats_object);
     printf("Drop Stats Request              %" PRIu64 "\n",
@@ -135,6 +139,8 @@ mem_stats_req_process(void *s_req)
             stats->vms_mtrie_stats_object);
     printf("Mtrie Table                     %" PRIu64 "\n",
             stats->vms_mtrie_table_object);
+    printf("Mtrie Leaf                      %" PRIu64 "\n",
+            stats->vms_mtrie_leaf_object);
     printf("Network Address                 %" PRIu64 "\n",
             stats->vms_network_address_object);
     printf("Nexthop                         %" PRIu64 "\n",